@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "sample_format.hpp"
+#include "i2s_memory.hpp"
+
+/// one waveform segment of an I2S_AWG_SEQUENCE
+struct I2S_AWG_SEGMENT {
+    const int32_t *samples; // frames in the sample format, in RAM or in flash
+    uint32_t length;        // in frames, a multiple of the length step like a pattern
+    uint32_t repeat;        // number of plays in a row (>= 1)
+    int32_t next;           // index of the segment after the repeats, -1 ends the sequence
+};
+
+/**
+ * @brief RP2040 DMA control block, the TX control channel writes it to the TRANS_COUNT and READ_ADDR_TRIG registers
+ * of the data channel. Two words on the RP2040, so the control channel wraps its write address with an 8 byte ring.
+ * A block with a NULL address ends the chain.
+ */
+struct I2S_DMA_CONTROL_BLOCK {
+    uintptr_t transfer_count;
+    const void *read_addr;
+};
+
+/**
+ * @brief segment list of the AWG mode compiled to DMA control blocks, see I2S_CONTROLLER::play_sequence()
+ * The segments are walked from segment 0 along next, every play of a segment becomes one control block.
+ * The control channel steps through the blocks on its own, so neither a segment change nor a repeat needs the CPU.
+ * If next leads back to a segment that was played before, the sequence loops from there: the block list ends after
+ * one pass and the DMA IRQ restarts the control channel at the loop, once per pass.
+ *
+ * Samples are read in place, so a segment can be a const array in flash that the DMA reads through XIP.
+ * XIP cache misses stall the data channel for a few hundred ns, the TX FIFO covers that.
+ * Memory: 8 bytes per play on the RP2040, so hold a level with a longer segment instead of many repeats of a short one.
+ */
+class I2S_AWG_SEQUENCE {
+private:
+    I2S_DMA_CONTROL_BLOCK *const blocks;
+    const uint32_t max_blocks;
+    I2S_BUFFER_ARENA *const arena;
+
+    uint32_t block_count = 0; // including the final NULL block
+    int32_t loop_block = -1;
+    uint32_t lead_frames = 0; // frames before the loop
+    uint32_t pass_frames = 0; // frames of one pass through the loop
+
+    // next segment of a walk, -1 stays at the end
+    static int32_t next_of(const I2S_AWG_SEGMENT *segments, int32_t index) { return index < 0 ? -1 : segments[index].next; }
+public:
+    /**
+     * @param _max_blocks plays of all segments in one pass plus one
+     * @param _arena place the control blocks there instead of the heap, see I2S_BUFFER_ARENA
+     */
+    I2S_AWG_SEQUENCE(uint32_t _max_blocks, I2S_BUFFER_ARENA *_arena = NULL)
+        : blocks((I2S_DMA_CONTROL_BLOCK *)i2s_allocate_words(_arena, storage_words(_max_blocks))), max_blocks(_max_blocks), arena(_arena) {
+    }
+
+    ~I2S_AWG_SEQUENCE() {
+        i2s_free_words(arena, (int32_t *)blocks);
+    }
+
+    /// arena words of the control blocks
+    static constexpr size_t storage_words(uint32_t max_blocks) {
+        return max_blocks * sizeof(I2S_DMA_CONTROL_BLOCK) / sizeof(int32_t);
+    }
+
+    /**
+     * @brief turn a segment list into control blocks, must not be called while the sequence is playing
+     * Format parameters like PATTERN_BUFFER, the controller passes its own, see I2S_CONTROLLER::play_sequence().
+     * @return false with a warning if a segment is invalid or the blocks do not fit, the sequence is empty then
+     */
+    bool compile(const I2S_AWG_SEGMENT *segments, uint32_t segment_count,
+                 I2S_SAMPLE_FORMAT format, uint32_t bit_depth, bool mono, uint32_t channel_count) {
+        const uint32_t frame_bits = i2s_frame_bits(format, bit_depth, channel_count);
+        const uint32_t length_step = mono ? 1 : i2s_unit_frames(frame_bits);
+
+        block_count = 0;
+        loop_block = -1;
+        lead_frames = pass_frames = 0;
+        if(segment_count == 0) {
+            return false;
+        }
+
+        for(uint32_t i=0; i<segment_count; ++i) {
+            const I2S_AWG_SEGMENT &segment = segments[i];
+            if(!segment.samples || segment.length == 0 || segment.length % length_step || segment.repeat == 0
+               || segment.next < -1 || segment.next >= (int32_t)segment_count) {
+                printf("i2s: AWG segment %lu is invalid, lengths have to be multiples of %lu frames\n", (unsigned long)i, (unsigned long)length_step);
+                return false;
+            }
+        }
+
+        // Floyd's cycle search finds the segment the walk loops back to, without marking visited segments
+        int32_t slow = 0, fast = 0;
+        do {
+            slow = next_of(segments, slow);
+            fast = next_of(segments, next_of(segments, fast));
+        } while(fast >= 0 && slow != fast);
+
+        int32_t loop_segment = -1;
+        if(fast >= 0) {
+            for(slow = 0; slow != fast; ) {
+                slow = next_of(segments, slow);
+                fast = next_of(segments, fast);
+            }
+            loop_segment = slow;
+        }
+
+        // one pass: the lead, then the loop once
+        for(int32_t index = 0; index >= 0; index = segments[index].next) {
+            if(index == loop_segment) {
+                if(loop_block >= 0) {
+                    break;
+                }
+                loop_block = block_count;
+            }
+
+            const I2S_AWG_SEGMENT &segment = segments[index];
+            const uint32_t words = mono ? segment.length : segment.length * frame_bits / 32;
+            for(uint32_t r=0; r<segment.repeat; ++r) {
+                if(block_count + 1 >= max_blocks) {
+                    printf("i2s: AWG sequence needs more than %lu control blocks\n", (unsigned long)max_blocks);
+                    block_count = 0;
+                    loop_block = -1;
+                    lead_frames = pass_frames = 0;
+                    return false;
+                }
+                blocks[block_count++] = {words, segment.samples};
+            }
+            (loop_block >= 0 ? pass_frames : lead_frames) += segment.length * segment.repeat;
+        }
+
+        blocks[block_count++] = {0, NULL};
+        return true;
+    }
+
+    /// first control block, NULL if nothing is compiled
+    const I2S_DMA_CONTROL_BLOCK *get_blocks() const { return block_count ? blocks : NULL; }
+
+    /// control block a pass continues with, NULL if the sequence ends
+    const I2S_DMA_CONTROL_BLOCK *get_loop() const { return loop_block >= 0 ? blocks + loop_block : NULL; }
+
+    uint32_t get_block_count() const { return block_count; }
+
+    /// frames played once before the loop starts, all frames of a sequence without a loop
+    uint32_t get_lead_frames() const { return lead_frames; }
+
+    /// frames of one pass through the loop, 0 without a loop
+    uint32_t get_loop_frames() const { return pass_frames; }
+};
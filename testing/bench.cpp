@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <pico/stdlib.h>
+#include <hardware/uart.h>
+#include <hardware/clocks.h>
+#include <hardware/dma.h>
+
+#include "i2s.hpp"
+
+// Benchmark firmware, prints one line of key=value pairs per result on the UART
+// so runs can be compared by scripts:
+//   bench=pattern     regeneration cost per PATTERN_BUFFER::PATTERN, bit depth and pattern length
+//   bench=dds         DDS_GENERATOR::render() cost per sample format and channel count, samples per second of one core
+//   bench=irq         DMA IRQ cost of queueing patterns and of streaming blocks (needs I2S_ENABLE_STATS),
+//                     streaming for I2S_CONTROLLER and I2S_STATIC_CONTROLLER
+//   bench=max_rate    smallest PIO divider without TX FIFO stall or underrun while this core services the IRQ of
+//                     short streamed blocks (source=irq) or also renders the stream with a DDS (source=stream)
+//   bench=contention  CPU cycles per word read while a DMA hammers the same or another SRAM bank, see I2S_BUFFER_ARENA
+
+#define PIN_I2S_DOUT 20
+#define PIN_I2S_CLOCK_BASE 17
+
+// fixed state machine, so the bench can watch its fdebug flags
+#define BENCH_PIO pio0
+#define BENCH_PIO_SM 0
+
+const uint BENCH_BUFFER_SIZE = 4096;
+const uint BENCH_MIN_TIME_US = 20000; // repeat measurements for at least this long
+const uint IRQ_BLOCK_WORDS = 16; // short blocks of the IRQ bound max_rate run
+
+static const char *pattern_name(PATTERN_BUFFER::PATTERN pattern) {
+    switch(pattern) {
+        case PATTERN_BUFFER::PATTERN::CONST: return "CONST";
+        case PATTERN_BUFFER::PATTERN::SINE: return "SINE";
+        case PATTERN_BUFFER::PATTERN::TRI: return "TRI";
+        case PATTERN_BUFFER::PATTERN::SQUARE: return "SQUARE";
+    }
+    return "?";
+}
+
+// system clock cycles per microsecond, the timer runs at 1 MHz
+static double cycles_per_us() {
+    return clock_get_hz(clk_sys) / 1e6;
+}
+
+static bool tx_stalled() {
+    return BENCH_PIO->fdebug & (1u << (PIO_FDEBUG_TXSTALL_LSB + BENCH_PIO_SM));
+}
+
+static void clear_tx_stall() {
+    BENCH_PIO->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + BENCH_PIO_SM);
+}
+
+static void bench_pattern() {
+    const uint bit_depths[] = {16, 24, 32};
+    const uint lengths[] = {64, 512, 4096};
+    const PATTERN_BUFFER::PATTERN patterns[] = {PATTERN_BUFFER::PATTERN::CONST, PATTERN_BUFFER::PATTERN::SINE, PATTERN_BUFFER::PATTERN::TRI, PATTERN_BUFFER::PATTERN::SQUARE};
+
+    for(uint bit_depth : bit_depths) {
+        PATTERN_BUFFER pattern_buffer(BENCH_BUFFER_SIZE, i2s_sample_format(bit_depth), bit_depth);
+
+        for(PATTERN_BUFFER::PATTERN pattern : patterns) {
+            for(uint length : lengths) {
+                uint renders = 0, samples = 0;
+                uint64_t start = time_us_64(), elapsed;
+
+                // every setter renders the whole pattern, left and right differ so both channels are generated
+                do {
+                    pattern_buffer.set_channel_pattern(0, pattern, 0, 0x10000000, 0);
+                    pattern_buffer.set_channel_pattern(1, pattern, 0, 0x10000000, 0x40000000);
+                    uint clipped_length = pattern_buffer.set_pattern_length(length);
+                    renders += 3;
+                    samples += 3 * 2 * clipped_length;
+                    elapsed = time_us_64() - start;
+                } while(elapsed < BENCH_MIN_TIME_US);
+
+                double cycles = elapsed * cycles_per_us();
+                printf("bench=pattern bit_depth=%u pattern=%s length=%u renders=%u cycles_per_render=%.0f cycles_per_sample=%.2f\n",
+                    bit_depth, pattern_name(pattern), length, renders, cycles / renders, cycles / samples);
+            }
+        }
+    }
+}
+
+static void bench_dds() {
+    const struct { uint bit_depth; uint channels; } runs[] = {{16, 2}, {24, 2}, {32, 2}, {32, 8}};
+    static int32_t buffer[256 * 8];
+
+    for(auto &run : runs) {
+        DDS_GENERATOR dds;
+        dds.set_sample_format(i2s_sample_format(run.bit_depth), run.bit_depth, run.channels);
+        for(uint c=0; c<run.channels; ++c) {
+            dds.set_frequency_word(c, DDS_GENERATOR::frequency_to_word(1000 + 100*c, 48000));
+            dds.set_amplitude(c, 0x10000000);
+        }
+
+        uint samples = 0;
+        uint64_t start = time_us_64(), elapsed;
+        do {
+            dds.render(buffer, 256);
+            samples += 256 * run.channels;
+            elapsed = time_us_64() - start;
+        } while(elapsed < BENCH_MIN_TIME_US);
+
+        printf("bench=dds bit_depth=%u channels=%u samples=%u cycles_per_sample=%.2f samples_per_s=%.0f\n",
+            run.bit_depth, run.channels, samples, elapsed * cycles_per_us() / samples, samples * 1e6 / elapsed);
+    }
+}
+
+#if I2S_ENABLE_STATS
+/// IRQ cost of streaming blocks of length words from a DDS_GENERATOR, for I2S_CONTROLLER and I2S_STATIC_CONTROLLER
+template<class CONTROLLER>
+static void bench_stream_irq(CONTROLLER &i2s, const char *controller, uint length) {
+    i2s.set_pio_divider(0x400);
+    i2s.enable_tx_streaming(13, length);
+
+    DDS_GENERATOR dds;
+    dds.set_frequency_word(0, DDS_GENERATOR::frequency_to_word(1000, i2s.get_sample_rate()));
+    dds.set_amplitude(0, 0x10000000);
+    dds.fill(*i2s.tx_stream);
+    i2s.start_i2s();
+    i2s.reset_stats();
+
+    uint64_t start = time_us_64();
+    while(time_us_64() - start < 100000) {
+        dds.fill(*i2s.tx_stream);
+    }
+
+    I2S_STATS stats = i2s.get_tx_stats();
+    printf("bench=irq source=stream controller=%s length=%u irqs=%" PRIu32 " isr_cycles_min=%" PRIu32 " isr_cycles_avg=%" PRIu32 " isr_cycles_max=%" PRIu32
+        " margin_us_min=%" PRIu32 " underruns=%" PRIu32 "\n",
+        controller, length, stats.irq_count, stats.isr_cycles_min, stats.isr_cycles_avg(), stats.isr_cycles_max, stats.margin_us_min, i2s.tx_stream->get_underrun_count());
+}
+#endif
+
+static void bench_irq() {
+#if I2S_ENABLE_STATS
+    const uint lengths[] = {32, 256, 2048};
+
+    // queued patterns, one IRQ per queue_tx_buffer()
+    for(uint length : lengths) {
+        I2S_CONTROLLER i2s(BENCH_BUFFER_SIZE, PIN_I2S_DOUT, PIN_I2S_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, BENCH_PIO, BENCH_PIO_SM);
+        i2s.set_pio_divider(0x400);
+        i2s.set_pattern(PATTERN_BUFFER::PATTERN::SINE, 0, 0x10000000, length);
+        i2s.start_i2s();
+
+        uint buffer_len;
+        const int32_t *buffer = i2s.pattern_buffer.get_next_buffer(buffer_len);
+        i2s.reset_stats();
+        for(uint i=0; i<200; ++i) {
+            uint32_t seq = i2s.queue_tx_buffer(buffer, buffer_len);
+            while(!i2s.is_tx_buffer_playing(seq)) {
+                tight_loop_contents();
+            }
+        }
+
+        I2S_STATS stats = i2s.get_tx_stats();
+        printf("bench=irq source=queue length=%u irqs=%" PRIu32 " isr_cycles_min=%" PRIu32 " isr_cycles_avg=%" PRIu32 " isr_cycles_max=%" PRIu32
+            " margin_us_min=%" PRIu32 "\n",
+            length, stats.irq_count, stats.isr_cycles_min, stats.isr_cycles_avg(), stats.isr_cycles_max, stats.margin_us_min);
+    }
+
+    // streaming, one IRQ per block, the runtime controller against one specialized at compile time
+    for(uint length : lengths) {
+        I2S_CONTROLLER i2s(BENCH_BUFFER_SIZE, PIN_I2S_DOUT, PIN_I2S_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, BENCH_PIO, BENCH_PIO_SM);
+        bench_stream_irq(i2s, "runtime", length);
+    }
+    for(uint length : lengths) {
+        I2S_STATIC_CONTROLLER<I2S_CONTROLLER_MODE::TX, 32> i2s(BENCH_BUFFER_SIZE, PIN_I2S_DOUT, PIN_I2S_CLOCK_BASE, BENCH_PIO, BENCH_PIO_SM);
+        bench_stream_irq(i2s, "static", length);
+    }
+#else
+    printf("bench=irq skipped=1 reason=I2S_ENABLE_STATS\n");
+#endif
+}
+
+/**
+ * @brief run at decreasing dividers until the TX FIFO stalls or the ring underruns
+ * Replaying the pattern buffer never loads the CPU, so both sources stream from the ring and the limit is the one of this core.
+ * @param render feed the ring from a DDS_GENERATOR in blocks of 256 words, otherwise only commit words in blocks of
+ *               IRQ_BLOCK_WORDS so the DMA IRQ is the bottleneck
+ */
+static void bench_max_rate(uint bit_depth, bool render) {
+    uint32_t best_divider = 0;
+    float best_rate = 0;
+    uint block_words = 256;
+
+    // whole dividers first, then quarters below 4
+    for(uint32_t divider=0x1000; divider>=0x100; divider -= divider > 0x400 ? 0x100 : 0x40) {
+        I2S_CONTROLLER i2s(BENCH_BUFFER_SIZE, PIN_I2S_DOUT, PIN_I2S_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, bit_depth, BENCH_PIO, BENCH_PIO_SM);
+        i2s.set_pio_divider(divider);
+
+        // blocks of whole units, see TX_RING_BUFFER
+        const uint unit_words = i2s_unit_words(i2s_frame_bits(i2s.get_sample_format(), bit_depth));
+        block_words = (render ? 256 : IRQ_BLOCK_WORDS) / unit_words * unit_words;
+        i2s.enable_tx_streaming(13, block_words);
+
+        DDS_GENERATOR dds;
+        dds.set_sample_format(i2s.get_sample_format(), bit_depth);
+        dds.set_frequency_word(0, DDS_GENERATOR::frequency_to_word(1000, i2s.get_sample_rate()));
+        dds.set_amplitude(0, 0x10000000);
+        auto fill = [&]() {
+            if(render) {
+                dds.fill(*i2s.tx_stream);
+                return;
+            }
+            uint32_t len;
+            i2s.tx_stream->get_write_region(len);
+            while(len) {
+                i2s.tx_stream->commit_write(len);
+                i2s.tx_stream->get_write_region(len);
+            }
+        };
+        fill();
+        i2s.start_i2s();
+
+        // the start itself may stall once
+        sleep_ms(1);
+        fill();
+        clear_tx_stall();
+
+        uint64_t start = time_us_64();
+        while(time_us_64() - start < 50000) {
+            fill();
+        }
+
+        bool failed = tx_stalled() || i2s.tx_stream->get_underrun_count() > 0;
+        if(failed) {
+            break;
+        }
+        best_divider = divider;
+        best_rate = i2s.get_sample_rate();
+    }
+
+    printf("bench=max_rate bit_depth=%u source=%s block_words=%u divider=0x%" PRIx32 " sample_rate=%.0f\n",
+        bit_depth, render ? "stream" : "irq", block_words, best_divider, best_rate);
+}
+
+// SRAM4 next to the core 1 stack, which is unused here. Core 0 runs on its stack in SRAM5
+static I2S_STATIC_ARENA<512> sram4_arena __scratch_x("bench");
+
+// striped SRAM banks 0-3, like the heap and the static data
+static int32_t striped_data[512];
+
+const uint CONTENTION_WORDS = 256;
+
+/// unpaced DMA that reads one word and writes a 4 word ring, until dma_channel_abort()
+static uint start_dma_load(int32_t *source, int32_t *sink) {
+    uint channel = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(channel);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_ring(&config, true, 4); // sink has to be 16 byte aligned
+    channel_config_set_dreq(&config, DREQ_FORCE);
+    dma_channel_configure(channel, &config, sink, source, 0xFFFFFFFF, true);
+    return channel;
+}
+
+/// CPU cycles per word of summing up data
+static double cpu_read_cycles(const volatile int32_t *data) {
+    uint passes = 0;
+    int32_t sum = 0;
+    uint64_t start = time_us_64(), elapsed;
+
+    do {
+        for(uint i=0; i<CONTENTION_WORDS; ++i) {
+            sum += data[i];
+        }
+        ++passes;
+        elapsed = time_us_64() - start;
+    } while(elapsed < BENCH_MIN_TIME_US);
+
+    (void)sum;
+    return elapsed * cycles_per_us() / (passes * CONTENTION_WORDS);
+}
+
+static void bench_contention() {
+    int32_t *sram4_cpu = (int32_t *)sram4_arena.allocate(CONTENTION_WORDS * sizeof(int32_t));
+    int32_t *sram4_dma = (int32_t *)sram4_arena.allocate(4 * sizeof(int32_t), 16);
+    int32_t *striped_cpu = striped_data;
+    int32_t *striped_dma = (int32_t *)(((uintptr_t)(striped_data + CONTENTION_WORDS) + 15) & ~(uintptr_t)15);
+
+    struct { const char *cpu_name; int32_t *cpu; const char *dma_name; int32_t *dma; } runs[] = {
+        {"striped", striped_cpu, "none", NULL},
+        {"striped", striped_cpu, "striped", striped_dma},
+        {"striped", striped_cpu, "sram4", sram4_dma},
+        {"sram4", sram4_cpu, "none", NULL},
+        {"sram4", sram4_cpu, "sram4", sram4_dma},
+        {"sram4", sram4_cpu, "striped", striped_dma},
+    };
+
+    for(auto &run : runs) {
+        int channel = run.dma ? start_dma_load(run.dma, run.dma) : -1;
+        double cycles = cpu_read_cycles(run.cpu);
+        if(channel >= 0) {
+            dma_channel_abort(channel);
+            dma_channel_unclaim(channel);
+        }
+        printf("bench=contention cpu=%s dma=%s cycles_per_word=%.3f\n", run.cpu_name, run.dma_name, cycles);
+    }
+    sram4_arena.reset();
+}
+
+int main(void) {
+    stdio_uart_init_full(uart0, 115200, 0, 1);
+    sleep_ms(100);
+
+    printf("bench=info sys_hz=%" PRIu32 " stats=%d\n", clock_get_hz(clk_sys), I2S_ENABLE_STATS);
+
+    bench_pattern();
+    bench_dds();
+    bench_irq();
+    const uint bit_depths[] = {16, 24, 32};
+    for(uint bit_depth : bit_depths) {
+        bench_max_rate(bit_depth, false);
+        bench_max_rate(bit_depth, true);
+    }
+    bench_contention();
+
+    printf("bench=done\n");
+    while(1) {
+        tight_loop_contents();
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#include "waveform.hpp"
+#include "tx_ring_buffer.hpp"
+#include "sample_format.hpp"
+
+#define DDS_MAX_CHANNELS I2S_MAX_CHANNELS
+
+/**
+ * @brief direct digital synthesis sine generator for the TX streaming mode
+ * Every channel has a 32 bit phase accumulator, so the frequency resolution is sample_rate / 2**32
+ * and no pattern buffer is needed for low frequencies.
+ * Settings can be changed from the other core, they are applied at the start of the next rendered block.
+ * The accumulator keeps running across frequency changes, so frequency hops are phase continuous.
+ */
+class DDS_GENERATOR {
+private:
+    struct CHANNEL {
+        uint32_t accumulator;
+        std::atomic<uint32_t> frequency_word; // phase increment per sample
+        std::atomic<uint32_t> phase_word;     // constant phase offset
+        std::atomic<int32_t> amplitude, offset;
+    } channels[DDS_MAX_CHANNELS];
+
+    I2S_SAMPLE_FORMAT format;
+    uint32_t bit_depth;
+    uint32_t channel_count;
+public:
+    DDS_GENERATOR() : format(I2S_SAMPLE_FORMAT::WORD_32), bit_depth(32), channel_count(2) {
+        for(uint32_t i=0; i<DDS_MAX_CHANNELS; ++i) {
+            channels[i].accumulator = 0;
+            channels[i].frequency_word = 0;
+            channels[i].phase_word = 0;
+            channels[i].amplitude = 0;
+            channels[i].offset = 0;
+        }
+    }
+
+    /// convert a frequency in Hz to a frequency word, not meant for the hot path
+    static uint32_t frequency_to_word(double frequency, double sample_rate) {
+        return (uint32_t)(int64_t)(frequency / sample_rate * 4294967296.0 + 0.5);
+    }
+
+    /// convert a phase in degrees to a phase word
+    static uint32_t degrees_to_word(double degrees) {
+        return (uint32_t)(int64_t)(degrees / 360. * 4294967296.0 + 0.5);
+    }
+
+    /**
+     * @brief memory layout of the rendered frames, not thread safe
+     * Has to match I2S_CONTROLLER::get_sample_format() and I2S_CONTROLLER::get_channel_count().
+     */
+    void set_sample_format(I2S_SAMPLE_FORMAT _format, uint32_t _bit_depth, uint32_t _channel_count = 2) {
+        format = _format;
+        bit_depth = _bit_depth;
+        channel_count = _channel_count;
+    }
+
+    void set_frequency_word(uint32_t channel, uint32_t frequency_word) { channels[channel].frequency_word.store(frequency_word, std::memory_order_relaxed); }
+    void set_phase_word(uint32_t channel, uint32_t phase_word) { channels[channel].phase_word.store(phase_word, std::memory_order_relaxed); }
+    void set_amplitude(uint32_t channel, int32_t amplitude) { channels[channel].amplitude.store(amplitude, std::memory_order_relaxed); }
+    void set_offset(uint32_t channel, int32_t offset) { channels[channel].offset.store(offset, std::memory_order_relaxed); }
+
+    /// restart all accumulators at phase 0, e.g. to align channels after frequency changes
+    void reset_phase() {
+        for(uint32_t i=0; i<DDS_MAX_CHANNELS; ++i)
+            channels[i].accumulator = 0;
+    }
+
+    /**
+     * @brief render interleaved L/R frames in the sample format
+     * @param buffer destination, frames * i2s_frame_bits() bits
+     * @param frames number of frames to generate, a multiple of i2s_unit_frames()
+     */
+    void render(int32_t *buffer, uint32_t frames) {
+        // take a consistent copy of the settings for this block
+        uint32_t accumulator[DDS_MAX_CHANNELS], frequency_word[DDS_MAX_CHANNELS], phase_word[DDS_MAX_CHANNELS];
+        int32_t amplitude[DDS_MAX_CHANNELS], offset[DDS_MAX_CHANNELS];
+        for(uint32_t c=0; c<channel_count; ++c) {
+            accumulator[c] = channels[c].accumulator;
+            frequency_word[c] = channels[c].frequency_word.load(std::memory_order_relaxed);
+            phase_word[c] = channels[c].phase_word.load(std::memory_order_relaxed);
+            amplitude[c] = channels[c].amplitude.load(std::memory_order_relaxed);
+            offset[c] = channels[c].offset.load(std::memory_order_relaxed);
+        }
+
+        I2S_FRAME_WRITER writer(buffer, format, bit_depth, channel_count);
+        int32_t frame[DDS_MAX_CHANNELS];
+        for(uint32_t i=0; i<frames; ++i) {
+            for(uint32_t c=0; c<channel_count; ++c) {
+                frame[c] = scale_q31(amplitude[c], sine_q31(accumulator[c] + phase_word[c])) + offset[c];
+                accumulator[c] += frequency_word[c];
+            }
+            writer.write_frame(frame);
+        }
+
+        for(uint32_t c=0; c<channel_count; ++c)
+            channels[c].accumulator = accumulator[c];
+    }
+
+    /**
+     * @brief render directly into the free space of a TX ring buffer
+     * @param max_frames upper limit of frames to render, keeps the time spent here bounded
+     * @return number of frames rendered
+     */
+    uint32_t fill(TX_RING_BUFFER &ring, uint32_t max_frames = 0xFFFFFFFF) {
+        // smallest number of frames that fills whole words, e.g. 2 frames in 3 words for PACKED_24
+        const uint32_t frame_bits = i2s_frame_bits(format, bit_depth, channel_count);
+        const uint32_t unit_frames = i2s_unit_frames(frame_bits);
+        const uint32_t unit_words = i2s_unit_words(frame_bits);
+        uint32_t rendered = 0, region_len;
+
+        // at most two regions because of the wrap around, plus one unit split by it
+        for(uint32_t region=0; region<3 && max_frames - rendered >= unit_frames; ++region) {
+            int32_t *region_start = ring.get_write_region(region_len);
+            uint32_t frames = region_len / unit_words * unit_frames;
+            if(frames > max_frames - rendered)
+                frames = (max_frames - rendered) / unit_frames * unit_frames;
+
+            if(frames == 0) {
+                // the unit does not fit in front of the wrap around, copy it over
+                int32_t unit[32]; // unit_words is at most the odd part of bit_depth
+                if(ring.free_space() < unit_words)
+                    break;
+                render(unit, unit_frames);
+                ring.write(unit, unit_words);
+                rendered += unit_frames;
+                continue;
+            }
+
+            render(region_start, frames);
+            ring.commit_write(frames / unit_frames * unit_words);
+            rendered += frames;
+        }
+        return rendered;
+    }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// default limit of the rate correction, well above the tolerance of two crystals
+#define DRIFT_MAX_CORRECTION_PPM 1000
+
+/**
+ * @brief PI controller that locks the TX sample rate to the rate the stream is written with
+ * Fed with the ring buffer fill level once per DMA block. A fuller buffer than the target means the source is faster,
+ * so the correction speeds up the output (smaller PIO divider) or, with a resampler, consumes more input per output frame.
+ * Blocks get shorter when the ring runs low or wraps around, so the integral steps with the words of every block
+ * and the loop keeps its bandwidth whatever the block lengths are.
+ *
+ * The PIO divider only has 8 fractional bits (hundreds of ppm at small dividers), so the divider is computed
+ * with 16 fractional bits and dithered between neighbouring steps from block to block (first order sigma-delta).
+ * Runs in the DMA IRQ, integer math only. Telemetry can be read from both cores.
+ */
+class DRIFT_CONTROLLER {
+private:
+    uint32_t target_fill;
+    int64_t kp;             // correction (Q32) per word of fill error
+    int64_t ki;             // integral step (Q56) per word of fill error and word played
+    int64_t max_integral;   // Q48
+    int64_t max_correction; // Q32
+
+    int64_t integral;       // Q48
+    uint32_t nominal_divider; // 16.16
+    uint32_t dither;
+
+    std::atomic<uint32_t> fill_level, min_fill, max_fill;
+    std::atomic<int32_t> correction; // Q32, rate correction of the output (positive is faster)
+    std::atomic<uint32_t> divider;   // 16.8, last divider from update()
+public:
+    /**
+     * @param _target_fill fill level to hold in words, usually half the ring
+     * @param _nominal_divider PIO divider in 16.8 format without correction
+     * @param words_per_second ring words played per second, sample_rate * frame bits / 32
+     * @param bandwidth_hz natural frequency of the loop, lower values follow the source more slowly but keep the pitch steadier
+     * @param max_correction_ppm limit of the correction
+     */
+    DRIFT_CONTROLLER(uint32_t _target_fill, uint32_t _nominal_divider, double words_per_second, double bandwidth_hz = 0.05, uint32_t max_correction_ppm = DRIFT_MAX_CORRECTION_PPM)
+        : target_fill(_target_fill), nominal_divider(_nominal_divider << 8) {
+        // fill'' = -words_per_second * correction'  ->  s^2 + W*kp*s + W*ki = 0 with a damping of 0.7
+        const double omega = 2 * 3.14159265358979 * bandwidth_hz;
+        const double damping = 0.7;
+
+        kp = (int64_t)(2 * damping * omega / words_per_second * 4294967296.0);
+        ki = (int64_t)(omega * omega / words_per_second / words_per_second * 72057594037927936.0);
+        max_correction = (int64_t)max_correction_ppm * 4294967296ll / 1000000;
+        max_integral = max_correction << 16;
+        reset();
+    }
+
+    /// forget the integral and the telemetry, e.g. after an underrun
+    void reset() {
+        integral = 0;
+        dither = 0;
+        fill_level.store(target_fill, std::memory_order_relaxed);
+        min_fill.store(0xFFFFFFFF, std::memory_order_relaxed);
+        max_fill.store(0, std::memory_order_relaxed);
+        correction.store(0, std::memory_order_relaxed);
+        divider.store(nominal_divider >> 8, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief one controller step, consumer side (DMA IRQ)
+     * @param fill words in the ring, TX_RING_BUFFER::fill_level()
+     * @param block_words words of the block queued with this update, the time to the next update
+     * @return PIO divider in 16.8 format for the next block
+     */
+    uint32_t update(uint32_t fill, uint32_t block_words) {
+        int32_t error = fill - target_fill;
+
+        integral += ((ki * error) >> 8) * block_words;
+        if(integral > max_integral)
+            integral = max_integral;
+        if(integral < -max_integral)
+            integral = -max_integral;
+
+        int64_t new_correction = (integral >> 16) + kp * error;
+        if(new_correction > max_correction)
+            new_correction = max_correction;
+        if(new_correction < -max_correction)
+            new_correction = -max_correction;
+
+        // divider = nominal / (1 + correction), to first order
+        uint32_t divider_16 = nominal_divider - (((int64_t)nominal_divider * new_correction) >> 32);
+        dither += divider_16 & 0xFF;
+        uint32_t new_divider = divider_16 >> 8;
+        if(dither >= 0x100) {
+            dither -= 0x100;
+            ++new_divider;
+        }
+
+        fill_level.store(fill, std::memory_order_relaxed);
+        if(fill < min_fill.load(std::memory_order_relaxed))
+            min_fill.store(fill, std::memory_order_relaxed);
+        if(fill > max_fill.load(std::memory_order_relaxed))
+            max_fill.store(fill, std::memory_order_relaxed);
+        correction.store(new_correction, std::memory_order_relaxed);
+        divider.store(new_divider, std::memory_order_relaxed);
+        return new_divider;
+    }
+
+    // ---- telemetry ---- //
+
+    uint32_t get_target_fill() const { return target_fill; }
+    uint32_t get_fill_level() const { return fill_level.load(std::memory_order_relaxed); }
+
+    /// lowest and highest fill level since reset()
+    uint32_t get_min_fill() const { return min_fill.load(std::memory_order_relaxed); }
+    uint32_t get_max_fill() const { return max_fill.load(std::memory_order_relaxed); }
+
+    /// rate correction in Q32, positive plays faster
+    int32_t get_correction() const { return correction.load(std::memory_order_relaxed); }
+    float get_correction_ppm() const { return get_correction() * (1e6f / 4294967296.f); }
+
+    /// last PIO divider in 16.8 format
+    uint32_t get_divider() const { return divider.load(std::memory_order_relaxed); }
+
+    /// input frames per output frame for POLYPHASE_RESAMPLER::set_step() in Q32.32 (1 + correction)
+    uint64_t get_resampler_step() const { return (1ull << 32) + (int64_t)get_correction(); }
+};
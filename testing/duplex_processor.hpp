@@ -0,0 +1,167 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+#include "i2s_memory.hpp"
+
+/**
+ * @brief per block processing callback of I2S_DUPLEX_PROCESSOR, runs in the DMA IRQ
+ * @param rx_block captured samples in the sample format, only valid during the call
+ * @param tx_block samples to play in the sample format, has to be filled completely
+ * @param frames frames per block, both blocks have the same layout
+ * @param context pointer passed to I2S_CONTROLLER::enable_duplex_processing()
+ */
+typedef void (*I2S_BLOCK_CALLBACK)(const int32_t *rx_block, int32_t *tx_block, uint32_t frames, void *context);
+
+/**
+ * @brief fixed latency RX -> TX processing in TRX modes
+ * The RX DMA fills a ring of three blocks, chained like the TX side: a control channel restarts it with the block queued in the last IRQ,
+ * so the IRQ may come up to a block late without losing samples. When block n is complete, the callback turns it into TX block n+1+latency_blocks,
+ * which the TX DMA picks from a ring of latency_blocks+1 blocks without any copy. So a sample goes out exactly
+ * (1+latency_blocks) blocks after it came in: one block for the capture, latency_blocks for the callback and the TX DMA that reads ahead.
+ * With latency_blocks = 1 the callback has to finish within one block, less the few words the TX FIFO reads ahead.
+ * Later blocks are counted with get_late_count().
+ * TX blocks not written yet (the first latency_blocks+1 after the start) are silent.
+ */
+class I2S_DUPLEX_PROCESSOR {
+private:
+    const I2S_BLOCK_CALLBACK callback;
+    void *const context;
+    const uint32_t block_frames, block_words;
+    const uint32_t latency_blocks;
+    const uint32_t tx_block_count; // TX ring, the block playing and latency_blocks blocks ahead of it
+    I2S_BUFFER_ARENA *const arena;
+
+    int32_t *tx_blocks;
+    int32_t *rx_blocks; // RX_BLOCK_COUNT blocks: the DMA fills one, the next one is queued, the callback reads the third
+
+    // ring positions, kept within their rings so they never wrap at 2^32 (the counts are no powers of two)
+    uint32_t tx_index;      // TX block handed to the TX DMA next
+    uint32_t rx_index;      // RX block the RX DMA writes to
+    uint32_t capture_index; // TX block of the capture in rx_index: capture n plays in block n+1+latency_blocks, that is n of the TX ring
+    std::atomic<uint32_t> processed_count;
+    std::atomic<uint32_t> late_count;
+
+    static uint32_t next_index(uint32_t index, uint32_t count) { return index + 1 == count ? 0 : index + 1; }
+    static uint32_t previous_index(uint32_t index, uint32_t count) { return index ? index - 1 : count - 1; }
+
+    int32_t *get_tx_block(uint32_t index) const { return tx_blocks + index * block_words; }
+    int32_t *get_rx_block(uint32_t index) const { return rx_blocks + index * block_words; }
+public:
+    static constexpr uint32_t RX_BLOCK_COUNT = 3;
+
+    /**
+     * @param _block_frames frames per block
+     * @param _block_words words per block in the sample format, see i2s_rx_buffer_words()
+     * @param _latency_blocks blocks between the end of a capture and the start of its playback (>= 1)
+     * @param _arena place the blocks there instead of the heap, see I2S_BUFFER_ARENA
+     */
+    I2S_DUPLEX_PROCESSOR(I2S_BLOCK_CALLBACK _callback, void *_context, uint32_t _block_frames, uint32_t _block_words,
+                         uint32_t _latency_blocks, I2S_BUFFER_ARENA *_arena = NULL)
+        : callback(_callback), context(_context), block_frames(_block_frames), block_words(_block_words),
+          latency_blocks(_latency_blocks ? _latency_blocks : 1), tx_block_count(latency_blocks + 1), arena(_arena) {
+        tx_blocks = i2s_allocate_words(arena, tx_block_count * block_words);
+        rx_blocks = i2s_allocate_words(arena, RX_BLOCK_COUNT * block_words);
+        reset();
+    }
+
+    ~I2S_DUPLEX_PROCESSOR() {
+        i2s_free_words(arena, rx_blocks);
+        i2s_free_words(arena, tx_blocks);
+    }
+
+    /// silence and counters, must not be called while DMA is running
+    void reset() {
+        memset(tx_blocks, 0, tx_block_count * block_words * sizeof(int32_t));
+        tx_index = 0;
+        rx_index = 0;
+        capture_index = 0;
+        processed_count.store(0, std::memory_order_relaxed);
+        late_count.store(0, std::memory_order_relaxed);
+    }
+
+    /// arena words of a processor, like i2s_tx_stream_storage_words()
+    static constexpr uint32_t storage_words(uint32_t block_words, uint32_t latency_blocks) {
+        return (latency_blocks + 1 + RX_BLOCK_COUNT) * block_words + i2s_object_words<I2S_DUPLEX_PROCESSOR>();
+    }
+
+    // ---- TX DMA ---- //
+
+    /// block the TX DMA should play after the one it got last, first call after reset() gives block 0
+    const int32_t *next_tx_block() {
+        const int32_t *block = get_tx_block(tx_index);
+        tx_index = next_index(tx_index, tx_block_count);
+        return block;
+    }
+
+    // ---- RX DMA ---- //
+
+    /// block the RX DMA should write to first, after reset()
+    int32_t *get_fill_buffer() const { return get_rx_block(rx_index); }
+
+    /// block the control channel restarts the RX DMA with after the one it writes to
+    int32_t *get_queued_buffer() const { return get_rx_block(next_index(rx_index, RX_BLOCK_COUNT)); }
+
+    /**
+     * @brief the RX DMA completed a block and continues with the queued one
+     * @return block to queue after that one, the filled one is handed to process()
+     */
+    int32_t *buffer_filled() {
+        rx_index = next_index(rx_index, RX_BLOCK_COUNT);
+        capture_index = next_index(capture_index, tx_block_count);
+        return get_queued_buffer();
+    }
+
+    /**
+     * @brief run the callback on the last filled block, after the RX DMA got the block to continue with
+     * @return TX block that was written, for check_deadline()
+     */
+    const int32_t *process() {
+        int32_t *tx_block = get_tx_block(previous_index(capture_index, tx_block_count));
+
+        callback(get_rx_block(previous_index(rx_index, RX_BLOCK_COUNT)), tx_block, block_frames, context);
+        processed_count.store(processed_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return tx_block;
+    }
+
+    /**
+     * @brief count the block as late if the TX DMA already read from it
+     * @param tx_read_addr read address of the TX DMA channel, sampled after process()
+     */
+    void check_deadline(const int32_t *tx_block, uintptr_t tx_read_addr) {
+        if(tx_read_addr > (uintptr_t)tx_block && tx_read_addr <= (uintptr_t)(tx_block + block_words)) {
+            late_count.store(late_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief round trip from the input pin to the output pin in words, from a snapshot of both channels
+     * The output is the word in the TX OSR, behind the read address by the TX FIFO. The input is the word in the RX ISR,
+     * ahead of the write address by the RX FIFO. Both positions are taken within a block, so they have to be less than
+     * half a block apart, which holds as both state machines share the frame clock.
+     */
+    uint32_t latency_words(uintptr_t tx_read_addr, uint32_t tx_fifo_level, uintptr_t rx_write_addr, uint32_t rx_fifo_level) const {
+        const int32_t block = block_words;
+        const int32_t tx_offset = ((tx_read_addr - (uintptr_t)tx_blocks) / sizeof(int32_t)) % block;
+        const int32_t rx_offset = ((rx_write_addr - (uintptr_t)rx_blocks) / sizeof(int32_t)) % block;
+
+        // the output runs ahead of the block grid by this much
+        int32_t lead = (tx_offset - (int32_t)tx_fifo_level - 1) - (rx_offset + (int32_t)rx_fifo_level);
+        lead = ((lead % block) + block + block / 2) % block - block / 2;
+
+        return (1 + latency_blocks) * block - lead;
+    }
+
+    /// blocks the callback turned around since the start
+    uint32_t get_processed_count() const { return processed_count.load(std::memory_order_relaxed); }
+
+    /// blocks the callback finished after the TX DMA started playing them
+    uint32_t get_late_count() const { return late_count.load(std::memory_order_relaxed); }
+
+    uint32_t get_block_frames() const { return block_frames; }
+    uint32_t get_block_words() const { return block_words; }
+    uint32_t get_latency_blocks() const { return latency_blocks; }
+};
@@ -0,0 +1,212 @@
+// Host benchmark of the hot paths, the counterpart of the bench_i2s firmware (bench.cpp) on one core of the build machine.
+// Prints the same bench=... key=value lines, with ns instead of system clock cycles:
+//   bench=pattern     regeneration cost per PATTERN_BUFFER::PATTERN, bit depth and pattern length
+//   bench=dds         DDS_GENERATOR::render() cost per sample format and channel count
+//   bench=irq         wall time of the DMA IRQ handler per streamed block, I2S_CONTROLLER and I2S_STATIC_CONTROLLER
+//   bench=max_rate    highest frame rate one core sustains when it renders the stream (source=stream)
+//                     or only services the IRQ of short blocks (source=irq), from the costs above
+//
+//   bench_i2s_host [quick]   quick: shorter runs, for ctest
+#include <string.h>
+#include <chrono>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+
+const uint BENCH_BUFFER_SIZE = 4096;
+const uint IRQ_BLOCK_WORDS = 16; // short blocks of the IRQ bound max_rate run, like in bench.cpp
+
+static double min_seconds = 0.05; // repeat measurements for at least this long
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char *pattern_name(PATTERN_BUFFER::PATTERN pattern) {
+    switch(pattern) {
+        case PATTERN_BUFFER::PATTERN::CONST: return "CONST";
+        case PATTERN_BUFFER::PATTERN::SINE: return "SINE";
+        case PATTERN_BUFFER::PATTERN::TRI: return "TRI";
+        case PATTERN_BUFFER::PATTERN::SQUARE: return "SQUARE";
+    }
+    return "?";
+}
+
+static void bench_pattern() {
+    const PATTERN_BUFFER::PATTERN patterns[] = {PATTERN_BUFFER::PATTERN::CONST, PATTERN_BUFFER::PATTERN::SINE, PATTERN_BUFFER::PATTERN::TRI, PATTERN_BUFFER::PATTERN::SQUARE};
+
+    for(uint bit_depth : {16, 24, 32}) {
+        PATTERN_BUFFER pattern_buffer(BENCH_BUFFER_SIZE, i2s_sample_format(bit_depth), bit_depth);
+
+        for(PATTERN_BUFFER::PATTERN pattern : patterns) {
+            for(uint length : {64, 512, 4096}) {
+                uint renders = 0, samples = 0;
+                const auto start = std::chrono::steady_clock::now();
+                double seconds;
+
+                // every setter renders the whole pattern, left and right differ so both channels are generated
+                do {
+                    pattern_buffer.set_channel_pattern(0, pattern, 0, 0x10000000, 0);
+                    pattern_buffer.set_channel_pattern(1, pattern, 0, 0x10000000, 0x40000000);
+                    uint clipped_length = pattern_buffer.set_pattern_length(length);
+                    renders += 3;
+                    samples += 3 * 2 * clipped_length;
+                    seconds = seconds_since(start);
+                } while(seconds < min_seconds);
+
+                printf("bench=pattern bit_depth=%u pattern=%s length=%u renders=%u ns_per_render=%.0f ns_per_sample=%.2f\n",
+                       bit_depth, pattern_name(pattern), length, renders, seconds * 1e9 / renders, seconds * 1e9 / samples);
+            }
+        }
+    }
+}
+
+/// ns per frame of DDS_GENERATOR::render() in the sample format of bit_depth
+static double dds_ns_per_frame(uint bit_depth, uint channels) {
+    static int32_t buffer[256 * 8];
+    DDS_GENERATOR dds;
+    dds.set_sample_format(i2s_sample_format(bit_depth), bit_depth, channels);
+    for(uint c=0; c<channels; ++c) {
+        dds.set_frequency_word(c, DDS_GENERATOR::frequency_to_word(1000 + 100*c, 48000));
+        dds.set_amplitude(c, 0x10000000);
+    }
+
+    uint frames = 0;
+    const auto start = std::chrono::steady_clock::now();
+    double seconds;
+    do {
+        dds.render(buffer, 256);
+        frames += 256;
+        seconds = seconds_since(start);
+    } while(seconds < min_seconds);
+    return seconds * 1e9 / frames;
+}
+
+static void bench_dds() {
+    const struct { uint bit_depth; uint channels; } runs[] = {{16, 2}, {24, 2}, {32, 2}, {32, 8}};
+    for(auto &run : runs) {
+        const double ns_per_frame = dds_ns_per_frame(run.bit_depth, run.channels);
+        printf("bench=dds bit_depth=%u channels=%u ns_per_sample=%.2f samples_per_s=%.0f\n",
+               run.bit_depth, run.channels, ns_per_frame / run.channels, run.channels * 1e9 / ns_per_frame);
+    }
+}
+
+// the I2S handler on the shared DMA IRQ, wrapped to time every call
+static irq_handler_t timed_handler;
+static double handler_seconds;
+static uint handler_calls;
+
+static void timing_wrapper() {
+    const auto start = std::chrono::steady_clock::now();
+    timed_handler();
+    handler_seconds += seconds_since(start);
+    ++handler_calls;
+}
+
+static void wrap_handler(bool wrap) {
+    std::vector<irq_handler_t> &handlers = i2s_host.irq_handlers[DMA_IRQ_0 + I2S_DMA_IRQ];
+    for(irq_handler_t &handler : handlers) {
+        if(wrap && handler != timing_wrapper) {
+            timed_handler = handler;
+            handler = timing_wrapper;
+        } else if(!wrap && handler == timing_wrapper) {
+            handler = timed_handler;
+        }
+    }
+}
+
+/**
+ * @brief ns of the IRQ handler per streamed block of block_words
+ * The ring is kept full without touching the samples, so only the handler costs time.
+ */
+template<class CONTROLLER>
+static double stream_irq_ns(CONTROLLER &i2s, uint block_words) {
+    i2s.set_pio_divider(0x400);
+    i2s.enable_tx_streaming(13, block_words);
+    auto fill = [&]() {
+        uint32_t len;
+        i2s.tx_stream->get_write_region(len);
+        while(len) {
+            i2s.tx_stream->commit_write(len);
+            i2s.tx_stream->get_write_region(len);
+        }
+    };
+    fill();
+    i2s.start_i2s();
+
+    wrap_handler(true);
+    handler_seconds = 0;
+    handler_calls = 0;
+    const auto start = std::chrono::steady_clock::now();
+    do {
+        sleep_us(100);
+        fill();
+    } while(seconds_since(start) < min_seconds / 5 || handler_calls < 20);
+    wrap_handler(false);
+
+    CHECK(i2s.tx_stream->get_underrun_count() == 0);
+    return handler_seconds * 1e9 / handler_calls;
+}
+
+static void bench_irq() {
+    for(uint length : {32, 256, 2048}) {
+        I2S_CONTROLLER runtime(BENCH_BUFFER_SIZE, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+        const double runtime_ns = stream_irq_ns(runtime, length);
+        printf("bench=irq source=stream controller=runtime length=%u irqs=%u ns_per_irq=%.0f\n", length, handler_calls, runtime_ns);
+    }
+    for(uint length : {32, 256, 2048}) {
+        I2S_STATIC_CONTROLLER<I2S_CONTROLLER_MODE::TX, 32> fixed(BENCH_BUFFER_SIZE, PIN_DATA, PIN_CLOCK_BASE, pio0);
+        const double static_ns = stream_irq_ns(fixed, length);
+        printf("bench=irq source=stream controller=static length=%u irqs=%u ns_per_irq=%.0f\n", length, handler_calls, static_ns);
+    }
+}
+
+/**
+ * The PIO model runs on a virtual clock, so the CPU bound limit is not found by stepping the divider like on the target.
+ * It follows from the costs per frame instead: the IRQ per block and, for source=stream, the rendering of every frame.
+ */
+static void bench_max_rate(uint bit_depth) {
+    const I2S_SAMPLE_FORMAT format = i2s_sample_format(bit_depth);
+    const uint unit_words = i2s_unit_words(i2s_frame_bits(format, bit_depth));
+    const double words_per_frame = i2s_frame_bits(format, bit_depth) / 32.0;
+
+    // IRQ bound: blocks of IRQ_BLOCK_WORDS (whole units), the producer only commits words
+    const uint irq_block = IRQ_BLOCK_WORDS / unit_words * unit_words;
+    double irq_ns;
+    {
+        I2S_CONTROLLER i2s(BENCH_BUFFER_SIZE, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, bit_depth, pio0);
+        irq_ns = stream_irq_ns(i2s, irq_block);
+    }
+    const double irq_frames = irq_block / words_per_frame;
+    printf("bench=max_rate bit_depth=%u source=irq block_words=%u ns_per_frame=%.2f frames_per_s=%.0f\n",
+           bit_depth, irq_block, irq_ns / irq_frames, irq_frames * 1e9 / irq_ns);
+
+    // render bound: DDS into blocks of 256 words
+    double stream_irq;
+    {
+        I2S_CONTROLLER i2s(BENCH_BUFFER_SIZE, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, bit_depth, pio0);
+        stream_irq = stream_irq_ns(i2s, 256);
+    }
+    const double stream_block = 256 / unit_words * unit_words / words_per_frame;
+    const double ns_per_frame = dds_ns_per_frame(bit_depth, 2) + stream_irq / stream_block;
+    printf("bench=max_rate bit_depth=%u source=stream block_words=256 ns_per_frame=%.2f frames_per_s=%.0f\n",
+           bit_depth, ns_per_frame, 1e9 / ns_per_frame);
+    CHECK(1e9 / ns_per_frame > 48000);
+}
+
+int main(int argc, char **argv) {
+    if(argc > 1 && !strcmp(argv[1], "quick"))
+        min_seconds = 0.005;
+
+    printf("bench=info host=1 min_seconds=%.3f\n", min_seconds);
+    bench_pattern();
+    bench_dds();
+    bench_irq();
+    for(uint bit_depth : {16, 24, 32})
+        bench_max_rate(bit_depth);
+    printf("bench=done\n");
+    return host_test_result();
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdio.h>
+
+/**
+ * Checks of the host tests, see CMakeLists.txt in this directory.
+ * A failed CHECK() prints where it failed and the test carries on, host_test_result() is the exit code for ctest.
+ */
+
+inline int host_test_failures = 0;
+
+#define CHECK(condition) do { \
+        if(!(condition)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            ++host_test_failures; \
+        } \
+    } while(0)
+
+static inline int host_test_result() {
+    printf("%s\n", host_test_failures ? "FAILED" : "OK");
+    return host_test_failures != 0;
+}
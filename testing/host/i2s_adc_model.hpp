@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "i2s_hal.hpp"
+
+/// test sample of a frame and channel, left-justified with bit_depth bits like the library's samples
+static inline int32_t i2s_test_sample(uint32_t frame, uint channel, uint bit_depth) {
+    uint32_t x = frame * 2 + channel + 0x9E3779B9u;
+    x = (x ^ (x >> 16)) * 0x7FEB352Du;
+    x = (x ^ (x >> 15)) * 0x846CA68Bu;
+    x ^= x >> 16;
+    return (int32_t)(bit_depth < 32 ? x & ~(0xFFFFFFFFu >> bit_depth) : x);
+}
+
+/**
+ * @brief stand-in for an I2S ADC on the virtual clock of i2s_hal_host.hpp, slave to BCLK and LRCK
+ * Behaves like a Philips I2S transmitter: the data pin changes output_delay system clock cycles after a BCLK falling edge,
+ * a word starts with its MSB one BCLK after the LRCK edge and LRCK low is the left channel.
+ * Sends i2s_test_sample(frame, channel, bit_depth), counting frames from the first left word, so tests know what was sent.
+ * Add it before a PIO_TRACE of the same pins, so the trace sees the data change at the step that caused it.
+ */
+class I2S_ADC_MODEL {
+private:
+    const uint pin_data, pin_bclk, pin_lrck;
+    const uint bit_depth;
+    const uint64_t output_delay; // in 1/256 system clock cycles
+
+    bool last_bclk, last_lrck;
+    bool start_pending = false;
+    uint channel = 0;
+    uint32_t frame = UINT32_MAX; // no left word yet
+    uint32_t word = 0;
+    uint bits_left = 0;
+
+    bool output_pending = false;
+    bool output_level = false;
+    uint64_t output_time = 0;
+
+    static void step_hook(void *context) {
+        I2S_ADC_MODEL &adc = *(I2S_ADC_MODEL *)context;
+        const bool bclk = i2s_host_gpio_get(adc.pin_bclk);
+        const bool lrck = i2s_host_gpio_get(adc.pin_lrck);
+
+        if(adc.last_bclk && !bclk)
+            adc.falling_edge(lrck);
+        adc.last_bclk = bclk;
+
+        if(adc.output_pending && i2s_host.now >= adc.output_time) {
+            i2s_host_gpio_put(adc.pin_data, adc.output_level);
+            adc.output_pending = false;
+        }
+    }
+
+    void falling_edge(bool lrck) {
+        if(start_pending) {
+            start_pending = false;
+            if(channel == 0)
+                ++frame;
+            word = i2s_test_sample(frame, channel, bit_depth);
+            bits_left = bit_depth;
+        }
+
+        // zeros after the LSB, like the padding of a long word
+        output_level = bits_left ? word >> 31 : 0;
+        word <<= 1;
+        if(bits_left)
+            --bits_left;
+        output_pending = true;
+        output_time = i2s_host.now + output_delay;
+
+        // LRCK changes one bit before the MSB
+        if(lrck != last_lrck) {
+            start_pending = true;
+            channel = lrck;
+            last_lrck = lrck;
+        }
+    }
+
+public:
+    /**
+     * @param output_delay_cycles system clock cycles from the BCLK falling edge to the new data bit,
+     *                            it is applied at the first state machine step after that time
+     */
+    I2S_ADC_MODEL(uint _pin_data, uint _pin_bclk, uint _pin_lrck, uint _bit_depth, uint32_t output_delay_cycles = 0)
+        : pin_data(_pin_data), pin_bclk(_pin_bclk), pin_lrck(_pin_lrck), bit_depth(_bit_depth), output_delay((uint64_t)output_delay_cycles << 8),
+          last_bclk(i2s_host_gpio_get(_pin_bclk)), last_lrck(i2s_host_gpio_get(_pin_lrck)) {
+        i2s_host_gpio_put(pin_data, false);
+        i2s_host_add_step_hook(step_hook, this);
+    }
+
+    ~I2S_ADC_MODEL() {
+        i2s_host_remove_step_hook(step_hook, this);
+    }
+
+    I2S_ADC_MODEL(const I2S_ADC_MODEL &) = delete;
+    I2S_ADC_MODEL &operator=(const I2S_ADC_MODEL &) = delete;
+};
@@ -0,0 +1,410 @@
+// Linux host side of the USB streaming firmware (usb_stream.cpp), framed as in stream_protocol.hpp
+//
+//   g++ -std=c++20 -O2 -Wall -I.. i2s_stream_tool.cpp -o i2s_stream_tool -pthread
+//
+//   i2s_stream_tool capture /dev/ttyACM0 <seconds> <rx.raw>  captured samples to a file, in the sample format of the frames
+//   i2s_stream_tool play /dev/ttyACM0 <tx.raw>               samples from a file to the TX stream, paced by USB flow control
+//   i2s_stream_tool rate /dev/ttyACM0 <Hz>                   change the sample rate
+//   i2s_stream_tool loopback [pty|socket] [seconds]          full duplex against a stand-in device on a pty or a socket pair
+//
+// Results are printed as key=value lines like the bench firmware:
+//   bench=usb_capture   RX payload rate from the device, with lost frames and resyncs
+//   bench=usb_play      TX payload rate to the device
+//   bench=usb_loopback  sustained payload rate both ways through the same tty code as for the device. Every sample word
+//                       carries a running counter, so dropped, doubled or corrupted data shows up in errors=
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "stream_protocol.hpp"
+#include "sample_format.hpp"
+
+const uint32_t LOOPBACK_FRAME_WORDS = 512;  // like a 256 frame RX block of the firmware at 32 bit
+const size_t MAX_PENDING_BYTES = 0x10000;   // queued output before the producer waits
+const double REQUIRED_MBIT_S = 96000 * 64 / 1e6; // 32 bit stereo at 96 kHz, one direction
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// tty (or socket) carrying frames both ways, non blocking
+class STREAM_ENDPOINT {
+public:
+    typedef std::function<void(const I2S_STREAM_HEADER &, const uint8_t *)> FRAME_HANDLER;
+private:
+    const int fd;
+    I2S_STREAM_SENDER sender;
+    I2S_STREAM_RECEIVER receiver;
+
+    std::vector<uint8_t> out;
+    size_t out_offset = 0;
+    std::vector<uint8_t> payload; // of the frame being received
+
+    void feed(const uint8_t *data, size_t len, const FRAME_HANDLER &handler) {
+        while(len) {
+            uint32_t space_len;
+            uint8_t *space = receiver.header_space(space_len);
+            uint32_t n;
+            if(space) {
+                n = space_len < len ? space_len : len;
+                memcpy(space, data, n);
+                if(receiver.header_filled(n)) {
+                    payload.clear();
+                    if(receiver.get_header().length == 0) {
+                        handler(receiver.get_header(), NULL);
+                    }
+                }
+            } else {
+                n = receiver.get_payload_left() < len ? receiver.get_payload_left() : len;
+                payload.insert(payload.end(), data, data + n);
+                receiver.payload_consumed(n);
+                if(!receiver.in_payload()) {
+                    payload_bytes_in += payload.size();
+                    handler(receiver.get_header(), payload.data());
+                }
+            }
+            data += n;
+            len -= n;
+        }
+    }
+public:
+    uint64_t payload_bytes_in = 0;
+
+    STREAM_ENDPOINT(int _fd) : fd(_fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        payload.reserve(I2S_STREAM_MAX_PAYLOAD);
+    }
+
+    /// open a tty in raw mode, a path that is no tty (e.g. a socket) is used as it is
+    static int open_path(const char *path) {
+        int fd = open(path, O_RDWR | O_NOCTTY);
+        if(fd < 0) {
+            fprintf(stderr, "i2s_stream_tool: cannot open %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        struct termios tio;
+        if(tcgetattr(fd, &tio) == 0) {
+            cfmakeraw(&tio);
+            tcsetattr(fd, TCSANOW, &tio);
+        }
+        return fd;
+    }
+
+    void queue_frame(I2S_STREAM_TYPE type, const void *data, uint32_t length, uint8_t sample_format = 0, uint8_t bit_depth = 0, uint8_t channel_count = 0) {
+        if(out_offset == out.size()) {
+            out.clear();
+            out_offset = 0;
+        }
+        I2S_STREAM_HEADER header = sender.header(type, length, sample_format, bit_depth, channel_count);
+        out.insert(out.end(), (const uint8_t *)&header, (const uint8_t *)(&header + 1));
+        out.insert(out.end(), (const uint8_t *)data, (const uint8_t *)data + length);
+    }
+
+    /// bytes queued but not written yet
+    size_t get_pending() const { return out.size() - out_offset; }
+
+    /**
+     * @brief wait for the fd once, then read and write what is possible
+     * @return false when the other side is gone
+     */
+    bool pump(int timeout_ms, const FRAME_HANDLER &handler) {
+        struct pollfd pfd = {fd, (short)(POLLIN | (get_pending() ? POLLOUT : 0)), 0};
+        if(poll(&pfd, 1, timeout_ms) < 0) {
+            return errno == EINTR;
+        }
+
+        if(pfd.revents & POLLIN) {
+            uint8_t buffer[0x10000];
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+                return false;
+            }
+            if(n > 0) {
+                feed(buffer, n, handler);
+            }
+        } else if(pfd.revents & (POLLHUP | POLLERR)) {
+            return false;
+        }
+
+        if(pfd.revents & POLLOUT) {
+            ssize_t n = write(fd, out.data() + out_offset, get_pending());
+            if(n < 0 && errno != EAGAIN && errno != EINTR) {
+                return false;
+            }
+            if(n > 0) {
+                out_offset += n;
+            }
+        }
+        return true;
+    }
+
+    uint32_t get_lost_frame_count() const { return receiver.get_lost_frame_count(); }
+    uint32_t get_resync_count() const { return receiver.get_resync_count(); }
+};
+
+static void print_status(const I2S_STREAM_STATUS &status) {
+    printf("status sample_rate=%u rx_overruns=%u tx_underruns=%u tx_fill=%u\n",
+        status.sample_rate, status.rx_overrun_count, status.tx_underrun_count, status.tx_fill_level);
+}
+
+// ---- device commands ---- //
+
+static int capture(const char *path, double seconds, const char *file_name) {
+    int fd = STREAM_ENDPOINT::open_path(path);
+    FILE *file = fopen(file_name, "wb");
+    if(fd < 0 || !file) {
+        return 1;
+    }
+
+    STREAM_ENDPOINT endpoint(fd);
+    uint64_t frames = 0;
+    I2S_STREAM_HEADER format = {};
+
+    auto start = std::chrono::steady_clock::now();
+    while(seconds_since(start) < seconds) {
+        bool open = endpoint.pump(100, [&](const I2S_STREAM_HEADER &header, const uint8_t *payload) {
+            if(header.type == I2S_STREAM_TYPE::RX_DATA) {
+                fwrite(payload, 1, header.length, file);
+                format = header;
+                ++frames;
+            } else if(header.type == I2S_STREAM_TYPE::STATUS && header.length == sizeof(I2S_STREAM_STATUS)) {
+                print_status(*(const I2S_STREAM_STATUS *)payload);
+            }
+        });
+        if(!open) {
+            fprintf(stderr, "i2s_stream_tool: %s closed\n", path);
+            break;
+        }
+    }
+    double elapsed = seconds_since(start);
+
+    printf("bench=usb_capture sample_format=%u bit_depth=%u channels=%u frames=%llu seconds=%.2f rx_mbit_s=%.3f lost=%u resync=%u\n",
+        format.sample_format, format.bit_depth, format.channel_count, (unsigned long long)frames, elapsed,
+        endpoint.payload_bytes_in * 8 / elapsed / 1e6, endpoint.get_lost_frame_count(), endpoint.get_resync_count());
+    fclose(file);
+    close(fd);
+    return 0;
+}
+
+static int play(const char *path, const char *file_name) {
+    int fd = STREAM_ENDPOINT::open_path(path);
+    FILE *file = fopen(file_name, "rb");
+    if(fd < 0 || !file) {
+        return 1;
+    }
+
+    STREAM_ENDPOINT endpoint(fd);
+    I2S_STREAM_HEADER format = {};
+    auto handler = [&](const I2S_STREAM_HEADER &header, const uint8_t *payload) {
+        if(header.type == I2S_STREAM_TYPE::RX_DATA) {
+            format = header;
+        } else if(header.type == I2S_STREAM_TYPE::STATUS && header.length == sizeof(I2S_STREAM_STATUS)) {
+            print_status(*(const I2S_STREAM_STATUS *)payload);
+        }
+    };
+
+    // the device drops TX frames of another format, its RX frames tell the one it uses
+    while(format.magic == 0) {
+        if(!endpoint.pump(1000, handler)) {
+            return 1;
+        }
+    }
+
+    uint8_t block[LOOPBACK_FRAME_WORDS * sizeof(int32_t)];
+    uint64_t bytes = 0;
+    size_t len = 1;
+    auto start = std::chrono::steady_clock::now();
+    while(len || endpoint.get_pending()) {
+        if(len && endpoint.get_pending() < MAX_PENDING_BYTES) {
+            len = fread(block, 1, sizeof(block), file) & ~(size_t)3;
+            if(len) {
+                endpoint.queue_frame(I2S_STREAM_TYPE::TX_DATA, block, len, format.sample_format, format.bit_depth, format.channel_count);
+                bytes += len;
+            }
+        }
+        if(!endpoint.pump(100, handler)) {
+            fprintf(stderr, "i2s_stream_tool: %s closed\n", path);
+            break;
+        }
+    }
+    double elapsed = seconds_since(start);
+
+    printf("bench=usb_play bytes=%llu seconds=%.2f tx_mbit_s=%.3f\n", (unsigned long long)bytes, elapsed, bytes * 8 / elapsed / 1e6);
+    fclose(file);
+    close(fd);
+    return 0;
+}
+
+static int set_rate(const char *path, uint32_t sample_rate) {
+    int fd = STREAM_ENDPOINT::open_path(path);
+    if(fd < 0) {
+        return 1;
+    }
+
+    STREAM_ENDPOINT endpoint(fd);
+    endpoint.queue_frame(I2S_STREAM_TYPE::SET_SAMPLE_RATE, &sample_rate, sizeof(sample_rate));
+    while(endpoint.get_pending() && endpoint.pump(1000, [](const I2S_STREAM_HEADER &, const uint8_t *) {})) {
+    }
+    close(fd);
+    return 0;
+}
+
+// ---- loopback ---- //
+
+/// counter words of the loopback, a frame continues where the last one ended
+struct COUNTER_STREAM {
+    uint32_t next_out = 0, next_in = 0;
+    uint64_t errors = 0;
+
+    void fill(uint32_t *words, uint32_t count) {
+        for(uint32_t i=0; i<count; ++i) {
+            words[i] = next_out++;
+        }
+    }
+
+    void check(const uint8_t *payload, uint32_t bytes) {
+        for(uint32_t i=0; i<bytes / 4; ++i) {
+            uint32_t word;
+            memcpy(&word, payload + 4 * i, 4);
+            if(word != next_in) {
+                ++errors;
+            }
+            next_in = word + 1;
+        }
+    }
+};
+
+/// stand-in for usb_stream.cpp: RX frames as fast as the fd takes them, TX frames are checked, a status frame per second
+static void stand_in_device(int fd, COUNTER_STREAM &tx_check, std::atomic<uint64_t> &tx_bytes) {
+    STREAM_ENDPOINT endpoint(fd);
+    COUNTER_STREAM rx;
+    uint32_t words[LOOPBACK_FRAME_WORDS];
+    const uint8_t format = (uint8_t)I2S_SAMPLE_FORMAT::WORD_32;
+    auto last_status = std::chrono::steady_clock::now();
+
+    bool open = true;
+    while(open) {
+        while(endpoint.get_pending() < MAX_PENDING_BYTES) {
+            rx.fill(words, LOOPBACK_FRAME_WORDS);
+            endpoint.queue_frame(I2S_STREAM_TYPE::RX_DATA, words, sizeof(words), format, 32, 2);
+        }
+        if(seconds_since(last_status) >= 1) {
+            last_status = std::chrono::steady_clock::now();
+            I2S_STREAM_STATUS status = {96000, 0, 0, 0};
+            endpoint.queue_frame(I2S_STREAM_TYPE::STATUS, &status, sizeof(status));
+        }
+
+        open = endpoint.pump(100, [&](const I2S_STREAM_HEADER &header, const uint8_t *payload) {
+            if(header.type == I2S_STREAM_TYPE::TX_DATA) {
+                tx_check.check(payload, header.length);
+            }
+        });
+        tx_bytes.store(endpoint.payload_bytes_in, std::memory_order_relaxed);
+    }
+    close(fd);
+}
+
+static int loopback(const char *transport, double seconds) {
+    int device_fd, host_fd;
+    if(strcmp(transport, "pty") == 0) {
+        device_fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if(device_fd < 0 || grantpt(device_fd) || unlockpt(device_fd)) {
+            fprintf(stderr, "i2s_stream_tool: no pty: %s\n", strerror(errno));
+            return 1;
+        }
+        // the host end goes through the same open as /dev/ttyACM0
+        host_fd = STREAM_ENDPOINT::open_path(ptsname(device_fd));
+    } else if(strcmp(transport, "socket") == 0) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+            fprintf(stderr, "i2s_stream_tool: no socket pair: %s\n", strerror(errno));
+            return 1;
+        }
+        device_fd = fds[0];
+        host_fd = fds[1];
+    } else {
+        fprintf(stderr, "i2s_stream_tool: unknown transport %s\n", transport);
+        return 1;
+    }
+    if(host_fd < 0) {
+        return 1;
+    }
+
+    COUNTER_STREAM tx, rx_check;
+    std::atomic<uint64_t> device_payload_bytes_in(0);
+    std::thread device(stand_in_device, device_fd, std::ref(tx), std::ref(device_payload_bytes_in));
+
+    STREAM_ENDPOINT endpoint(host_fd);
+    uint32_t words[LOOPBACK_FRAME_WORDS];
+    uint32_t status_count = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    while(seconds_since(start) < seconds) {
+        while(endpoint.get_pending() < MAX_PENDING_BYTES) {
+            tx.fill(words, LOOPBACK_FRAME_WORDS);
+            endpoint.queue_frame(I2S_STREAM_TYPE::TX_DATA, words, sizeof(words), (uint8_t)I2S_SAMPLE_FORMAT::WORD_32, 32, 2);
+        }
+        endpoint.pump(100, [&](const I2S_STREAM_HEADER &header, const uint8_t *payload) {
+            if(header.type == I2S_STREAM_TYPE::RX_DATA) {
+                rx_check.check(payload, header.length);
+            } else if(header.type == I2S_STREAM_TYPE::STATUS) {
+                ++status_count;
+            }
+        });
+    }
+    double elapsed = seconds_since(start);
+    const uint64_t rx_bytes = endpoint.payload_bytes_in;
+    const uint64_t tx_bytes = device_payload_bytes_in.load(std::memory_order_relaxed);
+
+    // the device sees the end of the stream and stops, its counters are final then
+    close(host_fd);
+    device.join();
+
+    const double rx_mbit_s = rx_bytes * 8 / elapsed / 1e6, tx_mbit_s = tx_bytes * 8 / elapsed / 1e6;
+    printf("bench=usb_loopback transport=%s seconds=%.2f rx_mbit_s=%.1f tx_mbit_s=%.1f required_mbit_s=%.2f status_frames=%u lost=%u resync=%u errors=%llu\n",
+        transport, elapsed, rx_mbit_s, tx_mbit_s, REQUIRED_MBIT_S, status_count,
+        endpoint.get_lost_frame_count(), endpoint.get_resync_count(), (unsigned long long)(rx_check.errors + tx.errors));
+
+    const bool ok = rx_check.errors + tx.errors == 0 && endpoint.get_lost_frame_count() == 0 && endpoint.get_resync_count() == 0
+                    && rx_mbit_s >= REQUIRED_MBIT_S && tx_mbit_s >= REQUIRED_MBIT_S;
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    // a closed peer shows up as EPIPE from write(), see STREAM_ENDPOINT::pump()
+    signal(SIGPIPE, SIG_IGN);
+
+    if(argc >= 5 && strcmp(argv[1], "capture") == 0) {
+        return capture(argv[2], atof(argv[3]), argv[4]);
+    }
+    if(argc >= 4 && strcmp(argv[1], "play") == 0) {
+        return play(argv[2], argv[3]);
+    }
+    if(argc >= 4 && strcmp(argv[1], "rate") == 0) {
+        return set_rate(argv[2], strtoul(argv[3], NULL, 0));
+    }
+    if(argc >= 2 && strcmp(argv[1], "loopback") == 0) {
+        return loopback(argc >= 3 ? argv[2] : "pty", argc >= 4 ? atof(argv[3]) : 2);
+    }
+
+    fprintf(stderr,
+        "usage: i2s_stream_tool capture <tty> <seconds> <rx.raw>\n"
+        "       i2s_stream_tool play <tty> <tx.raw>\n"
+        "       i2s_stream_tool rate <tty> <Hz>\n"
+        "       i2s_stream_tool loopback [pty|socket] [seconds]\n");
+    return 2;
+}
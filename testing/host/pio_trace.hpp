@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <initializer_list>
+#include <vector>
+
+#include "i2s_hal.hpp"
+
+/**
+ * @brief logic analyzer on the virtual clock of i2s_hal_host.hpp
+ * Records every level change of a few GPIOs, e.g. BCLK, LRCK and SDATA, from a step hook.
+ * Times are in 1/256 system clock cycles like i2s_host.now, so fractional dividers show up exactly.
+ * The trace can be written as VCD for GTKWave or PulseView.
+ */
+class PIO_TRACE {
+public:
+    struct SIGNAL {
+        const char *name;
+        uint pin;
+    };
+
+    struct EDGE {
+        uint64_t time;
+        bool level; // level after the edge
+    };
+
+private:
+    std::vector<SIGNAL> signals;
+    std::vector<bool> initial_levels;
+    std::vector<std::vector<EDGE>> edges;
+    uint64_t start_time;
+
+    static void step_hook(void *context) {
+        PIO_TRACE &trace = *(PIO_TRACE *)context;
+        for(size_t s=0; s<trace.signals.size(); ++s) {
+            const bool level = i2s_host_gpio_get(trace.signals[s].pin);
+            if(level != trace.level(s))
+                trace.edges[s].push_back({i2s_host.now, level});
+        }
+    }
+
+public:
+    /// starts recording, the levels right now are the initial levels
+    PIO_TRACE(std::initializer_list<SIGNAL> _signals) : signals(_signals), edges(signals.size()) {
+        clear();
+        i2s_host_add_step_hook(step_hook, this);
+    }
+
+    ~PIO_TRACE() {
+        i2s_host_remove_step_hook(step_hook, this);
+    }
+
+    PIO_TRACE(const PIO_TRACE &) = delete;
+    PIO_TRACE &operator=(const PIO_TRACE &) = delete;
+
+    /// drop the recorded edges, the levels right now become the initial levels
+    void clear() {
+        start_time = i2s_host.now;
+        initial_levels.clear();
+        for(const SIGNAL &signal : signals)
+            initial_levels.push_back(i2s_host_gpio_get(signal.pin));
+        for(auto &signal_edges : edges)
+            signal_edges.clear();
+    }
+
+    /// current level of a signal (index in the constructor list)
+    bool level(size_t signal) const {
+        return edges[signal].empty() ? initial_levels[signal] : edges[signal].back().level;
+    }
+
+    /// level of a signal after all edges up to and including time
+    bool level_at(size_t signal, uint64_t time) const {
+        bool result = initial_levels[signal];
+        for(const EDGE &edge : edges[signal]) {
+            if(edge.time > time)
+                break;
+            result = edge.level;
+        }
+        return result;
+    }
+
+    const std::vector<EDGE> &get_edges(size_t signal) const { return edges[signal]; }
+
+    /// times of the rising or falling edges of a signal
+    std::vector<uint64_t> edge_times(size_t signal, bool rising) const {
+        std::vector<uint64_t> times;
+        for(const EDGE &edge : edges[signal])
+            if(edge.level == rising)
+                times.push_back(edge.time);
+        return times;
+    }
+
+    uint64_t get_start_time() const { return start_time; }
+
+    /**
+     * @brief write the trace as Value Change Dump
+     * @param sys_clock_hz converts the virtual time to the 1 ps timescale of the file
+     * @return false if the file can not be written
+     */
+    bool write_vcd(const char *path, uint32_t sys_clock_hz = i2s_host.sys_clock_hz) const {
+        FILE *file = fopen(path, "w");
+        if(!file)
+            return false;
+
+        fprintf(file, "$timescale 1 ps $end\n$scope module pio $end\n");
+        for(size_t s=0; s<signals.size(); ++s)
+            fprintf(file, "$var wire 1 %c %s $end\n", (char)('!' + s), signals[s].name);
+        fprintf(file, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+        for(size_t s=0; s<signals.size(); ++s)
+            fprintf(file, "%d%c\n", (int)initial_levels[s], (char)('!' + s));
+        fprintf(file, "$end\n");
+
+        // merge the edges of all signals in time order
+        std::vector<size_t> next(signals.size(), 0);
+        while(true) {
+            uint64_t time = UINT64_MAX;
+            for(size_t s=0; s<signals.size(); ++s)
+                if(next[s] < edges[s].size() && edges[s][next[s]].time < time)
+                    time = edges[s][next[s]].time;
+            if(time == UINT64_MAX)
+                break;
+
+            fprintf(file, "#%llu\n", (unsigned long long)((time - start_time) * (1e12 / 256) / sys_clock_hz));
+            for(size_t s=0; s<signals.size(); ++s)
+                while(next[s] < edges[s].size() && edges[s][next[s]].time == time)
+                    fprintf(file, "%d%c\n", (int)edges[s][next[s]++].level, (char)('!' + s));
+        }
+        return fclose(file) == 0;
+    }
+};
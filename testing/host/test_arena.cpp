@@ -0,0 +1,139 @@
+// I2S_BUFFER_ARENA: the allocator, every controller buffer inside an arena of the documented size, the heap fallback of a full arena
+#include <vector>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+
+#define RING_LOG2 9
+#define PATTERN_SIZE 64
+
+// alignment, running full, owns(), reset() and the address of a bank arena
+static void test_allocator() {
+    static int32_t storage[16];
+    I2S_BUFFER_ARENA arena(storage, sizeof(storage));
+
+    const uint8_t *a = (const uint8_t *)arena.allocate(3, 1);
+    const uint8_t *b = (const uint8_t *)arena.allocate(8, 16);
+    CHECK(a == (const uint8_t *)storage && ((uintptr_t)b & 15) == 0 && b >= a + 3 && arena.owns(b) && arena.get_used() == (size_t)(b + 8 - a));
+    CHECK(arena.allocate(sizeof(storage)) == NULL);
+    CHECK(!arena.owns(storage + 16) && !arena.owns((const void *)((uintptr_t)storage - 1)));
+
+    arena.reset();
+    CHECK(arena.get_used() == 0 && arena.allocate(sizeof(storage)) == storage && arena.allocate(0) == storage + 16);
+
+    // offset 0x100 of bank 2 through the non-striped alias
+    I2S_BUFFER_ARENA bank = i2s_sram_bank_arena(2, 0x100, 0x400);
+    CHECK((uintptr_t)bank.allocate(4) == 0x21020100 && bank.get_size() == 0x400);
+}
+
+// objects of i2s_create() get destroyed in the arena and deleted on the heap
+static int live_objects = 0;
+
+struct OBJECT {
+    int64_t value;
+    OBJECT(int64_t _value) : value(_value) { ++live_objects; }
+    ~OBJECT() { --live_objects; }
+};
+
+static void test_create() {
+    static int32_t storage[i2s_object_words<OBJECT>()];
+    I2S_BUFFER_ARENA arena(storage, sizeof(storage));
+
+    OBJECT *in_arena = i2s_create<OBJECT>(&arena, 5);
+    arena.allocate(arena.get_size() - arena.get_used(), 1);
+    OBJECT *on_heap = i2s_create<OBJECT>(&arena, 7);
+    CHECK(arena.owns(in_arena) && ((uintptr_t)in_arena % alignof(OBJECT)) == 0 && !arena.owns(on_heap));
+    CHECK(in_arena->value == 5 && on_heap->value == 7 && live_objects == 2);
+    i2s_destroy(&arena, in_arena);
+    i2s_destroy(&arena, on_heap);
+    CHECK(live_objects == 0);
+
+    int32_t *words = i2s_allocate_words(&arena, 4);
+    CHECK(!arena.owns(words));
+    i2s_free_words(&arena, words);
+}
+
+/**
+ * A TX stream with drift compensation and an RX controller in arenas of the documented size:
+ * every buffer and object lands in its arena and a streamed counter and the RX data come through.
+ * With half the size the rest comes from the heap and nothing else changes.
+ */
+static void test_controller(bool full_size) {
+    const uint tx_words = i2s_controller_storage_words(I2S_CONTROLLER_MODE::TX, 32, PATTERN_SIZE) + i2s_tx_stream_storage_words(RING_LOG2);
+    const uint rx_words = I2S_STATIC_CONTROLLER<I2S_CONTROLLER_MODE::RX, 32>::storage_words(PATTERN_SIZE);
+    CHECK(rx_words == i2s_controller_storage_words(I2S_CONTROLLER_MODE::RX, 32, PATTERN_SIZE));
+
+    std::vector<int32_t> tx_storage(full_size ? tx_words : tx_words / 2), rx_storage(full_size ? rx_words : rx_words / 2);
+    I2S_BUFFER_ARENA tx_arena(tx_storage.data(), tx_storage.size() * sizeof(int32_t));
+    I2S_BUFFER_ARENA rx_arena(rx_storage.data(), rx_storage.size() * sizeof(int32_t));
+    {
+        I2S_CONTROLLER tx(PATTERN_SIZE, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0, -1, -1, 4, 1, 8, &tx_arena);
+        tx.set_pio_divider(4 << 8);
+        tx.enable_tx_streaming(RING_LOG2, 64);
+        tx.enable_drift_compensation();
+
+        I2S_CONTROLLER rx(PATTERN_SIZE, PIN_DATA + 1, PIN_CLOCK_BASE + 3, I2S_CONTROLLER_MODE::RX, 32, pio1, -1, -1, 4, 1, 8, &rx_arena);
+        rx.set_pio_divider(4 << 8);
+
+        uint pattern_len;
+        uint32_t ring_len;
+        const int32_t *pattern = tx.pattern_buffer.get_next_buffer(pattern_len);
+        const int32_t *ring = tx.tx_stream->get_write_region(ring_len);
+        const bool tx_placed = tx_arena.owns(pattern) && tx_arena.owns(tx.tx_stream) && tx_arena.owns(ring) && tx_arena.owns(tx.drift);
+        printf("controller: full_size=%d tx used=%zu of %zu placed=%d\n", full_size, tx_arena.get_used(), tx_arena.get_size(), tx_placed);
+        CHECK(tx_placed == full_size && tx_arena.get_used() <= tx_arena.get_size());
+        CHECK(full_size || tx_arena.get_used() > 0);
+
+        // RX samples a quiet pin of its own, the TX stream is checked in the FIFO words
+        int32_t counter = 0;
+        auto fill = [&]() {
+            while(tx.tx_stream->free_space()) {
+                tx.tx_stream->write(&counter, 1);
+                ++counter;
+            }
+        };
+        fill();
+        i2s_host_take_tx_words(pio0, 0);
+        tx.start_i2s();
+        rx.start_i2s();
+
+        uint rx_buffers = 0, rx_outside = 0;
+        for(uint i=0; i<100; ++i) {
+            sleep_us(50);
+            fill();
+            const int32_t *buffer;
+            uint32_t len;
+            while((buffer = rx.rx_queue.peek(len))) {
+                ++rx_buffers;
+                rx_outside += !rx_arena.owns(buffer) || !rx_arena.owns(buffer + len - 1);
+                rx.rx_queue.release();
+            }
+        }
+
+        const std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, 0);
+        size_t matching = 0;
+        while(matching < words.size() && words[matching] == matching)
+            ++matching;
+        printf("controller: full_size=%d words=%zu matching=%zu underruns=%u rx_buffers=%u rx_outside=%u rx used=%zu of %zu\n", full_size, words.size(),
+               matching, tx.tx_stream->get_underrun_count(), rx_buffers, rx_outside, rx_arena.get_used(), rx_arena.get_size());
+        CHECK(words.size() > 1000 && matching == words.size() && tx.tx_stream->get_underrun_count() == 0);
+        CHECK(rx_buffers > 10 && rx.rx_queue.get_overrun_count() == 0);
+        CHECK(full_size ? rx_outside == 0 && rx_arena.get_used() == rx_arena.get_size() : rx_outside == rx_buffers);
+    }
+
+    // the controllers are gone, the arenas can be used again
+    tx_arena.reset();
+    rx_arena.reset();
+    CHECK(tx_arena.get_used() == 0 && rx_arena.get_used() == 0);
+}
+
+int main() {
+    test_allocator();
+    test_create();
+    test_controller(true);
+    test_controller(false);
+    return host_test_result();
+}
@@ -0,0 +1,219 @@
+// AWG sequences: compiling segment lists, and the transitions of the DMA IRQ between loop passes, a pending sequence,
+// the end of a sequence, stop_sequence() and the pattern buffer, word for word on the TX FIFO
+#include <vector>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+
+#define PATTERN_WORD 0x7777u
+
+// read in place like a const array in flash
+static const int32_t seg_a[8] = {0x0A000000, 0x0A000001, 0x0A000002, 0x0A000003, 0x0A000004, 0x0A000005, 0x0A000006, 0x0A000007};
+static int32_t seg_b[12], seg_c[4], seg_d[6];
+
+// A x3, then B x2 and C in a loop: a lead of 24 words and 28 words per pass
+static const I2S_AWG_SEGMENT looping[] = {
+    {seg_a, 4, 3, 1},
+    {seg_b, 6, 2, 2},
+    {seg_c, 2, 1, 1},
+};
+static const uint LEAD_WORDS = 24, PASS_WORDS = 28;
+
+// D x5 and the end
+static const I2S_AWG_SEGMENT ending[] = {{seg_d, 3, 5, -1}};
+
+static void append(std::vector<uint32_t> &words, const int32_t *samples, uint count, uint repeat) {
+    for(uint r=0; r<repeat; ++r)
+        words.insert(words.end(), samples, samples + count);
+}
+
+// the words of looping[] from the start, at least count of them
+static std::vector<uint32_t> looping_words(size_t count) {
+    std::vector<uint32_t> words;
+    append(words, seg_a, 8, 3);
+    while(words.size() < count) {
+        append(words, seg_b, 12, 2);
+        append(words, seg_c, 4, 1);
+    }
+    return words;
+}
+
+// words of PATTERN_WORD from i on, i is left after them
+static size_t skip_pattern(const std::vector<uint32_t> &words, size_t &i) {
+    const size_t start = i;
+    while(i < words.size() && words[i] == PATTERN_WORD)
+        ++i;
+    return i - start;
+}
+
+static bool tx_stalled() {
+    return pio0->fdebug & (1u << PIO_FDEBUG_TXSTALL_LSB);
+}
+
+// control blocks, lead and loop of segment lists, the lengths the format allows, running out of blocks
+static void test_compile() {
+    I2S_AWG_SEQUENCE sequence(16);
+    CHECK(sequence.compile(looping, 3, I2S_SAMPLE_FORMAT::WORD_32, 32, false, 2));
+    const I2S_DMA_CONTROL_BLOCK *blocks = sequence.get_blocks();
+    const int32_t *order[] = {seg_a, seg_a, seg_a, seg_b, seg_b, seg_c};
+    CHECK(sequence.get_block_count() == 7 && sequence.get_loop() == blocks + 3);
+    for(uint b=0; b<6; ++b)
+        CHECK(blocks[b].read_addr == order[b] && blocks[b].transfer_count == (b < 3 ? 8u : b < 5 ? 12u : 4u));
+    CHECK(blocks[6].read_addr == NULL && blocks[6].transfer_count == 0);
+    CHECK(sequence.get_lead_frames() == 12 && sequence.get_loop_frames() == 14);
+
+    // no loop: every frame is lead
+    CHECK(sequence.compile(ending, 1, I2S_SAMPLE_FORMAT::WORD_32, 32, false, 2));
+    CHECK(sequence.get_block_count() == 6 && sequence.get_loop() == NULL && sequence.get_lead_frames() == 15 && sequence.get_loop_frames() == 0);
+
+    // a loop back to the first segment has no lead
+    const I2S_AWG_SEGMENT circle[] = {{seg_b, 2, 1, 1}, {seg_c, 2, 2, 0}};
+    CHECK(sequence.compile(circle, 2, I2S_SAMPLE_FORMAT::WORD_32, 32, false, 2));
+    CHECK(sequence.get_loop() == sequence.get_blocks() && sequence.get_lead_frames() == 0 && sequence.get_loop_frames() == 6);
+
+    // PACKED_24 moves units of two frames in three words, TX_MONO one word per frame
+    const I2S_AWG_SEGMENT packed[] = {{seg_b, 4, 1, -1}};
+    CHECK(sequence.compile(packed, 1, I2S_SAMPLE_FORMAT::PACKED_24, 24, false, 2) && sequence.get_blocks()[0].transfer_count == 6);
+    const I2S_AWG_SEGMENT odd[] = {{seg_b, 3, 1, -1}};
+    CHECK(!sequence.compile(odd, 1, I2S_SAMPLE_FORMAT::PACKED_24, 24, false, 2) && sequence.get_blocks() == NULL);
+    CHECK(sequence.compile(odd, 1, I2S_SAMPLE_FORMAT::WORD_32, 32, true, 2) && sequence.get_blocks()[0].transfer_count == 3);
+
+    // invalid segments and too many plays leave the sequence empty
+    const I2S_AWG_SEGMENT no_repeat[] = {{seg_b, 2, 0, -1}};
+    const I2S_AWG_SEGMENT bad_next[] = {{seg_b, 2, 1, 1}};
+    const I2S_AWG_SEGMENT many[] = {{seg_b, 2, 16, -1}};
+    CHECK(!sequence.compile(no_repeat, 1, I2S_SAMPLE_FORMAT::WORD_32, 32, false, 2));
+    CHECK(!sequence.compile(bad_next, 1, I2S_SAMPLE_FORMAT::WORD_32, 32, false, 2));
+    CHECK(!sequence.compile(many, 1, I2S_SAMPLE_FORMAT::WORD_32, 32, false, 2) && sequence.get_block_count() == 0);
+    CHECK(!sequence.compile(looping, 0, I2S_SAMPLE_FORMAT::WORD_32, 32, false, 2));
+}
+
+/**
+ * The IRQ transitions of one controller in a row: a looping sequence from the start, its passes counted,
+ * a pending sequence taking over at the end of a pass, the pattern again after a sequence ends,
+ * and stop_sequence() ending a loop after its pass. No word is lost or repeated and the FIFO never runs dry.
+ */
+static void test_transitions() {
+    I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+    I2S_AWG_SEQUENCE sequence(16), other(16);
+    i2s.set_pio_divider(0x400);
+    i2s.set_pattern(PATTERN_BUFFER::PATTERN::CONST, PATTERN_WORD, 0, 8);
+    CHECK(i2s.play_sequence(sequence, looping, 3));
+    CHECK(!i2s.play_sequence(sequence, looping, 3)); // the playing sequence is not compiled again
+    CHECK(i2s.is_sequence_playing());
+
+    // the loop with its passes
+    i2s_host_take_tx_words(pio0, 0);
+    pio0->fdebug = 0xFFFFFFFF;
+    i2s.start_i2s();
+    sleep_ms(2);
+    const uint32_t passes = i2s.get_sequence_pass_count();
+    std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, 0);
+    const std::vector<uint32_t> expected = looping_words(words.size() + 64);
+    size_t played = 0;
+    while(played < words.size() && words[played] == expected[played])
+        ++played;
+    const size_t full_passes = (words.size() - LEAD_WORDS) / PASS_WORDS;
+    printf("loop: words=%zu matching=%zu passes=%u full_passes=%zu\n", words.size(), played, passes, full_passes);
+    CHECK(played == words.size() && words.size() > 900);
+    CHECK(passes == full_passes || passes == full_passes + 1);
+
+    // a pending sequence follows the end of the pass, then the pattern the end of the sequence
+    CHECK(i2s.play_sequence(other, ending, 1));
+    sleep_ms(1);
+    CHECK(!i2s.is_sequence_playing() && i2s.get_sequence_pass_count() == 1);
+    words = i2s_host_take_tx_words(pio0, 0);
+    size_t i = 0;
+    while(i < words.size() && words[i] == expected[played]) {
+        ++i;
+        ++played;
+    }
+    const bool pass_end = (played - LEAD_WORDS) % PASS_WORDS == 0;
+    size_t d = 0;
+    while(i < words.size() && d < 30 && words[i] == (uint32_t)seg_d[d % 6]) {
+        ++i;
+        ++d;
+    }
+    const size_t pattern_words = skip_pattern(words, i);
+    printf("pending: pass_end=%d d_words=%zu pattern_words=%zu rest=%zu\n", pass_end, d, pattern_words, words.size() - i);
+    CHECK(pass_end && d == 30 && pattern_words > 100 && i == words.size());
+
+    // the pattern until its period ends, the loop again, stopped at the end of a pass, the pattern again
+    CHECK(i2s.play_sequence(sequence, looping, 3));
+    sleep_ms(1);
+    i2s.stop_sequence();
+    sleep_ms(1);
+    CHECK(!i2s.is_sequence_playing());
+    words = i2s_host_take_tx_words(pio0, 0);
+    i = 0;
+    const size_t pattern_before = skip_pattern(words, i);
+    const std::vector<uint32_t> restarted = looping_words(words.size());
+    size_t k = 0;
+    while(i < words.size() && words[i] == restarted[k]) {
+        ++i;
+        ++k;
+    }
+    const size_t pattern_after = skip_pattern(words, i);
+    printf("stop: pattern_before=%zu sequence_words=%zu pattern_after=%zu rest=%zu\n", pattern_before, k, pattern_after, words.size() - i);
+    CHECK(pattern_before > 0 && (pattern_words + pattern_before) % 16 == 0); // whole periods of 8 frames since the pattern came back
+    CHECK(k > LEAD_WORDS && (k - LEAD_WORDS) % PASS_WORDS == 0 && pattern_after > 100 && i == words.size());
+    CHECK(!tx_stalled());
+}
+
+// PACKED_24 plays the segment words byte swapped, TX_MONO one word per frame, both looping from the start
+static void test_formats() {
+    {
+        I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 24, pio0);
+        I2S_AWG_SEQUENCE sequence(8);
+        const I2S_AWG_SEGMENT odd[] = {{seg_b, 3, 1, -1}};
+        CHECK(!i2s.play_sequence(sequence, odd, 1));
+        const I2S_AWG_SEGMENT packed[] = {{seg_b, 4, 2, 0}}; // 4 frames in 6 words
+        i2s.set_pio_divider(0x400);
+        CHECK(i2s.play_sequence(sequence, packed, 1));
+        i2s_host_take_tx_words(pio0, 0);
+        pio0->fdebug = 0xFFFFFFFF;
+        i2s.start_i2s();
+        sleep_ms(1);
+        const std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, 0);
+        size_t matching = 0;
+        for(size_t t=0; t<words.size(); ++t)
+            matching += words[t] == __builtin_bswap32((uint32_t)seg_b[t % 6]);
+        printf("packed_24: words=%zu matching=%zu passes=%u\n", words.size(), matching, i2s.get_sequence_pass_count());
+        CHECK(matching == words.size() && words.size() > 400 && !tx_stalled());
+    }
+    {
+        I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX_MONO, 16, pio0);
+        I2S_AWG_SEQUENCE sequence(8);
+        const I2S_AWG_SEGMENT mono[] = {{seg_c, 1, 3, 1}, {seg_d, 2, 1, 0}};
+        i2s.set_pio_divider(0x400);
+        CHECK(i2s.play_sequence(sequence, mono, 2));
+        i2s_host_take_tx_words(pio0, 0);
+        pio0->fdebug = 0xFFFFFFFF;
+        i2s.start_i2s();
+        sleep_ms(1);
+        const std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, 0);
+        const uint32_t pass[5] = {(uint32_t)seg_c[0], (uint32_t)seg_c[0], (uint32_t)seg_c[0], (uint32_t)seg_d[0], (uint32_t)seg_d[1]};
+        size_t matching = 0;
+        for(size_t w=0; w<words.size(); ++w)
+            matching += words[w] == pass[w % 5];
+        printf("mono: words=%zu matching=%zu\n", words.size(), matching);
+        CHECK(matching == words.size() && words.size() > 100 && !tx_stalled());
+    }
+}
+
+int main() {
+    for(int i=0; i<12; ++i)
+        seg_b[i] = 0x0B000000 + i;
+    for(int i=0; i<4; ++i)
+        seg_c[i] = 0x0C000000 + i;
+    for(int i=0; i<6; ++i)
+        seg_d[i] = 0x0D000000 + i;
+
+    test_compile();
+    test_transitions();
+    test_formats();
+    return host_test_result();
+}
@@ -0,0 +1,109 @@
+// Sample rate solver: the standard rate table, the error tolerance and system clock range, set_sample_rate() on the controller
+#include <math.h>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+
+static const uint32_t RATES_8K[] = {8000, 16000, 32000, 48000, 96000};
+static const uint32_t RATES_44K1[] = {22050, 44100, 88200};
+
+// the PLL and divider fields describe the reported rate, within the limits of the hardware
+static bool consistent(const I2S_CLOCK_SETTINGS &s, uint32_t sample_rate, uint32_t cycles_per_frame) {
+    const double sys_clock = (double)s.vco_hz / (s.postdiv1 * s.postdiv2);
+    const double rate = sys_clock / s.pio_divider / cycles_per_frame;
+    return s.valid && s.vco_hz >= I2S_CLOCK_VCO_MIN_HZ && s.vco_hz <= I2S_CLOCK_VCO_MAX_HZ && s.vco_hz % I2S_CLOCK_XOSC_HZ == 0
+        && s.postdiv1 <= I2S_CLOCK_POSTDIV_MAX && s.postdiv2 <= s.postdiv1 && s.sys_clock_hz == (uint32_t)sys_clock
+        && fabs(rate - s.sample_rate) < 1e-6 && fabs((rate / sample_rate - 1) * 1e6 - s.error_ppm) < 1e-6;
+}
+
+// 16 bit TX, 32 bit TX and 32 bit TRX: 64, 128 and 256 PIO cycles per frame
+static void test_standard_rates() {
+    for(uint32_t cycles_per_frame : {64u, 128u, 256u}) {
+        for(uint32_t rate : RATES_8K) {
+            const I2S_CLOCK_SETTINGS s = i2s_solve_clock(rate, cycles_per_frame);
+            printf("rate=%u cycles_per_frame=%u sys_clock=%u divider=%u error_ppm=%.3f\n", rate, cycles_per_frame, s.sys_clock_hz, s.pio_divider, s.error_ppm);
+            CHECK(consistent(s, rate, cycles_per_frame));
+            CHECK(s.sys_clock_hz <= I2S_CLOCK_SYS_MAX_HZ);
+            // 256 cycles per frame at 32 and 96 kHz only get close
+            if(cycles_per_frame * rate <= 128 * 96000 && !(cycles_per_frame == 256 && rate == 32000))
+                CHECK(s.error_ppm == 0);
+        }
+        for(uint32_t rate : RATES_44K1) {
+            const I2S_CLOCK_SETTINGS s = i2s_solve_clock(rate, cycles_per_frame);
+            printf("rate=%u cycles_per_frame=%u sys_clock=%u divider=%u error_ppm=%.3f\n", rate, cycles_per_frame, s.sys_clock_hz, s.pio_divider, s.error_ppm);
+            CHECK(consistent(s, rate, cycles_per_frame));
+            if(cycles_per_frame * rate <= 256 * 44100)
+                CHECK(fabs(s.error_ppm) < 63.5);
+        }
+    }
+
+    // the case of the header comment: exact 48 kHz with 32 bit TX drops the system clock to 61.44 MHz
+    CHECK(i2s_solve_clock(48000, 128).sys_clock_hz == 61440000);
+
+    // with MCLK the divider also has to give whole MCLK periods
+    for(uint32_t multiple : {256u, 384u}) {
+        const I2S_CLOCK_SETTINGS s = i2s_solve_clock(48000, 128, multiple);
+        uint32_t pio_divider, period;
+        CHECK(consistent(s, 48000, 128) && s.mclk_divider * multiple == s.pio_divider * 128 && i2s_mclk_split(s.mclk_divider, pio_divider, period));
+    }
+}
+
+// a tolerance picks the highest system clock within it, never a larger error than allowed if anything fits
+static void test_tolerance() {
+    for(uint32_t cycles_per_frame : {64u, 128u, 256u}) {
+        for(uint32_t rate : {8000u, 16000u, 32000u, 44100u, 48000u, 96000u}) {
+            const I2S_CLOCK_SETTINGS exact = i2s_solve_clock(rate, cycles_per_frame);
+            for(double tolerance : {10., 50., 200.}) {
+                const I2S_CLOCK_SETTINGS s = i2s_solve_clock(rate, cycles_per_frame, 0, 1, I2S_CLOCK_SYS_MAX_HZ, 0, tolerance);
+                CHECK(consistent(s, rate, cycles_per_frame));
+                if(fabs(exact.error_ppm) <= tolerance)
+                    CHECK(fabs(s.error_ppm) <= tolerance && s.sys_clock_hz >= exact.sys_clock_hz);
+                else
+                    CHECK(fabs(s.error_ppm) == fabs(exact.error_ppm));
+            }
+        }
+    }
+
+    const I2S_CLOCK_SETTINGS fast = i2s_solve_clock(48000, 128, 0, 1, I2S_CLOCK_SYS_MAX_HZ, 0, 200);
+    printf("tolerance: rate=48000 cycles_per_frame=128 sys_clock=%u error_ppm=%.3f\n", fast.sys_clock_hz, fast.error_ppm);
+    CHECK(fast.sys_clock_hz > 100000000 && fabs(fast.error_ppm) <= 200);
+
+    // the system clock range is kept even when the best error lies outside
+    const I2S_CLOCK_SETTINGS ranged = i2s_solve_clock(48000, 128, 0, 1, 125000000, 100000000);
+    CHECK(consistent(ranged, 48000, 128) && ranged.sys_clock_hz >= 100000000 && ranged.sys_clock_hz <= 125000000);
+    CHECK(!i2s_solve_clock(48000, 128, 0, 1, 1000000, 0).valid);
+}
+
+/**
+ * set_sample_rate() on two controllers: the first one sets the system clock, the second one only its divider.
+ * Changing the system clock again changes the rate of a controller whose divider was not recomputed.
+ */
+static void test_controllers() {
+    I2S_CONTROLLER first(16, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+    I2S_CONTROLLER second(16, 10, 2, I2S_CONTROLLER_MODE::TX, 16, pio0);
+
+    const I2S_CLOCK_SETTINGS s = first.set_sample_rate(48000, true, 200);
+    CHECK(s.valid && i2s_host.sys_clock_hz == s.sys_clock_hz && fabs(first.get_sample_rate() - s.sample_rate) < 0.01);
+
+    const I2S_CLOCK_SETTINGS t = second.set_sample_rate(32000, false);
+    printf("controllers: sys_clock=%u first=%.3f second=%.3f (%.3f ppm)\n", i2s_host.sys_clock_hz, first.get_sample_rate(), second.get_sample_rate(), t.error_ppm);
+    CHECK(t.valid && t.sys_clock_hz == s.sys_clock_hz && fabs(second.get_sample_rate() - t.sample_rate) < 0.01);
+
+    const double before = second.get_sample_rate();
+    first.set_sample_rate(48000);
+    CHECK(fabs(second.get_sample_rate() / before - (double)i2s_host.sys_clock_hz / s.sys_clock_hz) < 1e-6);
+
+    // nothing fits: nothing changes
+    const uint32_t sys_clock = i2s_host.sys_clock_hz;
+    CHECK(!first.set_sample_rate(48000, true, 0, 1000000, 2000000).valid && i2s_host.sys_clock_hz == sys_clock);
+}
+
+int main() {
+    test_standard_rates();
+    test_tolerance();
+    test_controllers();
+    return host_test_result();
+}
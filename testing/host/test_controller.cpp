@@ -0,0 +1,188 @@
+// End to end tests of I2S_CONTROLLER on the host model: pattern playback, ring streaming, the RX queue and TRX loopback
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+
+// TX FIFO words of a pattern buffer, the DMA swaps the bytes of PACKED_24 words to bit stream order
+static uint32_t pattern_word(I2S_SAMPLE_FORMAT format, const int32_t *buffer, uint buffer_len, size_t index) {
+    const uint32_t word = buffer[index % buffer_len];
+    return format == I2S_SAMPLE_FORMAT::PACKED_24 ? __builtin_bswap32(word) : word;
+}
+
+// the pattern repeats on the pins at the sample rate, without TX stalls
+static void test_pattern(I2S_CONTROLLER_MODE mode, uint bit_depth, uint tdm_slots = 8) {
+    I2S_CONTROLLER i2s(256, PIN_DATA, PIN_CLOCK_BASE, mode, bit_depth, pio0, -1, -1, 4, 1, tdm_slots);
+    i2s.set_pio_divider(0x200);
+    i2s.set_pattern(PATTERN_BUFFER::PATTERN::SINE, 0, 0x10000000, 64);
+    i2s.start_i2s();
+    sleep_ms(5);
+
+    uint len;
+    const int32_t *buffer = i2s.pattern_buffer.get_next_buffer(len);
+    const std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, 0);
+    size_t matching = 0;
+    for(size_t i=0; i<words.size(); ++i)
+        matching += words[i] == pattern_word(i2s.get_sample_format(), buffer, len, i);
+
+    const double words_per_frame = mode == I2S_CONTROLLER_MODE::TX_MONO ? 1 :
+        i2s_frame_bits(i2s.get_sample_format(), bit_depth, i2s.get_channel_count()) / 32.;
+    const double expected = i2s.get_sample_rate() * 0.005 * words_per_frame;
+    printf("pattern mode=%d bit_depth=%u words=%zu expected=%.0f matching=%zu\n", (int)mode, bit_depth, words.size(), expected, matching);
+    CHECK(!words.empty() && matching == words.size());
+    CHECK(words.size() > expected * 0.98 && words.size() < expected * 1.02 + 8);
+    CHECK(!((pio0->fdebug >> PIO_FDEBUG_TXSTALL_LSB) & 1));
+}
+
+// a new pattern starts at a buffer boundary, after the old one
+static void test_pattern_update() {
+    I2S_CONTROLLER i2s(256, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+    i2s.set_pio_divider(0x200);
+    i2s.set_pattern(PATTERN_BUFFER::PATTERN::CONST, 5, 0, 16);
+    i2s.start_i2s();
+    sleep_ms(1);
+    i2s.set_pattern(PATTERN_BUFFER::PATTERN::CONST, 7, 0, 16);
+    while(!i2s.is_pattern_update_done())
+        tight_loop_contents();
+    sleep_ms(1);
+
+    size_t fives = 0, sevens = 0, other = 0;
+    bool in_order = true;
+    for(uint32_t word : i2s_host_take_tx_words(pio0, 0)) {
+        if(word == 5) {
+            ++fives;
+            in_order &= sevens == 0;
+        } else if(word == 7) {
+            ++sevens;
+        } else {
+            ++other;
+        }
+    }
+    printf("pattern update: old=%zu new=%zu other=%zu\n", fives, sevens, other);
+    CHECK(other == 0 && in_order);
+    CHECK(fives > 0 && sevens > 0 && fives % 32 == 0);
+}
+
+// a counter written to the ring comes out unchanged, without underruns
+static void test_streaming() {
+    I2S_CONTROLLER i2s(256, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+    i2s.set_pio_divider(0x400);
+    i2s.enable_tx_streaming(10, 64);
+
+    int32_t counter = 0;
+    auto fill = [&]() {
+        while(i2s.tx_stream->free_space() >= 2) {
+            const int32_t frame[2] = {counter, counter};
+            ++counter;
+            i2s.tx_stream->write(frame, 2);
+        }
+    };
+    fill();
+    i2s.start_i2s();
+    for(int i=0; i<200; ++i) {
+        sleep_us(50);
+        fill();
+    }
+
+    const std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, 0);
+    size_t matching = 0;
+    while(matching < words.size() && words[matching] == matching / 2)
+        ++matching;
+    printf("streaming: words=%zu matching=%zu underruns=%u\n", words.size(), matching, i2s.tx_stream->get_underrun_count());
+    CHECK(words.size() > 1000 && matching == words.size());
+    CHECK(i2s.tx_stream->get_underrun_count() == 0);
+}
+
+// RX buffers arrive at the sample rate, a consumer that does not release them gets overruns instead of stale data
+static void test_rx_queue(uint bit_depth) {
+    i2s_host_gpio_put(PIN_DATA, true);
+    I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::RX, bit_depth, pio0, -1, -1, 4);
+    i2s.set_pio_divider(0x400);
+    i2s.start_i2s();
+
+    const uint32_t ones = i2s.get_sample_format() == I2S_SAMPLE_FORMAT::WORD_32 && bit_depth < 32 ? (1u << bit_depth) - 1 : 0xFFFFFFFFu;
+    uint buffers = 0, bad = 0;
+    for(int i=0; i<100; ++i) {
+        sleep_us(100);
+        const int32_t *buffer;
+        uint32_t len;
+        while((buffer = i2s.rx_queue.peek(len))) {
+            for(uint32_t w=0; w<len; ++w)
+                bad += (uint32_t)buffer[w] != ones;
+            ++buffers;
+            i2s.rx_queue.release();
+        }
+    }
+    const double expected = i2s.get_sample_rate() * 0.01 / 64;
+    printf("rx queue: bit_depth=%u buffers=%u expected=%.1f bad=%u overruns=%u\n", bit_depth, buffers, expected, bad, i2s.rx_queue.get_overrun_count());
+    CHECK(bad == 0 && i2s.rx_queue.get_overrun_count() == 0);
+    CHECK(buffers + 1 >= expected && buffers <= expected + 1);
+
+    // stop consuming
+    sleep_ms(5);
+    CHECK(i2s.rx_queue.available() == i2s.rx_queue.get_buffer_count() - 1);
+    CHECK(i2s.rx_queue.get_overrun_count() > 0);
+    CHECK(!(pio0->fdebug & (1u << PIO_FDEBUG_RXSTALL_LSB)));
+    i2s_host_gpio_put(PIN_DATA, false);
+}
+
+// position of three consecutive RX words in the pattern, -1 if they are not in it
+static int find_in_pattern(const int32_t *rx, const int32_t *pattern, uint len) {
+    for(uint offset=0; offset<len; ++offset)
+        if(rx[0] == pattern[offset] && rx[1] == pattern[(offset+1) % len] && rx[2] == pattern[(offset+2) % len])
+            return offset;
+    return -1;
+}
+
+// TX data wired back to the RX data pin, the captured buffers continue the pattern
+static void test_trx_loopback(I2S_CONTROLLER_MODE mode) {
+    i2s_host_connect_pins(PIN_DATA, PIN_DATA + 1);
+    I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, mode, 32, pio1);
+    i2s.set_pio_divider(0x400);
+    i2s.set_pattern(PATTERN_BUFFER::PATTERN::TRI, 0, 0x10000000, 64);
+    i2s.start_i2s();
+
+    uint len;
+    const int32_t *pattern = i2s.pattern_buffer.get_next_buffer(len);
+    uint buffers = 0, bad = 0;
+    for(int i=0; i<50; ++i) {
+        sleep_us(200);
+        const int32_t *rx;
+        uint32_t rx_len;
+        while((rx = i2s.rx_queue.peek(rx_len))) {
+            // the first buffer starts with the pipeline filling up
+            if(buffers++ > 0) {
+                const int offset = find_in_pattern(rx, pattern, len);
+                for(uint32_t w=0; w<rx_len; ++w) {
+                    if(offset < 0 || rx[w] != pattern[(offset + w) % len]) {
+                        ++bad;
+                        break;
+                    }
+                }
+            }
+            i2s.rx_queue.release();
+        }
+    }
+    printf("trx loopback: mode=%d buffers=%u bad=%u overruns=%u\n", (int)mode, buffers, bad, i2s.rx_queue.get_overrun_count());
+    CHECK(buffers > 10 && bad == 0 && i2s.rx_queue.get_overrun_count() == 0);
+    i2s_host_connect_pins(PIN_DATA + 1, PIN_DATA + 1);
+}
+
+int main() {
+    test_pattern(I2S_CONTROLLER_MODE::TX, 32);
+    test_pattern(I2S_CONTROLLER_MODE::TX, 16);
+    test_pattern(I2S_CONTROLLER_MODE::TX, 24);
+    test_pattern(I2S_CONTROLLER_MODE::TX, 20);
+    test_pattern(I2S_CONTROLLER_MODE::TX_MONO, 32);
+    test_pattern(I2S_CONTROLLER_MODE::TX_TDM, 32, 8);
+    test_pattern(I2S_CONTROLLER_MODE::TX_TDM, 16, 6);
+    test_pattern_update();
+    test_streaming();
+    test_rx_queue(32);
+    test_rx_queue(16);
+    test_rx_queue(24);
+    test_trx_loopback(I2S_CONTROLLER_MODE::TRX);
+    test_trx_loopback(I2S_CONTROLLER_MODE::TRX_FULL_RATE);
+    return host_test_result();
+}
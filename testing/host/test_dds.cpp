@@ -0,0 +1,158 @@
+// DDS_GENERATOR: spectral purity of the rendered sine, phase continuous frequency hops, samples per second on one host core
+#include <math.h>
+#include <chrono>
+#include <complex>
+#include <vector>
+
+#include "dds_generator.hpp"
+#include "host_test.hpp"
+
+#define FFT_BITS 14
+#define FFT_SIZE (1u << FFT_BITS)
+
+// in place radix 2 FFT
+static void fft(std::vector<std::complex<double>> &x) {
+    const uint32_t n = x.size();
+    for(uint32_t i=1, j=0; i<n; ++i) {
+        uint32_t bit = n >> 1;
+        for(; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if(i < j)
+            std::swap(x[i], x[j]);
+    }
+    for(uint32_t len=2; len<=n; len<<=1) {
+        const std::complex<double> w = std::polar(1.0, -2 * M_PI / len);
+        for(uint32_t i=0; i<n; i+=len) {
+            std::complex<double> wk = 1;
+            for(uint32_t k=0; k<len/2; ++k) {
+                const std::complex<double> a = x[i + k], b = x[i + k + len/2] * wk;
+                x[i + k] = a + b;
+                x[i + k + len/2] = a - b;
+                wk *= w;
+            }
+        }
+    }
+}
+
+// left channel of FFT_SIZE rendered frames, decoded back to left-justified samples
+static std::vector<double> render_left(DDS_GENERATOR &dds, I2S_SAMPLE_FORMAT format, uint bit_depth) {
+    std::vector<int32_t> buffer(2 * FFT_SIZE);
+    dds.set_sample_format(format, bit_depth);
+    dds.render(buffer.data(), FFT_SIZE);
+
+    std::vector<double> left(FFT_SIZE);
+    for(uint i=0; i<FFT_SIZE; ++i)
+        left[i] = format == I2S_SAMPLE_FORMAT::PACKED_16 ? (int32_t)(buffer[i] & 0xFFFF0000) : buffer[2*i];
+    return left;
+}
+
+/**
+ * SFDR in dBc: carrier against the largest other bin up to half the sample rate.
+ * DC is left out, truncating to the sample width always leaves an offset of half an LSB there.
+ * cycles whole periods in the FFT, so no window is needed and the leakage does not hide spurs.
+ */
+static double sfdr_db(const std::vector<double> &samples, uint cycles) {
+    std::vector<std::complex<double>> spectrum(samples.begin(), samples.end());
+    fft(spectrum);
+    double spur = 0;
+    for(uint k=1; k<=FFT_SIZE/2; ++k)
+        if(k != cycles)
+            spur = std::max(spur, std::norm(spectrum[k]));
+    return 10 * log10(std::norm(spectrum[cycles]) / spur);
+}
+
+// full scale sine at an odd number of periods per FFT, so the phases hit many table positions. The phase word moves them between table entries
+static void test_sfdr(I2S_SAMPLE_FORMAT format, uint bit_depth, uint cycles, uint32_t phase_word, double min_sfdr_db) {
+    DDS_GENERATOR dds;
+    dds.set_frequency_word(0, cycles << (32 - FFT_BITS));
+    dds.set_phase_word(0, phase_word);
+    dds.set_amplitude(0, 0x7FFFFFFF);
+    const double sfdr = sfdr_db(render_left(dds, format, bit_depth), cycles);
+    printf("sfdr format=%d bit_depth=%u cycles=%u phase_word=0x%08x: sfdr_dbc=%.1f\n", (int)format, bit_depth, cycles, phase_word, sfdr);
+    CHECK(sfdr >= min_sfdr_db);
+}
+
+// frequency hops keep the accumulator running: the samples follow the summed frequency words exactly
+static void test_hops() {
+    DDS_GENERATOR dds;
+    dds.set_amplitude(0, 0x40000000);
+    dds.set_amplitude(1, 0x40000000);
+    dds.set_phase_word(1, DDS_GENERATOR::degrees_to_word(90));
+
+    const uint32_t words[] = {DDS_GENERATOR::frequency_to_word(1000, 48000), DDS_GENERATOR::frequency_to_word(1234.5678, 48000),
+                              DDS_GENERATOR::frequency_to_word(0.01, 48000), DDS_GENERATOR::frequency_to_word(23999, 48000)};
+    uint32_t accumulator = 0;
+    uint wrong = 0;
+    std::vector<int32_t> block(2 * 37);
+    for(uint hop=0; hop<20; ++hop) {
+        const uint32_t word = words[hop % 4];
+        dds.set_frequency_word(0, word);
+        dds.set_frequency_word(1, word);
+        dds.render(block.data(), 37);
+        for(uint i=0; i<37; ++i) {
+            wrong += block[2*i] != scale_q31(0x40000000, sine_q31(accumulator));
+            wrong += block[2*i+1] != scale_q31(0x40000000, sine_q31(accumulator + 0x40000000));
+            accumulator += word;
+        }
+    }
+    printf("hops: wrong=%u\n", wrong);
+    CHECK(wrong == 0);
+}
+
+// render into a plain buffer, and fill() a TX ring the way the streaming firmware does
+static void bench_render(I2S_SAMPLE_FORMAT format, uint bit_depth, uint channels) {
+    DDS_GENERATOR dds;
+    dds.set_sample_format(format, bit_depth, channels);
+    for(uint c=0; c<channels; ++c) {
+        dds.set_frequency_word(c, DDS_GENERATOR::frequency_to_word(1000 + 100*c, 48000));
+        dds.set_amplitude(c, 0x40000000);
+    }
+
+    const uint frames = 1024;
+    std::vector<int32_t> buffer(frames * channels);
+    uint64_t samples = 0;
+    const auto start = std::chrono::steady_clock::now();
+    double seconds;
+    do {
+        dds.render(buffer.data(), frames);
+        samples += frames * channels;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while(seconds < 0.2);
+    printf("bench=dds path=render format=%d bit_depth=%u channels=%u samples_per_s=%.0f ns_per_sample=%.2f\n",
+           (int)format, bit_depth, channels, samples / seconds, seconds * 1e9 / samples);
+    CHECK(samples / seconds > 48000 * channels);
+
+    const uint32_t unit = i2s_unit_words(i2s_frame_bits(format, bit_depth, channels));
+    TX_RING_BUFFER ring(12, 256, unit);
+    uint32_t len;
+    samples = 0;
+    const auto fill_start = std::chrono::steady_clock::now();
+    do {
+        samples += dds.fill(ring) * channels;
+        // drain like the DMA does
+        while(ring.fill_level() >= unit) {
+            ring.start_block(len);
+            ring.finish_block();
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - fill_start).count();
+    } while(seconds < 0.2);
+    printf("bench=dds path=fill format=%d bit_depth=%u channels=%u samples_per_s=%.0f ns_per_sample=%.2f\n",
+           (int)format, bit_depth, channels, samples / seconds, seconds * 1e9 / samples);
+}
+
+int main() {
+    // 32 bit: limited by the sine kernel, 16 bit: limited by the truncation to 16 bits
+    test_sfdr(I2S_SAMPLE_FORMAT::WORD_32, 32, 1001, 0, 180);
+    test_sfdr(I2S_SAMPLE_FORMAT::WORD_32, 32, 3, 0x01234567, 180);
+    test_sfdr(I2S_SAMPLE_FORMAT::WORD_32, 32, 6553, 0x00013579, 180);
+    test_sfdr(I2S_SAMPLE_FORMAT::PACKED_16, 16, 1001, 0, 110);
+    test_sfdr(I2S_SAMPLE_FORMAT::PACKED_16, 16, 6553, 0x00013579, 110);
+    test_hops();
+
+    bench_render(I2S_SAMPLE_FORMAT::WORD_32, 32, 2);
+    bench_render(I2S_SAMPLE_FORMAT::PACKED_16, 16, 2);
+    bench_render(I2S_SAMPLE_FORMAT::PACKED_24, 24, 2);
+    bench_render(I2S_SAMPLE_FORMAT::WORD_32, 32, 8);
+    return host_test_result();
+}
@@ -0,0 +1,119 @@
+// TX DMA chaining: the control channel replays the buffer without the CPU, queued buffers follow at a buffer boundary
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+#define BUFFER_LEN 48
+
+static uint irq_count = 0;
+
+static void count_irq() {
+    ++irq_count;
+}
+
+// buffer of distinct words, so every position in the output can be told apart
+static std::vector<int32_t> make_buffer(int32_t first) {
+    std::vector<int32_t> buffer(BUFFER_LEN);
+    for(int i=0; i<BUFFER_LEN; ++i)
+        buffer[i] = first + i;
+    return buffer;
+}
+
+// number of whole buffer passes at the start of words, -1 if a word is missing or out of place
+static int count_passes(const std::vector<uint32_t> &words, size_t &pos, const std::vector<int32_t> &buffer) {
+    int passes = 0;
+    while(pos + BUFFER_LEN <= words.size() && words[pos] == (uint32_t)buffer[0]) {
+        for(uint i=0; i<BUFFER_LEN; ++i)
+            if(words[pos + i] != (uint32_t)buffer[i])
+                return -1;
+        pos += BUFFER_LEN;
+        ++passes;
+    }
+    return passes;
+}
+
+// a queued buffer repeats gaplessly with the TX IRQ disabled
+static void test_replay_without_irq() {
+    const std::vector<int32_t> a = make_buffer(0x1000);
+    I2S_CONTROLLER i2s(BUFFER_LEN/2, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+    i2s.set_pio_divider(0x400);
+    i2s.queue_tx_buffer(a.data(), BUFFER_LEN);
+    i2s.start_i2s();
+    sleep_us(100);
+    i2s_host_take_tx_words(pio0, 0);
+
+    irq_count = 0;
+    sleep_ms(2);
+    const std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, 0);
+
+    // the first words finish the pass that was running
+    size_t pos = 0;
+    while(pos < words.size() && words[pos] != (uint32_t)a[0])
+        ++pos;
+    const int passes = count_passes(words, pos, a);
+    printf("replay: words=%zu passes=%d irqs=%u\n", words.size(), passes, irq_count);
+    CHECK(passes > 10 && words.size() - pos < BUFFER_LEN);
+    CHECK(irq_count == 0);
+    CHECK(i2s_host.dma_regs.inte0 == 0); // no channel IRQ enabled while a buffer repeats
+    CHECK(!((pio0->fdebug >> PIO_FDEBUG_TXSTALL_LSB) & 1));
+}
+
+// the next buffer starts right after a whole pass of the current one, one IRQ per switch
+static void test_buffer_switch() {
+    const std::vector<int32_t> a = make_buffer(0x1000), b = make_buffer(0x2000);
+    I2S_CONTROLLER i2s(BUFFER_LEN/2, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+    i2s.set_pio_divider(0x400);
+    i2s.queue_tx_buffer(a.data(), BUFFER_LEN);
+    i2s.start_i2s();
+    sleep_us(300);
+
+    irq_count = 0;
+    const uint32_t seq = i2s.queue_tx_buffer(b.data(), BUFFER_LEN);
+    CHECK(!i2s.is_tx_buffer_playing(seq));
+    while(!i2s.is_tx_buffer_playing(seq))
+        tight_loop_contents();
+    sleep_us(500);
+
+    const std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, 0);
+    size_t pos = 0;
+    const int passes_a = count_passes(words, pos, a);
+    const int passes_b = count_passes(words, pos, b);
+    printf("switch: passes a=%d b=%d rest=%zu irqs=%u\n", passes_a, passes_b, words.size() - pos, irq_count);
+    CHECK(passes_a > 0 && passes_b > 0 && words.size() - pos < BUFFER_LEN);
+    CHECK(irq_count > 0 && irq_count <= 2);
+    CHECK(i2s_host.dma_regs.inte0 == 0); // no channel IRQ enabled while a buffer repeats
+    CHECK(!((pio0->fdebug >> PIO_FDEBUG_TXSTALL_LSB) & 1));
+}
+
+// a buffer queued before the previous one played replaces it, the output never mixes buffers
+static void test_superseded_buffer() {
+    const std::vector<int32_t> a = make_buffer(0x1000), b = make_buffer(0x2000), c = make_buffer(0x3000);
+    I2S_CONTROLLER i2s(BUFFER_LEN/2, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+    i2s.set_pio_divider(0x400);
+    i2s.queue_tx_buffer(a.data(), BUFFER_LEN);
+    i2s.start_i2s();
+    sleep_us(300);
+
+    i2s.queue_tx_buffer(b.data(), BUFFER_LEN);
+    const uint32_t seq = i2s.queue_tx_buffer(c.data(), BUFFER_LEN);
+    while(!i2s.is_tx_buffer_playing(seq))
+        tight_loop_contents();
+    sleep_us(500);
+
+    const std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, 0);
+    size_t pos = 0;
+    const int passes_a = count_passes(words, pos, a);
+    const int passes_b = count_passes(words, pos, b);
+    const int passes_c = count_passes(words, pos, c);
+    printf("supersede: passes a=%d b=%d c=%d rest=%zu\n", passes_a, passes_b, passes_c, words.size() - pos);
+    CHECK(passes_a > 0 && passes_b >= 0 && passes_c > 0 && words.size() - pos < BUFFER_LEN);
+}
+
+int main() {
+    irq_add_shared_handler(DMA_IRQ_0 + I2S_DMA_IRQ, count_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    test_replay_without_irq();
+    test_buffer_switch();
+    test_superseded_buffer();
+    return host_test_result();
+}
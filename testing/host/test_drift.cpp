@@ -0,0 +1,98 @@
+// DRIFT_CONTROLLER against a model of the ring: lock to a source that is off by up to 200 ppm with any block lengths
+#include <math.h>
+#include <stdlib.h>
+
+#include "drift_controller.hpp"
+#include "host_test.hpp"
+
+#define WORDS_PER_SECOND 96000.0 // 32 bit stereo at 48 kHz
+#define RING_WORDS 8192
+#define NOMINAL_DIVIDER (10 << 8)
+#define SECONDS 150
+#define SETTLED_SECONDS 90
+
+enum class BLOCKS { FULL, SHORT, RANDOM, WRAPPING };
+
+static const char *blocks_name(BLOCKS blocks) {
+    switch(blocks) {
+        case BLOCKS::FULL: return "full";
+        case BLOCKS::SHORT: return "short";
+        case BLOCKS::RANDOM: return "random";
+        case BLOCKS::WRAPPING: return "wrapping";
+    }
+    return "?";
+}
+
+// words of the next DMA block: 256, 32, 1..256 or every eighth block cut short like at the end of the ring
+static uint32_t block_words(BLOCKS blocks, uint32_t index) {
+    switch(blocks) {
+        case BLOCKS::FULL: return 256;
+        case BLOCKS::SHORT: return 32;
+        case BLOCKS::RANDOM: return 1 + rand() % 256;
+        case BLOCKS::WRAPPING: return index % 8 == 7 ? 40 : 256;
+    }
+    return 256;
+}
+
+struct LOCK_RESULT {
+    double peak_error;    // largest distance of the fill level from the target, words
+    double settled_error; // largest distance after SETTLED_SECONDS
+    double correction_ppm;
+};
+
+/**
+ * The source writes offset_ppm faster than nominal, the output plays every block at the divider of the update before it.
+ * The fill level is continuous, which is what TX_RING_BUFFER::fill_level() sees at block granularity.
+ */
+static LOCK_RESULT run_lock(double offset_ppm, BLOCKS blocks) {
+    srand(1);
+    DRIFT_CONTROLLER drift(RING_WORDS / 2, NOMINAL_DIVIDER, WORDS_PER_SECOND);
+    LOCK_RESULT result = {};
+    double fill = RING_WORDS / 2, time = 0;
+    uint32_t divider = NOMINAL_DIVIDER;
+    for(uint32_t index=0; time<SECONDS; ++index) {
+        const uint32_t words = block_words(blocks, index);
+        divider = drift.update((uint32_t)lround(fill), words);
+        const double duration = words / (WORDS_PER_SECOND * NOMINAL_DIVIDER / divider);
+        fill += WORDS_PER_SECOND * (1 + offset_ppm * 1e-6) * duration - words;
+        time += duration;
+
+        const double error = fabs(fill - RING_WORDS / 2);
+        result.peak_error = fmax(result.peak_error, error);
+        if(time > SETTLED_SECONDS)
+            result.settled_error = fmax(result.settled_error, error);
+    }
+    result.correction_ppm = drift.get_correction_ppm();
+    printf("lock offset_ppm=%+.0f blocks=%s: peak_error=%.1f settled_error=%.1f correction_ppm=%.2f min_fill=%u max_fill=%u\n", offset_ppm,
+           blocks_name(blocks), result.peak_error, result.settled_error, result.correction_ppm, drift.get_min_fill(), drift.get_max_fill());
+    return result;
+}
+
+// the buffer stays bounded and settles, the correction matches the offset, the same for every block pattern
+static void test_lock(double offset_ppm) {
+    const LOCK_RESULT reference = run_lock(offset_ppm, BLOCKS::FULL);
+    for(BLOCKS blocks : {BLOCKS::FULL, BLOCKS::SHORT, BLOCKS::RANDOM, BLOCKS::WRAPPING}) {
+        const LOCK_RESULT result = blocks == BLOCKS::FULL ? reference : run_lock(offset_ppm, blocks);
+        CHECK(result.peak_error < RING_WORDS / 16);
+        CHECK(result.settled_error < 16 + 0.1 * result.peak_error);
+        CHECK(fabs(result.correction_ppm - offset_ppm) < 5);
+
+        // the loop dynamics do not depend on how often update() runs
+        CHECK(fabs(result.peak_error - reference.peak_error) <= 0.15 * reference.peak_error + 4);
+    }
+}
+
+// beyond the correction limit the fill level runs away instead of the divider
+static void test_limit() {
+    const LOCK_RESULT result = run_lock(2 * DRIFT_MAX_CORRECTION_PPM, BLOCKS::FULL);
+    CHECK(fabs(result.correction_ppm - DRIFT_MAX_CORRECTION_PPM) < 1);
+    CHECK(result.settled_error > RING_WORDS / 16);
+}
+
+int main() {
+    test_lock(200);
+    test_lock(-200);
+    test_lock(0);
+    test_limit();
+    return host_test_result();
+}
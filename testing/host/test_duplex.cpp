@@ -0,0 +1,125 @@
+// Duplex processing on the PIO model: TX wired back to RX, every round trip adds one, so the words on the pin count the passes
+#include <vector>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+
+#define BLOCK_FRAMES 16
+
+// the callback plays the captured block plus one, in every word of the block
+static void add_one(const int32_t *rx_block, int32_t *tx_block, uint32_t frames, void *context) {
+    const uint32_t words = *(const uint32_t *)context;
+    for(uint32_t w=0; w<words; ++w)
+        tx_block[w] = rx_block[w] + 1;
+    (void)frames;
+}
+
+/**
+ * Starting from silence, a word on the TX pin is the number of round trips its sample made, so word s has to be s / D
+ * with D the words of (1+latency_blocks) blocks. That is the latency get_duplex_latency_frames() has to report.
+ * @param delay_irqs keep the IRQs off for half a block every block, far longer than the RX FIFO covers, without RX stalls
+ */
+template<class CONTROLLER>
+static void test_round_trip(CONTROLLER &i2s, const char *name, uint bit_depth, uint latency_blocks, uint32_t divider, bool delay_irqs = false) {
+    static uint32_t block_words;
+    block_words = i2s_rx_buffer_words(BLOCK_FRAMES, i2s.get_sample_format(), bit_depth);
+    i2s.set_pio_divider(divider);
+    i2s.enable_duplex_processing(add_one, &block_words, BLOCK_FRAMES, latency_blocks);
+    CHECK(i2s.duplex != NULL);
+    i2s_host_take_tx_words(pio0, 0);
+    i2s_host_take_tx_words(pio1, 0);
+    pio0->fdebug = pio1->fdebug = 0xFFFFFFFF;
+    i2s.start_i2s();
+
+    const double block_us = BLOCK_FRAMES * 1e6 / i2s.get_sample_rate();
+    const uint irq_delay_us = delay_irqs ? block_us / 2 : 0;
+    const float expected_frames = (1 + latency_blocks) * BLOCK_FRAMES;
+    const float word_frames = 32.f / i2s_frame_bits(i2s.get_sample_format(), bit_depth);
+    float min_frames = 1e9, max_frames = 0;
+    for(uint i=0; i<40; ++i) {
+        if(irq_delay_us) {
+            const uint32_t irq_state = save_and_disable_interrupts();
+            sleep_us(irq_delay_us);
+            restore_interrupts(irq_state);
+        }
+        for(uint j=0; j<20; ++j) {
+            sleep_us(block_us / 20 + 1);
+            const float frames = i2s.get_duplex_latency_frames();
+            min_frames = frames < min_frames ? frames : min_frames;
+            max_frames = frames > max_frames ? frames : max_frames;
+        }
+    }
+
+    std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, 0);
+    if(words.empty())
+        words = i2s_host_take_tx_words(pio1, 0);
+    const uint32_t round_trip_words = (1 + latency_blocks) * block_words;
+    size_t bad = 0;
+    for(size_t s=0; s<words.size(); ++s)
+        bad += words[s] != s / round_trip_words;
+    printf("round trip: %s bit_depth=%u latency_blocks=%u irq_delay_us=%u words=%zu bad=%zu latency_frames=%.2f..%.2f expected=%.0f processed=%u late=%u\n",
+           name, bit_depth, latency_blocks, irq_delay_us, words.size(), bad, min_frames, max_frames, expected_frames,
+           i2s.duplex->get_processed_count(), i2s.get_duplex_late_count());
+    CHECK(words.size() > 10 * round_trip_words && bad == 0);
+    CHECK(max_frames == expected_frames && min_frames >= expected_frames - word_frames);
+    CHECK(i2s.get_duplex_late_count() == 0);
+    // a full RX FIFO stops the TRX state machine and its clocks instead of losing words, so it only shows as a stall
+    CHECK(!(pio0->fdebug & (0xFu << PIO_FDEBUG_RXSTALL_LSB)) && !(pio1->fdebug & (0xFu << PIO_FDEBUG_RXSTALL_LSB)));
+}
+
+/**
+ * latency_words() from DMA positions around the block grid: the output runs ahead of or behind the capture
+ * by the FIFO levels, also across the end of a block
+ */
+static void test_latency_words() {
+    const uint32_t block_words = 32;
+    I2S_DUPLEX_PROCESSOR duplex(add_one, NULL, 16, block_words, 2);
+    const uintptr_t tx = (uintptr_t)duplex.next_tx_block(), rx = (uintptr_t)duplex.get_fill_buffer();
+    const uint32_t nominal = 3 * block_words;
+
+    // output word = read position - TX FIFO - OSR, input word = write position + RX FIFO
+    struct { uint32_t tx_offset, tx_fifo, rx_offset, rx_fifo; int32_t lead; } cases[] = {
+        {10, 4, 5, 0, 0},   // in step
+        {10, 3, 5, 0, 1},   // the output one word ahead
+        {10, 4, 5, 1, -1},  // one word behind
+        {2, 4, 29, 0, 0},   // the capture wrapped into the next block first
+        {0, 0, 31, 0, 0},   // the output at the start of the block, the capture at its end
+        {20, 0, 4, 0, 15},  // up to half a block either way
+    };
+    for(auto &c : cases) {
+        const uint32_t words = duplex.latency_words(tx + c.tx_offset * 4 + 2 * block_words * 4, c.tx_fifo, rx + c.rx_offset * 4 + block_words * 4, c.rx_fifo);
+        CHECK(words == nominal - c.lead);
+    }
+}
+
+int main() {
+    test_latency_words();
+
+    i2s_host_connect_pins(PIN_DATA, PIN_DATA + 1);
+    {
+        I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TRX, 32, pio0);
+        test_round_trip(i2s, "TRX", 32, 1, 0x200);
+    }
+    {
+        I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TRX, 32, pio0);
+        test_round_trip(i2s, "TRX", 32, 3, 0x200);
+    }
+    {
+        I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TRX, 16, pio0);
+        test_round_trip(i2s, "TRX", 16, 1, 0x200);
+    }
+    {
+        I2S_STATIC_CONTROLLER<I2S_CONTROLLER_MODE::TRX_FULL_RATE, 32> i2s(64, PIN_DATA, PIN_CLOCK_BASE, pio1);
+        test_round_trip(i2s, "TRX_FULL_RATE static", 32, 1, 0x400);
+    }
+
+    {
+        I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TRX, 32, pio0);
+        test_round_trip(i2s, "TRX", 32, 1, 0x200, true);
+    }
+    i2s_host_connect_pins(PIN_DATA + 1, PIN_DATA + 1);
+    return host_test_result();
+}
@@ -0,0 +1,112 @@
+// Multi-lane TX on the PIO model: walking one bit samples, so a swapped lane, channel or bit shows up as exactly that
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+#include "pio_trace.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+#define PIN_BCLK PIN_CLOCK_BASE
+#define PIN_LRCK (PIN_CLOCK_BASE + 1)
+
+#define FRAMES 64
+
+enum { SIGNAL_BCLK, SIGNAL_LRCK, SIGNAL_DATA };
+
+// the only set bit of a sample, counted from the MSB, differs between neighbouring channels and frames
+static uint one_bit(uint frame, uint channel, uint bit_depth) {
+    return (frame * 7 + channel * 3) % bit_depth;
+}
+
+/**
+ * bits set on every lane in the frames on the pins, as positions from the first bit of the left word:
+ * the left word starts one BCLK after LRCK falls, the right word bit_depth BCLKs later
+ */
+static std::vector<std::vector<std::vector<uint>>> decode_set_bits(const PIO_TRACE &trace, uint lanes, uint bit_depth) {
+    const std::vector<uint64_t> rising = trace.edge_times(SIGNAL_BCLK, true);
+    std::vector<std::vector<std::vector<uint>>> frames;
+    for(uint64_t lrck_fall : trace.edge_times(SIGNAL_LRCK, false)) {
+        const size_t first = std::upper_bound(rising.begin(), rising.end(), lrck_fall) - rising.begin() + 1;
+        if(first + 2 * bit_depth > rising.size())
+            break;
+        std::vector<std::vector<uint>> frame(lanes);
+        for(uint lane=0; lane<lanes; ++lane)
+            for(uint bit=0; bit<2*bit_depth; ++bit)
+                if(trace.level_at(SIGNAL_DATA + lane, rising[first + bit]))
+                    frame[lane].push_back(bit);
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+// lane L plays channels 2L (left) and 2L+1 (right)
+static std::vector<uint> expected_bits(uint frame, uint lane, uint bit_depth) {
+    const uint left = one_bit(frame, 2*lane, bit_depth), right = bit_depth + one_bit(frame, 2*lane + 1, bit_depth);
+    return {std::min(left, right), std::max(left, right)};
+}
+
+static void test_lanes(uint lanes, uint bit_depth) {
+    const int failures = host_test_failures;
+    const I2S_SAMPLE_FORMAT format = i2s_controller_sample_format(I2S_CONTROLLER_MODE::TX, bit_depth, lanes);
+    I2S_CONTROLLER i2s(FRAMES, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, bit_depth, pio0, -1, -1, 8, lanes);
+    i2s.set_pio_divider(4 << 8);
+
+    const uint words = FRAMES * i2s_frame_bits(format, bit_depth, 2 * lanes) / 32;
+    std::vector<int32_t> buffer(words + 1);
+    I2S_FRAME_WRITER writer(buffer.data(), format, bit_depth, 2 * lanes);
+    for(uint f=0; f<FRAMES; ++f) {
+        int32_t samples[I2S_MAX_CHANNELS];
+        for(uint ch=0; ch<2*lanes; ++ch)
+            samples[ch] = (int32_t)(0x80000000u >> one_bit(f, ch, bit_depth));
+        writer.write_frame(samples);
+    }
+    i2s.queue_tx_buffer(buffer.data(), words);
+
+    PIO_TRACE trace({{"bclk", PIN_BCLK}, {"lrck", PIN_LRCK}, {"data0", PIN_DATA}, {"data1", PIN_DATA + 1}, {"data2", PIN_DATA + 2}, {"data3", PIN_DATA + 3}});
+    i2s.start_i2s();
+    i2s_host_run_cycles((uint64_t)(FRAMES + 8) * i2s_generate_pio_program(I2S_CONTROLLER_MODE::TX, bit_depth, lanes, 2 * lanes).cycles_per_frame * 4);
+
+    // the first frame may have started before the trace, the buffer frame of the second one is found by trying them all
+    const auto frames = decode_set_bits(trace, lanes, bit_depth);
+    CHECK(frames.size() > FRAMES + 2);
+    size_t best_bad = SIZE_MAX;
+    uint best_start = 0;
+    for(uint start=0; start<FRAMES && frames.size() > 1; ++start) {
+        size_t bad = 0;
+        for(size_t f=1; f<frames.size(); ++f)
+            for(uint lane=0; lane<lanes; ++lane)
+                bad += frames[f][lane] != expected_bits((start + f - 1) % FRAMES, lane, bit_depth);
+        if(bad < best_bad) {
+            best_bad = bad;
+            best_start = start;
+        }
+    }
+    CHECK(best_bad == 0);
+
+    // the first wrong lane, with the bit positions seen and expected
+    for(size_t f=1; f<frames.size() && best_bad; ++f) {
+        for(uint lane=0; lane<lanes; ++lane) {
+            const std::vector<uint> expected = expected_bits((best_start + f - 1) % FRAMES, lane, bit_depth);
+            if(frames[f][lane] == expected)
+                continue;
+            std::string seen;
+            for(uint bit : frames[f][lane])
+                seen += " " + std::to_string(bit);
+            printf("  frame %zu lane %u: bits%s, expected %u %u\n", f, lane, seen.c_str(), expected[0], expected[1]);
+            best_bad = 0;
+            break;
+        }
+    }
+    CHECK(!(pio0->fdebug & 0x0F000000u));
+    printf("lanes=%u bit_depth=%u frames=%zu: %s\n", lanes, bit_depth, frames.size(), host_test_failures == failures ? "ok" : "FAILED");
+}
+
+int main() {
+    for(uint lanes : {2, 4})
+        for(uint bit_depth : {2, 7, 8, 16, 20, 24, 31, 32})
+            test_lanes(lanes, bit_depth);
+    return host_test_result();
+}
@@ -0,0 +1,140 @@
+// Several controllers on both PIOs: one IRQ handler dispatches to all of them, automatic claims, synchronized start
+#include <memory>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define INSTANCES 4
+
+// data pins 10..13, BCLK/LRCK pairs from 0, instances 0 and 1 on pio0, 2 and 3 on pio1
+static uint pin_data(uint i) { return 10 + i; }
+static uint pin_clock(uint i) { return 2 * i; }
+static PIO instance_pio(uint i) { return i < 2 ? pio0 : pio1; }
+
+// BCLK rising edges of every instance, in system clock cycles
+struct CLOCK_EDGES {
+    std::vector<uint64_t> edges[INSTANCES];
+    bool level[INSTANCES] = {};
+
+    static void step(void *context) {
+        CLOCK_EDGES &self = *(CLOCK_EDGES *)context;
+        for(uint i=0; i<INSTANCES; ++i) {
+            const bool bclk = i2s_host_gpio_get(pin_clock(i));
+            if(bclk && !self.level[i])
+                self.edges[i].push_back(i2s_host.now >> 8);
+            self.level[i] = bclk;
+        }
+    }
+};
+
+static uint count_claimed_dma_channels() {
+    uint claimed = 0;
+    for(uint channel=0; channel<NUM_DMA_CHANNELS; ++channel)
+        claimed += i2s_host.dma[channel].claimed;
+    return claimed;
+}
+
+// only words of the given values, in that order
+static bool words_follow(const std::vector<uint32_t> &words, std::initializer_list<uint32_t> values) {
+    auto value = values.begin();
+    for(uint32_t word : words) {
+        while(value != values.end() && word != *value)
+            ++value;
+        if(value == values.end())
+            return false;
+    }
+    return !words.empty();
+}
+
+// a channel of another driver on the same IRQ, completes a memory copy
+static int foreign_channel = -1;
+static uint foreign_irqs = 0;
+
+static void foreign_handler() {
+    if(dma_irqn_get_channel_status(I2S_DMA_IRQ, foreign_channel)) {
+        dma_irqn_acknowledge_channel(I2S_DMA_IRQ, foreign_channel);
+        ++foreign_irqs;
+    }
+}
+
+static void start_foreign_copy() {
+    static int32_t source[16], destination[16];
+    dma_channel_config config = dma_channel_get_default_config(foreign_channel);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, true);
+    dma_channel_configure(foreign_channel, &config, destination, source, 16, true);
+}
+
+static void test_instances() {
+    std::unique_ptr<I2S_CONTROLLER> controllers[INSTANCES];
+    for(uint i=0; i<INSTANCES; ++i) {
+        controllers[i] = std::make_unique<I2S_CONTROLLER>(64, pin_data(i), pin_clock(i), I2S_CONTROLLER_MODE::TX, 32, instance_pio(i));
+        controllers[i]->set_pio_divider(0x300);
+        controllers[i]->set_offset(i + 1);
+    }
+
+    // one handler for all instances, SMs and DMA channels claimed without collisions
+    CHECK(i2s_host.irq_handlers[DMA_IRQ_0 + I2S_DMA_IRQ].size() == 1);
+    CHECK(i2s_host_sm(pio0, 0).claimed && i2s_host_sm(pio0, 1).claimed && !i2s_host_sm(pio0, 2).claimed);
+    CHECK(i2s_host_sm(pio1, 0).claimed && i2s_host_sm(pio1, 1).claimed && !i2s_host_sm(pio1, 2).claimed);
+    CHECK(count_claimed_dma_channels() == 2 * INSTANCES);
+
+    // the foreign handler comes after the I2S one, so the I2S handler must leave its channel alone
+    foreign_channel = dma_claim_unused_channel(true);
+    irq_add_shared_handler(DMA_IRQ_0 + I2S_DMA_IRQ, foreign_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    dma_irqn_set_channel_enabled(I2S_DMA_IRQ, foreign_channel, true);
+
+    CLOCK_EDGES clocks;
+    i2s_host_add_step_hook(CLOCK_EDGES::step, &clocks);
+    I2S_CONTROLLER *const started[INSTANCES] = {controllers[0].get(), controllers[1].get(), controllers[2].get(), controllers[3].get()};
+    I2S_CONTROLLER::start_i2s_synchronized(started, INSTANCES);
+    sleep_us(300);
+    i2s_host_remove_step_hook(CLOCK_EDGES::step, &clocks);
+
+    // same PIO: the same edges, other PIO: a constant offset
+    bool same_pio_aligned = clocks.edges[0] == clocks.edges[1] && clocks.edges[2] == clocks.edges[3];
+    const size_t edges = std::min(clocks.edges[0].size(), clocks.edges[2].size());
+    const int64_t offset = edges ? (int64_t)(clocks.edges[2][0] - clocks.edges[0][0]) : -1;
+    uint offset_changes = 0;
+    for(size_t e=0; e<edges; ++e)
+        offset_changes += (int64_t)(clocks.edges[2][e] - clocks.edges[0][e]) != offset;
+    printf("sync: edges=%zu/%zu/%zu/%zu pio1_offset_cycles=%lld offset_changes=%u\n", clocks.edges[0].size(), clocks.edges[1].size(),
+           clocks.edges[2].size(), clocks.edges[3].size(), (long long)offset, offset_changes);
+    CHECK(edges > 100 && same_pio_aligned && offset_changes == 0 && offset >= 0 && offset < 0x300 >> 8);
+
+    // updates of two instances at once, IRQs of both channels in one handler call and the foreign one in between
+    for(uint i=0; i<INSTANCES; ++i)
+        i2s_host_take_tx_words(instance_pio(i), i % 2);
+    start_foreign_copy();
+    controllers[1]->set_offset(20);
+    controllers[3]->set_offset(40);
+    sleep_us(10); // the two copies would share one IRQ otherwise
+    start_foreign_copy();
+    while(!controllers[1]->is_pattern_update_done() || !controllers[3]->is_pattern_update_done())
+        tight_loop_contents();
+    sleep_us(200);
+
+    const std::initializer_list<uint32_t> expected[INSTANCES] = {{1}, {2, 20}, {3}, {4, 40}};
+    for(uint i=0; i<INSTANCES; ++i) {
+        const bool ok = words_follow(i2s_host_take_tx_words(instance_pio(i), i % 2), expected[i]);
+        printf("dispatch: instance=%u ok=%d\n", i, ok);
+        CHECK(ok);
+    }
+    printf("foreign: irqs=%u\n", foreign_irqs);
+    CHECK(foreign_irqs == 2);
+    CHECK(!((pio0->fdebug >> PIO_FDEBUG_TXSTALL_LSB) & 3) && !((pio1->fdebug >> PIO_FDEBUG_TXSTALL_LSB) & 3));
+
+    // the destructors release everything, an explicitly requested SM and new channels can be claimed again
+    for(auto &controller : controllers)
+        controller.reset();
+    CHECK(!i2s_host_sm(pio0, 0).claimed && !i2s_host_sm(pio1, 1).claimed);
+    CHECK(count_claimed_dma_channels() == 1);
+    I2S_CONTROLLER again(64, pin_data(0), pin_clock(0), I2S_CONTROLLER_MODE::TX, 32, pio1, 1);
+    CHECK(i2s_host_sm(pio1, 1).claimed && count_claimed_dma_channels() == 3);
+    CHECK(i2s_host.irq_handlers[DMA_IRQ_0 + I2S_DMA_IRQ].size() == 2);
+}
+
+int main() {
+    test_instances();
+    return host_test_result();
+}
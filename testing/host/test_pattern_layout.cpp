@@ -0,0 +1,200 @@
+// PATTERN_BUFFER layouts: independent channels in their slots, I/Q phases, identical channels copied, TX_MONO with one word per frame
+#include <math.h>
+#include <vector>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+typedef PATTERN_BUFFER::PATTERN PATTERN;
+
+// one channel on its own: a mono buffer renders channel 0 straight into its words, nothing is copied
+static std::vector<int32_t> render_channel(PATTERN pattern, int32_t offset, int32_t amplitude, uint32_t phase, uint length) {
+    PATTERN_BUFFER mono(length, I2S_SAMPLE_FORMAT::WORD_32, 32, true);
+    mono.set_pattern_length(length);
+    mono.set_channel_pattern(0, pattern, offset, amplitude, phase);
+    return std::vector<int32_t>(mono.pattern_buffer, mono.pattern_buffer + length);
+}
+
+// left and right samples of a stereo pattern, MSB aligned
+static void unpack(PATTERN_BUFFER &buffer, uint length, std::vector<int32_t> &left, std::vector<int32_t> &right,
+                   I2S_SAMPLE_FORMAT format = I2S_SAMPLE_FORMAT::WORD_32, uint bit_depth = 32) {
+    uint words;
+    const int32_t *data = buffer.get_next_buffer(words);
+    left.resize(length);
+    right.resize(length);
+    i2s_unpack_rx(data, length, format, bit_depth, left.data(), right.data());
+}
+
+/**
+ * L and R with their own pattern, amplitude and offset land in their slots,
+ * the values follow the formulas of the patterns: square and triangle exact, sine within a few LSB
+ */
+static void test_slots() {
+    const uint length = 100;
+    const int32_t left_amplitude = 0x20000000, right_amplitude = -0x01000000, left_offset = 1000, right_offset = -0x300000;
+    PATTERN_BUFFER buffer(length);
+    buffer.set_pattern_length(length);
+    buffer.set_channel_pattern(0, PATTERN::SQUARE, left_offset, left_amplitude);
+    buffer.set_channel_pattern(1, PATTERN::TRI, right_offset, right_amplitude);
+
+    uint words;
+    const int32_t *data = buffer.get_next_buffer(words);
+    uint wrong = 0;
+    for(uint i=0; i<length; ++i) {
+        const int64_t ramp = i < length/2 ? i : length - i - 1;
+        wrong += data[2*i] != (i >= length/2 ? left_amplitude : 0) + left_offset;
+        wrong += data[2*i+1] != (int32_t)(2*(int64_t)right_amplitude*ramp / (int64_t)length + right_offset);
+    }
+    printf("slots: square/tri words=%u wrong=%u\n", words, wrong);
+    CHECK(words == 2*length && wrong == 0);
+
+    // a sine on the right leaves the left alone
+    buffer.set_channel_pattern(1, PATTERN::SINE, right_offset, left_amplitude);
+    data = buffer.get_next_buffer(words);
+    double max_error = 0;
+    wrong = 0;
+    for(uint i=0; i<length; ++i) {
+        const double error = fabs(data[2*i+1] - (sin(2*M_PI*i/length)*left_amplitude + right_offset));
+        max_error = error > max_error ? error : max_error;
+        wrong += data[2*i] != (i >= length/2 ? left_amplitude : 0) + left_offset;
+    }
+    printf("slots: sine max_error_lsb=%.1f left_wrong=%u\n", max_error, wrong);
+    CHECK(max_error <= left_amplitude * 4e-9 + 2 && wrong == 0);
+
+    // six TDM slots, every one different
+    PATTERN_BUFFER tdm(length, I2S_SAMPLE_FORMAT::WORD_32, 32, false, 6);
+    tdm.set_pattern_length(length);
+    for(uint c=0; c<6; ++c)
+        tdm.set_channel_pattern(c, c % 2 ? PATTERN::SQUARE : PATTERN::CONST, 100 * c, 0x10000 * (c + 1));
+    data = tdm.get_next_buffer(words);
+    wrong = 0;
+    for(uint i=0; i<length; ++i)
+        for(uint c=0; c<6; ++c)
+            wrong += data[6*i + c] != (c % 2 && i >= length/2 ? 0x10000 * (int32_t)(c + 1) : 0) + 100 * (int32_t)c;
+    printf("slots: tdm words=%u wrong=%u\n", words, wrong);
+    CHECK(words == 6*length && wrong == 0);
+}
+
+/**
+ * A phase of 0x40000000 on the right channel: the sine is the exact cosine even where a quarter period is no whole
+ * number of samples, triangle and square are the left channel rotated by whole samples
+ */
+static void test_iq(uint length) {
+    const int32_t amplitude = 0x40000000;
+    const uint shift = ((uint64_t)0x40000000 * length) >> 32;
+    PATTERN_BUFFER buffer(length);
+    buffer.set_pattern_length(length);
+    std::vector<int32_t> left, right;
+
+    buffer.set_channel_pattern(0, PATTERN::SINE, 0, amplitude);
+    buffer.set_channel_pattern(1, PATTERN::SINE, 0, amplitude, 0x40000000);
+    unpack(buffer, length, left, right);
+    double max_error = 0;
+    for(uint i=0; i<length; ++i) {
+        const double error = fabs(right[i] - cos(2*M_PI*i/length)*amplitude);
+        max_error = error > max_error ? error : max_error;
+    }
+    const bool rotated = right == render_channel(PATTERN::SINE, 0, amplitude, 0x40000000, length);
+    printf("iq: length=%u sine max_error_lsb=%.1f\n", length, max_error);
+    CHECK(max_error <= amplitude * 4e-9 + 2 && rotated);
+    if(length % 4 == 0) {
+        uint wrong = 0;
+        for(uint i=0; i<length; ++i)
+            wrong += right[i] != left[(i + length/4) % length];
+        CHECK(wrong == 0);
+    }
+
+    for(PATTERN pattern : {PATTERN::TRI, PATTERN::SQUARE}) {
+        buffer.set_channel_pattern(0, pattern, 7, amplitude);
+        buffer.set_channel_pattern(1, pattern, 7, amplitude, 0x40000000);
+        unpack(buffer, length, left, right);
+        uint wrong = 0;
+        for(uint i=0; i<length; ++i)
+            wrong += right[i] != left[(i + shift) % length];
+        printf("iq: length=%u pattern=%d shift=%u wrong=%u\n", length, (int)pattern, shift, wrong);
+        CHECK(wrong == 0);
+    }
+}
+
+/**
+ * Identical channels are generated once and copied, the words equal those of every channel rendered on its own.
+ * Also in the packed 16 and 24 bit formats and with the copy source in the middle of a TDM frame.
+ */
+static void test_copies() {
+    const uint length = 64;
+    const struct { PATTERN pattern; int32_t offset, amplitude; uint32_t phase; } settings[] = {
+        {PATTERN::SINE, 0x1000, 0x30000000, 0x12345678},
+        {PATTERN::TRI, -0x10000, 0x7FFF0000, 0},
+        {PATTERN::SQUARE, 0, -0x20000000, 0x80000000},
+    };
+    const struct { I2S_SAMPLE_FORMAT format; uint bit_depth; } formats[] = {
+        {I2S_SAMPLE_FORMAT::WORD_32, 32}, {I2S_SAMPLE_FORMAT::PACKED_16, 16}, {I2S_SAMPLE_FORMAT::PACKED_24, 24},
+    };
+
+    for(auto &f : formats) {
+        const int32_t mask = (int32_t)(0xFFFFFFFFu << (32 - f.bit_depth));
+        for(auto &s : settings) {
+            PATTERN_BUFFER buffer(length, f.format, f.bit_depth);
+            buffer.set_pattern_length(length);
+            buffer.set_channel_pattern(0, s.pattern, s.offset, s.amplitude, s.phase);
+            buffer.set_channel_pattern(1, s.pattern, s.offset, s.amplitude, s.phase);
+            std::vector<int32_t> left, right;
+            unpack(buffer, length, left, right, f.format, f.bit_depth);
+
+            const std::vector<int32_t> alone = render_channel(s.pattern, s.offset, s.amplitude, s.phase, length);
+            uint wrong = 0;
+            for(uint i=0; i<length; ++i)
+                wrong += left[i] != (alone[i] & mask) || right[i] != left[i];
+            printf("copies: bit_depth=%u pattern=%d wrong=%u\n", f.bit_depth, (int)s.pattern, wrong);
+            CHECK(wrong == 0);
+        }
+    }
+
+    // slots 1 and 4 alike, 1 is generated and 4 copied from it
+    PATTERN_BUFFER tdm(length, I2S_SAMPLE_FORMAT::WORD_32, 32, false, 6);
+    tdm.set_pattern_length(length);
+    tdm.set_channel_pattern(1, PATTERN::SINE, 5, 0x10000000, 0x20000000);
+    tdm.set_channel_pattern(4, PATTERN::SINE, 5, 0x10000000, 0x20000000);
+    uint words;
+    const int32_t *data = tdm.get_next_buffer(words);
+    const std::vector<int32_t> alone = render_channel(PATTERN::SINE, 5, 0x10000000, 0x20000000, length);
+    uint wrong = 0;
+    for(uint i=0; i<length; ++i)
+        wrong += data[6*i + 1] != alone[i] || data[6*i + 4] != alone[i] || data[6*i] != 0 || data[6*i + 5] != 0;
+    printf("copies: tdm wrong=%u\n", wrong);
+    CHECK(wrong == 0);
+}
+
+// TX_MONO: one word per frame from channel 0, half the memory of stereo, also in the controller
+static void test_mono() {
+    const uint length = 50;
+    PATTERN_BUFFER mono(length, I2S_SAMPLE_FORMAT::WORD_32, 32, true);
+    CHECK(PATTERN_BUFFER::storage_words(length, I2S_SAMPLE_FORMAT::WORD_32, 32, true) == 2*length);
+    CHECK(PATTERN_BUFFER::storage_words(length) == 4*length);
+    mono.set_pattern_length(length);
+    mono.set_channel_pattern(0, PATTERN::SQUARE, -3, 0x100);
+    mono.set_channel_pattern(1, PATTERN::CONST, 0x55, 0); // ignored, there is only one word per frame
+
+    uint words;
+    const int32_t *data = mono.get_next_buffer(words);
+    uint wrong = 0;
+    for(uint i=0; i<length; ++i)
+        wrong += data[i] != (i >= length/2 ? 0x100 : 0) - 3;
+    printf("mono: words=%u wrong=%u\n", words, wrong);
+    CHECK(words == length && wrong == 0);
+
+    I2S_CONTROLLER i2s(length, 20, 17, I2S_CONTROLLER_MODE::TX_MONO, 16, pio0);
+    i2s.set_pattern(PATTERN::TRI, 0, 0x40000000, length);
+    data = i2s.pattern_buffer.get_next_buffer(words);
+    const std::vector<int32_t> alone = render_channel(PATTERN::TRI, 0, 0x40000000, 0, length);
+    CHECK(words == length && std::vector<int32_t>(data, data + words) == alone);
+}
+
+int main() {
+    test_slots();
+    test_iq(64);
+    test_iq(50);
+    test_copies();
+    test_mono();
+    return host_test_result();
+}
@@ -0,0 +1,102 @@
+// Pattern updates while the DMA plays: every period on the output comes from a single update, is_pattern_update_done() is exact
+#include <random>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+#define BUFFER_FRAMES 64
+
+// TX FIFO words of one period of update k: a CONST pattern with offset k, so each update is told apart by its value
+struct OUTPUT {
+    std::vector<uint32_t> words;
+    std::vector<uint> period_words = {0}; // words per period of update k, 0 has none
+
+    void take() {
+        const std::vector<uint32_t> taken = i2s_host_take_tx_words(pio0, 0);
+        words.insert(words.end(), taken.begin(), taken.end());
+    }
+};
+
+// the updates come at random points of the period, some back to back before the previous one played
+static void test_swap(bool change_length) {
+    I2S_CONTROLLER i2s(BUFFER_FRAMES, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+    i2s.set_pio_divider(0x100);
+    i2s.start_i2s();
+    sleep_us(50);
+    i2s_host_take_tx_words(pio0, 0);
+
+    std::mt19937 random(change_length ? 5 : 4);
+    OUTPUT output;
+    uint late = 0, waits = 0;
+    for(uint k=1; k<=300; ++k) {
+        uint length = BUFFER_FRAMES;
+        if(change_length)
+            length = i2s.set_pattern(PATTERN_BUFFER::PATTERN::CONST, k, 0, random() % BUFFER_FRAMES + 1);
+        else
+            i2s.set_offset(k);
+        output.take();
+        output.period_words.push_back(2 * length);
+
+        // none of the new value before the update was made
+        const size_t queued_at = output.words.size();
+        for(size_t i=queued_at > 64 ? queued_at - 64 : 0; i<queued_at; ++i)
+            late += output.words[i] >= k;
+
+        if(random() % 3 == 0) {
+            // the next update right away
+            continue;
+        }
+        if(random() % 2) {
+            while(!i2s.is_pattern_update_done()) {
+                ++waits;
+                sleep_us(random() % 3);
+            }
+            // done means playing: apart from the FIFO nothing older than k comes out anymore
+            output.take();
+            const size_t done_at = output.words.size();
+            sleep_us(100);
+            output.take();
+            for(size_t i=done_at + 8; i<output.words.size(); ++i)
+                late += output.words[i] < k;
+        }
+        sleep_us(random() % 200);
+    }
+    while(!i2s.is_pattern_update_done())
+        tight_loop_contents();
+    sleep_us(200);
+    output.take();
+
+    // runs of one value: whole periods, the values only go up. The first run started before the test
+    uint mixed = 0, backwards = 0, runs = 0;
+    size_t i = 0;
+    while(i < output.words.size() && output.words[i] == 0)
+        ++i;
+    uint32_t last = 0;
+    while(i < output.words.size()) {
+        const uint32_t value = output.words[i];
+        size_t run = 0;
+        while(i < output.words.size() && output.words[i] == value) {
+            ++run;
+            ++i;
+        }
+        ++runs;
+        backwards += value <= last || value >= output.period_words.size();
+        // the last run is cut off by the end of the test
+        if(i < output.words.size() && value < output.period_words.size())
+            mixed += run % output.period_words[value] != 0;
+        last = value;
+    }
+    printf("swap change_length=%d: words=%zu runs=%u waits=%u mixed=%u backwards=%u late=%u last=%u\n",
+           change_length, output.words.size(), runs, waits, mixed, backwards, late, last);
+    CHECK(mixed == 0 && backwards == 0 && late == 0);
+    CHECK(runs > 100 && last == 300);
+    CHECK(!((pio0->fdebug >> PIO_FDEBUG_TXSTALL_LSB) & 1));
+}
+
+int main() {
+    test_swap(false);
+    test_swap(true);
+    return host_test_result();
+}
@@ -0,0 +1,331 @@
+// Golden waveform checks of the generated PIO programs on the PIO model of i2s_hal_host.hpp, for every mode and bit depth 2..32:
+//  - BCLK period and 50 % duty cycle, LRCK (or the TDM frame sync) only changing with a BCLK falling edge
+//  - cycles per frame from the LRCK period, against get_sample_rate()
+//  - bit alignment: the words on every data pin, MSB first one BCLK after the LRCK edge, LRCK low for the left channel,
+//    and the RX buffers against an I2S ADC model
+//
+//   test_pio_golden [vcd_directory]   also writes the trace of every configuration as VCD
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+#include "pio_trace.hpp"
+#include "i2s_adc_model.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+#define PIN_BCLK PIN_CLOCK_BASE
+#define PIN_LRCK (PIN_CLOCK_BASE + 1)
+
+#define FRAMES 16 // TX buffer length, a multiple of the unit frames of every format
+
+static const char *vcd_directory = NULL;
+
+struct GOLDEN_CASE {
+    I2S_CONTROLLER_MODE mode;
+    uint bit_depth;
+    uint data_lanes;
+    uint tdm_slots;
+    uint32_t divider; // 16.8
+
+    bool has_tx() const { return mode != I2S_CONTROLLER_MODE::RX; }
+    bool has_rx() const { return mode == I2S_CONTROLLER_MODE::RX || mode == I2S_CONTROLLER_MODE::TRX || mode == I2S_CONTROLLER_MODE::TRX_FULL_RATE; }
+    bool is_tdm() const { return mode == I2S_CONTROLLER_MODE::TX_TDM; }
+    uint channels() const { return is_tdm() ? tdm_slots : 2 * data_lanes; }
+    uint rx_pin() const { return mode == I2S_CONTROLLER_MODE::RX ? PIN_DATA : PIN_DATA + 1; }
+
+    // samples of the TX buffer, TX_MONO sends one word on both channels
+    int32_t tx_sample(uint32_t frame, uint channel) const {
+        return i2s_test_sample(frame % FRAMES, mode == I2S_CONTROLLER_MODE::TX_MONO ? 0 : channel, bit_depth);
+    }
+
+    uint32_t cycles_per_frame() const { return i2s_generate_pio_program(mode, bit_depth, data_lanes, channels()).cycles_per_frame; }
+
+    std::string name() const {
+        static const char *const mode_names[] = {"tx", "rx", "trx", "tx_mono", "tx_tdm", "trx_full_rate"};
+        std::string result = std::string(mode_names[mode]) + "_" + std::to_string(bit_depth);
+        if(data_lanes > 1)
+            result += "_lanes" + std::to_string(data_lanes);
+        if(is_tdm())
+            result += "_slots" + std::to_string(tdm_slots);
+        if(divider & 0xFF)
+            result += "_fractional";
+        return result;
+    }
+};
+
+// trace signals
+enum { SIGNAL_BCLK, SIGNAL_LRCK, SIGNAL_RX_DATA, SIGNAL_DATA };
+
+static bool contains(const std::vector<uint64_t> &sorted, uint64_t value) {
+    return std::binary_search(sorted.begin(), sorted.end(), value);
+}
+
+/**
+ * decode the frames on the data pins, each frame has channels samples
+ * I2S: a word starts one BCLK after the LRCK edge, LRCK low is channel 2*lane, high 2*lane+1
+ * TDM: slot 0 starts one BCLK after the frame sync rises
+ */
+static std::vector<std::vector<int32_t>> decode_frames(const PIO_TRACE &trace, const GOLDEN_CASE &c) {
+    const std::vector<uint64_t> rising = trace.edge_times(SIGNAL_BCLK, true);
+    std::vector<std::vector<int32_t>> frames;
+    std::vector<int32_t> frame(c.channels());
+    bool have_left = false;
+
+    for(const PIO_TRACE::EDGE &lrck : trace.get_edges(SIGNAL_LRCK)) {
+        if(c.is_tdm() && !lrck.level)
+            continue;
+
+        // first BCLK rising edge after the LRCK edge still belongs to the previous word
+        const size_t first = std::upper_bound(rising.begin(), rising.end(), lrck.time) - rising.begin() + 1;
+        const uint words = c.is_tdm() ? c.tdm_slots : 1;
+        if(first + words * c.bit_depth > rising.size())
+            break;
+
+        for(uint lane=0; lane<(c.is_tdm() ? 1 : c.data_lanes); ++lane) {
+            for(uint w=0; w<words; ++w) {
+                uint32_t value = 0;
+                for(uint bit=0; bit<c.bit_depth; ++bit)
+                    value = value << 1 | trace.level_at(SIGNAL_DATA + lane, rising[first + w*c.bit_depth + bit]);
+                value <<= 32 - c.bit_depth;
+                frame[c.is_tdm() ? w : 2*lane + lrck.level] = (int32_t)value;
+            }
+        }
+
+        if(c.is_tdm()) {
+            frames.push_back(frame);
+        } else if(!lrck.level) {
+            have_left = true;
+        } else if(have_left) {
+            frames.push_back(frame);
+        }
+    }
+    return frames;
+}
+
+// BCLK, LRCK and the data edges against the bit and frame timing of the mode
+static void check_timing(const PIO_TRACE &trace, const GOLDEN_CASE &c, const I2S_CONTROLLER &i2s) {
+    const uint bits_per_frame = c.is_tdm() ? c.bit_depth * c.tdm_slots : 2 * c.bit_depth;
+    const uint64_t frame_time = (uint64_t)c.cycles_per_frame() * c.divider; // 1/256 system clock cycles
+    const std::vector<uint64_t> rising = trace.edge_times(SIGNAL_BCLK, true);
+    const std::vector<uint64_t> falling = trace.edge_times(SIGNAL_BCLK, false);
+    CHECK(rising.size() > 4 * bits_per_frame);
+    if(rising.size() < 4 * bits_per_frame)
+        return;
+
+    // the PIO clock only jitters with a fractional divider, by one system clock cycle
+    const bool exact = !(c.divider & 0xFF);
+    const double bit_time = (double)frame_time / bits_per_frame;
+    const double tolerance = exact ? 0 : 256;
+    uint bad_period = 0, bad_duty = 0;
+    for(size_t i=1; i+1<rising.size(); ++i) {
+        const double period = rising[i] - rising[i-1];
+        const double high = *std::upper_bound(falling.begin(), falling.end(), rising[i-1]) - rising[i-1];
+        bad_period += fabs(period - bit_time) > tolerance;
+        bad_duty += exact ? 2 * high != period : fabs(high - bit_time / 2) > tolerance;
+    }
+    CHECK(bad_period == 0);
+    CHECK(bad_duty == 0);
+    // the whole run averages to the exact bit period
+    CHECK(fabs((double)(rising.back() - rising.front()) / (rising.size() - 1) - bit_time) < 1);
+
+    // LRCK and data only change with BCLK falling, after the entry instruction set the clocks
+    const uint64_t start = falling.front();
+    uint bad_lrck = 0, bad_data = 0;
+    for(const PIO_TRACE::EDGE &edge : trace.get_edges(SIGNAL_LRCK))
+        bad_lrck += edge.time >= start && !contains(falling, edge.time);
+    for(uint lane=0; lane<(c.has_tx() ? c.data_lanes : 0); ++lane)
+        for(const PIO_TRACE::EDGE &edge : trace.get_edges(SIGNAL_DATA + lane))
+            bad_data += !contains(falling, edge.time);
+    CHECK(bad_lrck == 0);
+    CHECK(bad_data == 0);
+
+    // frames from LRCK rising to rising, high for one word (I2S) or for one bit (TDM frame sync)
+    std::vector<uint64_t> lrck_rising = trace.edge_times(SIGNAL_LRCK, true);
+    const std::vector<uint64_t> lrck_falling = trace.edge_times(SIGNAL_LRCK, false);
+    std::erase_if(lrck_rising, [&](uint64_t time) { return time < start || time >= lrck_falling.back(); });
+    CHECK(lrck_rising.size() > 3);
+    if(lrck_rising.size() <= 3)
+        return;
+    const double high_time = c.is_tdm() ? bit_time : frame_time / 2.;
+    uint bad_frame = 0, bad_high = 0;
+    for(size_t i=1; i<lrck_rising.size(); ++i) {
+        const double period = lrck_rising[i] - lrck_rising[i-1];
+        const double high = *std::upper_bound(lrck_falling.begin(), lrck_falling.end(), lrck_rising[i-1]) - lrck_rising[i-1];
+        bad_frame += fabs(period - frame_time) > tolerance;
+        bad_high += fabs(high - high_time) > tolerance;
+    }
+    CHECK(bad_frame == 0);
+    CHECK(bad_high == 0);
+
+    // get_sample_rate() against the measured frames
+    const double measured_rate = (double)clock_get_hz(clk_sys) * 256 * (lrck_rising.size() - 1) / (lrck_rising.back() - lrck_rising.front());
+    const double cycles_per_frame = (double)(lrck_rising.back() - lrck_rising.front()) / (lrck_rising.size() - 1) / c.divider;
+    CHECK(fabs(measured_rate / i2s.get_sample_rate() - 1) < (exact ? 1e-6 : 1e-3));
+    CHECK(fabs(cycles_per_frame - c.cycles_per_frame()) < (exact ? 1e-9 : 0.1));
+}
+
+// decoded frames continue the TX buffer, from any frame on
+static void check_tx_data(const PIO_TRACE &trace, const GOLDEN_CASE &c) {
+    const std::vector<std::vector<int32_t>> frames = decode_frames(trace, c);
+    CHECK(frames.size() > FRAMES + 2);
+    if(frames.size() <= 2)
+        return;
+
+    // the first frame may have started before the trace
+    int start = -1;
+    for(uint f=0; f<FRAMES && start < 0; ++f) {
+        bool match = true;
+        for(uint ch=0; ch<c.channels(); ++ch)
+            match &= frames[1][ch] == c.tx_sample(f, ch);
+        if(match)
+            start = f;
+    }
+    CHECK(start >= 0);
+    if(start < 0) {
+        printf("  first frame:");
+        for(int32_t sample : frames[1])
+            printf(" %08x", (uint32_t)sample);
+        printf(", buffer frame 0: %08x %08x\n", (uint32_t)c.tx_sample(0, 0), (uint32_t)c.tx_sample(0, 1));
+        return;
+    }
+
+    uint bad = 0;
+    for(size_t f=1; f<frames.size(); ++f)
+        for(uint ch=0; ch<c.channels(); ++ch)
+            bad += frames[f][ch] != c.tx_sample(start + f - 1, ch);
+    CHECK(bad == 0);
+}
+
+// RX buffers continue the samples of the ADC model, left and right in place
+static void check_rx_data(const std::vector<int32_t> &left, const std::vector<int32_t> &right, const GOLDEN_CASE &c) {
+    CHECK(left.size() > FRAMES + 4);
+    if(left.size() <= FRAMES + 4)
+        return;
+
+    // the first frames are captured before the ADC model is in sync
+    const size_t first = 4;
+    int start = -1;
+    // small bit depths repeat samples, a match has to hold for a few frames
+    for(uint f=0; f<8 && start < 0; ++f) {
+        bool match = true;
+        for(uint i=0; i<8; ++i)
+            match &= left[first + i] == i2s_test_sample(f + i, 0, c.bit_depth) && right[first + i] == i2s_test_sample(f + i, 1, c.bit_depth);
+        if(match)
+            start = f;
+    }
+    CHECK(start >= 0);
+    if(start < 0) {
+        printf("  rx frame %zu: %08x %08x, adc frames 0..: %08x %08x %08x %08x\n", first, (uint32_t)left[first], (uint32_t)right[first],
+               (uint32_t)i2s_test_sample(0, 0, c.bit_depth), (uint32_t)i2s_test_sample(0, 1, c.bit_depth),
+               (uint32_t)i2s_test_sample(1, 0, c.bit_depth), (uint32_t)i2s_test_sample(1, 1, c.bit_depth));
+        return;
+    }
+
+    uint bad = 0;
+    for(size_t f=first; f<left.size(); ++f)
+        bad += left[f] != i2s_test_sample(start + f - first, 0, c.bit_depth) || right[f] != i2s_test_sample(start + f - first, 1, c.bit_depth);
+    CHECK(bad == 0);
+}
+
+static void run_case(const GOLDEN_CASE &c) {
+    const int failures = host_test_failures;
+    const I2S_SAMPLE_FORMAT format = i2s_controller_sample_format(c.mode, c.bit_depth, c.data_lanes);
+    i2s_host_gpio_put(PIN_DATA, false);
+
+    I2S_CONTROLLER i2s(FRAMES, PIN_DATA, PIN_CLOCK_BASE, c.mode, c.bit_depth, pio0, -1, -1, 8, c.data_lanes, c.tdm_slots);
+    i2s.set_pio_divider(c.divider);
+
+    // TX buffer of FRAMES frames of test samples
+    std::vector<int32_t> tx_buffer;
+    if(c.has_tx()) {
+        const uint words = c.mode == I2S_CONTROLLER_MODE::TX_MONO ? FRAMES : FRAMES * i2s_frame_bits(format, c.bit_depth, c.channels()) / 32;
+        tx_buffer.resize(words + 1); // the frame writer writes PACKED_24 frames in pairs
+        I2S_FRAME_WRITER writer(tx_buffer.data(), format, c.bit_depth, c.channels());
+        for(uint f=0; f<FRAMES; ++f) {
+            if(c.mode == I2S_CONTROLLER_MODE::TX_MONO) {
+                tx_buffer[f] = c.tx_sample(f, 0);
+            } else {
+                int32_t samples[I2S_MAX_CHANNELS];
+                for(uint ch=0; ch<c.channels(); ++ch)
+                    samples[ch] = c.tx_sample(f, ch);
+                writer.write_frame(samples);
+            }
+        }
+        i2s.queue_tx_buffer(tx_buffer.data(), words);
+    }
+
+    // ADC model first, so the trace sees its data at the step that caused it
+    I2S_ADC_MODEL *adc = c.has_rx() ? new I2S_ADC_MODEL(c.rx_pin(), PIN_BCLK, PIN_LRCK, c.bit_depth) : NULL;
+    PIO_TRACE trace({{"bclk", PIN_BCLK}, {"lrck", PIN_LRCK}, {"rx_data", c.rx_pin()},
+                     {"data0", PIN_DATA}, {"data1", PIN_DATA + 1}, {"data2", PIN_DATA + 2}, {"data3", PIN_DATA + 3}});
+
+    i2s.start_i2s();
+
+    // run FRAMES + 8 frames, collecting the RX buffers on the way
+    std::vector<int32_t> left, right;
+    const uint64_t frame_cycles = (uint64_t)c.cycles_per_frame() * c.divider / 256 + 1;
+    const uint rx_frames = c.has_rx() ? i2s.rx_queue.get_buffer_size() * 32 / i2s_frame_bits(format, c.bit_depth) : 0;
+    for(uint f=0; f<2*FRAMES + 8; ++f) {
+        i2s_host_run_cycles(frame_cycles);
+        const int32_t *buffer;
+        uint32_t len;
+        while(c.has_rx() && (buffer = i2s.rx_queue.peek(len))) {
+            const size_t size = left.size();
+            left.resize(size + rx_frames);
+            right.resize(size + rx_frames);
+            i2s_unpack_rx(buffer, rx_frames, format, c.bit_depth, left.data() + size, right.data() + size);
+            i2s.rx_queue.release();
+        }
+    }
+
+    check_timing(trace, c, i2s);
+    if(c.has_tx())
+        check_tx_data(trace, c);
+    if(c.has_rx()) {
+        check_rx_data(left, right, c);
+        CHECK(i2s.rx_queue.get_overrun_count() == 0);
+    }
+    CHECK(!(pio0->fdebug & 0x0F0F0F0Fu)); // no TX or RX stalls
+
+    const std::string name = c.name();
+    if(host_test_failures != failures) {
+        printf("  %s failed, trace in golden_%s.vcd\n", name.c_str(), name.c_str());
+        trace.write_vcd(("golden_" + name + ".vcd").c_str());
+    }
+    if(vcd_directory)
+        trace.write_vcd((std::string(vcd_directory) + "/" + name + ".vcd").c_str());
+    delete adc;
+}
+
+static void run_bit_depths(I2S_CONTROLLER_MODE mode, uint data_lanes = 1, uint tdm_slots = 8) {
+    const int failures = host_test_failures;
+    for(uint bit_depth=2; bit_depth<=32; ++bit_depth)
+        run_case({mode, bit_depth, data_lanes, tdm_slots, 4 << 8});
+    // fractional divider: same frames and rate on average, one system clock cycle of jitter
+    run_case({mode, 32, data_lanes, tdm_slots, (4 << 8) | 0x80});
+    run_case({mode, 24, data_lanes, tdm_slots, (5 << 8) | 0x40});
+    printf("%s lanes=%u slots=%u bit depths 2..32: %s\n", GOLDEN_CASE{mode, 2, data_lanes, tdm_slots, 0}.name().c_str(), data_lanes, tdm_slots,
+           host_test_failures == failures ? "ok" : "FAILED");
+}
+
+int main(int argc, char **argv) {
+    if(argc > 1)
+        vcd_directory = argv[1];
+
+    run_bit_depths(I2S_CONTROLLER_MODE::TX);
+    run_bit_depths(I2S_CONTROLLER_MODE::TX, 2);
+    run_bit_depths(I2S_CONTROLLER_MODE::TX, 4);
+    run_bit_depths(I2S_CONTROLLER_MODE::RX);
+    run_bit_depths(I2S_CONTROLLER_MODE::TRX);
+    run_bit_depths(I2S_CONTROLLER_MODE::TX_MONO);
+    for(uint slots : {2, 4, 6, 8, 16})
+        run_bit_depths(I2S_CONTROLLER_MODE::TX_TDM, 1, slots);
+    run_bit_depths(I2S_CONTROLLER_MODE::TRX_FULL_RATE);
+    return host_test_result();
+}
@@ -0,0 +1,228 @@
+// POLYPHASE_RESAMPLER: clean sine at 1 +- 200 ppm across calls, split input like one call, DRIFT_CONTROLLER ring lock through the resampler
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+
+#define CHANNELS 2
+#define AMPLITUDE 1073741824.0     // half scale
+#define FREQUENCY (1000.0 / 48000) // cycles per input frame
+#define LAG (RESAMPLER_TAPS / 2 + 1)
+
+static uint64_t step_ppm(double ppm) {
+    return (uint64_t)llround((1 + ppm * 1e-6) * 4294967296.0);
+}
+
+// a sine on the left, the inverted sine on the right
+static void sine_frames(std::vector<int32_t> &frames, uint32_t first, uint32_t count) {
+    for(uint32_t i=first; i<first+count; ++i) {
+        const int32_t sample = (int32_t)lround(AMPLITUDE * sin(2 * M_PI * FREQUENCY * i));
+        frames.push_back(sample);
+        frames.push_back(-sample);
+    }
+}
+
+/**
+ * Output frame n is the input at n*step - LAG. Odd input and output chunks, so process() stops on either side
+ * in every phase. The error is largest right after a call returned if the position is lost between calls.
+ */
+static void test_sine(double ppm) {
+    const uint32_t input_frames = 40000;
+    std::vector<int32_t> input;
+    sine_frames(input, 0, input_frames);
+
+    POLYPHASE_RESAMPLER resampler(CHANNELS);
+    const uint64_t step = step_ppm(ppm);
+    resampler.set_step(step);
+
+    std::vector<int32_t> output;
+    std::vector<bool> call_start;
+    uint32_t position = 0, calls = 0;
+    for(uint32_t chunk=17; position < input_frames; chunk = chunk % 61 + 13) {
+        int32_t out[64 * CHANNELS];
+        uint32_t consumed;
+        const uint32_t space = (chunk * 7) % 64 + 1;
+        const uint32_t written = resampler.process(input.data() + position * CHANNELS, std::min(chunk, input_frames - position),
+                                                   out, space, consumed);
+        position += consumed;
+        output.insert(output.end(), out, out + written * CHANNELS);
+        for(uint32_t i=0; i<written; ++i)
+            call_start.push_back(i == 0);
+        ++calls;
+    }
+
+    double signal = 0, noise = 0, max_error = 0, max_error_call_start = 0;
+    uint32_t wrong_sign = 0;
+    const uint32_t frames = output.size() / CHANNELS;
+    for(uint32_t n=2*RESAMPLER_TAPS; n<frames; ++n) {
+        const double t = n * (step / 4294967296.0) - LAG;
+        const double expected = AMPLITUDE * sin(2 * M_PI * FREQUENCY * t);
+        const double error = fabs(output[n * CHANNELS] - expected);
+        signal += expected * expected;
+        noise += error * error;
+        max_error = fmax(max_error, error);
+        if(call_start[n])
+            max_error_call_start = fmax(max_error_call_start, error);
+        wrong_sign += output[n * CHANNELS + 1] != -output[n * CHANNELS] && output[n * CHANNELS + 1] != -output[n * CHANNELS] - 1
+                      && output[n * CHANNELS + 1] != -output[n * CHANNELS] + 1;
+    }
+    const double snr_db = 10 * log10(signal / noise);
+    printf("sine ppm=%+.0f: calls=%u frames=%u snr_db=%.1f max_error=%.2e call_start_error=%.2e\n", ppm, calls, frames, snr_db,
+           max_error / AMPLITUDE, max_error_call_start / AMPLITUDE);
+    CHECK(snr_db > 75); // 8 taps with interpolated coefficients
+    CHECK(max_error < AMPLITUDE * 3e-4);
+    CHECK(max_error_call_start <= max_error);
+    CHECK(wrong_sign == 0);
+
+    // every input frame became step^-1 output frames
+    CHECK(fabs(frames - input_frames / (step / 4294967296.0)) < 2);
+}
+
+/**
+ * Input split at random and output space that runs out in between: the caller passes the rest again.
+ * Same output and the same consumed total as a single call with all input and enough space.
+ */
+static void test_accounting(double ppm) {
+    const uint32_t input_frames = 5000;
+    std::vector<int32_t> input;
+    sine_frames(input, 0, input_frames);
+
+    POLYPHASE_RESAMPLER whole(CHANNELS), split(CHANNELS);
+    whole.set_step(step_ppm(ppm));
+    split.set_step(step_ppm(ppm));
+
+    std::vector<int32_t> reference(2 * input_frames * CHANNELS);
+    uint32_t reference_consumed;
+    const uint32_t reference_frames = whole.process(input.data(), input_frames, reference.data(), 2 * input_frames, reference_consumed);
+    reference.resize(reference_frames * CHANNELS);
+
+    srand(3);
+    std::vector<int32_t> output;
+    uint32_t position = 0, total_consumed = 0, bad_consumed = 0, empty_calls = 0;
+    while(position < input_frames) {
+        const uint32_t offered = std::min<uint32_t>(rand() % 40, input_frames - position);
+        const uint32_t space = rand() % 40;
+        int32_t out[40 * CHANNELS];
+        uint32_t consumed;
+        const uint32_t written = split.process(input.data() + position * CHANNELS, offered, out, space, consumed);
+        bad_consumed += consumed > offered || written > space;
+        empty_calls += written == 0 && consumed == 0;
+        position += consumed;
+        total_consumed += consumed;
+        output.insert(output.end(), out, out + written * CHANNELS);
+    }
+    printf("accounting ppm=%+.0f: frames=%u split_frames=%u consumed=%u split_consumed=%u\n", ppm, reference_frames,
+           (uint32_t)(output.size() / CHANNELS), reference_consumed, total_consumed);
+    CHECK(reference_consumed == input_frames && total_consumed == input_frames && bad_consumed == 0);
+    CHECK(output == reference);
+    CHECK(empty_calls > 0); // some calls had no space or no input
+}
+
+#define WORDS_PER_SECOND 96000.0 // 32 bit stereo at 48 kHz
+#define RING_FRAMES 4096
+#define BLOCK_WORDS 256
+#define SECONDS 150
+#define SETTLED_SECONDS 90
+
+/**
+ * The model of test_drift with a fixed output clock: the DMA plays a block at the nominal rate, the DRIFT_CONTROLLER
+ * update() of the block only sets the step, and the producer writes the source frames of the block time through the resampler.
+ * Played frames are a sine without steps, the second difference stays at the curvature of the sine.
+ */
+static void test_drift_loop(double offset_ppm) {
+    POLYPHASE_RESAMPLER resampler(CHANNELS);
+    DRIFT_CONTROLLER drift(RING_FRAMES * CHANNELS / 2, 10 << 8, WORDS_PER_SECOND);
+    std::vector<int32_t> ring(RING_FRAMES * CHANNELS / 2, 0), source;
+    size_t read = 0; // half a ring of silence queued before the source starts
+
+    double time = 0, source_frames = 0, peak_error = 0, settled_error = 0, max_curvature = 0;
+    uint32_t source_written = 0;
+    int32_t previous[2] = {0, 0};
+    uint32_t played = 0;
+    for(; time<SECONDS; time += BLOCK_WORDS / WORDS_PER_SECOND) {
+        const uint32_t fill = ring.size() - read;
+        drift.update(fill, BLOCK_WORDS); // the divider is not used
+        resampler.set_step(drift.get_resampler_step());
+
+        // the block plays, the source writes meanwhile
+        if(fill < BLOCK_WORDS)
+            break;
+        for(uint32_t i=0; i<BLOCK_WORDS; i+=CHANNELS, ++played) {
+            const int32_t sample = ring[read + i];
+            if(played >= RING_FRAMES) {
+                const double curvature = fabs((double)sample - 2.0 * previous[1] + previous[0]);
+                max_curvature = fmax(max_curvature, curvature);
+            }
+            previous[0] = previous[1];
+            previous[1] = sample;
+        }
+        read += BLOCK_WORDS;
+
+        source_frames += BLOCK_WORDS / CHANNELS * (1 + offset_ppm * 1e-6);
+        const uint32_t frames = (uint32_t)source_frames - source_written;
+        source.clear();
+        sine_frames(source, source_written, frames);
+        source_written += frames;
+        for(uint32_t position=0; position<frames;) {
+            int32_t out[64 * CHANNELS];
+            uint32_t consumed;
+            const uint32_t written = resampler.process(source.data() + position * CHANNELS, frames - position, out, 64, consumed);
+            position += consumed;
+            ring.insert(ring.end(), out, out + written * CHANNELS);
+        }
+
+        const double error = fabs((double)(ring.size() - read) - RING_FRAMES * CHANNELS / 2);
+        peak_error = fmax(peak_error, error);
+        if(time > SETTLED_SECONDS)
+            settled_error = fmax(settled_error, error);
+    }
+
+    const double sine_curvature = AMPLITUDE * pow(2 * M_PI * FREQUENCY, 2);
+    printf("drift offset_ppm=%+.0f: time=%.0f peak_error=%.1f settled_error=%.1f correction_ppm=%.2f curvature=%.3f\n", offset_ppm,
+           time, peak_error, settled_error, drift.get_correction_ppm(), max_curvature / sine_curvature);
+    CHECK(time >= SECONDS);
+    CHECK(peak_error < RING_FRAMES * CHANNELS / 16);
+    CHECK(settled_error < 16 + 0.1 * peak_error);
+    CHECK(fabs(drift.get_correction_ppm() - offset_ppm) < 5);
+    CHECK(max_curvature < 1.05 * sine_curvature);
+}
+
+/**
+ * The controller with trim_divider false: the fill level reaches the correction and the resampler step,
+ * the PIO divider stays at its setting
+ */
+static void test_fixed_divider(bool trim_divider) {
+    I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+    i2s.enable_tx_streaming(10, 64);
+    i2s.enable_drift_compensation(trim_divider);
+    const uint32_t clkdiv = i2s_host_sm(pio0, 0).config.clkdiv;
+
+    // the source stops after half the ring, the output has to slow down
+    std::vector<int32_t> words(512, 0x1000);
+    i2s.tx_stream->write(words.data(), words.size());
+    i2s.start_i2s();
+    sleep_us(2000);
+
+    const uint32_t new_clkdiv = i2s_host_sm(pio0, 0).config.clkdiv;
+    printf("fixed_divider trim=%d: correction_ppm=%.1f step=0x%llx clkdiv=0x%x->0x%x\n", trim_divider, i2s.drift->get_correction_ppm(),
+           (unsigned long long)i2s.drift->get_resampler_step(), clkdiv, new_clkdiv);
+    CHECK(i2s.drift->get_correction() < 0 && i2s.drift->get_resampler_step() < (1ull << 32));
+    CHECK(trim_divider ? new_clkdiv > clkdiv : new_clkdiv == clkdiv);
+}
+
+int main() {
+    test_sine(200);
+    test_sine(-200);
+    test_accounting(200);
+    test_accounting(-200);
+    test_drift_loop(200);
+    test_drift_loop(-200);
+    test_fixed_divider(false);
+    test_fixed_divider(true);
+    return host_test_result();
+}
@@ -0,0 +1,153 @@
+// RX_BUFFER_QUEUE against a mocked DMA: buffers arrive in order, the buffer being filled is never handed out, overruns drop the newest data
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "rx_buffer_queue.hpp"
+#include "host_test.hpp"
+
+/// stands in for the RX DMA channel and its completion IRQ
+struct MOCK_DMA {
+    RX_BUFFER_QUEUE &queue;
+    int32_t *fill_buffer;
+    int32_t seq = 0;
+
+    explicit MOCK_DMA(RX_BUFFER_QUEUE &_queue) : queue(_queue), fill_buffer(_queue.get_fill_buffer()) {}
+
+    // write a whole buffer of the next sequence number, then the IRQ publishes it and restarts on the next one
+    void complete() {
+        for(uint32_t i=0; i<queue.get_buffer_size(); ++i)
+            fill_buffer[i] = seq;
+        ++seq;
+        fill_buffer = queue.buffer_filled();
+    }
+};
+
+// a buffer holds one sequence number in every word
+static int32_t buffer_seq(const int32_t *buffer, uint32_t len) {
+    for(uint32_t i=1; i<len; ++i)
+        if(buffer[i] != buffer[0])
+            return -1;
+    return buffer[0];
+}
+
+static void test_in_order() {
+    RX_BUFFER_QUEUE queue(4, 16);
+    MOCK_DMA dma(queue);
+    uint32_t len;
+    CHECK(queue.peek(len) == NULL && len == 0);
+
+    int32_t expected = 0;
+    for(int round=0; round<20; ++round) {
+        for(int i=0; i<round % 4; ++i)
+            dma.complete();
+        const int32_t *buffer;
+        while((buffer = queue.peek(len))) {
+            CHECK(buffer != dma.fill_buffer);
+            CHECK(len == 16 && buffer_seq(buffer, len) == expected++);
+            queue.release();
+        }
+    }
+    CHECK(expected == dma.seq && queue.get_overrun_count() == 0);
+}
+
+// the DMA keeps one buffer, a full queue refills it and the waiting buffers stay untouched
+static void test_overrun() {
+    RX_BUFFER_QUEUE queue(3, 8);
+    MOCK_DMA dma(queue);
+    for(int i=0; i<5; ++i)
+        dma.complete();
+    CHECK(queue.available() == 2);
+    CHECK(queue.get_overrun_count() == 3);
+
+    uint32_t len;
+    const int32_t *buffer = queue.peek(len);
+    CHECK(buffer && buffer_seq(buffer, len) == 0 && buffer != dma.fill_buffer);
+    queue.release();
+    buffer = queue.peek(len);
+    CHECK(buffer && buffer_seq(buffer, len) == 1 && buffer != dma.fill_buffer);
+
+    // a released buffer takes the next completion
+    queue.release();
+    dma.complete();
+    buffer = queue.peek(len);
+    CHECK(buffer && buffer_seq(buffer, len) == 5);
+
+    queue.reset();
+    CHECK(queue.available() == 0 && queue.get_overrun_count() == 0);
+}
+
+// counts that are no power of two: the buffers take turns in a fixed order, also when the indices wrap around
+static void test_ring_order(uint32_t buffer_count) {
+    RX_BUFFER_QUEUE queue(buffer_count, 4);
+    MOCK_DMA dma(queue);
+    std::vector<const int32_t *> handed_out;
+    for(int round=0; round<100; ++round) {
+        for(int i=0; i<round % (int)buffer_count; ++i)
+            dma.complete();
+        uint32_t len;
+        const int32_t *buffer;
+        while((buffer = queue.peek(len))) {
+            CHECK(buffer_seq(buffer, len) == (int32_t)handed_out.size());
+            handed_out.push_back(buffer);
+            queue.release();
+        }
+    }
+
+    size_t wrong = 0;
+    for(size_t i=buffer_count; i<handed_out.size(); ++i)
+        wrong += handed_out[i] != handed_out[i - buffer_count] || handed_out[i] == handed_out[i - 1];
+    printf("ring order: buffer_count=%u buffers=%zu wrong=%zu\n", buffer_count, handed_out.size(), wrong);
+    CHECK(handed_out.size() > 10 * buffer_count && wrong == 0 && queue.get_overrun_count() == 0);
+}
+
+// DMA IRQ and consumer on different cores: no torn buffers, gaps only where overruns were counted
+static void test_threads() {
+    RX_BUFFER_QUEUE queue(4, 64);
+    MOCK_DMA dma(queue);
+    const int32_t total = 50000;
+
+    std::atomic<bool> done = false;
+    std::thread producer([&]() {
+        while(dma.seq < total) {
+            dma.complete();
+            // a buffer takes a while to fill, give the consumer a chance on a single core machine
+            std::this_thread::yield();
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    int32_t last = -1, received = 0, torn = 0, out_of_order = 0;
+    while(true) {
+        // read done first, so no buffer published before it is missed
+        const bool finished = done.load(std::memory_order_acquire);
+        uint32_t len;
+        const int32_t *buffer = queue.peek(len);
+        if(!buffer) {
+            if(finished)
+                break;
+            std::this_thread::yield();
+            continue;
+        }
+        const int32_t seq = buffer_seq(buffer, len);
+        torn += seq < 0;
+        out_of_order += seq <= last;
+        last = seq;
+        ++received;
+        queue.release();
+    }
+    producer.join();
+
+    printf("threads: received=%d overruns=%u torn=%d out_of_order=%d\n", received, queue.get_overrun_count(), torn, out_of_order);
+    CHECK(received > 0 && torn == 0 && out_of_order == 0);
+    CHECK((uint32_t)received + queue.get_overrun_count() == (uint32_t)total);
+}
+
+int main() {
+    test_in_order();
+    test_overrun();
+    test_ring_order(3);
+    test_ring_order(5);
+    test_threads();
+    return host_test_result();
+}
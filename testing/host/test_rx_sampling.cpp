@@ -0,0 +1,109 @@
+// RX sampling edge of RX, TRX and TRX_FULL_RATE: the ADC model delays its data after the BCLK falling edge,
+// the capture has to stay correct up to the rising edge and break after it
+#include "i2s.hpp"
+#include "host_test.hpp"
+#include "i2s_adc_model.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+#define PIN_BCLK PIN_CLOCK_BASE
+#define PIN_LRCK (PIN_CLOCK_BASE + 1)
+
+#define BIT_DEPTH 24
+#define DIVIDER 4 // system clock cycles per PIO cycle
+
+static const char *mode_name(I2S_CONTROLLER_MODE mode) {
+    switch(mode) {
+        case I2S_CONTROLLER_MODE::RX: return "rx";
+        case I2S_CONTROLLER_MODE::TRX: return "trx";
+        case I2S_CONTROLLER_MODE::TRX_FULL_RATE: return "trx_full_rate";
+        default: return "?";
+    }
+}
+
+// capture 24 frames with the ADC data delayed by delay_cycles, true if they continue the ADC samples
+static bool capture_ok(I2S_CONTROLLER_MODE mode, uint delay_cycles) {
+    const uint rx_pin = mode == I2S_CONTROLLER_MODE::RX ? PIN_DATA : PIN_DATA + 1;
+    const I2S_SAMPLE_FORMAT format = i2s_controller_sample_format(mode, BIT_DEPTH, 1);
+    i2s_host_gpio_put(rx_pin, false);
+
+    I2S_CONTROLLER i2s(16, PIN_DATA, PIN_CLOCK_BASE, mode, BIT_DEPTH, pio0, -1, -1, 8);
+    i2s.set_pio_divider(DIVIDER << 8);
+    I2S_ADC_MODEL adc(rx_pin, PIN_BCLK, PIN_LRCK, BIT_DEPTH, delay_cycles);
+    i2s.start_i2s();
+
+    std::vector<int32_t> left, right;
+    const uint rx_frames = i2s.rx_queue.get_buffer_size() * 32 / i2s_frame_bits(format, BIT_DEPTH);
+    const uint64_t frame_cycles = (uint64_t)i2s_generate_pio_program(mode, BIT_DEPTH).cycles_per_frame * DIVIDER;
+    while(left.size() < 32) {
+        i2s_host_run_cycles(frame_cycles);
+        const int32_t *buffer;
+        uint32_t len;
+        while((buffer = i2s.rx_queue.peek(len))) {
+            const size_t size = left.size();
+            left.resize(size + rx_frames);
+            right.resize(size + rx_frames);
+            i2s_unpack_rx(buffer, rx_frames, format, BIT_DEPTH, left.data() + size, right.data() + size);
+            i2s.rx_queue.release();
+        }
+    }
+
+    // the first frames are captured before the ADC model is in sync, then frame f of the ADC at some offset
+    const size_t first = 4;
+    for(uint start=0; start<8; ++start) {
+        bool match = true;
+        for(size_t f=first; f<left.size(); ++f)
+            match &= left[f] == i2s_test_sample(start + f - first, 0, BIT_DEPTH) && right[f] == i2s_test_sample(start + f - first, 1, BIT_DEPTH);
+        if(match)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Sweep the data delay over one BCLK period. The data of a bit is valid from the falling edge plus the delay
+ * to the next falling edge plus the delay, so the capture works up to the delay where the sampling point leaves
+ * that window: the time from the falling to the rising edge when the PIO samples with the rising edge.
+ */
+static void test_sampling_edge(I2S_CONTROLLER_MODE mode) {
+    const uint bclk_cycles = i2s_generate_pio_program(mode, BIT_DEPTH).cycles_per_frame * DIVIDER / (2 * BIT_DEPTH);
+    const uint half_period = bclk_cycles / 2;
+
+    // the largest delay that still works, all smaller ones have to work too
+    int last_ok = -1;
+    uint holes = 0;
+    for(uint delay=0; delay<bclk_cycles; ++delay) {
+        if(capture_ok(mode, delay)) {
+            holes += last_ok != (int)delay - 1;
+            last_ok = delay;
+        }
+    }
+    printf("sampling %s: bclk_cycles=%u falling_to_rising=%u max_data_delay=%d holes=%u\n", mode_name(mode), bclk_cycles, half_period, last_ok, holes);
+    CHECK(holes == 0);
+
+    // every mode has to take at least half a BCLK minus one PIO cycle of delay, the model applies a new level with the
+    // next PIO step. RX samples with the next falling edge, which the input synchronizer puts before the data change
+    CHECK(last_ok >= (int)(half_period - DIVIDER) && last_ok <= (int)half_period);
+}
+
+static double sample_rate(I2S_CONTROLLER_MODE mode) {
+    I2S_CONTROLLER i2s(16, PIN_DATA, PIN_CLOCK_BASE, mode, 32, pio0);
+    i2s.set_pio_divider(DIVIDER << 8);
+    return i2s.get_sample_rate();
+}
+
+// TRX_FULL_RATE runs at the rate of TX, TRX at half of it
+static void test_rates() {
+    const double tx = sample_rate(I2S_CONTROLLER_MODE::TX), trx = sample_rate(I2S_CONTROLLER_MODE::TRX), full = sample_rate(I2S_CONTROLLER_MODE::TRX_FULL_RATE);
+    printf("rates: tx=%.0f trx=%.0f trx_full_rate=%.0f\n", tx, trx, full);
+    CHECK(full == tx);
+    CHECK(trx == tx / 2);
+}
+
+int main() {
+    test_sampling_edge(I2S_CONTROLLER_MODE::RX);
+    test_sampling_edge(I2S_CONTROLLER_MODE::TRX);
+    test_sampling_edge(I2S_CONTROLLER_MODE::TRX_FULL_RATE);
+    test_rates();
+    return host_test_result();
+}
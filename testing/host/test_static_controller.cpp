@@ -0,0 +1,155 @@
+// I2S_STATIC_CONTROLLER against I2S_CONTROLLER: the same calls give the same pins, FIFO words and RX data in every mode
+#include <vector>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+#include "i2s_adc_model.hpp"
+#include "pio_trace.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+#define PIN_BCLK PIN_CLOCK_BASE
+#define PIN_LRCK (PIN_CLOCK_BASE + 1)
+
+#define RUN_US 3000
+#define STEP_US 50
+
+enum class SOURCE { PATTERN, STREAM };
+
+// everything observable of one run, edge times relative to start_i2s()
+struct RECORDING {
+    std::vector<std::vector<PIO_TRACE::EDGE>> edges;
+    std::vector<uint32_t> tx_words;
+    std::vector<int32_t> rx_words;
+    uint32_t underruns;
+    uint32_t rx_overruns;
+
+    bool operator==(const RECORDING &other) const {
+        if(edges.size() != other.edges.size())
+            return false;
+        for(size_t s=0; s<edges.size(); ++s) {
+            if(edges[s].size() != other.edges[s].size())
+                return false;
+            for(size_t e=0; e<edges[s].size(); ++e)
+                if(edges[s][e].time != other.edges[s][e].time || edges[s][e].level != other.edges[s][e].level)
+                    return false;
+        }
+        return tx_words == other.tx_words && rx_words == other.rx_words && underruns == other.underruns && rx_overruns == other.rx_overruns;
+    }
+};
+
+/**
+ * Plays a sine pattern or a counter from the ring at a fractional divider, an ADC model feeds the RX pin.
+ * The ring is refilled and the RX buffers are released every STEP_US, at the same virtual times in every run.
+ */
+template<class CONTROLLER>
+static RECORDING record(CONTROLLER &i2s, I2S_CONTROLLER_MODE mode, SOURCE source, uint bit_depth) {
+    const bool has_tx = mode != I2S_CONTROLLER_MODE::RX;
+    const bool has_rx = mode == I2S_CONTROLLER_MODE::RX || mode == I2S_CONTROLLER_MODE::TRX || mode == I2S_CONTROLLER_MODE::TRX_FULL_RATE;
+    const uint rx_pin = mode == I2S_CONTROLLER_MODE::RX ? PIN_DATA : PIN_DATA + 1;
+    i2s.set_pio_divider(0x2C0);
+
+    int32_t counter = 0;
+    auto fill = [&]() {
+        while(i2s.tx_stream && i2s.tx_stream->free_space()) {
+            i2s.tx_stream->write(&counter, 1);
+            ++counter;
+        }
+    };
+    if(source == SOURCE::STREAM) {
+        i2s.enable_tx_streaming(10, 48);
+        fill();
+    } else if(has_tx) {
+        i2s.set_pattern(PATTERN_BUFFER::PATTERN::SINE, 0, 0x10000000, 48);
+    }
+
+    for(uint sm=0; sm<4; ++sm)
+        i2s_host_take_tx_words(pio0, sm);
+    I2S_ADC_MODEL *adc = has_rx ? new I2S_ADC_MODEL(rx_pin, PIN_BCLK, PIN_LRCK, bit_depth) : NULL;
+    PIO_TRACE trace({{"bclk", PIN_BCLK}, {"lrck", PIN_LRCK}, {"data0", PIN_DATA}, {"data1", PIN_DATA + 1}, {"data2", PIN_DATA + 2}, {"data3", PIN_DATA + 3}});
+    i2s.start_i2s();
+
+    RECORDING recording = {};
+    for(uint t=0; t<RUN_US; t+=STEP_US) {
+        sleep_us(STEP_US);
+        fill();
+        const int32_t *buffer;
+        uint32_t len;
+        while(has_rx && (buffer = i2s.rx_queue.peek(len))) {
+            recording.rx_words.insert(recording.rx_words.end(), buffer, buffer + len);
+            i2s.rx_queue.release();
+        }
+    }
+
+    for(size_t s=0; s<6; ++s) {
+        std::vector<PIO_TRACE::EDGE> edges = trace.get_edges(s);
+        for(PIO_TRACE::EDGE &edge : edges)
+            edge.time -= trace.get_start_time();
+        recording.edges.push_back(edges);
+    }
+    for(uint sm=0; sm<4; ++sm) {
+        const std::vector<uint32_t> words = i2s_host_take_tx_words(pio0, sm);
+        recording.tx_words.insert(recording.tx_words.end(), words.begin(), words.end());
+    }
+    recording.underruns = i2s.tx_stream ? i2s.tx_stream->get_underrun_count() : 0;
+    recording.rx_overruns = has_rx ? i2s.rx_queue.get_overrun_count() : 0;
+    delete adc;
+    return recording;
+}
+
+// every pin low, so both runs start from the same levels
+static void reset_pins() {
+    for(uint pin=PIN_CLOCK_BASE; pin<PIN_CLOCK_BASE+3; ++pin)
+        i2s_host_gpio_put(pin, false);
+    for(uint pin=PIN_DATA; pin<PIN_DATA+4; ++pin)
+        i2s_host_gpio_put(pin, false);
+}
+
+template<I2S_CONTROLLER_MODE MODE, uint8_t BIT_DEPTH, uint8_t DATA_LANES = 1, uint8_t TDM_SLOTS = 8>
+static void test_equivalence(SOURCE source) {
+    RECORDING runtime_recording, static_recording;
+    reset_pins();
+    {
+        I2S_CONTROLLER i2s(96, PIN_DATA, PIN_CLOCK_BASE, MODE, BIT_DEPTH, pio0, -1, -1, 4, DATA_LANES, TDM_SLOTS);
+        runtime_recording = record(i2s, MODE, source, BIT_DEPTH);
+    }
+    reset_pins();
+    {
+        I2S_STATIC_CONTROLLER<MODE, BIT_DEPTH, DATA_LANES, TDM_SLOTS> i2s(96, PIN_DATA, PIN_CLOCK_BASE, pio0);
+        static_recording = record(i2s, MODE, source, BIT_DEPTH);
+    }
+
+    size_t edges = 0;
+    for(const auto &signal_edges : runtime_recording.edges)
+        edges += signal_edges.size();
+    const bool equal = runtime_recording == static_recording;
+    printf("mode=%d bit_depth=%u lanes=%u slots=%u source=%s: edges=%zu tx_words=%zu rx_words=%zu underruns=%u equal=%d\n", (int)MODE, BIT_DEPTH,
+           DATA_LANES, TDM_SLOTS, source == SOURCE::STREAM ? "stream" : "pattern", edges, runtime_recording.tx_words.size(),
+           runtime_recording.rx_words.size(), runtime_recording.underruns, equal);
+    CHECK(equal);
+
+    // the runs did something
+    CHECK(edges > 1000 && runtime_recording.underruns == 0 && runtime_recording.rx_overruns == 0);
+    if(MODE != I2S_CONTROLLER_MODE::RX)
+        CHECK(runtime_recording.tx_words.size() > 100);
+    if(MODE == I2S_CONTROLLER_MODE::RX || MODE == I2S_CONTROLLER_MODE::TRX || MODE == I2S_CONTROLLER_MODE::TRX_FULL_RATE)
+        CHECK(runtime_recording.rx_words.size() > 100);
+}
+
+int main() {
+    test_equivalence<I2S_CONTROLLER_MODE::TX, 16>(SOURCE::PATTERN);
+    test_equivalence<I2S_CONTROLLER_MODE::TX, 24>(SOURCE::PATTERN);
+    test_equivalence<I2S_CONTROLLER_MODE::TX, 32>(SOURCE::PATTERN);
+    test_equivalence<I2S_CONTROLLER_MODE::TX, 24>(SOURCE::STREAM);
+    test_equivalence<I2S_CONTROLLER_MODE::TX, 32>(SOURCE::STREAM);
+    test_equivalence<I2S_CONTROLLER_MODE::TX_MONO, 32>(SOURCE::PATTERN);
+    test_equivalence<I2S_CONTROLLER_MODE::TX_TDM, 32, 1, 6>(SOURCE::PATTERN);
+    test_equivalence<I2S_CONTROLLER_MODE::TX_TDM, 16, 1, 4>(SOURCE::STREAM);
+    test_equivalence<I2S_CONTROLLER_MODE::TX, 32, 2>(SOURCE::PATTERN);
+    test_equivalence<I2S_CONTROLLER_MODE::TX, 16, 4>(SOURCE::STREAM);
+    test_equivalence<I2S_CONTROLLER_MODE::RX, 32>(SOURCE::PATTERN);
+    test_equivalence<I2S_CONTROLLER_MODE::RX, 24>(SOURCE::PATTERN);
+    test_equivalence<I2S_CONTROLLER_MODE::TRX, 32>(SOURCE::PATTERN);
+    test_equivalence<I2S_CONTROLLER_MODE::TRX_FULL_RATE, 32>(SOURCE::PATTERN);
+    return host_test_result();
+}
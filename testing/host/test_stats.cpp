@@ -0,0 +1,130 @@
+// I2S_STATS: aggregation of I2S_STATS_COLLECTOR, consistent snapshots from another thread, the counters of a running controller
+#include <atomic>
+#include <thread>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+
+// min, max, sum and average of the handler cycles, intervals from the IRQ times, the 32 bit us timer wrapping around
+static void test_aggregation() {
+    I2S_STATS_COLLECTOR collector;
+    I2S_STATS s = collector.snapshot();
+    CHECK(s.irq_count == 0 && s.isr_cycles_avg() == 0 && s.isr_cycles_min == 0xFFFFFFFF && s.interval_us_min == 0xFFFFFFFF && s.margin_us_min == 0xFFFFFFFF);
+
+    const uint32_t cycles[] = {300, 120, 900, 450};
+    const uint32_t times[] = {0xFFFFFF00, 0xFFFFFFA0, 0x00000050, 0x00000060}; // intervals 160, 176, 16
+    for(uint i=0; i<4; ++i)
+        collector.record_irq(cycles[i], times[i]);
+    s = collector.snapshot();
+    CHECK(s.irq_count == 4 && s.isr_cycles_min == 120 && s.isr_cycles_max == 900 && s.isr_cycles_sum == 1770 && s.isr_cycles_avg() == 442);
+    CHECK(s.interval_us_min == 16 && s.interval_us_max == 176);
+
+    // only stalls that were seen count, the margin keeps its minimum
+    collector.record_stalls(false, false);
+    collector.record_stalls(true, false);
+    collector.record_stalls(true, true);
+    collector.record_margin(80);
+    collector.record_margin(30);
+    collector.record_margin(50);
+    s = collector.snapshot();
+    CHECK(s.tx_stall_count == 2 && s.rx_stall_count == 1 && s.margin_us_min == 30);
+    CHECK(s.rx_overrun_count == 0);
+
+    // reset() takes effect with the next write from the IRQ, the first IRQ after it has no interval
+    collector.reset();
+    CHECK(collector.snapshot().irq_count == 4);
+    collector.record_irq(200, 1000);
+    s = collector.snapshot();
+    CHECK(s.irq_count == 1 && s.isr_cycles_min == 200 && s.isr_cycles_max == 200 && s.interval_us_min == 0xFFFFFFFF && s.tx_stall_count == 0);
+    CHECK(s.margin_us_min == 0xFFFFFFFF);
+
+    // a reset with only a margin write after it
+    collector.reset();
+    collector.record_margin(500);
+    s = collector.snapshot();
+    CHECK(s.irq_count == 0 && s.margin_us_min == 500);
+}
+
+/**
+ * The writer keeps every field a function of irq_count, so a torn snapshot shows up as a mismatch.
+ * One core here, so both sides yield.
+ */
+static void test_snapshot_consistency() {
+    I2S_STATS_COLLECTOR collector;
+    std::atomic<bool> done(false);
+    std::thread writer([&] {
+        for(uint32_t n=1; n<=200000; ++n) {
+            collector.record_irq(n, n * 10);
+            collector.record_stalls(true, (n & 1) != 0);
+            if(n % 64 == 0)
+                std::this_thread::yield();
+        }
+        done = true;
+    });
+
+    uint snapshots = 0, torn = 0;
+    while(!done) {
+        const I2S_STATS s = collector.snapshot();
+        const uint64_t n = s.irq_count;
+        if(n) {
+            // record_stalls() of the same n may not have happened yet
+            torn += s.isr_cycles_sum != n * (n + 1) / 2 || s.isr_cycles_max != n || s.isr_cycles_min != 1;
+            torn += (n > 1 && (s.interval_us_min != 10 || s.interval_us_max != 10));
+            torn += s.tx_stall_count != n && s.tx_stall_count != n - 1;
+        }
+        ++snapshots;
+        std::this_thread::yield();
+    }
+    writer.join();
+    printf("consistency: snapshots=%u torn=%u\n", snapshots, torn);
+    CHECK(snapshots > 10 && torn == 0);
+}
+
+// a streaming controller: one IRQ per block, no stalls, margins within a block, RX overruns from the queue
+static void test_controller() {
+    I2S_CONTROLLER i2s(256, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX, 32, pio0);
+    i2s.set_pio_divider(4 << 8);
+    i2s.enable_tx_streaming(10, 128);
+    auto fill = [&]() {
+        const int32_t frame[2] = {0x1000, -0x1000};
+        while(i2s.tx_stream->free_space() >= 2)
+            i2s.tx_stream->write(frame, 2);
+    };
+    fill();
+    i2s.start_i2s();
+    sleep_us(1000);
+    fill();
+    i2s.reset_stats();
+    for(uint i=0; i<100; ++i) {
+        sleep_us(200);
+        fill();
+    }
+
+    const I2S_STATS tx = i2s.get_tx_stats();
+    const double block_us = 64 / i2s.get_sample_rate() * 1e6;
+    printf("controller: irqs=%u interval_us=%u..%u block_us=%.1f margin_us_min=%u tx_stalls=%u\n", tx.irq_count, tx.interval_us_min, tx.interval_us_max,
+           block_us, tx.margin_us_min, tx.tx_stall_count);
+    CHECK(tx.irq_count >= (uint32_t)(20000 / block_us) - 1 && tx.irq_count <= (uint32_t)(20000 / block_us) + 1);
+    CHECK(tx.interval_us_min >= block_us - 1 && tx.interval_us_max <= block_us + 1);
+    CHECK(tx.margin_us_min > 0 && tx.margin_us_min <= block_us + 1 && tx.tx_stall_count == 0);
+    CHECK(i2s.tx_stream->get_underrun_count() == 0);
+
+    I2S_CONTROLLER rx(64, PIN_DATA + 1, PIN_CLOCK_BASE + 3, I2S_CONTROLLER_MODE::RX, 32, pio1, -1, -1, 4);
+    rx.set_pio_divider(4 << 8);
+    rx.start_i2s();
+    sleep_us(5000); // nobody releases the buffers
+    const I2S_STATS rx_stats = rx.get_rx_stats();
+    printf("controller: rx irqs=%u rx_overruns=%u rx_stalls=%u\n", rx_stats.irq_count, rx_stats.rx_overrun_count, rx_stats.rx_stall_count);
+    CHECK(rx_stats.irq_count > 4 && rx_stats.rx_overrun_count == rx.rx_queue.get_overrun_count() && rx_stats.rx_overrun_count > 0);
+    CHECK(rx_stats.rx_stall_count == 0);
+}
+
+int main() {
+    test_aggregation();
+    test_snapshot_consistency();
+    test_controller();
+    return host_test_result();
+}
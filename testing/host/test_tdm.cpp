@@ -0,0 +1,125 @@
+// TDM on the PIO model: frame sync position and width, slot boundaries, every slot with walking one bit samples
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+#include "pio_trace.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+#define PIN_BCLK PIN_CLOCK_BASE
+#define PIN_FSYNC (PIN_CLOCK_BASE + 1)
+
+#define FRAMES 32
+
+enum { SIGNAL_BCLK, SIGNAL_FSYNC, SIGNAL_DATA };
+
+// the only set bit of a sample, counted from the MSB, differs between neighbouring slots and frames
+static uint one_bit(uint frame, uint slot, uint bit_depth) {
+    return (frame * 5 + slot * 3) % bit_depth;
+}
+
+// bit positions of the set bits of a frame, sorted
+static std::vector<uint> expected_bits(uint frame, uint slots, uint bit_depth) {
+    std::vector<uint> bits;
+    for(uint slot=0; slot<slots; ++slot)
+        bits.push_back(slot * bit_depth + one_bit(frame, slot, bit_depth));
+    return bits;
+}
+
+static void test_tdm(uint slots, uint bit_depth) {
+    const int failures = host_test_failures;
+    const I2S_SAMPLE_FORMAT format = i2s_controller_sample_format(I2S_CONTROLLER_MODE::TX_TDM, bit_depth, 1);
+    I2S_CONTROLLER i2s(FRAMES, PIN_DATA, PIN_CLOCK_BASE, I2S_CONTROLLER_MODE::TX_TDM, bit_depth, pio0, -1, -1, 8, 1, slots);
+    i2s.set_pio_divider(4 << 8);
+    CHECK(i2s.get_channel_count() == slots);
+
+    const uint words = FRAMES * i2s_frame_bits(format, bit_depth, slots) / 32;
+    std::vector<int32_t> buffer(words + 1);
+    I2S_FRAME_WRITER writer(buffer.data(), format, bit_depth, slots);
+    for(uint f=0; f<FRAMES; ++f) {
+        int32_t samples[I2S_MAX_CHANNELS];
+        for(uint slot=0; slot<slots; ++slot)
+            samples[slot] = (int32_t)(0x80000000u >> one_bit(f, slot, bit_depth));
+        writer.write_frame(samples);
+    }
+    i2s.queue_tx_buffer(buffer.data(), words);
+
+    PIO_TRACE trace({{"bclk", PIN_BCLK}, {"fsync", PIN_FSYNC}, {"data", PIN_DATA}});
+    i2s.start_i2s();
+    const uint32_t cycles_per_frame = i2s_generate_pio_program(I2S_CONTROLLER_MODE::TX_TDM, bit_depth, 1, slots).cycles_per_frame;
+    i2s_host_run_cycles((uint64_t)(FRAMES + 8) * cycles_per_frame * 4);
+
+    const std::vector<uint64_t> rising = trace.edge_times(SIGNAL_BCLK, true);
+    const std::vector<uint64_t> falling = trace.edge_times(SIGNAL_BCLK, false);
+    const std::vector<uint64_t> sync_rising = trace.edge_times(SIGNAL_FSYNC, true);
+    const std::vector<uint64_t> sync_falling = trace.edge_times(SIGNAL_FSYNC, false);
+    CHECK(sync_rising.size() > FRAMES + 2);
+    if(sync_rising.size() <= 2)
+        return;
+
+    // frame sync: rises with a BCLK falling edge, high for exactly one BCLK, every slots * bit_depth BCLKs
+    uint bad_sync = 0, bad_frame_length = 0;
+    std::vector<std::vector<uint>> frames;
+    for(size_t i=1; i+1<sync_rising.size(); ++i) {
+        const size_t fall = std::lower_bound(falling.begin(), falling.end(), sync_rising[i]) - falling.begin();
+        const auto sync_end = std::upper_bound(sync_falling.begin(), sync_falling.end(), sync_rising[i]);
+        bad_sync += fall + 1 >= falling.size() || falling[fall] != sync_rising[i] || sync_end == sync_falling.end() || *sync_end != falling[fall + 1];
+
+        // BCLK rising edges from one frame sync to the next: the last bit of the previous frame, then slots * bit_depth bits
+        const size_t first = std::upper_bound(rising.begin(), rising.end(), sync_rising[i]) - rising.begin();
+        const size_t next = std::upper_bound(rising.begin(), rising.end(), sync_rising[i+1]) - rising.begin();
+        bad_frame_length += next - first != slots * bit_depth;
+
+        // slot 0 starts with the second rising edge, its MSB is sampled one BCLK after the frame sync
+        std::vector<uint> bits;
+        for(uint bit=0; bit<slots*bit_depth && first + 1 + bit < rising.size(); ++bit)
+            if(trace.level_at(SIGNAL_DATA, rising[first + 1 + bit]))
+                bits.push_back(bit);
+        frames.push_back(bits);
+    }
+    CHECK(bad_sync == 0);
+    CHECK(bad_frame_length == 0);
+
+    // the first frame may have started before the trace, the buffer frame of the second one is found by trying them all
+    size_t best_bad = SIZE_MAX;
+    uint best_start = 0;
+    for(uint start=0; start<FRAMES; ++start) {
+        size_t bad = 0;
+        for(size_t f=0; f<frames.size(); ++f)
+            bad += frames[f] != expected_bits((start + f) % FRAMES, slots, bit_depth);
+        if(bad < best_bad) {
+            best_bad = bad;
+            best_start = start;
+        }
+    }
+    CHECK(best_bad == 0);
+
+    // the first wrong frame, with the bit positions seen and expected
+    for(size_t f=0; f<frames.size() && best_bad; ++f) {
+        const std::vector<uint> expected = expected_bits((best_start + f) % FRAMES, slots, bit_depth);
+        if(frames[f] == expected)
+            continue;
+        std::string seen, wanted;
+        for(uint bit : frames[f])
+            seen += " " + std::to_string(bit);
+        for(uint bit : expected)
+            wanted += " " + std::to_string(bit);
+        printf("  frame %zu: bits%s, expected%s\n", f, seen.c_str(), wanted.c_str());
+        break;
+    }
+    CHECK(!(pio0->fdebug & 0x0F000000u));
+    printf("slots=%u bit_depth=%u frames=%zu bad_sync=%u bad_frame_length=%u: %s\n", slots, bit_depth, frames.size(), bad_sync, bad_frame_length,
+           host_test_failures == failures ? "ok" : "FAILED");
+}
+
+int main() {
+    for(uint slots : {2, 4, 6, 8, 16})
+        for(uint bit_depth : {16, 24, 32})
+            test_tdm(slots, bit_depth);
+    test_tdm(8, 20);
+    test_tdm(4, 8);
+    return host_test_result();
+}
@@ -0,0 +1,239 @@
+// TX_RING_BUFFER: underruns keep frames aligned for every sample format, producer and DMA consumer on different threads
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#define PIN_DATA 20
+#define PIN_CLOCK_BASE 17
+
+// consumer side like the DMA IRQ: one block playing, one queued
+struct MOCK_DMA {
+    TX_RING_BUFFER &ring;
+    std::vector<int32_t> played;
+    std::vector<size_t> idle_positions; // words of real data played before each idle block
+    uint bad_idle_len = 0;
+
+    explicit MOCK_DMA(TX_RING_BUFFER &_ring) : ring(_ring) {
+        start();
+        start();
+    }
+
+    void start() {
+        uint32_t len;
+        const int32_t *block = ring.start_block(len);
+        if(block == NULL)
+            return;
+        if(ring.get_underrun_count() != idle_positions.size()) {
+            idle_positions.push_back(played.size());
+            bad_idle_len += len != ring.get_idle_block_len();
+        } else {
+            played.insert(played.end(), block, block + len);
+        }
+    }
+
+    /// the playing block is done, the queued one plays and the next one is queued
+    void complete() {
+        ring.finish_block();
+        start();
+    }
+};
+
+// idle blocks are whole units and start at unit boundaries, the data is played unchanged around them
+static void test_units() {
+    std::mt19937 random(1);
+    for(uint32_t unit=1; unit<=31; ++unit) {
+        TX_RING_BUFFER ring(6, 16, unit);
+        MOCK_DMA dma(ring);
+
+        // the producer writes odd amounts, the consumer runs dry in between
+        std::vector<int32_t> written;
+        int32_t counter = 1;
+        for(int round=0; round<200; ++round) {
+            const uint32_t len = random() % 24;
+            for(uint32_t i=0; i<len && ring.free_space(); ++i) {
+                ring.write(&counter, 1);
+                written.push_back(counter++);
+            }
+            for(uint32_t blocks=random() % 4; blocks; --blocks)
+                dma.complete();
+        }
+        // the rest, up to whole units
+        while(written.size() % unit) {
+            while(!ring.free_space())
+                dma.complete();
+            ring.write(&counter, 1);
+            written.push_back(counter++);
+        }
+        while(ring.fill_level())
+            dma.complete();
+
+        uint misaligned = 0;
+        for(size_t position : dma.idle_positions)
+            misaligned += position % unit != 0;
+        const bool data_ok = dma.played == written;
+        if(!data_ok || misaligned || dma.bad_idle_len || ring.get_idle_block_len() % unit || dma.idle_positions.empty())
+            printf("unit=%u: words=%zu/%zu underruns=%zu misaligned=%u bad_idle_len=%u\n", unit, dma.played.size(), written.size(),
+                   dma.idle_positions.size(), misaligned, dma.bad_idle_len);
+        CHECK(data_ok && misaligned == 0 && dma.bad_idle_len == 0);
+        CHECK(ring.get_idle_block_len() % unit == 0 && ring.get_block_size() % unit == 0);
+        CHECK(!dma.idle_positions.empty());
+    }
+}
+
+// sample whose 32 bit, 16 bit, byte and interleaved words are never 0, so idle words (0) can be told apart
+static int32_t nonzero_sample(uint32_t index) {
+    uint32_t x = index * 0x9E3779B9u;
+    x ^= x >> 15;
+    return (int32_t)(x | 0x80808080u);
+}
+
+// the controller streams through underruns with any sample format, idle blocks only between whole units
+static void test_underrun(I2S_CONTROLLER_MODE mode, uint bit_depth, uint lanes = 1, uint tdm_slots = 8) {
+    I2S_CONTROLLER i2s(64, PIN_DATA, PIN_CLOCK_BASE, mode, bit_depth, pio0, -1, -1, 4, lanes, tdm_slots);
+    i2s.set_pio_divider(0x200);
+    i2s.enable_tx_streaming(8, 40);
+
+    const I2S_SAMPLE_FORMAT format = i2s.get_sample_format();
+    const uint channels = i2s.get_channel_count();
+    const bool mono = mode == I2S_CONTROLLER_MODE::TX_MONO;
+    const uint32_t frame_bits = i2s_frame_bits(format, bit_depth, channels);
+    const uint unit = i2s.tx_stream->get_unit_words();
+    CHECK(unit == (mono ? 1 : i2s_unit_words(frame_bits)));
+
+    // the words of whole units of frames
+    const uint frames = 60 * (mono ? 1 : i2s_unit_frames(frame_bits));
+    std::vector<int32_t> words(frames * (mono ? 32 : frame_bits) / 32 + 1);
+    I2S_FRAME_WRITER writer(words.data(), format, bit_depth, channels);
+    for(uint f=0; f<frames; ++f) {
+        if(mono) {
+            words[f] = nonzero_sample(f);
+        } else {
+            int32_t samples[I2S_MAX_CHANNELS];
+            for(uint ch=0; ch<channels; ++ch)
+                samples[ch] = nonzero_sample(f * channels + ch);
+            writer.write_frame(samples);
+        }
+    }
+    words.pop_back();
+
+    // odd chunks, each one plays out before the next
+    i2s.start_i2s();
+    size_t position = 0;
+    for(uint chunk=7; position < words.size(); chunk = chunk % 13 + 5) {
+        position += i2s.tx_stream->write(words.data() + position, std::min<size_t>(chunk, words.size() - position));
+        while(i2s.tx_stream->fill_level() >= unit) // a partial unit waits for the next chunk
+            sleep_us(5);
+        sleep_us(20);
+    }
+
+    // FIFO words back to buffer words, the DMA swaps the bytes of PACKED_24 words
+    std::vector<uint32_t> fifo = i2s_host_take_tx_words(pio0, 0);
+    std::vector<uint32_t> expected;
+    for(int32_t word : words)
+        expected.push_back(i2s_dma_byte_swap(format) ? __builtin_bswap32(word) : (uint32_t)word);
+
+    size_t data = 0;
+    uint misaligned = 0, bad_idle_len = 0, wrong = 0, idle_runs = 0;
+    for(size_t i=0; i<fifo.size();) {
+        if(fifo[i] == 0) {
+            size_t run = 0;
+            while(i < fifo.size() && fifo[i] == 0) {
+                ++run;
+                ++i;
+            }
+            ++idle_runs;
+            misaligned += data % unit != 0;
+            // the last run is cut off by the end of the test
+            bad_idle_len += i < fifo.size() && run % i2s.tx_stream->get_idle_block_len() != 0;
+        } else {
+            wrong += data >= expected.size() || fifo[i] != expected[data];
+            ++data;
+            ++i;
+        }
+    }
+    printf("underrun mode=%d bit_depth=%u lanes=%u channels=%u unit=%u: words=%zu/%zu idle_runs=%u underruns=%u misaligned=%u bad_idle_len=%u wrong=%u\n",
+           (int)mode, bit_depth, lanes, channels, unit, data, expected.size(), idle_runs, i2s.tx_stream->get_underrun_count(), misaligned, bad_idle_len, wrong);
+    CHECK(data == expected.size() && wrong == 0);
+    CHECK(idle_runs > 2 && misaligned == 0 && bad_idle_len == 0);
+}
+
+// producer and consumer on two threads: the order survives, throughput of the ring itself
+static void test_threads(uint32_t unit) {
+    TX_RING_BUFFER ring(10, 96, unit);
+    const uint32_t total = 3000000 / unit * unit;
+    std::atomic<bool> done = false;
+
+    std::thread producer([&]() {
+        std::mt19937 random(2);
+        int32_t chunk[64];
+        uint32_t counter = 0;
+        while(counter < total) {
+            uint32_t len = random() % 64 + 1;
+            if(len > total - counter)
+                len = total - counter;
+            for(uint32_t i=0; i<len; ++i)
+                chunk[i] = counter + i;
+            const uint32_t written = ring.write(chunk, len);
+            counter += written;
+            if(written < len)
+                std::this_thread::yield();
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    // checks every block when it is handed out, the data stays in place until finish_block()
+    uint32_t expected = 0, wrong = 0, misaligned = 0, underruns = 0;
+    auto start_block = [&]() {
+        uint32_t len;
+        const int32_t *block = ring.start_block(len);
+        if(ring.get_underrun_count() != underruns) {
+            underruns = ring.get_underrun_count();
+            misaligned += expected % unit != 0 || len % unit != 0;
+            std::this_thread::yield();
+            return;
+        }
+        for(uint32_t i=0; i<len; ++i)
+            wrong += (uint32_t)block[i] != expected + i;
+        expected += len;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    start_block();
+    start_block();
+    while(expected < total) {
+        if(done.load(std::memory_order_acquire) && ring.fill_level() == 0)
+            break;
+        ring.finish_block();
+        start_block();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    producer.join();
+
+    printf("bench=tx_ring_threads unit=%u words=%u words_per_s=%.0f underruns=%u misaligned=%u wrong=%u\n",
+           unit, expected, expected / seconds, underruns, misaligned, wrong);
+    CHECK(expected == total && wrong == 0 && misaligned == 0);
+}
+
+int main() {
+    test_units();
+
+    test_underrun(I2S_CONTROLLER_MODE::TX, 32);
+    test_underrun(I2S_CONTROLLER_MODE::TX, 16);
+    test_underrun(I2S_CONTROLLER_MODE::TX, 24);
+    test_underrun(I2S_CONTROLLER_MODE::TX, 20, 2);
+    test_underrun(I2S_CONTROLLER_MODE::TX, 24, 4);
+    test_underrun(I2S_CONTROLLER_MODE::TX_MONO, 32);
+    test_underrun(I2S_CONTROLLER_MODE::TX_TDM, 32, 1, 6);
+    test_underrun(I2S_CONTROLLER_MODE::TX_TDM, 16, 1, 6);
+    test_underrun(I2S_CONTROLLER_MODE::TX_TDM, 24, 1, 10);
+    test_underrun(I2S_CONTROLLER_MODE::TX_TDM, 16, 1, 14);
+
+    test_threads(2);
+    test_threads(3);
+    test_threads(5);
+    return host_test_result();
+}
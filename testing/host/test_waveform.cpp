@@ -0,0 +1,109 @@
+// Fixed point waveform kernels against double precision references, and against the float implementation they replaced
+#include <math.h>
+#include <chrono>
+
+#include "i2s.hpp"
+#include "host_test.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HOST_CYCLES() __rdtsc()
+#else
+#define HOST_CYCLES() 0ull
+#endif
+
+// the generator before the fixed point kernels, double sine of a float phase
+static int32_t float_sine(uint i, uint length, int32_t amplitude, int32_t offset) {
+    return sin(2*M_PI*(((int)i)/(float)length))*amplitude + offset;
+}
+
+static double reference_sine(uint i, uint length, int32_t amplitude, int32_t offset) {
+    return sin(2*M_PI*i/length)*amplitude + offset;
+}
+
+// sine_q31 over the whole period, error in Q31 LSB and in LSB of a 24 bit sample
+static void test_sine_q31() {
+    double max_error = 0;
+    for(uint64_t phase=0; phase<(1ull << 32); phase+=0x10001) {
+        const double error = fabs(sine_q31(phase) - sin(2*M_PI*phase / 4294967296.0) * 2147483647.0);
+        max_error = error > max_error ? error : max_error;
+    }
+    printf("sine_q31: max_error_q31_lsb=%.0f max_error_24bit_lsb=%.4f\n", max_error, max_error / 256);
+    CHECK(max_error <= 4); // 0.016 LSB of a 24 bit sample
+    CHECK(sine_q31(0) == 0 && sine_q31(0x40000000) == 2147483647 && sine_q31(0xC0000000) == -2147483647);
+}
+
+// PATTERN_BUFFER sine is within a few LSB of the exact values, much closer than the float implementation was
+static void test_pattern_sine(uint length, int32_t amplitude, int32_t offset) {
+    PATTERN_BUFFER buffer(length);
+    buffer.set_pattern(PATTERN_BUFFER::PATTERN::SINE, offset, amplitude, length);
+
+    double max_error = 0, max_error_float = 0;
+    for(uint i=0; i<length; ++i) {
+        const double reference = reference_sine(i, length, amplitude, offset);
+        const double error = fabs(buffer.pattern_buffer[2*i] - reference);
+        const double error_float = fabs(float_sine(i, length, amplitude, offset) - reference);
+        max_error = error > max_error ? error : max_error;
+        max_error_float = error_float > max_error_float ? error_float : max_error_float;
+        CHECK(buffer.pattern_buffer[2*i+1] == buffer.pattern_buffer[2*i]);
+    }
+    printf("pattern sine: length=%u amplitude=%d max_error_lsb=%.1f float_max_error_lsb=%.1f\n", length, amplitude, max_error, max_error_float);
+    CHECK(max_error <= fabs((double)amplitude) * 4e-9 + 2);
+    CHECK(max_error <= max_error_float + 1);
+}
+
+// triangles are exact: 2*amplitude*i/length on the rising half, mirrored on the falling half
+static void test_pattern_triangle(uint length, int32_t amplitude, int32_t offset) {
+    PATTERN_BUFFER buffer(length);
+    buffer.set_pattern(PATTERN_BUFFER::PATTERN::TRI, offset, amplitude, length);
+
+    uint wrong = 0;
+    for(uint i=0; i<length; ++i) {
+        const int64_t ramp = i < length/2 ? i : length - i - 1;
+        wrong += buffer.pattern_buffer[2*i] != (int32_t)(2*(int64_t)amplitude*ramp / (int64_t)length + offset);
+    }
+    printf("pattern triangle: length=%u amplitude=%d wrong=%u\n", length, amplitude, wrong);
+    CHECK(wrong == 0);
+}
+
+// host timing of the kernels, the cycle counts only mean something relative to each other
+template<class F>
+static void bench(const char *name, uint samples, F f, uint samples_per_call = 1) {
+    volatile uint32_t sink = 0; // unsigned, so the sum may wrap
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t start_cycles = HOST_CYCLES();
+    for(uint i=0; i<samples; ++i)
+        sink = sink + (uint32_t)f(i);
+    const uint64_t cycles = HOST_CYCLES() - start_cycles;
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    samples *= samples_per_call;
+    printf("bench=waveform kernel=%s samples=%u ns_per_sample=%.2f host_cycles_per_sample=%.2f\n", name, samples, ns / samples, (double)cycles / samples);
+}
+
+int main() {
+    test_sine_q31();
+    test_pattern_sine(1000, 0x40000000, 0);
+    test_pattern_sine(4096, 0x7FFFFFFF, 0);
+    test_pattern_sine(48, -0x100000, 0x1000);
+    test_pattern_sine(997, 0x7FFF << 16, 0);
+    test_pattern_triangle(1000, 0x40000000, 0);
+    test_pattern_triangle(999, 0x7FFFFFFF, -5);
+    test_pattern_triangle(64, -0x123456, 77);
+
+    const uint samples = 1 << 22, length = 4096;
+    WAVEFORM_PHASE phase(length);
+    bench("sine_q31", samples, [&](uint) {
+        const int32_t value = scale_q31(0x40000000, sine_q31(phase.get()));
+        phase.next();
+        return value;
+    });
+    bench("float_sine", samples, [&](uint i) { return float_sine(i % length, length, 0x40000000, 0); });
+
+    // whole buffers, one call renders length stereo frames through the frame writer, so this is the cost per frame
+    PATTERN_BUFFER buffer(length);
+    bench("pattern_buffer_sine", 64, [&](uint i) {
+        buffer.set_pattern(PATTERN_BUFFER::PATTERN::SINE, i, 0x40000000, length);
+        return buffer.pattern_buffer[0];
+    }, length);
+    return host_test_result();
+}
@@ -1,21 +1,42 @@
 #pragma once
 
-#include <hardware/pio.h>
-#include <hardware/dma.h>
-#include <hardware/clocks.h>
-
 #include <exception>
-#define _USE_MATH_DEFINES
-#include <cmath>
+#include <inttypes.h>
+
+#include "i2s_hal.hpp"
 
-#define I2S_PIO_MAX_PROGRAM_LENGTH 16
+#include "waveform.hpp"
+#include "sample_format.hpp"
+#include "i2s_pio_program.hpp"
+#include "i2s_clock.hpp"
+#include "i2s_memory.hpp"
+
+#include "rx_buffer_queue.hpp"
+#include "tx_ring_buffer.hpp"
+#include "duplex_processor.hpp"
+#include "awg_sequence.hpp"
+#include "dds_generator.hpp"
+#include "drift_controller.hpp"
+#include "resampler.hpp"
+#include "i2s_stats.hpp"
 
 // This can be changed to DMA IRQ1 if needed
 #define I2S_DMA_IRQ 0
 
+// maximum number of interleaved channels per frame (left/right of every data lane or TDM slots)
+#define PATTERN_BUFFER_MAX_CHANNELS I2S_MAX_CHANNELS
+
 /**
  * @brief small class that provides the I2S buffer and pattern
  *  can generate some basic waveforms and quick updating
+ *
+ * Every change is rendered into a second buffer that becomes the front buffer afterwards.
+ * While I2S is running, use the I2S_CONTROLLER wrappers so the DMA switches buffers on a period boundary.
+ *
+ * Each channel (left/right of every data lane, or TDM slot) has its own pattern, offset, amplitude and phase.
+ * Identical channels are generated once and copied.
+ * Frames are stored in the sample format of the bit depth (see sample_format.hpp), so 16 bit patterns need half the memory.
+ * In mono mode only one word per frame is stored and the PIO sends it on both channels (see I2S_CONTROLLER_MODE::TX_MONO).
  */
 class PATTERN_BUFFER {
 public:
@@ -26,112 +47,329 @@ public:
         SQUARE=3,
     };
 
-    int32_t *pattern_buffer;
+    struct CHANNEL_SETTINGS {
+        PATTERN pattern;
+        int32_t offset, amplitude;
+        uint32_t phase; // 2**32 is one period
+
+        bool operator==(const CHANNEL_SETTINGS &other) const {
+            return pattern == other.pattern && offset == other.offset && amplitude == other.amplitude && phase == other.phase;
+        }
+    };
+
+    int32_t *pattern_buffer; // front buffer with the current pattern
 private:
+    int32_t *back_buffer;    // the next pattern is rendered here, so the front buffer is never modified
     uint buffer_size, pattern_length;
-    PATTERN pattern;
-    int32_t offset, amplitude;
+    const I2S_SAMPLE_FORMAT format;
+    const uint bit_depth;
+    const uint channel_count;
+    const bool mono;         // one word per frame for both channels
+    const uint length_step;  // e.g. PACKED_24 patterns need an even length to fill whole words
+    I2S_BUFFER_ARENA *const arena;
+    CHANNEL_SETTINGS channels[PATTERN_BUFFER_MAX_CHANNELS];
 
 private:
-    /// update the pattern buffer
-    void update_pattern_buffer() {
-        switch(pattern) {
-            case PATTERN::CONST:
-                for(uint i=0; i<pattern_length*2; ++i)
-                    pattern_buffer[i] = offset;
-                break;
-            case PATTERN::SINE:
-                for(uint i=0; i<pattern_length*2; ++i)
-                    pattern_buffer[i] = sin(2*M_PI*(((int)(i/2))/(float)pattern_length))*amplitude + offset;
-                break;
-            case PATTERN::TRI:
-                for(uint i=0; i<pattern_length; ++i) {
-                    if(i < (pattern_length/2)) {
-                        pattern_buffer[i*2] = ((float)amplitude) * i*2/pattern_length + offset;
-                    } else {
-                        pattern_buffer[i*2] = ((float)amplitude) * (pattern_length-i-1)*2/pattern_length + offset;
-                    }
-                    pattern_buffer[i*2+1] = pattern_buffer[i*2];
+    /**
+     * @brief generates the samples of one channel in buffer order
+     * The phase rotates the pattern, so the first sample is pattern sample ((phase * length) >> 32).
+     */
+    class CHANNEL_GENERATOR {
+    private:
+        CHANNEL_SETTINGS settings;
+        uint length;
+        uint index;           // pattern sample of the next call
+        WAVEFORM_PHASE phase; // SINE, exact and not rounded to whole samples
+        WAVEFORM_RAMP ramp;   // TRI, positioned at ramp_index(index)
+
+        // the falling half of the triangle mirrors the rising half
+        uint ramp_index(uint i) const { return i < length/2 ? i : length - i - 1; }
+    public:
+        CHANNEL_GENERATOR() : settings{PATTERN::CONST, 0, 0, 0}, length(1), index(0) {}
+
+        CHANNEL_GENERATOR(const CHANNEL_SETTINGS &_settings, uint _length) : settings(_settings), length(_length),
+            index(((uint64_t)settings.phase * length) >> 32), phase(length, settings.phase), ramp(2*(int64_t)settings.amplitude, length, ramp_index(index)) {}
+
+        int32_t next() {
+            int32_t value;
+            uint next_index = index + 1 == length ? 0 : index + 1;
+
+            switch(settings.pattern) {
+                case PATTERN::CONST:
+                    value = settings.offset;
+                    break;
+                case PATTERN::SINE:
+                    value = scale_q31(settings.amplitude, sine_q31(phase.get())) + settings.offset;
+                    phase.next();
+                    break;
+                case PATTERN::TRI: {
+                    value = ramp.get() + settings.offset;
+
+                    // the ramp index changes by at most one per sample
+                    uint current = ramp_index(index), upcoming = ramp_index(next_index);
+                    if(upcoming > current)
+                        ramp.next();
+                    else if(upcoming < current)
+                        ramp.prev();
+                    break;
                 }
-                break;
-            case PATTERN::SQUARE:
-                for(uint i=0; i<pattern_length*2; ++i)
-                    pattern_buffer[i] = (((uint)(i/2)) >= (pattern_length/2))*amplitude + offset;
-                break;
-            default: // handle undefined pattern values gracefully
+                case PATTERN::SQUARE:
+                    value = (index >= (length/2))*settings.amplitude + settings.offset;
+                    break;
+                default: // handle undefined pattern values gracefully
+                    value = 0;
+            }
+
+            index = next_index;
+            return value;
+        }
+    };
+
+    /// render the pattern into the back buffer and swap it to the front
+    void update_pattern_buffer() {
+        int32_t *buffer = back_buffer;
+        CHANNEL_GENERATOR generators[PATTERN_BUFFER_MAX_CHANNELS];
+        uint source[PATTERN_BUFFER_MAX_CHANNELS]; // channel the samples are copied from
+
+        for(uint c=0; c<channel_count; ++c) {
+            if(channels[c].pattern > PATTERN::SQUARE)
                 printf("pattern_buffer: Pattern not implemented\n");
-                for(uint i=0; i<pattern_length*2; ++i)
-                    pattern_buffer[i] = 0;
+
+            // channels with the same settings as a previous one are copied instead of generated
+            source[c] = c;
+            for(uint other=0; other<c; ++other) {
+                if(channels[other] == channels[c]) {
+                    source[c] = other;
+                    break;
+                }
+            }
+            if(source[c] == c)
+                generators[c] = CHANNEL_GENERATOR(channels[c], pattern_length);
+        }
+
+        if(mono) {
+            for(uint i=0; i<pattern_length; ++i)
+                buffer[i] = generators[0].next();
+        } else {
+            I2S_FRAME_WRITER writer(buffer, format, bit_depth, channel_count);
+            int32_t frame[PATTERN_BUFFER_MAX_CHANNELS];
+
+            for(uint i=0; i<pattern_length; ++i) {
+                for(uint c=0; c<channel_count; ++c)
+                    frame[c] = source[c] == c ? generators[c].next() : frame[source[c]];
+                writer.write_frame(frame);
+            }
         }
+
+        back_buffer = pattern_buffer;
+        pattern_buffer = buffer;
+    }
+
+    /// clip to the buffer size and the length step
+    uint clip_pattern_length(uint new_pattern_length) const {
+        uint max_length = buffer_size - buffer_size % length_step;
+        new_pattern_length = new_pattern_length < max_length ? new_pattern_length : max_length;
+        new_pattern_length -= new_pattern_length % length_step;
+        return new_pattern_length ? new_pattern_length : length_step;
+    }
+
+    /// buffer words of a pattern with length frames
+    uint pattern_words(uint length) const { return mono ? length : length * i2s_frame_bits(format, bit_depth, channel_count) / 32; }
+
+    static constexpr uint length_step_of(I2S_SAMPLE_FORMAT format, uint bit_depth, bool mono, uint channel_count) {
+        return mono ? 1 : i2s_unit_frames(i2s_frame_bits(format, bit_depth, channel_count));
     }
 public:
-    PATTERN_BUFFER(uint _buffer_size) : buffer_size(_buffer_size){
-        pattern_buffer = new int32_t[buffer_size*2];
+    /// words of front and back buffer, e.g. for sizing an I2S_BUFFER_ARENA. Parameters like the constructor
+    static constexpr uint storage_words(uint buffer_size, I2S_SAMPLE_FORMAT format = I2S_SAMPLE_FORMAT::WORD_32, uint bit_depth = 32, bool mono = false, uint channel_count = 2) {
+        uint length = buffer_size > length_step_of(format, bit_depth, mono, channel_count) ? buffer_size : length_step_of(format, bit_depth, mono, channel_count);
+        return 2 * (mono ? length : length * i2s_frame_bits(format, bit_depth, channel_count) / 32);
+    }
+
+    /**
+     * @param _buffer_size maximum pattern length in frames
+     * @param _format memory layout of the frames
+     * @param _bit_depth bits per sample, used by the packed formats
+     * @param _mono store a single word per frame that is used for all channels, ignores the format
+     * @param _channel_count channels per frame (even, up to PATTERN_BUFFER_MAX_CHANNELS): 2*lanes or the TDM slot count
+     * @param _arena place both buffers there instead of the heap, see I2S_BUFFER_ARENA
+     */
+    PATTERN_BUFFER(uint _buffer_size, I2S_SAMPLE_FORMAT _format = I2S_SAMPLE_FORMAT::WORD_32, uint _bit_depth = 32, bool _mono = false, uint _channel_count = 2,
+                   I2S_BUFFER_ARENA *_arena = NULL)
+        : buffer_size(_buffer_size), format(_format), bit_depth(_bit_depth), channel_count(_channel_count), mono(_mono),
+          length_step(length_step_of(_format, _bit_depth, _mono, _channel_count)), arena(_arena) {
+        uint words = storage_words(buffer_size, format, bit_depth, mono, channel_count) / 2;
+        pattern_buffer = i2s_allocate_words(arena, words);
+        back_buffer = i2s_allocate_words(arena, words);
+
+        pattern_length = clip_pattern_length(buffer_size);
+        for(uint c=0; c<PATTERN_BUFFER_MAX_CHANNELS; ++c)
+            channels[c] = {PATTERN::CONST, 0, 0, 0};
 
-        pattern_length = buffer_size;
-        pattern = PATTERN::CONST;
-        offset = 0;
-        amplitude = 0;
+        // silence until the first setter, the DMA may start on this buffer
+        update_pattern_buffer();
     }
 
     ~PATTERN_BUFFER() {
-        delete [] pattern_buffer;
+        i2s_free_words(arena, pattern_buffer);
+        i2s_free_words(arena, back_buffer);
     }
 
-    void set_pattern(PATTERN new_pattern) { pattern = new_pattern; update_pattern_buffer(); }
-    void set_offset(int32_t new_offset) { offset = new_offset; update_pattern_buffer(); }
-    void set_amplitude(int32_t new_amplitude) { amplitude = new_amplitude; update_pattern_buffer(); }
-    uint set_pattern_length(uint new_pattern_length) { return pattern_length = new_pattern_length < buffer_size ? new_pattern_length : buffer_size; update_pattern_buffer(); }
+    // these change all channels
+    void set_pattern(PATTERN new_pattern) { for(auto &channel : channels) channel.pattern = new_pattern; update_pattern_buffer(); }
+    void set_offset(int32_t new_offset) { for(auto &channel : channels) channel.offset = new_offset; update_pattern_buffer(); }
+    void set_amplitude(int32_t new_amplitude) { for(auto &channel : channels) channel.amplitude = new_amplitude; update_pattern_buffer(); }
+    uint set_pattern_length(uint new_pattern_length) { pattern_length = clip_pattern_length(new_pattern_length); update_pattern_buffer(); return pattern_length; }
 
     /**
-     * @brief change setting generator
+     * @brief change setting generator for all channels
      *
-     * @return new pattern length (might be clipped due to buffer size
+     * @return new pattern length (might be clipped due to buffer size, even for 24 bit)
      */
     uint set_pattern(PATTERN new_pattern, int32_t new_offset, int32_t new_amplitude, uint new_pattern_length) {
-        pattern = new_pattern;
-        offset = new_offset;
-        amplitude = new_amplitude;
-        pattern_length = new_pattern_length < buffer_size ? new_pattern_length : buffer_size;
+        for(auto &channel : channels)
+            channel = {new_pattern, new_offset, new_amplitude, 0};
+        pattern_length = clip_pattern_length(new_pattern_length);
 
         update_pattern_buffer();
 
         return pattern_length;
     }
-	
-    // TODO: low frequency signal interpolation with second buffer?
+
+    /**
+     * @brief change the generator of a single channel, e.g. for I/Q signals with phase = 0x40000000 (90 degree)
+     * In mono mode only channel 0 is used.
+     * @param channel 0 for left, 1 for right, 2*lane + 0/1 with several data lanes, slot number in TDM mode
+     */
+    void set_channel_pattern(uint channel, PATTERN new_pattern, int32_t new_offset, int32_t new_amplitude, uint32_t new_phase = 0) {
+        if(channel >= channel_count)
+            return;
+
+        channels[channel] = {new_pattern, new_offset, new_amplitude, new_phase};
+        update_pattern_buffer();
+    }
+
+    const CHANNEL_SETTINGS &get_channel_settings(uint channel) const { return channels[channel]; }
+
+    // for arbitrary or very low frequencies use DDS_GENERATOR with the TX streaming mode instead
+    // buffer_len is in 32 bit words
     int32_t *get_next_buffer(uint &buffer_len) {
-        buffer_len = pattern_length*2;
+        buffer_len = pattern_words(pattern_length);
         return pattern_buffer;
     }
 
     void print_pattern_config() {
-        printf("pattern=%u, offset=%li, amplitude=%li, length=%u\n", pattern, offset, amplitude, pattern_length);
+        for(uint c=0; c<channel_count; ++c)
+            printf("channel=%u, pattern=%u, offset=%" PRId32 ", amplitude=%" PRId32 ", phase=%" PRIu32 ", length=%u\n", c, channels[c].pattern, channels[c].offset, channels[c].amplitude, channels[c].phase, pattern_length);
     }
 };
 
-enum I2S_CONTROLLER_MODE {
-    TX  = 0, // for DAC only
-    RX  = 1, // for ADC only
-    TRX = 2, // for ADC & DAC
+/// memory layout of a mode, the mono program counts bits itself and takes whole words
+static constexpr I2S_SAMPLE_FORMAT i2s_controller_sample_format(I2S_CONTROLLER_MODE mode, uint32_t bit_depth, uint32_t data_lanes) {
+    return mode == I2S_CONTROLLER_MODE::TX_MONO ? I2S_SAMPLE_FORMAT::WORD_32 : i2s_sample_format(bit_depth, data_lanes);
+}
+
+// RX buffer size in words for a number of frames, rounded up to whole words (e.g. an even number of PACKED_24 frames)
+static constexpr uint i2s_rx_buffer_words(uint frames, I2S_SAMPLE_FORMAT format, uint bit_depth) {
+    uint frame_bits = i2s_frame_bits(format, bit_depth);
+    uint unit_frames = i2s_unit_frames(frame_bits);
+    frames = (frames + unit_frames - 1) / unit_frames * unit_frames;
+    return frames * frame_bits / 32;
+}
+
+/**
+ * @brief I2S_BUFFER_ARENA words for the pattern and RX buffers of a controller
+ * Parameters like the I2S_CONTROLLER constructor. enable_tx_streaming() needs i2s_tx_stream_storage_words() on top.
+ */
+static constexpr uint i2s_controller_storage_words(I2S_CONTROLLER_MODE mode, uint bit_depth, uint pattern_buffer_size, uint rx_buffer_count = 4, uint data_lanes = 1, uint tdm_slots = 8) {
+    const uint channel_count = mode == I2S_CONTROLLER_MODE::TX_TDM ? tdm_slots : 2*data_lanes;
+    const I2S_SAMPLE_FORMAT format = i2s_controller_sample_format(mode, bit_depth, data_lanes);
+    const bool has_rx = mode == I2S_CONTROLLER_MODE::RX || mode == I2S_CONTROLLER_MODE::TRX || mode == I2S_CONTROLLER_MODE::TRX_FULL_RATE;
+
+    return PATTERN_BUFFER::storage_words(pattern_buffer_size, format, bit_depth, mode == I2S_CONTROLLER_MODE::TX_MONO, channel_count)
+        + (has_rx ? rx_buffer_count * i2s_rx_buffer_words(pattern_buffer_size, format, bit_depth) : 0);
+}
+
+/// I2S_BUFFER_ARENA words for the ring and the objects of enable_tx_streaming() and enable_drift_compensation()
+static constexpr uint i2s_tx_stream_storage_words(uint ring_size_log2) {
+    return (1u << ring_size_log2) + i2s_object_words<TX_RING_BUFFER>() + i2s_object_words<DRIFT_CONTROLLER>();
+}
+
+/// I2S_BUFFER_ARENA words for the blocks and the object of enable_duplex_processing(), parameters like there
+static constexpr uint i2s_duplex_storage_words(I2S_CONTROLLER_MODE mode, uint bit_depth, uint block_frames, uint latency_blocks = 1) {
+    return I2S_DUPLEX_PROCESSOR::storage_words(i2s_rx_buffer_words(block_frames, i2s_controller_sample_format(mode, bit_depth, 1), bit_depth), latency_blocks);
+}
+
+/**
+ * @brief mode, bit depth and frame layout of an I2S_CONTROLLER chosen at runtime
+ * Invalid lane and slot counts are replaced with a warning, see the I2S_CONTROLLER constructor.
+ */
+class I2S_RUNTIME_CONFIG {
+public:
+    const I2S_CONTROLLER_MODE mode;
+    const uint8_t BIT_DEPTH;
+    const uint8_t DATA_LANES; // data pins driven in parallel in TX mode
+    const uint8_t CHANNEL_COUNT; // samples per frame: TDM slots or left/right of every lane
+    const I2S_SAMPLE_FORMAT SAMPLE_FORMAT; // memory layout of TX and RX buffers, follows from BIT_DEPTH
+    const I2S_PIO_PROGRAM pio_program;
+
+    // what the DMA IRQ handler can assume about the channels of this configuration: nothing
+    static constexpr bool MAY_TX = true;
+    static constexpr bool MAY_RX = true;
+
+    I2S_RUNTIME_CONFIG(I2S_CONTROLLER_MODE trx_mode, uint8_t bit_depth, uint8_t data_lanes, uint8_t tdm_slots);
+};
+
+/**
+ * @brief the same settings fixed at compile time, see I2S_STATIC_CONTROLLER
+ * Everything is a constant expression, including the PIO program, so invalid settings fail to compile
+ * and the code of the other modes is never generated.
+ */
+template<I2S_CONTROLLER_MODE TRX_MODE, uint8_t BITS, uint8_t LANES = 1, uint8_t TDM_SLOTS = 8>
+class I2S_STATIC_CONFIG {
+public:
+    static constexpr I2S_CONTROLLER_MODE mode = TRX_MODE;
+    static constexpr uint8_t BIT_DEPTH = BITS;
+    static constexpr uint8_t DATA_LANES = LANES;
+    static constexpr uint8_t CHANNEL_COUNT = TRX_MODE == I2S_CONTROLLER_MODE::TX_TDM ? TDM_SLOTS : 2*LANES;
+    static constexpr I2S_SAMPLE_FORMAT SAMPLE_FORMAT = i2s_controller_sample_format(TRX_MODE, BITS, LANES);
+    static constexpr I2S_PIO_PROGRAM pio_program = i2s_generate_pio_program(TRX_MODE, BITS, LANES, CHANNEL_COUNT);
+
+    static constexpr bool MAY_TX = TRX_MODE != I2S_CONTROLLER_MODE::RX;
+    static constexpr bool MAY_RX = TRX_MODE == I2S_CONTROLLER_MODE::RX || TRX_MODE == I2S_CONTROLLER_MODE::TRX || TRX_MODE == I2S_CONTROLLER_MODE::TRX_FULL_RATE;
+
+    static_assert(BIT_DEPTH >= 2 && BIT_DEPTH <= 32, "i2s: the bit depth has to be 2..32");
+    static_assert(DATA_LANES == 1 || (TRX_MODE == I2S_CONTROLLER_MODE::TX && (DATA_LANES == 2 || DATA_LANES == 4)), "i2s: 2 or 4 data lanes are only supported in TX mode");
+    static_assert(TRX_MODE != I2S_CONTROLLER_MODE::TX_TDM || (CHANNEL_COUNT >= 2 && CHANNEL_COUNT <= I2S_MAX_CHANNELS && CHANNEL_COUNT % 2 == 0), "i2s: TDM needs an even slot count up to I2S_MAX_CHANNELS");
+    static_assert(pio_program.length > 0 && pio_program.length <= I2S_PIO_MAX_PROGRAM_LENGTH, "i2s: no PIO program for this mode");
+    static_assert(pio_program.entry < pio_program.length && pio_program.wrap_target < pio_program.length, "i2s: PIO program entry or wrap target out of range");
 };
 
 /**
  * @brief I2S signal generator using PIO
  * This is an I2S transmitter implementation for the RP2040 PIO.
  * It is built for up to 32 bits and 
+ *
+ * CONFIG is I2S_RUNTIME_CONFIG for I2S_CONTROLLER or an I2S_STATIC_CONFIG for I2S_STATIC_CONTROLLER.
+ * Use those two classes, the constructor parameters are documented at I2S_CONTROLLER.
  */
-class I2S_CONTROLLER {
+template<class CONFIG>
+class I2S_CONTROLLER_IMPL : protected CONFIG {
 private:
-    I2S_CONTROLLER_MODE mode;
+    using CONFIG::mode;
+    using CONFIG::BIT_DEPTH;
+    using CONFIG::DATA_LANES;
+    using CONFIG::CHANNEL_COUNT;
+    using CONFIG::SAMPLE_FORMAT;
+    using CONFIG::pio_program;
 
     // PIO and DMA settings
     const PIO I2S_PIO;
     const uint8_t I2S_PIO_SM;
+    const uint8_t I2S_PIO_SM_RX; // RX follower in TRX_FULL_RATE mode, I2S_PIO_SM otherwise
     uint8_t I2S_DMA_CHANNEL_TX, I2S_DMA_CHANNEL_RX;
-
-    // general setup
-    const uint8_t BIT_DEPTH;
+    uint8_t I2S_DMA_CHANNEL_TX_CTRL; // restarts the TX channel, claimed automatically
+    uint8_t I2S_DMA_CHANNEL_RX_CTRL; // restarts the RX channel with duplex processing, claimed by enable_duplex_processing()
 
     // Pin settings
     const uint8_t PIN_DATA_BASE; 
@@ -140,16 +378,71 @@ private:
     // status
     uint32_t clock_divider_setting;
 
-    // buffers for PIO code
-    uint16_t i2s_pio_code[I2S_PIO_MAX_PROGRAM_LENGTH];
+    // PIO code, the program itself is part of the configuration
     struct pio_program i2s_program_header;
     uint pio_program_offset;
-    uint I2S_PIO_PROGRAM_LENGTH = 0;
+
+    // RX follower in TRX_FULL_RATE mode
+    I2S_PIO_PROGRAM rx_pio_program;
+    struct pio_program rx_program_header;
+    uint rx_program_offset;
+
+    // MCLK output, see enable_mclk()
+    int8_t I2S_PIO_SM_MCLK = -1;
+    uint8_t PIN_MCLK = 0;
+    uint32_t mclk_multiple = 0;
+    I2S_PIO_PROGRAM mclk_pio_program;
+    struct pio_program mclk_program_header;
+    int mclk_program_offset = -1;
+
+    bool tx_running = false;
+    uint32_t pattern_update_seq = 0; // queue_tx_buffer() sequence number of the last pattern change
+
+    I2S_BUFFER_ARENA *const buffer_arena; // buffers and streaming objects go there instead of the heap if set
+    const I2S_AWG_SEQUENCE *awg_sequence = NULL; // last one handed to play_sequence()
+
+#if I2S_ENABLE_STATS
+    I2S_STATS_COLLECTOR tx_stats, rx_stats;
+#endif
 public:
     PATTERN_BUFFER pattern_buffer;
 
-    int32_t *input_buffer = NULL;
+    /// captured data in RX and TRX mode, see RX_BUFFER_QUEUE::peek() and RX_BUFFER_QUEUE::release()
+    RX_BUFFER_QUEUE rx_queue;
+
+    /// sample source in TX streaming mode, NULL otherwise. See enable_tx_streaming()
+    TX_RING_BUFFER *tx_stream = NULL;
+
+    /// rate control of the TX stream with its telemetry, NULL otherwise. See enable_drift_compensation()
+    DRIFT_CONTROLLER *drift = NULL;
+
+    /// RX -> TX block processing in TRX modes, NULL otherwise. See enable_duplex_processing()
+    I2S_DUPLEX_PROCESSOR *duplex = NULL;
 private:
+    bool has_tx() const { return mode != I2S_CONTROLLER_MODE::RX; }
+    bool has_rx() const { return mode == I2S_CONTROLLER_MODE::RX || mode == I2S_CONTROLLER_MODE::TRX || mode == I2S_CONTROLLER_MODE::TRX_FULL_RATE; }
+
+    /// TX and RX use separate DMA channels
+    bool is_duplex() const { return mode == I2S_CONTROLLER_MODE::TRX || mode == I2S_CONTROLLER_MODE::TRX_FULL_RATE; }
+
+    /// state machines of this instance, for enabling them together
+    uint32_t pio_sm_mask() const {
+        uint32_t mask = (1u << I2S_PIO_SM) | (1u << I2S_PIO_SM_RX);
+        if(mclk_program_offset >= 0) {
+            mask |= 1u << I2S_PIO_SM_MCLK;
+        }
+        return mask;
+    }
+
+    /**
+     * @brief claim the DMA channels for TX and RX
+     * @param first_channel first channel to use or -1 to claim unused channels
+     */
+    void claim_dma_channels(int first_channel);
+
+    /// start the DMA channels and fill the TX FIFO, the state machine is enabled afterwards
+    void start_dma();
+
     /**
      * @brief set up PIO as we need it
      * @param divider clock divider setting, see set_pio_divider() for more
@@ -157,10 +450,22 @@ private:
     void configure_pio(uint32_t divider);
 
     /**
-     * @brief generate PIO program and load it into PIO memory
+     * @brief load the PIO program of the configuration into PIO memory, see i2s_generate_pio_program()
      * @return the program offset
      */
-    uint generate_pio_program();
+    uint load_pio_program();
+
+    /// load and start the RX follower program of TRX_FULL_RATE mode, see i2s_generate_rx_follower_program()
+    void configure_rx_follower();
+
+    /**
+     * @brief load the MCLK program for a period and set up its state machine, see enable_mclk()
+     * @param mclk_divider system clock cycles per MCLK period from i2s_solve_clock()
+     */
+    void configure_mclk(uint32_t mclk_divider);
+
+    /// buffer words played or captured per second at the current sample rate
+    double words_per_second() const;
 
     /**
      * @brief wrapper to configure a DMA channel
@@ -168,53 +473,343 @@ private:
      * @param is_tx set to true for an outgoing DMA channel
      */
     void configure_dma_channel(uint channel_offset, bool is_tx);
+
+    /**
+     * @brief claim and configure the control channel that restarts the TX channel
+     * The TX channel chains to it after every buffer, so replaying a pattern needs no IRQ.
+     */
+    void configure_tx_control_channel();
+
+    /**
+     * @brief claim and configure the control channel that restarts the RX channel with duplex processing
+     * The RX channel chains to it after every block, so the IRQ has a block to queue the next one instead of the RX FIFO depth.
+     */
+    void configure_rx_control_channel();
     void configure_dma();
+
+    /// wait until the pattern back buffer is no longer read by the DMA
+    void begin_pattern_update();
+
+    /// queue the freshly rendered pattern front buffer
+    void finish_pattern_update();
 public:
     /**
-     * @brief constructor
-     * @param pattern_buffer_size size of the pattern buffer in samples
-     * @param pin_data_base pin number of the first I2S data pin (in TRX mode order will be TX, RX)
-     * @param mode select for output, input etc
-     * @param pin_clock_base pin number of the BCLK clock pin
-     *                       LRCK is at pin (clock_base_pin + 1)
-     *                       (chosen to be pin compatible to the pico-extras I2S implementation)
-     * @param bit_depth I2S bit count per sample (valid values are 2..32)
-     * @param i2s_pio either pio0 or pio1, can be adjusted to avoid conflictls with other PIO programs
-     * @param i2s_pio_sm The state machine to be used, can be adjusted to avoid conflictls with other PIO programs (0..3)
-     * @param i2s_dma_channel The DMA channel to be used, can be adjusted to avoid conflictls (0..11)
-     *                        Note that TRX mode will need two channels and also claim the next DMA channel!
-     *
-     * clock divider setting defaults to 100*256 (sample_rate = 125e6/(clock_divider/256)/bit_depth)
+     * @brief constructor, see I2S_CONTROLLER for the parameters
+     * @param config mode, bit depth and frame layout
      */
-    I2S_CONTROLLER (
+    I2S_CONTROLLER_IMPL (
+        const CONFIG &config,
         uint pattern_buffer_size,
         uint8_t pin_data_base,
         uint8_t pin_clock_base,
-        I2S_CONTROLLER_MODE trx_mode = I2S_CONTROLLER_MODE::TX,
-        uint8_t bit_depth = 32,
-        PIO i2s_pio = pio0,
-        uint8_t i2s_pio_sm = 0,
-        uint8_t i2s_dma_channel = 0
-    );   
+        PIO i2s_pio,
+        int i2s_pio_sm,
+        int i2s_dma_channel,
+        uint rx_buffer_count,
+        I2S_BUFFER_ARENA *buffer_arena
+    );
 
-    ~I2S_CONTROLLER();
+    ~I2S_CONTROLLER_IMPL();
 
     /**
      * @brief set the clock divider for the I2S PIO state machiene
-     * @param divider divider value from the RP2040 system clock includeing 256 fractional value (so 0x100 is a divider of 1, 0xA00 is a divider of 10)
+     * @param divider divider value from the RP2040 system clock includeing 256 fractional value (so 0x100 is a divider of 1, 0xA00 is a divider of 10, up to 0xFFFFFF)
+     *                Fractional values jitter the bit clock by one system clock cycle, see set_sample_rate()
+     *                TRX_FULL_RATE mode needs at least 0x400, the RX follower samples up to 3 system clock cycles after the BCLK edge
+     */
+    void set_pio_divider(uint32_t divider);
+
+    /**
+     * @brief set an exact sample rate with integer dividers only, see i2s_solve_clock()
+     * Changes the system clock unless change_sys_clock is false. clk_peri follows it, so UART baud rates have to be set again
+     * before anything is printed (this function does not print the result for that reason).
+     * The dividers of other running controllers are not recomputed, their rates change with the system clock:
+     * set the rate of the first one with the system clock, then the others with change_sys_clock = false.
+     * Call before start_i2s().
+     * @param max_error_ppm acceptable error, the highest system clock within it wins (see i2s_solve_clock())
+     * @param min_sys_clock_hz, max_sys_clock_hz range of acceptable system clocks
+     * @return the chosen settings with the achieved rate and its error, valid is false if nothing fits (nothing is changed then)
+     */
+    I2S_CLOCK_SETTINGS set_sample_rate(uint32_t sample_rate, bool change_sys_clock = true, double max_error_ppm = 0,
+                                       uint32_t min_sys_clock_hz = 0, uint32_t max_sys_clock_hz = I2S_CLOCK_SYS_MAX_HZ);
+
+    /**
+     * @brief output a master clock from a spare state machine on the same PIO
+     * The MCLK is phase locked to BCLK and starts together with the I2S state machines,
+     * it is set up by the next set_sample_rate() call.
+     * @param pin_mclk any GPIO
+     * @param multiple MCLK frequency as a multiple of the sample rate, usually 256 or 384
      */
-    void set_pio_divider(uint16_t divider);
+    void enable_mclk(uint8_t pin_mclk, uint32_t multiple = 256);
 
     /// @brief returns the current sample rate in Hz (assuming perfect crystal)
     float get_sample_rate() const;
 
+    /// memory layout of the TX and RX buffers, use i2s_unpack_rx() for captured data
+    I2S_SAMPLE_FORMAT get_sample_format() const { return SAMPLE_FORMAT; }
+
+    uint get_data_lanes() const { return DATA_LANES; }
+
+    /// samples per frame in the pattern and stream buffers
+    uint get_channel_count() const { return CHANNEL_COUNT; }
+
+#if I2S_ENABLE_STATS
+    /// IRQ statistics of the TX DMA channel, can be called from both cores. The IRQ only runs while streaming or while a new buffer is queued
+    I2S_STATS get_tx_stats() const { return tx_stats.snapshot(); }
+
+    /// IRQ statistics of the RX DMA channel, can be called from both cores
+    I2S_STATS get_rx_stats() const {
+        I2S_STATS stats = rx_stats.snapshot();
+        stats.rx_overrun_count = rx_queue.get_overrun_count();
+        return stats;
+    }
+
+    /// start the statistics over with the next IRQ
+    void reset_stats() {
+        tx_stats.reset();
+        rx_stats.reset();
+    }
+#endif
+
     /// enable PIO and start DMA
     void start_i2s();
 
-    /// just a wrapper for PATTERN_BUFFER::set_pattern()
+    /**
+     * @brief start several instances at once, instead of start_i2s()
+     * All state machines of one PIO start on the same clock cycle with their clock dividers in phase.
+     * Instances on pio1 start a few system clock cycles after the ones on pio0, the offset is constant.
+     * Use the same clock divider for all instances to keep them aligned.
+     * All instances have to be of the same class, either I2S_CONTROLLER or one I2S_STATIC_CONTROLLER.
+     */
+    template<class CONTROLLER>
+    static void start_i2s_synchronized(CONTROLLER *const controllers[], uint controller_count);
+
+    /**
+     * @brief hand a new buffer to the TX DMA chain
+     * The buffer is played after the current buffer has finished and then repeated until the next call.
+     * The previously queued buffer must stay valid until this one is playing.
+     * Can be called from both cores.
+     * @param buffer interleaved L/R samples in the sample format, see I2S_FRAME_WRITER
+     * @param buffer_len length in 32 bit words (multiple of 3 for 24 bit)
+     * @return sequence number of the buffer for is_tx_buffer_playing()
+     */
+    uint32_t queue_tx_buffer(const int32_t *buffer, uint buffer_len);
+
+    /// true as soon as the DMA plays the buffer with the sequence number from queue_tx_buffer() (or a newer one)
+    bool is_tx_buffer_playing(uint32_t seq) const;
+
+    /// true once the last pattern change is on the output
+    bool is_pattern_update_done() const { return is_tx_buffer_playing(pattern_update_seq); }
+
+    /**
+     * @brief play samples from the ring buffer tx_stream instead of the pattern buffer
+     * Has to be called before start_i2s(). Write interleaved L/R samples in the sample format with tx_stream->write()
+     * or let DDS_GENERATOR::fill() render them.
+     * @param ring_size_log2 ring buffer size is 2**ring_size_log2 32 bit words
+     * @param block_size maximum number of words per DMA transfer, one IRQ per block. Rounded down to whole units of frames
+     *                   (TX_RING_BUFFER::get_unit_words(), e.g. 3 words for two PACKED_24 frames)
+     * @param idle_value sent when the ring runs out of whole units, see TX_RING_BUFFER::get_underrun_count(). Raw word, so only 0 is a neutral value for every sample format
+     */
+    void enable_tx_streaming(uint ring_size_log2, uint block_size, int32_t idle_value = 0);
+
+    /**
+     * @brief follow the rate the TX stream is written with, for sources with their own clock
+     * Every DMA block the ring fill level goes through a PI controller (see DRIFT_CONTROLLER),
+     * which trims the PIO divider around the current setting. Call after enable_tx_streaming() and set_sample_rate(), before start_i2s().
+     * The MCLK of enable_mclk() does not follow the trim.
+     * @param trim_divider false only computes the correction, e.g. to pass drift->get_resampler_step() to a POLYPHASE_RESAMPLER
+     *                     if the I2S clock has to stay fixed or the source is further off than DRIFT_MAX_CORRECTION_PPM
+     * @param bandwidth_hz loop bandwidth, see DRIFT_CONTROLLER
+     * @param target_fill fill level to hold in words, 0 for half the ring
+     */
+    void enable_drift_compensation(bool trim_divider = true, float bandwidth_hz = 0.05, uint target_fill = 0);
+
+    /**
+     * @brief turn every captured block into a TX block with a fixed latency, TRX modes only
+     * The callback runs in the DMA IRQ with the RX block and the TX block to fill, see I2S_DUPLEX_PROCESSOR.
+     * A sample is played (1+latency_blocks)*block_frames frames after it was captured, the pattern buffer and
+     * queue_tx_buffer() are not used anymore and rx_queue gets no data. Has to be called before start_i2s().
+     * Claims one more DMA channel, which restarts the capture like the control channel of TX (see configure_rx_control_channel()).
+     * So the DMA IRQ may come up to a block late on both sides; with the RX queue it has to come within the RX FIFO depth.
+     * @param block_frames frames per block, rounded up like the RX buffers (e.g. 16)
+     * @param latency_blocks blocks the callback and the TX DMA get after a capture (>= 1), the callback has to finish
+     *                       within latency_blocks blocks. See get_duplex_late_count()
+     */
+    void enable_duplex_processing(I2S_BLOCK_CALLBACK callback, void *context, uint block_frames, uint latency_blocks = 1);
+
+    /**
+     * @brief measured round trip of the duplex processing from the RX pin to the TX pin in frames
+     * Taken from the DMA positions and FIFO levels of both channels, it stays at (1+latency_blocks)*block_frames
+     * unless a block got lost. During the last bit of a word the TX state machine already holds the next one,
+     * so it reads one DMA transfer short then (half a frame at 32 bit). 0 without duplex processing or before start_i2s().
+     */
+    float get_duplex_latency_frames() const;
+
+    /// blocks the duplex callback finished after their playback started, 0 without duplex processing
+    uint32_t get_duplex_late_count() const { return duplex ? duplex->get_late_count() : 0; }
+
+    /**
+     * @brief arbitrary waveform mode: play a list of segments instead of the pattern buffer, see I2S_AWG_SEQUENCE
+     * The segments are compiled into sequence, which has to stay valid while it plays. The DMA walks its control blocks
+     * without the CPU, only the end of a pass raises an IRQ. A running sequence is replaced at the end of its pass,
+     * the pattern buffer (or the last queued buffer) is replaced at the end of its next period. A sequence that ends
+     * returns to the buffers. Not available in streaming mode or with duplex processing.
+     * @param sequence storage for the control blocks, must not be the playing sequence
+     * @param segments waveforms in the sample format, lengths in frames like the pattern length
+     * @return false if the segments are invalid or do not fit into sequence
+     */
+    bool play_sequence(I2S_AWG_SEQUENCE &sequence, const I2S_AWG_SEGMENT *segments, uint segment_count);
+
+    /// end a looping sequence after the current pass
+    void stop_sequence();
+
+    /// true from play_sequence() until the end of the sequence
+    bool is_sequence_playing() const;
+
+    /// passes completed by the current sequence, a sequence without a loop has one when it ends
+    uint32_t get_sequence_pass_count() const;
+
+    /**
+     * @brief wrappers for the PATTERN_BUFFER setters that swap buffers on a period boundary
+     * The new pattern is rendered into the back buffer, so they block until the previous update is playing.
+     * Use is_pattern_update_done() to see when the change reached the output.
+     */
     uint set_pattern(PATTERN_BUFFER::PATTERN pattern, int32_t offset, int32_t amplitude, uint pattern_length) {
-        if(mode != I2S_CONTROLLER_MODE::RX) {
-            return pattern_buffer.set_pattern(pattern, offset, amplitude, pattern_length);
+        if(!has_tx()) {
+            return 0;
         }
+
+        begin_pattern_update();
+        uint new_length = pattern_buffer.set_pattern(pattern, offset, amplitude, pattern_length);
+        finish_pattern_update();
+        return new_length;
+    }
+
+    void set_offset(int32_t offset) {
+        if(!has_tx()) {
+            return;
+        }
+
+        begin_pattern_update();
+        pattern_buffer.set_offset(offset);
+        finish_pattern_update();
+    }
+
+    void set_amplitude(int32_t amplitude) {
+        if(!has_tx()) {
+            return;
+        }
+
+        begin_pattern_update();
+        pattern_buffer.set_amplitude(amplitude);
+        finish_pattern_update();
+    }
+
+    uint set_pattern_length(uint pattern_length) {
+        if(!has_tx()) {
+            return 0;
+        }
+
+        begin_pattern_update();
+        uint new_length = pattern_buffer.set_pattern_length(pattern_length);
+        finish_pattern_update();
+        return new_length;
+    }
+
+    /// wrapper for PATTERN_BUFFER::set_channel_pattern()
+    void set_channel_pattern(uint channel, PATTERN_BUFFER::PATTERN pattern, int32_t offset, int32_t amplitude, uint32_t phase = 0) {
+        if(!has_tx()) {
+            return;
+        }
+
+        begin_pattern_update();
+        pattern_buffer.set_channel_pattern(channel, pattern, offset, amplitude, phase);
+        finish_pattern_update();
     }
 };
+
+/**
+ * @brief I2S controller with mode, bit depth and frame layout chosen at runtime
+ * Thin wrapper of I2S_CONTROLLER_IMPL, its code is compiled once in i2s.cpp and handles every mode.
+ */
+class I2S_CONTROLLER : public I2S_CONTROLLER_IMPL<I2S_RUNTIME_CONFIG> {
+public:
+    /**
+     * @brief constructor
+     * @param pattern_buffer_size size of the pattern buffer in samples, also sets the RX buffer size
+     * @param pin_data_base pin number of the first I2S data pin (in TRX modes order will be TX, RX)
+     * @param mode select for output, input etc
+     * @param pin_clock_base pin number of the BCLK clock pin
+     *                       LRCK is at pin (clock_base_pin + 1)
+     *                       (chosen to be pin compatible to the pico-extras I2S implementation)
+     * @param bit_depth I2S bit count per sample (valid values are 2..32)
+     * @param i2s_pio either pio0 or pio1, can be adjusted to avoid conflictls with other PIO programs
+     * @param i2s_pio_sm The state machine to be used (0..3), -1 claims an unused one
+     *                   TRX_FULL_RATE mode claims an unused second state machine on the same PIO for RX
+     * @param i2s_dma_channel The DMA channel to be used (0..11), -1 claims unused channels
+     *                        Note that TRX modes will need two channels and also claim the next DMA channel!
+     *                        TX modes claim one more channel automatically, see configure_tx_control_channel()
+     * @param rx_buffer_count number of RX buffers (>= 2) in RX and TRX modes, each holds pattern_buffer_size L/R samples
+     * @param data_lanes number of data pins starting at pin_data_base in TX mode (1, 2 or 4), all share BCLK/LRCK and stay sample aligned.
+     *                   Channel 2*lane is the left, 2*lane+1 the right channel of a lane, see I2S_SAMPLE_FORMAT::INTERLEAVED
+     * @param tdm_slots number of slots per frame in TX_TDM mode (even, up to 16), each slot has bit_depth bits.
+     *                  The frame sync is high during the last bit of a frame, so slot 0 starts one BCLK after it rises.
+     * @param buffer_arena place all buffers there instead of the heap, NULL for the heap. Size it with i2s_controller_storage_words(),
+     *                     plus i2s_tx_stream_storage_words() for streaming. See I2S_BUFFER_ARENA for the SRAM bank placement
+     *
+     * Buffers use the sample format of the bit depth (see sample_format.hpp):
+     * up to 16 bit both samples are packed into one word, 24 bit samples are packed into 3 bytes.
+     *
+     * The clock divider setting (16.8 format) defaults to 2500, 96 kHz for 32 bit TX at a 120 MHz system clock.
+     * sample_rate = sys_clk / (clock_divider/256) / cycles_per_frame, the cycles per frame depend on mode and bit depth
+     * (2*2*bit_depth for TX, see I2S_PIO_PROGRAM and get_sample_rate()). Use set_sample_rate() for an exact rate
+     */
+    I2S_CONTROLLER (
+        uint pattern_buffer_size,
+        uint8_t pin_data_base,
+        uint8_t pin_clock_base,
+        I2S_CONTROLLER_MODE trx_mode = I2S_CONTROLLER_MODE::TX,
+        uint8_t bit_depth = 32,
+        PIO i2s_pio = pio0,
+        int i2s_pio_sm = -1,
+        int i2s_dma_channel = -1,
+        uint rx_buffer_count = 4,
+        uint8_t data_lanes = 1,
+        uint8_t tdm_slots = 8,
+        I2S_BUFFER_ARENA *buffer_arena = NULL
+    ) : I2S_CONTROLLER_IMPL(I2S_RUNTIME_CONFIG(trx_mode, bit_depth, data_lanes, tdm_slots), pattern_buffer_size, pin_data_base, pin_clock_base,
+                            i2s_pio, i2s_pio_sm, i2s_dma_channel, rx_buffer_count, buffer_arena) {}
+};
+
+/**
+ * @brief I2S controller with mode, bit depth and frame layout fixed at compile time
+ * Same interface as I2S_CONTROLLER. The PIO program is a constant checked by the compiler (see I2S_STATIC_CONFIG),
+ * the code of other modes is left out and the DMA IRQ handler is specialized for the configuration,
+ * e.g. a TX controller has no RX branch in its refill path.
+ * Every configuration registers its own shared DMA IRQ handler.
+ *
+ *   I2S_STATIC_CONTROLLER<I2S_CONTROLLER_MODE::TX, 16> i2s(4096, PIN_I2S_DOUT, PIN_I2S_CLOCK_BASE);
+ */
+template<I2S_CONTROLLER_MODE MODE, uint8_t BIT_DEPTH, uint8_t DATA_LANES = 1, uint8_t TDM_SLOTS = 8>
+class I2S_STATIC_CONTROLLER : public I2S_CONTROLLER_IMPL<I2S_STATIC_CONFIG<MODE, BIT_DEPTH, DATA_LANES, TDM_SLOTS>> {
+public:
+    /// see I2S_CONTROLLER for the parameters
+    I2S_STATIC_CONTROLLER (
+        uint pattern_buffer_size,
+        uint8_t pin_data_base,
+        uint8_t pin_clock_base,
+        PIO i2s_pio = pio0,
+        int i2s_pio_sm = -1,
+        int i2s_dma_channel = -1,
+        uint rx_buffer_count = 4,
+        I2S_BUFFER_ARENA *buffer_arena = NULL
+    ) : I2S_CONTROLLER_IMPL<I2S_STATIC_CONFIG<MODE, BIT_DEPTH, DATA_LANES, TDM_SLOTS>>(I2S_STATIC_CONFIG<MODE, BIT_DEPTH, DATA_LANES, TDM_SLOTS>(),
+            pattern_buffer_size, pin_data_base, pin_clock_base, i2s_pio, i2s_pio_sm, i2s_dma_channel, rx_buffer_count, buffer_arena) {}
+
+    /// I2S_BUFFER_ARENA words for the pattern and RX buffers, so the arena can be sized at compile time
+    static constexpr uint storage_words(uint pattern_buffer_size, uint rx_buffer_count = 4) {
+        return i2s_controller_storage_words(MODE, BIT_DEPTH, pattern_buffer_size, rx_buffer_count, DATA_LANES, TDM_SLOTS);
+    }
+};
+
+#include "i2s_controller_impl.hpp"
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Clock planning for exact sample rates
+ * The PIO runs at sys_clk / divider. A fractional divider hits any rate on average, but it jitters the bit clock by one sys_clk cycle.
+ * An integer divider gives a clean clock, which is only exact if sys_clk is a multiple of sample_rate * cycles_per_frame,
+ * so the solver searches the system PLL settings together with the integer divider.
+ *
+ * System PLL: sys_clk = 12 MHz * fbdiv / (postdiv1 * postdiv2), with the VCO (12 MHz * fbdiv) in 750..1600 MHz.
+ * Exact settings exist for the 8 kHz family, but often only at a low system clock: 32 bit TX (128 cycles per frame) is exact
+ * at 48 and 96 kHz only with 61.44 MHz, the closest above 100 MHz are 186 ppm off. A tolerance (max_error_ppm) trades
+ * that error for the highest system clock. The 44.1 kHz family needs a factor of 7^2 in the PLL, the best settings are about 63 ppm off.
+ */
+
+#define I2S_CLOCK_XOSC_HZ 12000000u
+#define I2S_CLOCK_VCO_MIN_HZ 750000000u
+#define I2S_CLOCK_VCO_MAX_HZ 1600000000u
+#define I2S_CLOCK_FBDIV_MIN 16
+#define I2S_CLOCK_FBDIV_MAX 320
+#define I2S_CLOCK_POSTDIV_MAX 7
+#define I2S_CLOCK_PIO_DIVIDER_MAX 65535
+#define I2S_CLOCK_SYS_MAX_HZ 133000000u // highest specified system clock
+
+// longest MCLK period in PIO clock cycles, see i2s_generate_mclk_program()
+#define I2S_MCLK_MAX_PERIOD 64
+
+/// result of i2s_solve_clock()
+struct I2S_CLOCK_SETTINGS {
+    bool valid;
+    uint32_t vco_hz;          // set_sys_clock_pll() arguments
+    uint8_t postdiv1, postdiv2;
+    uint32_t sys_clock_hz;    // truncated like clock_get_hz() reports it
+    uint32_t pio_divider;     // integer divider of the I2S state machine
+    uint32_t mclk_divider;    // sys_clk cycles per MCLK period, 0 without MCLK
+    double sample_rate;       // achieved sample rate
+    double error_ppm;         // deviation of the achieved from the requested sample rate
+};
+
+/**
+ * @brief split an MCLK period into a PIO divider and a program period, see i2s_generate_mclk_program()
+ * @param mclk_divider sys_clk cycles per MCLK period
+ * @return false if the period can not be built without a fractional divider (e.g. a prime above I2S_MCLK_MAX_PERIOD)
+ */
+static inline bool i2s_mclk_split(uint32_t mclk_divider, uint32_t &pio_divider, uint32_t &period) {
+    for(uint32_t d=1; d<=I2S_CLOCK_PIO_DIVIDER_MAX && d*2<=mclk_divider; ++d) {
+        if(mclk_divider % d == 0 && mclk_divider / d <= I2S_MCLK_MAX_PERIOD) {
+            pio_divider = d;
+            period = mclk_divider / d;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief find the integer PIO divider for a fixed clock of clock_numerator / clock_denominator Hz
+ * @return settings without the PLL fields, valid is false if no divider fits
+ */
+static inline I2S_CLOCK_SETTINGS i2s_solve_pio_divider(uint64_t clock_numerator, uint32_t clock_denominator, uint32_t sample_rate, uint32_t cycles_per_frame,
+                                                        uint32_t mclk_multiple = 0, uint32_t min_pio_divider = 1) {
+    I2S_CLOCK_SETTINGS settings = {};
+    const uint64_t frame_clock = (uint64_t)sample_rate * cycles_per_frame; // PIO clock for a divider of 1
+    const uint64_t denominator = frame_clock * clock_denominator;
+
+    // with MCLK, divider * cycles_per_frame has to be a multiple of mclk_multiple
+    uint32_t step = 1;
+    if(mclk_multiple) {
+        uint32_t a = cycles_per_frame, b = mclk_multiple;
+        while(b) {
+            uint32_t t = a % b;
+            a = b;
+            b = t;
+        }
+        step = mclk_multiple / a;
+    }
+
+    uint64_t divider = (clock_numerator + denominator * step / 2) / (denominator * step) * step;
+    if(divider < min_pio_divider)
+        divider = (min_pio_divider + step - 1) / step * step;
+    if(divider == 0)
+        divider = step;
+    if(divider > I2S_CLOCK_PIO_DIVIDER_MAX)
+        return settings;
+
+    if(mclk_multiple) {
+        uint32_t mclk_pio_divider, mclk_period;
+        settings.mclk_divider = divider * cycles_per_frame / mclk_multiple;
+        if(!i2s_mclk_split(settings.mclk_divider, mclk_pio_divider, mclk_period))
+            return settings;
+    }
+
+    settings.valid = true;
+    settings.pio_divider = divider;
+    settings.sys_clock_hz = clock_numerator / clock_denominator;
+    settings.sample_rate = (double)clock_numerator / clock_denominator / divider / cycles_per_frame;
+    settings.error_ppm = clock_numerator == denominator * divider ? 0. : (settings.sample_rate / sample_rate - 1.) * 1e6;
+    return settings;
+}
+
+/**
+ * @brief search the system PLL and the integer PIO divider for a sample rate
+ * Settings within max_error_ppm count as equally good and the highest system clock among them wins.
+ * Without one, the smallest error wins and ties go to the highest system clock.
+ * @param sample_rate requested sample rate in Hz
+ * @param cycles_per_frame PIO cycles per frame of the program, see I2S_PIO_PROGRAM
+ * @param mclk_multiple MCLK as a multiple of the sample rate (e.g. 256 or 384), 0 without MCLK
+ * @param min_pio_divider smallest usable PIO divider, e.g. 4 in TRX_FULL_RATE mode
+ * @param max_sys_clock_hz, min_sys_clock_hz range of acceptable system clocks
+ * @param max_error_ppm acceptable sample rate error, 0 only takes exact settings as equal
+ */
+static inline I2S_CLOCK_SETTINGS i2s_solve_clock(uint32_t sample_rate, uint32_t cycles_per_frame, uint32_t mclk_multiple = 0, uint32_t min_pio_divider = 1,
+                                                  uint32_t max_sys_clock_hz = I2S_CLOCK_SYS_MAX_HZ, uint32_t min_sys_clock_hz = 0, double max_error_ppm = 0) {
+    I2S_CLOCK_SETTINGS best = {};
+    double best_error = 0;
+
+    for(uint32_t fbdiv=I2S_CLOCK_FBDIV_MIN; fbdiv<=I2S_CLOCK_FBDIV_MAX; ++fbdiv) {
+        const uint32_t vco = I2S_CLOCK_XOSC_HZ * fbdiv;
+        if(vco < I2S_CLOCK_VCO_MIN_HZ || vco > I2S_CLOCK_VCO_MAX_HZ)
+            continue;
+
+        for(uint32_t postdiv1=1; postdiv1<=I2S_CLOCK_POSTDIV_MAX; ++postdiv1) {
+            for(uint32_t postdiv2=1; postdiv2<=postdiv1; ++postdiv2) {
+                const uint32_t postdiv = postdiv1 * postdiv2;
+                if(vco > (uint64_t)max_sys_clock_hz * postdiv || vco < (uint64_t)min_sys_clock_hz * postdiv)
+                    continue;
+
+                I2S_CLOCK_SETTINGS settings = i2s_solve_pio_divider(vco, postdiv, sample_rate, cycles_per_frame, mclk_multiple, min_pio_divider);
+                if(!settings.valid)
+                    continue;
+
+                const double error = settings.error_ppm < 0 ? -settings.error_ppm : settings.error_ppm;
+                const bool good = error <= max_error_ppm, best_good = best_error <= max_error_ppm;
+                bool better;
+                if(good && best_good) {
+                    better = settings.sys_clock_hz > best.sys_clock_hz || (settings.sys_clock_hz == best.sys_clock_hz && error < best_error);
+                } else if(good != best_good) {
+                    better = good;
+                } else {
+                    better = error < best_error || (error == best_error && settings.sys_clock_hz > best.sys_clock_hz);
+                }
+                if(!best.valid || better) {
+                    settings.vco_hz = vco;
+                    settings.postdiv1 = postdiv1;
+                    settings.postdiv2 = postdiv2;
+                    best = settings;
+                    best_error = error;
+                }
+            }
+        }
+    }
+    return best;
+}
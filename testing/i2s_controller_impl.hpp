@@ -0,0 +1,1012 @@
+#pragma once
+
+/**
+ * Implementation of I2S_CONTROLLER_IMPL, included by i2s.hpp
+ * Everything is a template of the configuration, so an I2S_STATIC_CONTROLLER compiles
+ * to the code of its own mode only. The runtime I2S_CONTROLLER is instantiated once in i2s.cpp.
+ */
+
+#include <type_traits>
+
+struct I2S_SETTINGS{
+    bool tx_initialized;
+    bool rx_initialized;
+    PATTERN_BUFFER *pattern_buffer;
+    RX_BUFFER_QUEUE *rx_queue;
+
+    // chained TX playback, see I2S_CONTROLLER::queue_tx_buffer()
+    const int32_t * volatile tx_read_addr; // read by the control DMA channel on every restart of the data channel
+    uint tx_read_len;                      // in DMA transfers (words), like tx_pending_len
+    const int32_t *tx_pending_buffer;      // buffer queued by the application, handed over in the IRQ
+    uint tx_pending_len;
+
+    // sequence numbers of queued buffers, a buffer is played from the second IRQ after queueing on
+    volatile uint32_t tx_pending_seq; // last buffer queued by the application
+    volatile uint32_t tx_chained_seq; // last buffer handed to the control channel
+    volatile uint32_t tx_played_seq;  // last buffer that is confirmed to be played
+
+    // streaming TX, see I2S_CONTROLLER::enable_tx_streaming()
+    TX_RING_BUFFER *tx_stream;
+
+    // rate control of the stream, see I2S_CONTROLLER::enable_drift_compensation()
+    DRIFT_CONTROLLER *drift;
+    bool drift_trims_divider;
+
+    // AWG sequence, see I2S_CONTROLLER::play_sequence(). A new sequence is handed over in the IRQ like a queued buffer
+    uint tx_ctrl_channel;
+    const I2S_DMA_CONTROL_BLOCK *awg_pending;       // first block of the sequence to start
+    const I2S_DMA_CONTROL_BLOCK *awg_pending_loop;
+    const I2S_DMA_CONTROL_BLOCK *awg_loop;          // where the next pass starts, NULL ends the sequence after this pass
+    volatile bool awg_playing;                      // the control channel walks control blocks instead of replaying tx_read_addr
+    volatile uint32_t awg_pass_count;
+
+    // RX -> TX block processing, see I2S_CONTROLLER::enable_duplex_processing(). Set for both channels
+    I2S_DUPLEX_PROCESSOR *duplex;
+    uint duplex_tx_channel;               // for the deadline check in the RX IRQ
+    int32_t * volatile rx_write_addr;     // read by the RX control channel when the capture of a block is complete
+
+    // state machine served by the channel
+    PIO pio;
+    uint pio_sm;
+
+#if I2S_ENABLE_STATS
+    I2S_STATS_COLLECTOR *stats;
+    uint32_t us_per_transfer_q16; // duration of one DMA transfer in us, Q16
+#endif
+};
+
+// settings of all I2S controllers, indexed by DMA channel
+extern I2S_SETTINGS i2s_settings[NUM_DMA_CHANNELS];
+
+// protects the queued TX buffers, the application might run on the other core
+extern spin_lock_t *i2s_spin_lock;
+
+// DMA channels with an I2S IRQ of a configuration, other channels on the shared IRQ belong to other handlers
+template<class CONFIG>
+inline volatile uint32_t i2s_dma_channel_mask = 0;
+
+// every configuration has its own IRQ handler, it is shared by all instances and only registered once
+template<class CONFIG>
+inline bool i2s_irq_handler_installed = false;
+
+#if I2S_ENABLE_STATS
+// account the IRQ of a channel, see I2S_STATS
+static inline void i2s_record_stats(uint dma_channel, uint32_t isr_start) {
+    I2S_SETTINGS &settings = i2s_settings[dma_channel];
+    const bool is_tx = settings.tx_initialized;
+
+    // the stall flags are sticky, so every flag seen stands for at least one stall since the last IRQ
+    const uint32_t stall_mask = 1u << ((is_tx ? PIO_FDEBUG_TXSTALL_LSB : PIO_FDEBUG_RXSTALL_LSB) + settings.pio_sm);
+    const uint32_t stall = settings.pio->fdebug & stall_mask;
+    settings.pio->fdebug = stall; // write 1 to clear
+
+    // SysTick counts down
+    settings.stats->record_irq((isr_start - systick_hw->cvr) & 0xFFFFFF, time_us_32());
+    settings.stats->record_stalls(is_tx && stall, !is_tx && stall);
+    if(is_tx) {
+        // reading TRANS_COUNT gives the transfers left of the playing block
+        settings.stats->record_margin(((uint64_t)dma_channel_hw_addr(dma_channel)->transfer_count * settings.us_per_transfer_q16) >> 16);
+    }
+}
+#endif
+
+// let the control channel walk the control blocks of an AWG sequence instead of replaying tx_read_addr
+// The data channel goes quiet, its IRQ only fires at the NULL block at the end of a pass.
+static inline void i2s_start_awg_chain(uint dma_channel, const I2S_DMA_CONTROL_BLOCK *blocks, bool trigger) {
+    const uint ctrl_channel = i2s_settings[dma_channel].tx_ctrl_channel;
+
+    dma_channel_config dma_config = dma_get_channel_config(dma_channel);
+    channel_config_set_irq_quiet(&dma_config, true);
+    dma_channel_set_config(dma_channel, &dma_config, false);
+
+    // every trigger writes one block to TRANS_COUNT and READ_ADDR_TRIG, the ring puts the write address back
+    dma_config = dma_get_channel_config(ctrl_channel);
+    channel_config_set_read_increment(&dma_config, true);
+    channel_config_set_write_increment(&dma_config, true);
+    channel_config_set_ring(&dma_config, true, __builtin_ctz(sizeof(I2S_DMA_CONTROL_BLOCK)));
+    dma_channel_configure(ctrl_channel, &dma_config, &dma_channel_hw_addr(dma_channel)->al3_transfer_count, blocks, 2, trigger);
+}
+
+// back to replaying tx_read_addr after a sequence, starts the last chained buffer
+static inline void i2s_stop_awg_chain(uint dma_channel) {
+    I2S_SETTINGS &settings = i2s_settings[dma_channel];
+
+    dma_channel_config dma_config = dma_get_channel_config(dma_channel);
+    channel_config_set_irq_quiet(&dma_config, false);
+    dma_channel_set_config(dma_channel, &dma_config, false);
+    dma_channel_hw_addr(dma_channel)->transfer_count = settings.tx_read_len;
+
+    dma_config = dma_get_channel_config(settings.tx_ctrl_channel);
+    channel_config_set_read_increment(&dma_config, false);
+    channel_config_set_write_increment(&dma_config, false);
+    channel_config_set_ring(&dma_config, false, 0);
+    dma_channel_configure(settings.tx_ctrl_channel, &dma_config, &dma_channel_hw_addr(dma_channel)->al3_read_addr_trig, &settings.tx_read_addr, 1, true);
+}
+
+// irq handler for DMA
+// TX channels restart themselves through their control channel, so the IRQ is only enabled for them while a new buffer is queued
+// or while streaming.
+// A static configuration knows at compile time whether its channels can be TX or RX,
+// so the branches of other modes drop out.
+template<class CONFIG>
+void __isr __time_critical_func(i2s_dma_irq_handler)() {
+#if I2S_ENABLE_STATS
+    const uint32_t isr_start = systick_hw->cvr;
+#endif
+
+    // get trigger reason and acknowledge quickly
+    auto &dma_register = I2S_DMA_IRQ ? dma_hw->ints1 : dma_hw->ints0;
+    uint32_t trigger_reason = dma_register & i2s_dma_channel_mask<CONFIG>;
+    dma_register = trigger_reason;
+
+    // only visit the channels that triggered, lowest channel first
+    while(trigger_reason) {
+        uint dma_channel = __builtin_ctz(trigger_reason);
+        trigger_reason &= trigger_reason - 1;
+
+        I2S_SETTINGS &settings = i2s_settings[dma_channel];
+
+        if (CONFIG::MAY_TX && settings.tx_initialized) {
+            // The control channel already restarted the data channel with the block queued in the last IRQ.
+            // Writing TRANS_COUNT only sets the reload value, so both changes take effect on the next restart.
+            if(settings.duplex) {
+                // the blocks all have the same length, so only the address changes
+                settings.tx_read_addr = settings.duplex->next_tx_block();
+            } else if(settings.tx_stream) {
+                TX_RING_BUFFER *tx_stream = settings.tx_stream;
+                uint32_t block_len;
+
+                tx_stream->finish_block();
+                settings.tx_read_addr = tx_stream->start_block(block_len);
+                dma_channel_hw_addr(dma_channel)->transfer_count = block_len;
+
+                DRIFT_CONTROLLER *drift = settings.drift;
+                if(drift) {
+                    uint32_t divider = drift->update(tx_stream->fill_level(), block_len);
+                    if(settings.drift_trims_divider) {
+                        pio_sm_set_clkdiv_int_frac(settings.pio, settings.pio_sm, divider >> 8, divider & 0xff);
+                    }
+                }
+            } else {
+                spin_lock_unsafe_blocking(i2s_spin_lock);
+
+                if(settings.awg_playing) {
+                    // The NULL block ended a pass and stopped the data channel, the TX FIFO covers the IRQ latency.
+                    // Continue with a new sequence, the loop or the buffers.
+                    if(settings.awg_pending) {
+                        settings.awg_loop = settings.awg_pending_loop;
+                        settings.awg_pass_count = 0;
+                        dma_channel_set_read_addr(settings.tx_ctrl_channel, settings.awg_pending, true);
+                        settings.awg_pending = NULL;
+                    } else {
+                        settings.awg_pass_count = settings.awg_pass_count + 1;
+                        if(settings.awg_loop) {
+                            dma_channel_set_read_addr(settings.tx_ctrl_channel, settings.awg_loop, true);
+                        } else {
+                            i2s_stop_awg_chain(dma_channel);
+                            settings.awg_playing = false;
+                        }
+                    }
+                }
+
+                if(!settings.awg_playing) {
+                    // the buffer handed over in the last IRQ is playing now
+                    settings.tx_played_seq = settings.tx_chained_seq;
+
+                    if(settings.awg_pending) {
+                        // the sequence follows the buffer that just started
+                        i2s_start_awg_chain(dma_channel, settings.awg_pending, false);
+                        settings.awg_loop = settings.awg_pending_loop;
+                        settings.awg_pass_count = 0;
+                        settings.awg_pending = NULL;
+                        settings.awg_playing = true;
+                    } else if(settings.tx_pending_seq != settings.tx_chained_seq) {
+                        dma_channel_hw_addr(dma_channel)->transfer_count = settings.tx_pending_len;
+                        settings.tx_read_addr = settings.tx_pending_buffer;
+                        settings.tx_read_len = settings.tx_pending_len;
+                        settings.tx_chained_seq = settings.tx_pending_seq;
+                    } else {
+                        dma_irqn_set_channel_enabled(I2S_DMA_IRQ, dma_channel, false);
+                    }
+                }
+
+                spin_unlock_unsafe(i2s_spin_lock);
+            }
+        } else if (CONFIG::MAY_RX && settings.rx_initialized) {
+            if(settings.duplex) {
+                // The control channel already restarted the capture with the block queued in the last IRQ.
+                // Queue the one after it first, the callback may take up to a block.
+                I2S_DUPLEX_PROCESSOR *duplex = settings.duplex;
+                settings.rx_write_addr = duplex->buffer_filled();
+
+                const int32_t *tx_block = duplex->process();
+                duplex->check_deadline(tx_block, dma_channel_hw_addr(settings.duplex_tx_channel)->read_addr);
+            } else {
+                // publish the filled buffer and continue with the next free one
+                RX_BUFFER_QUEUE *rx_queue = settings.rx_queue;
+                dma_channel_transfer_to_buffer_now(dma_channel, rx_queue->buffer_filled(), rx_queue->get_buffer_size());
+            }
+        }
+
+#if I2S_ENABLE_STATS
+        if(settings.stats) {
+            i2s_record_stats(dma_channel, isr_start);
+        }
+#endif
+    }
+}
+
+// ------------- I2S_CONTROLLER_IMPL Class ---------------- //
+
+// claim the requested state machine or any free one
+static inline uint i2s_claim_pio_sm(PIO pio, int sm) {
+    if(sm < 0) {
+        return pio_claim_unused_sm(pio, true);
+    }
+    pio_sm_claim(pio, sm);
+    return sm;
+}
+
+template<class CONFIG>
+I2S_CONTROLLER_IMPL<CONFIG>::I2S_CONTROLLER_IMPL (
+    const CONFIG &config,
+    uint pattern_buffer_size,
+    uint8_t pin_data_base,
+    uint8_t pin_clock_base,
+    PIO i2s_pio,
+    int i2s_pio_sm,
+    int i2s_dma_channel,
+    uint rx_buffer_count,
+    I2S_BUFFER_ARENA *arena
+    ) : CONFIG(config), I2S_PIO(i2s_pio), I2S_PIO_SM(i2s_claim_pio_sm(i2s_pio, i2s_pio_sm)),
+        I2S_PIO_SM_RX(mode == I2S_CONTROLLER_MODE::TRX_FULL_RATE ? i2s_claim_pio_sm(i2s_pio, -1) : I2S_PIO_SM),
+        PIN_DATA_BASE(pin_data_base), PIN_CLK_BASE(pin_clock_base), buffer_arena(arena),
+        pattern_buffer(pattern_buffer_size, SAMPLE_FORMAT, BIT_DEPTH, mode == I2S_CONTROLLER_MODE::TX_MONO, CHANNEL_COUNT, arena),
+        rx_queue(has_rx() ? rx_buffer_count : 0, i2s_rx_buffer_words(pattern_buffer_size, SAMPLE_FORMAT, BIT_DEPTH), arena) {
+
+    claim_dma_channels(i2s_dma_channel);
+
+    configure_pio(2500); // correct for 96 kHz 32bit @ 120 MHz system clock, 2 clock steps per bit in PIO
+    configure_dma();
+
+    if(!i2s_spin_lock) {
+        i2s_spin_lock = spin_lock_instance(spin_lock_claim_unused(true));
+    }
+
+#if I2S_ENABLE_STATS
+    // free running SysTick at the system clock for the IRQ durations, on the core that runs the IRQ handler
+    if(!(systick_hw->csr & 1)) {
+        systick_hw->rvr = 0xFFFFFF;
+        systick_hw->csr = 0x5; // processor clock, enabled, no interrupt
+    }
+#endif
+
+    // pass data to DMA hanlder
+    if(has_tx()) {
+        uint buffer_len;
+        i2s_settings[I2S_DMA_CHANNEL_TX].tx_read_addr = pattern_buffer.get_next_buffer(buffer_len);
+        i2s_settings[I2S_DMA_CHANNEL_TX].tx_read_len = buffer_len;
+        i2s_settings[I2S_DMA_CHANNEL_TX].pattern_buffer = &pattern_buffer;
+        i2s_settings[I2S_DMA_CHANNEL_TX].pio = I2S_PIO;
+        i2s_settings[I2S_DMA_CHANNEL_TX].pio_sm = I2S_PIO_SM;
+        i2s_settings[I2S_DMA_CHANNEL_TX].tx_ctrl_channel = I2S_DMA_CHANNEL_TX_CTRL;
+#if I2S_ENABLE_STATS
+        i2s_settings[I2S_DMA_CHANNEL_TX].stats = &tx_stats;
+#endif
+        i2s_settings[I2S_DMA_CHANNEL_TX].tx_initialized = true;
+        i2s_settings[I2S_DMA_CHANNEL_TX].rx_initialized = false;
+    }
+
+    if(has_rx()) {
+        i2s_settings[I2S_DMA_CHANNEL_RX].rx_queue = &rx_queue;
+        i2s_settings[I2S_DMA_CHANNEL_RX].pio = I2S_PIO;
+        i2s_settings[I2S_DMA_CHANNEL_RX].pio_sm = I2S_PIO_SM_RX;
+#if I2S_ENABLE_STATS
+        i2s_settings[I2S_DMA_CHANNEL_RX].stats = &rx_stats;
+#endif
+        i2s_settings[I2S_DMA_CHANNEL_RX].rx_initialized = true;
+        i2s_settings[I2S_DMA_CHANNEL_RX].tx_initialized = false;
+    }
+}
+
+template<class CONFIG>
+I2S_CONTROLLER_IMPL<CONFIG>::~I2S_CONTROLLER_IMPL () {
+    // both I2S_DMA_CHANNEL_* are always valid values, so this is safe
+    i2s_settings[I2S_DMA_CHANNEL_TX].tx_initialized = false;
+    i2s_settings[I2S_DMA_CHANNEL_RX].rx_initialized = false;
+
+    if(has_tx()) {
+        i2s_settings[I2S_DMA_CHANNEL_TX].tx_stream = NULL;
+        i2s_settings[I2S_DMA_CHANNEL_TX].drift = NULL;
+        i2s_settings[I2S_DMA_CHANNEL_TX].awg_pending = NULL;
+        i2s_settings[I2S_DMA_CHANNEL_TX].awg_loop = NULL;
+        i2s_settings[I2S_DMA_CHANNEL_TX].awg_playing = false;
+
+        // break the chain first, otherwise the control channel could restart the TX channel
+        dma_channel_config dma_config = dma_get_channel_config(I2S_DMA_CHANNEL_TX);
+        channel_config_set_chain_to(&dma_config, I2S_DMA_CHANNEL_TX);
+        dma_channel_set_config(I2S_DMA_CHANNEL_TX, &dma_config, false);
+
+        dma_channel_abort(I2S_DMA_CHANNEL_TX_CTRL);
+        dma_channel_abort(I2S_DMA_CHANNEL_TX);
+        dma_channel_unclaim(I2S_DMA_CHANNEL_TX_CTRL);
+        dma_channel_unclaim(I2S_DMA_CHANNEL_TX);
+
+        i2s_destroy(buffer_arena, tx_stream);
+        i2s_destroy(buffer_arena, drift);
+    }
+
+    if(has_rx()) {
+        i2s_settings[I2S_DMA_CHANNEL_RX].duplex = NULL;
+        if(duplex) {
+            // like on the TX side, so the control channel can not restart the RX channel
+            dma_channel_config dma_config = dma_get_channel_config(I2S_DMA_CHANNEL_RX);
+            channel_config_set_chain_to(&dma_config, I2S_DMA_CHANNEL_RX);
+            dma_channel_set_config(I2S_DMA_CHANNEL_RX, &dma_config, false);
+
+            dma_channel_abort(I2S_DMA_CHANNEL_RX_CTRL);
+            dma_channel_unclaim(I2S_DMA_CHANNEL_RX_CTRL);
+        }
+        dma_channel_abort(I2S_DMA_CHANNEL_RX);
+        dma_channel_unclaim(I2S_DMA_CHANNEL_RX);
+    }
+
+    if(duplex) {
+        i2s_settings[I2S_DMA_CHANNEL_TX].duplex = NULL;
+        i2s_destroy(buffer_arena, duplex);
+    }
+
+    uint32_t channel_mask = (1u << I2S_DMA_CHANNEL_TX) | (1u << I2S_DMA_CHANNEL_RX);
+    dma_irqn_set_channel_mask_enabled(I2S_DMA_IRQ, channel_mask, false);
+    i2s_dma_channel_mask<CONFIG> = i2s_dma_channel_mask<CONFIG> & ~channel_mask;
+
+    pio_set_sm_mask_enabled(I2S_PIO, pio_sm_mask(), false);
+    pio_remove_program(I2S_PIO, &i2s_program_header, pio_program_offset);
+    pio_sm_unclaim(I2S_PIO, I2S_PIO_SM);
+
+    if(I2S_PIO_SM_RX != I2S_PIO_SM) {
+        pio_remove_program(I2S_PIO, &rx_program_header, rx_program_offset);
+        pio_sm_unclaim(I2S_PIO, I2S_PIO_SM_RX);
+    }
+
+    if(I2S_PIO_SM_MCLK >= 0) {
+        pio_sm_set_enabled(I2S_PIO, I2S_PIO_SM_MCLK, false);
+        if(mclk_program_offset >= 0) {
+            pio_remove_program(I2S_PIO, &mclk_program_header, mclk_program_offset);
+        }
+        pio_sm_unclaim(I2S_PIO, I2S_PIO_SM_MCLK);
+    }
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::claim_dma_channels(int first_channel) {
+    if(first_channel < 0) {
+        I2S_DMA_CHANNEL_TX = dma_claim_unused_channel(true);
+        I2S_DMA_CHANNEL_RX = is_duplex() ? dma_claim_unused_channel(true) : I2S_DMA_CHANNEL_TX;
+    } else {
+        I2S_DMA_CHANNEL_TX = first_channel;
+        I2S_DMA_CHANNEL_RX = is_duplex() ? first_channel+1 : first_channel;
+
+        dma_channel_claim(I2S_DMA_CHANNEL_TX);
+        if(I2S_DMA_CHANNEL_RX != I2S_DMA_CHANNEL_TX) {
+            dma_channel_claim(I2S_DMA_CHANNEL_RX);
+        }
+    }
+    // only one gets used outside of the TRX modes
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::set_pio_divider(uint32_t divider) {
+    clock_divider_setting = divider;
+    pio_sm_set_clkdiv_int_frac(I2S_PIO, I2S_PIO_SM, divider >> 8, divider & 0xff);
+
+#if I2S_ENABLE_STATS
+    uint32_t us_per_transfer_q16 = 65536e6 / words_per_second();
+    i2s_settings[I2S_DMA_CHANNEL_TX].us_per_transfer_q16 = us_per_transfer_q16;
+    i2s_settings[I2S_DMA_CHANNEL_RX].us_per_transfer_q16 = us_per_transfer_q16;
+#endif
+}
+
+template<class CONFIG>
+double I2S_CONTROLLER_IMPL<CONFIG>::words_per_second() const {
+    // the buffers hold frames in the sample format, TX_MONO has one word per frame
+    uint frame_bits = mode == I2S_CONTROLLER_MODE::TX_MONO ? 32 : i2s_frame_bits(SAMPLE_FORMAT, BIT_DEPTH, CHANNEL_COUNT);
+    return get_sample_rate() * frame_bits / 32;
+}
+
+template<class CONFIG>
+I2S_CLOCK_SETTINGS I2S_CONTROLLER_IMPL<CONFIG>::set_sample_rate(uint32_t sample_rate, bool change_sys_clock, double max_error_ppm,
+                                                                uint32_t min_sys_clock_hz, uint32_t max_sys_clock_hz) {
+    // the RX follower needs a few system clock cycles per BCLK phase
+    const uint32_t min_pio_divider = mode == I2S_CONTROLLER_MODE::TRX_FULL_RATE ? 4 : 1;
+    I2S_CLOCK_SETTINGS settings;
+
+    if(change_sys_clock) {
+        settings = i2s_solve_clock(sample_rate, pio_program.cycles_per_frame, mclk_multiple, min_pio_divider, max_sys_clock_hz, min_sys_clock_hz, max_error_ppm);
+    } else {
+        settings = i2s_solve_pio_divider(clock_get_hz(clk_sys), 1, sample_rate, pio_program.cycles_per_frame, mclk_multiple, min_pio_divider);
+    }
+
+    if(!settings.valid) {
+        printf("i2s: no integer clock setting for %" PRIu32 " Hz\n", sample_rate);
+        return settings;
+    }
+
+    if(change_sys_clock) {
+        set_sys_clock_pll(settings.vco_hz, settings.postdiv1, settings.postdiv2);
+    }
+    set_pio_divider(settings.pio_divider << 8);
+    if(mclk_multiple) {
+        configure_mclk(settings.mclk_divider);
+    }
+    return settings;
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::enable_mclk(uint8_t pin_mclk, uint32_t multiple) {
+    if(I2S_PIO_SM_MCLK < 0) {
+        I2S_PIO_SM_MCLK = pio_claim_unused_sm(I2S_PIO, true);
+    }
+    PIN_MCLK = pin_mclk;
+    mclk_multiple = multiple;
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::configure_mclk(uint32_t mclk_divider) {
+    uint32_t pio_divider = 1, period = mclk_divider;
+    i2s_mclk_split(mclk_divider, pio_divider, period); // already checked by the solver
+
+    pio_sm_set_enabled(I2S_PIO, I2S_PIO_SM_MCLK, false);
+    if(mclk_program_offset >= 0) {
+        pio_remove_program(I2S_PIO, &mclk_program_header, mclk_program_offset);
+    }
+
+    mclk_pio_program = i2s_generate_mclk_program(period);
+    mclk_program_header.instructions = mclk_pio_program.code;
+    mclk_program_header.length = mclk_pio_program.length;
+    mclk_program_header.origin = -1;
+    mclk_program_offset = pio_add_program(I2S_PIO, &mclk_program_header);
+
+    pio_sm_config sm_config = pio_get_default_sm_config();
+    sm_config_set_wrap(&sm_config, mclk_program_offset, mclk_program_offset + mclk_pio_program.length-1);
+    sm_config_set_set_pins(&sm_config, PIN_MCLK, 1);
+    sm_config_set_clkdiv_int_frac(&sm_config, pio_divider, 0);
+
+    pio_sm_init(I2S_PIO, I2S_PIO_SM_MCLK, mclk_program_offset, &sm_config);
+    pio_gpio_init(I2S_PIO, PIN_MCLK);
+    pio_sm_set_consecutive_pindirs(I2S_PIO, I2S_PIO_SM_MCLK, PIN_MCLK, 1, true);
+}
+
+template<class CONFIG>
+float I2S_CONTROLLER_IMPL<CONFIG>::get_sample_rate() const {
+    //     System clock            Fractional divider value       PIO cycles per L/R frame (or TDM frame)
+    return clock_get_hz(clk_sys) / (clock_divider_setting/256.) / pio_program.cycles_per_frame;
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::configure_pio(uint32_t divider) {
+    const uint shift_threshold = i2s_shift_threshold(SAMPLE_FORMAT, BIT_DEPTH); // one sample, both packed samples or a word of the bit stream
+    uint pin_mask=0, pin_mask_dir=0;
+
+    // load program
+    uint program_offset = load_pio_program();
+    const uint8_t sideset_pin_cnt = pio_program.sideset_pins;
+
+    // call the PIO block setup function
+    pio_sm_config sm_config = pio_get_default_sm_config();
+    sm_config_set_wrap(&sm_config, program_offset + pio_program.wrap_target, program_offset + pio_program.length-1); // set program length and wrapping
+    sm_config_set_sideset(&sm_config, sideset_pin_cnt, false, false); // set side pin count
+
+    switch(mode) {
+        case I2S_CONTROLLER_MODE::TX:
+            sm_config_set_out_pins(&sm_config, PIN_DATA_BASE, DATA_LANES);
+
+            pin_mask = (((1u << DATA_LANES) - 1) << PIN_DATA_BASE) | (3u << PIN_CLK_BASE);
+            pin_mask_dir = pin_mask;
+
+            sm_config_set_out_shift(&sm_config, false, true, shift_threshold); // enables autopull with correct bit per word count
+            break;
+        case I2S_CONTROLLER_MODE::TX_MONO:
+            sm_config_set_out_pins(&sm_config, PIN_DATA_BASE, 1);
+
+            pin_mask = (1u << PIN_DATA_BASE) | (3u << PIN_CLK_BASE);
+            pin_mask_dir = pin_mask;
+
+            sm_config_set_out_shift(&sm_config, false, false, BIT_DEPTH-1); // no autopull, the threshold marks the last bit of a sample for jmp !osre
+            break;
+        case I2S_CONTROLLER_MODE::TX_TDM:
+            sm_config_set_out_pins(&sm_config, PIN_DATA_BASE, 1);
+
+            pin_mask = (1u << PIN_DATA_BASE) | (3u << PIN_CLK_BASE);
+            pin_mask_dir = pin_mask;
+
+            sm_config_set_out_shift(&sm_config, false, true, shift_threshold); // enables autopull with correct bit per word count
+            break;
+        case I2S_CONTROLLER_MODE::RX:
+            sm_config_set_in_pins(&sm_config, PIN_DATA_BASE);
+
+            pin_mask = (1u << PIN_DATA_BASE) | (3u << PIN_CLK_BASE);
+            pin_mask_dir = 0 | (3u << PIN_CLK_BASE);
+
+            sm_config_set_in_shift(&sm_config, false, true, shift_threshold); // enables autopush with correct bit per word count
+            break;
+        case I2S_CONTROLLER_MODE::TRX:
+            sm_config_set_out_pins(&sm_config, PIN_DATA_BASE, 1);
+            sm_config_set_in_pins(&sm_config, PIN_DATA_BASE+1);
+
+            pin_mask = (3u << PIN_DATA_BASE) | (7u << PIN_CLK_BASE);
+            pin_mask_dir = (1u << PIN_DATA_BASE) | (7u << PIN_CLK_BASE);
+
+            sm_config_set_out_shift(&sm_config, false, true, shift_threshold); // enables autopull with correct bit per word count
+            sm_config_set_in_shift(&sm_config, false, true, shift_threshold);  // enables autopush with correct bit per word count
+            break;
+        case I2S_CONTROLLER_MODE::TRX_FULL_RATE:
+            // RX is done by the follower state machine, see configure_rx_follower()
+            sm_config_set_out_pins(&sm_config, PIN_DATA_BASE, 1);
+
+            pin_mask = (3u << PIN_DATA_BASE) | (3u << PIN_CLK_BASE);
+            pin_mask_dir = (1u << PIN_DATA_BASE) | (3u << PIN_CLK_BASE);
+
+            sm_config_set_out_shift(&sm_config, false, true, shift_threshold); // enables autopull with correct bit per word count
+            break;
+    }
+    sm_config_set_sideset_pins(&sm_config, PIN_CLK_BASE);
+
+    pio_sm_init(I2S_PIO, I2S_PIO_SM, program_offset, &sm_config);
+
+    for(uint lane=0; lane<DATA_LANES; ++lane) {
+        pio_gpio_init(I2S_PIO, PIN_DATA_BASE + lane);
+    }
+    pio_gpio_init(I2S_PIO, PIN_CLK_BASE);
+    pio_gpio_init(I2S_PIO, PIN_CLK_BASE+1);
+    if(mode == I2S_CONTROLLER_MODE::TRX) {
+        pio_gpio_init(I2S_PIO, PIN_DATA_BASE+1);
+        pio_gpio_init(I2S_PIO, PIN_CLK_BASE+2);
+    } else if(mode == I2S_CONTROLLER_MODE::TRX_FULL_RATE) {
+        pio_gpio_init(I2S_PIO, PIN_DATA_BASE+1);
+    }
+
+    pio_sm_set_pindirs_with_mask(I2S_PIO, I2S_PIO_SM, pin_mask_dir, pin_mask);
+    pio_sm_set_pins(I2S_PIO, I2S_PIO_SM, 0); // initialize all SM pins with 0
+
+    if(pio_program.load_y) {
+        // e.g. TDM frames are too long for set, so the bit counter reload value goes through the FIFO into Y
+        pio_sm_put(I2S_PIO, I2S_PIO_SM, pio_program.y_value);
+        pio_sm_exec(I2S_PIO, I2S_PIO_SM, i2s_pio_encode_pull(false, true));
+        pio_sm_exec(I2S_PIO, I2S_PIO_SM, i2s_pio_encode_out(I2S_PIO_Y, 32));
+    }
+    if(pio_program.load_x) {
+        // e.g. RX starts inside the bit loop of the first word
+        pio_sm_exec(I2S_PIO, I2S_PIO_SM, i2s_pio_encode_set(I2S_PIO_X, pio_program.x_value));
+    }
+
+    pio_sm_exec(I2S_PIO, I2S_PIO_SM, i2s_pio_encode_jmp(program_offset + pio_program.entry));
+
+    // set clock settings
+    set_pio_divider(divider);
+
+    if(mode == I2S_CONTROLLER_MODE::TRX_FULL_RATE) {
+        configure_rx_follower();
+    }
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::configure_rx_follower() {
+    const uint shift_threshold = i2s_shift_threshold(SAMPLE_FORMAT, BIT_DEPTH);
+
+    rx_pio_program = i2s_generate_rx_follower_program(PIN_CLK_BASE, PIN_CLK_BASE+1);
+    rx_program_header.instructions = rx_pio_program.code;
+    rx_program_header.length = rx_pio_program.length;
+    rx_program_header.origin = -1;
+    rx_program_offset = pio_add_program(I2S_PIO, &rx_program_header);
+
+    pio_sm_config sm_config = pio_get_default_sm_config();
+    sm_config_set_wrap(&sm_config, rx_program_offset + rx_pio_program.wrap_target, rx_program_offset + rx_pio_program.length-1);
+    sm_config_set_in_pins(&sm_config, PIN_DATA_BASE+1);
+    sm_config_set_in_shift(&sm_config, false, true, shift_threshold); // enables autopush with correct bit per word count
+    sm_config_set_clkdiv_int_frac(&sm_config, 1, 0); // has to see every BCLK edge, the TX state machine sets the pace
+
+    pio_sm_init(I2S_PIO, I2S_PIO_SM_RX, rx_program_offset, &sm_config);
+    pio_sm_set_consecutive_pindirs(I2S_PIO, I2S_PIO_SM_RX, PIN_DATA_BASE+1, 1, false);
+    pio_sm_exec(I2S_PIO, I2S_PIO_SM_RX, i2s_pio_encode_jmp(rx_program_offset + rx_pio_program.entry));
+}
+
+template<class CONFIG>
+uint I2S_CONTROLLER_IMPL<CONFIG>::load_pio_program() {
+    // set PIO header, the program itself comes with the configuration
+    i2s_program_header.instructions = pio_program.code;
+    i2s_program_header.length = pio_program.length;
+    i2s_program_header.origin = -1;
+
+    pio_program_offset = pio_add_program(I2S_PIO, &i2s_program_header);
+    return pio_program_offset;
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::configure_dma_channel(uint dma_channel, bool is_tx) {
+    // configure DMA channel
+    printf("Configuring DMA channel %d for i2s\n", dma_channel);
+    dma_channel_config dma_config = dma_channel_get_default_config(dma_channel);
+
+    channel_config_set_dreq(&dma_config, pio_get_dreq(I2S_PIO, is_tx ? I2S_PIO_SM : I2S_PIO_SM_RX, is_tx));
+    if(is_tx) {
+        channel_config_set_read_increment(&dma_config, true);
+        channel_config_set_write_increment(&dma_config, false);
+    } else {    
+        channel_config_set_write_increment(&dma_config, true);
+        channel_config_set_read_increment(&dma_config, false); // REQUIRED (I don't get why, but must be set like this for RX to work
+    }
+
+    // whole words for every format, the byte swap turns a PACKED_24 byte stream into the MSB first bit stream the PIO shifts
+    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+    channel_config_set_bswap(&dma_config, i2s_dma_byte_swap(SAMPLE_FORMAT));
+
+    if(is_tx) {
+        dma_channel_configure(dma_channel,
+            &dma_config,
+            &I2S_PIO->txf[I2S_PIO_SM],
+            NULL,
+            0,
+            false
+        );
+    } else {
+        dma_channel_configure(dma_channel,
+            &dma_config,
+            NULL,
+            &I2S_PIO->rxf[I2S_PIO_SM_RX],
+            0,
+            false
+        );
+    }
+
+    // TX channels only raise an IRQ when a new buffer is queued
+    i2s_dma_channel_mask<CONFIG> = i2s_dma_channel_mask<CONFIG> | (1u << dma_channel);
+    dma_irqn_set_channel_enabled(I2S_DMA_IRQ, dma_channel, !is_tx);
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::configure_tx_control_channel() {
+    I2S_DMA_CHANNEL_TX_CTRL = dma_claim_unused_channel(true);
+    printf("Configuring DMA channel %d as i2s TX control channel\n", I2S_DMA_CHANNEL_TX_CTRL);
+
+    // the control channel copies the current buffer address into the data channel and thereby restarts it
+    dma_channel_config dma_config = dma_channel_get_default_config(I2S_DMA_CHANNEL_TX_CTRL);
+    channel_config_set_read_increment(&dma_config, false);
+    channel_config_set_write_increment(&dma_config, false);
+    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+
+    dma_channel_configure(I2S_DMA_CHANNEL_TX_CTRL,
+        &dma_config,
+        &dma_channel_hw_addr(I2S_DMA_CHANNEL_TX)->al3_read_addr_trig,
+        &i2s_settings[I2S_DMA_CHANNEL_TX].tx_read_addr,
+        1,
+        false
+    );
+
+    // let the data channel trigger the control channel once it is done
+    dma_config = dma_get_channel_config(I2S_DMA_CHANNEL_TX);
+    channel_config_set_chain_to(&dma_config, I2S_DMA_CHANNEL_TX_CTRL);
+    dma_channel_set_config(I2S_DMA_CHANNEL_TX, &dma_config, false);
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::configure_rx_control_channel() {
+    I2S_DMA_CHANNEL_RX_CTRL = dma_claim_unused_channel(true);
+    printf("Configuring DMA channel %d as i2s RX control channel\n", I2S_DMA_CHANNEL_RX_CTRL);
+
+    // the control channel copies the queued block address into the data channel and thereby restarts it
+    dma_channel_config dma_config = dma_channel_get_default_config(I2S_DMA_CHANNEL_RX_CTRL);
+    channel_config_set_read_increment(&dma_config, false);
+    channel_config_set_write_increment(&dma_config, false);
+    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+
+    dma_channel_configure(I2S_DMA_CHANNEL_RX_CTRL,
+        &dma_config,
+        &dma_channel_hw_addr(I2S_DMA_CHANNEL_RX)->al2_write_addr_trig,
+        &i2s_settings[I2S_DMA_CHANNEL_RX].rx_write_addr,
+        1,
+        false
+    );
+
+    dma_config = dma_get_channel_config(I2S_DMA_CHANNEL_RX);
+    channel_config_set_chain_to(&dma_config, I2S_DMA_CHANNEL_RX_CTRL);
+    dma_channel_set_config(I2S_DMA_CHANNEL_RX, &dma_config, false);
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::configure_dma() {
+    if(!i2s_irq_handler_installed<CONFIG>) {
+        irq_add_shared_handler(DMA_IRQ_0 + I2S_DMA_IRQ, i2s_dma_irq_handler<CONFIG>, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        i2s_irq_handler_installed<CONFIG> = true;
+    }
+
+    switch(mode) {
+        case I2S_CONTROLLER_MODE::TX:
+        case I2S_CONTROLLER_MODE::TX_MONO:
+        case I2S_CONTROLLER_MODE::TX_TDM:
+            configure_dma_channel(I2S_DMA_CHANNEL_TX, true);
+            configure_tx_control_channel();
+            break;
+        case I2S_CONTROLLER_MODE::RX:
+            configure_dma_channel(I2S_DMA_CHANNEL_RX, false);
+            break;
+        case I2S_CONTROLLER_MODE::TRX:
+        case I2S_CONTROLLER_MODE::TRX_FULL_RATE:
+            configure_dma_channel(I2S_DMA_CHANNEL_TX, true);
+            configure_dma_channel(I2S_DMA_CHANNEL_RX, false);
+            configure_tx_control_channel();
+            break;
+    }
+
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::start_i2s() {
+    start_dma();
+    pio_enable_sm_mask_in_sync(I2S_PIO, pio_sm_mask());
+}
+
+template<class CONFIG>
+template<class CONTROLLER>
+void I2S_CONTROLLER_IMPL<CONFIG>::start_i2s_synchronized(CONTROLLER *const controllers[], uint controller_count) {
+    static_assert(std::is_base_of_v<I2S_CONTROLLER_IMPL, CONTROLLER>, "only controllers of one type can be started together");
+
+    uint32_t sm_mask[NUM_PIOS] = {};
+
+    // the DMA fills the FIFOs while the state machines are still stopped
+    for(uint i=0; i<controller_count; ++i) {
+        controllers[i]->start_dma();
+        sm_mask[pio_get_index(controllers[i]->I2S_PIO)] |= controllers[i]->pio_sm_mask();
+    }
+
+    // enabling also restarts the clock dividers, so all state machines of one PIO run in lockstep
+    uint32_t irq_state = save_and_disable_interrupts();
+    for(uint i=0; i<NUM_PIOS; ++i) {
+        if(sm_mask[i]) {
+            pio_enable_sm_mask_in_sync(pio_get_instance(i), sm_mask[i]);
+        }
+    }
+    restore_interrupts(irq_state);
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::start_dma() {
+    uint buffer_len = 0;
+    const int32_t *new_buffer;
+
+    printf("i2s interrupt started\n");
+    irq_set_enabled(DMA_IRQ_0 + I2S_DMA_IRQ, 1);
+
+    if(duplex) {
+        // silence until the first processed block, the IRQ queues the next ring block from then on
+        const uint block_words = duplex->get_block_words();
+
+        duplex->reset();
+        dma_channel_transfer_from_buffer_now(I2S_DMA_CHANNEL_TX, duplex->next_tx_block(), block_words);
+
+        i2s_settings[I2S_DMA_CHANNEL_TX].tx_read_addr = duplex->next_tx_block();
+        dma_channel_hw_addr(I2S_DMA_CHANNEL_TX)->transfer_count = block_words;
+
+        dma_irqn_acknowledge_channel(I2S_DMA_IRQ, I2S_DMA_CHANNEL_TX);
+        dma_irqn_set_channel_enabled(I2S_DMA_IRQ, I2S_DMA_CHANNEL_TX, true);
+    } else if(tx_stream) {
+        // start the first block and queue the second one, the IRQ keeps one block queued from then on
+        // samples written before the start are played first
+        uint32_t block_len;
+
+        new_buffer = tx_stream->start_block(block_len);
+        dma_channel_transfer_from_buffer_now(I2S_DMA_CHANNEL_TX, new_buffer, block_len);
+
+        i2s_settings[I2S_DMA_CHANNEL_TX].tx_read_addr = tx_stream->start_block(block_len);
+        dma_channel_hw_addr(I2S_DMA_CHANNEL_TX)->transfer_count = block_len;
+
+        dma_irqn_acknowledge_channel(I2S_DMA_IRQ, I2S_DMA_CHANNEL_TX);
+        dma_irqn_set_channel_enabled(I2S_DMA_IRQ, I2S_DMA_CHANNEL_TX, true);
+    } else if(i2s_settings[I2S_DMA_CHANNEL_TX].awg_pending) {
+        // a sequence queued before the start plays right away
+        I2S_SETTINGS &settings = i2s_settings[I2S_DMA_CHANNEL_TX];
+
+        settings.awg_loop = settings.awg_pending_loop;
+        settings.awg_pass_count = 0;
+        settings.awg_playing = true;
+        i2s_start_awg_chain(I2S_DMA_CHANNEL_TX, settings.awg_pending, true);
+        settings.awg_pending = NULL;
+
+        dma_irqn_acknowledge_channel(I2S_DMA_IRQ, I2S_DMA_CHANNEL_TX);
+        dma_irqn_set_channel_enabled(I2S_DMA_IRQ, I2S_DMA_CHANNEL_TX, true);
+    } else if(has_tx()) {
+        // after this, the control channel keeps restarting the data channel with the same buffer
+        new_buffer = i2s_settings[I2S_DMA_CHANNEL_TX].tx_read_addr;
+        buffer_len = i2s_settings[I2S_DMA_CHANNEL_TX].tx_read_len;
+        dma_channel_transfer_from_buffer_now(I2S_DMA_CHANNEL_TX, new_buffer, buffer_len);
+    }
+    tx_running = true;
+    
+    if(has_rx()) {
+        puts("starting RX DMA");
+        rx_queue.reset();
+        // a completion left over from an earlier user of the channel would publish a buffer that was never filled
+        dma_irqn_acknowledge_channel(I2S_DMA_IRQ, I2S_DMA_CHANNEL_RX);
+        if(duplex) {
+            // the IRQ keeps one block queued for the control channel from then on
+            i2s_settings[I2S_DMA_CHANNEL_RX].rx_write_addr = duplex->get_queued_buffer();
+            dma_channel_transfer_to_buffer_now(I2S_DMA_CHANNEL_RX, duplex->get_fill_buffer(), duplex->get_block_words());
+        } else {
+            dma_channel_transfer_to_buffer_now(I2S_DMA_CHANNEL_RX, rx_queue.get_fill_buffer(), rx_queue.get_buffer_size());
+        }
+    }
+}
+
+template<class CONFIG>
+uint32_t I2S_CONTROLLER_IMPL<CONFIG>::queue_tx_buffer(const int32_t *buffer, uint buffer_len) {
+    I2S_SETTINGS &settings = i2s_settings[I2S_DMA_CHANNEL_TX];
+
+    if(tx_stream || duplex) {
+        return settings.tx_pending_seq; // the IRQ is busy feeding blocks from the stream or the duplex processing
+    }
+
+    uint32_t irq_state = spin_lock_blocking(i2s_spin_lock);
+    uint32_t seq = settings.tx_pending_seq + 1;
+
+    settings.tx_pending_buffer = buffer;
+    settings.tx_pending_len = buffer_len;
+    settings.tx_pending_seq = seq;
+
+    if(!tx_running) {
+        // start_i2s() picks it up directly
+        settings.tx_read_addr = buffer;
+        settings.tx_read_len = buffer_len;
+        settings.tx_chained_seq = seq;
+        settings.tx_played_seq = seq;
+    } else if(settings.tx_chained_seq == settings.tx_played_seq && !settings.awg_playing) {
+        // IRQ is off, drop old completions so it fires at the end of the buffer that is currently played
+        // (a sequence keeps it on, its buffers follow the sequence)
+        dma_irqn_acknowledge_channel(I2S_DMA_IRQ, I2S_DMA_CHANNEL_TX);
+        dma_irqn_set_channel_enabled(I2S_DMA_IRQ, I2S_DMA_CHANNEL_TX, true);
+    }
+    spin_unlock(i2s_spin_lock, irq_state);
+
+    return seq;
+}
+
+template<class CONFIG>
+bool I2S_CONTROLLER_IMPL<CONFIG>::is_tx_buffer_playing(uint32_t seq) const {
+    return (int32_t)(i2s_settings[I2S_DMA_CHANNEL_TX].tx_played_seq - seq) >= 0;
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::begin_pattern_update() {
+    // the back buffer is the one that was played before the last update, wait until the DMA left it
+    while(!is_tx_buffer_playing(pattern_update_seq)) {
+        tight_loop_contents();
+    }
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::finish_pattern_update() {
+    uint buffer_len;
+    const int32_t *buffer = pattern_buffer.get_next_buffer(buffer_len);
+    pattern_update_seq = queue_tx_buffer(buffer, buffer_len);
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::enable_tx_streaming(uint ring_size_log2, uint block_size, int32_t idle_value) {
+    if(!has_tx() || tx_stream || duplex) {
+        return;
+    }
+
+    // TX_MONO plays one word per frame, the other modes need whole units, e.g. two PACKED_24 frames in 3 words
+    const uint unit_words = mode == I2S_CONTROLLER_MODE::TX_MONO ? 1 : i2s_unit_words(i2s_frame_bits(SAMPLE_FORMAT, BIT_DEPTH, CHANNEL_COUNT));
+    tx_stream = i2s_create<TX_RING_BUFFER>(buffer_arena, ring_size_log2, block_size, unit_words, idle_value, buffer_arena);
+    i2s_settings[I2S_DMA_CHANNEL_TX].tx_stream = tx_stream;
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::enable_drift_compensation(bool trim_divider, float bandwidth_hz, uint target_fill) {
+    if(!tx_stream || drift) {
+        return;
+    }
+
+    if(target_fill == 0) {
+        target_fill = tx_stream->get_size() / 2;
+    }
+
+    // the ring holds frames in the sample format, so the controller works in words
+    drift = i2s_create<DRIFT_CONTROLLER>(buffer_arena, target_fill, clock_divider_setting, words_per_second(), bandwidth_hz);
+
+    i2s_settings[I2S_DMA_CHANNEL_TX].drift_trims_divider = trim_divider;
+    i2s_settings[I2S_DMA_CHANNEL_TX].drift = drift;
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::enable_duplex_processing(I2S_BLOCK_CALLBACK callback, void *context, uint block_frames, uint latency_blocks) {
+    if(!is_duplex() || tx_stream || duplex || tx_running) {
+        return;
+    }
+
+    // blocks are laid out like RX buffers, so a PACKED_24 block has an even number of frames
+    const uint block_words = i2s_rx_buffer_words(block_frames, SAMPLE_FORMAT, BIT_DEPTH);
+    block_frames = block_words * 32 / i2s_frame_bits(SAMPLE_FORMAT, BIT_DEPTH);
+
+    duplex = i2s_create<I2S_DUPLEX_PROCESSOR>(buffer_arena, callback, context, block_frames, block_words, latency_blocks, buffer_arena);
+    configure_rx_control_channel();
+
+    i2s_settings[I2S_DMA_CHANNEL_RX].duplex_tx_channel = I2S_DMA_CHANNEL_TX;
+    i2s_settings[I2S_DMA_CHANNEL_RX].duplex = duplex;
+    i2s_settings[I2S_DMA_CHANNEL_TX].duplex = duplex;
+}
+
+template<class CONFIG>
+float I2S_CONTROLLER_IMPL<CONFIG>::get_duplex_latency_frames() const {
+    if(!duplex || !tx_running) {
+        return 0;
+    }
+
+    // all four values of the same moment, the state machines move on by a bit every few hundred system clock cycles
+    uint32_t irq_state = save_and_disable_interrupts();
+    const uintptr_t tx_read_addr = dma_channel_hw_addr(I2S_DMA_CHANNEL_TX)->read_addr;
+    const uint32_t tx_fifo_level = pio_sm_get_tx_fifo_level(I2S_PIO, I2S_PIO_SM);
+    const uintptr_t rx_write_addr = dma_channel_hw_addr(I2S_DMA_CHANNEL_RX)->write_addr;
+    const uint32_t rx_fifo_level = pio_sm_get_rx_fifo_level(I2S_PIO, I2S_PIO_SM_RX);
+    restore_interrupts(irq_state);
+
+    uint32_t words = duplex->latency_words(tx_read_addr, tx_fifo_level, rx_write_addr, rx_fifo_level);
+    return (float)words * duplex->get_block_frames() / duplex->get_block_words();
+}
+
+template<class CONFIG>
+bool I2S_CONTROLLER_IMPL<CONFIG>::play_sequence(I2S_AWG_SEQUENCE &sequence, const I2S_AWG_SEGMENT *segments, uint segment_count) {
+    I2S_SETTINGS &settings = i2s_settings[I2S_DMA_CHANNEL_TX];
+
+    if(!has_tx() || tx_stream || duplex) {
+        return false;
+    }
+
+    // the DMA reads the control blocks of the playing sequence
+    if(&sequence == awg_sequence && is_sequence_playing()) {
+        printf("i2s: sequence is playing, compile into another one\n");
+        return false;
+    }
+
+    if(!sequence.compile(segments, segment_count, SAMPLE_FORMAT, BIT_DEPTH, mode == I2S_CONTROLLER_MODE::TX_MONO, CHANNEL_COUNT)) {
+        return false;
+    }
+
+    uint32_t irq_state = spin_lock_blocking(i2s_spin_lock);
+    awg_sequence = &sequence;
+    settings.awg_pending = sequence.get_blocks();
+    settings.awg_pending_loop = sequence.get_loop();
+
+    if(tx_running && !settings.awg_playing && settings.tx_chained_seq == settings.tx_played_seq) {
+        // IRQ is off, like in queue_tx_buffer()
+        dma_irqn_acknowledge_channel(I2S_DMA_IRQ, I2S_DMA_CHANNEL_TX);
+        dma_irqn_set_channel_enabled(I2S_DMA_IRQ, I2S_DMA_CHANNEL_TX, true);
+    }
+    spin_unlock(i2s_spin_lock, irq_state);
+
+    return true;
+}
+
+template<class CONFIG>
+void I2S_CONTROLLER_IMPL<CONFIG>::stop_sequence() {
+    I2S_SETTINGS &settings = i2s_settings[I2S_DMA_CHANNEL_TX];
+
+    uint32_t irq_state = spin_lock_blocking(i2s_spin_lock);
+    settings.awg_pending = NULL;
+    settings.awg_loop = NULL;
+    spin_unlock(i2s_spin_lock, irq_state);
+}
+
+template<class CONFIG>
+bool I2S_CONTROLLER_IMPL<CONFIG>::is_sequence_playing() const {
+    const I2S_SETTINGS &settings = i2s_settings[I2S_DMA_CHANNEL_TX];
+    return settings.awg_playing || settings.awg_pending;
+}
+
+template<class CONFIG>
+uint32_t I2S_CONTROLLER_IMPL<CONFIG>::get_sequence_pass_count() const {
+    return i2s_settings[I2S_DMA_CHANNEL_TX].awg_pass_count;
+}
+
+// the runtime configuration is compiled once, in i2s.cpp
+extern template class I2S_CONTROLLER_IMPL<I2S_RUNTIME_CONFIG>;
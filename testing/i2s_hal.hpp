@@ -0,0 +1,29 @@
+#pragma once
+
+/**
+ * Hardware backend of the I2S library, selected at compile time
+ * The library only uses a small part of the pico-sdk: PIO programs and state machine setup, DMA channels with chaining,
+ * the shared DMA IRQ, spin locks, the system clock and the timer.
+ *
+ * On the RP2040 this header includes the SDK and nothing else, so the backend adds no code and no indirection.
+ * Compiled with -DI2S_HAL_HOST=1, i2s_hal_host.hpp provides the same part of the SDK API on a host machine, on top of
+ * a simulated PIO and DMA that run on a virtual clock. I2S_CONTROLLER can then be driven end-to-end and profiled
+ * with the usual Linux tools, e.g. g++ -std=c++20 -DI2S_HAL_HOST=1 app.cpp i2s.cpp
+ * The tests in host/ are built that way, see host/CMakeLists.txt.
+ */
+
+#ifndef I2S_HAL_HOST
+#define I2S_HAL_HOST 0
+#endif
+
+#if I2S_HAL_HOST
+#include "i2s_hal_host.hpp"
+#else
+#include <pico/time.h>
+#include <hardware/pio.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/clocks.h>
+#include <hardware/sync.h>
+#include <hardware/structs/systick.h>
+#endif
@@ -0,0 +1,1060 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <utility>
+#include <vector>
+
+/**
+ * Host backend of i2s_hal.hpp, built with -DI2S_HAL_HOST=1
+ * Provides the part of the pico-sdk API the I2S library uses, on top of a model of the PIO and the DMA.
+ *
+ * Nothing runs on its own, everything happens on a virtual clock in system clock cycles:
+ * i2s_host_run_cycles() advances it, and so do sleep_us(), sleep_ms() and tight_loop_contents() (1 us), so the
+ * library's busy waits make progress.
+ *  - State machines execute their programs instruction by instruction at their clock divider, including side-set,
+ *    delays, autopull/autopush and FIFO stalls (flagged in fdebug), so timing and the words on the pins are exact.
+ *    Pins are a single level per GPIO, pin directions and the input synchronizer are not modelled.
+ *  - DMA channels move data as soon as their DREQ allows, a transfer takes no time. Completion raises the channel's
+ *    IRQ bit and triggers the chained channel. A write to a channel's al3_read_addr_trig register moves a native
+ *    pointer and triggers that channel, so control blocks hold pointers like on the RP2040. al2_write_addr_trig does the same
+ *    for the write address. Writes to al3_transfer_count
+ *    move a native word as well, so a control channel steps and wraps its addresses in pointer sized words.
+ *    A NULL write to al3_read_addr_trig is a null trigger, it raises the IRQ of a channel in IRQ_QUIET mode.
+ *  - DMA IRQ handlers run between two state machine steps, never while the application holds a spin lock.
+ *    They take no virtual time.
+ *  - Step hooks run after every state machine step, to trace the pins or to drive inputs like an external ADC,
+ *    see i2s_host_add_step_hook().
+ * Single threaded: there is no second core.
+ */
+
+// ---- pico/platform ---- //
+
+#define __isr
+#define __time_critical_func(func_name) func_name
+#define __not_in_flash_func(func_name) func_name
+#define __scratch_x(group)
+#define __scratch_y(group)
+
+#define NUM_PIOS 2
+#define NUM_PIO_STATE_MACHINES 4
+#define NUM_DMA_CHANNELS 12
+#define NUM_SPIN_LOCKS 32
+
+#define DMA_IRQ_0 11
+#define DMA_IRQ_1 12
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+
+#define PIO_FDEBUG_TXSTALL_LSB 24
+#define PIO_FDEBUG_RXSTALL_LSB 0
+
+#define DREQ_PIO0_TX0 0
+#define DREQ_PIO0_RX0 4
+#define DREQ_FORCE 0x3f
+
+#define I2S_HOST_PIO_FIFO_DEPTH 4
+#define I2S_HOST_PIO_INSTRUCTIONS 32
+#define I2S_HOST_GPIO_COUNT 32
+
+static inline void i2s_host_panic(const char *message) {
+    fprintf(stderr, "i2s host: %s\n", message);
+    abort();
+}
+
+// ---- hardware/pio_instructions ---- //
+
+// operands of the interpreter, the library encodes its instructions itself (see i2s_pio_program.hpp)
+enum pio_src_dest {
+    pio_pins = 0u,
+    pio_x = 1u,
+    pio_y = 2u,
+    pio_null = 3u,
+    pio_pindirs = 4u,
+    pio_exec_mov = 4u,
+    pio_status = 5u,
+    pio_pc = 5u,
+    pio_isr = 6u,
+    pio_osr = 7u,
+    pio_exec_out = 7u,
+};
+
+// ---- register models ---- //
+
+/// interrupt status register, reads as raw & enabled, writing 1 clears the raw bit
+struct I2S_HOST_IRQ_STATUS {
+    uint32_t *raw;
+    const uint32_t *enabled;
+
+    operator uint32_t() const { return *raw & *enabled; }
+    I2S_HOST_IRQ_STATUS &operator=(uint32_t mask) { *raw &= ~mask; return *this; }
+};
+
+/// sticky flags, writing 1 clears them
+struct I2S_HOST_W1C {
+    uint32_t value;
+
+    operator uint32_t() const { return value; }
+    I2S_HOST_W1C &operator=(uint32_t mask) { value &= ~mask; return *this; }
+};
+
+/// DMA TRANS_COUNT, reads the transfers left, writing sets the count of the next trigger
+struct I2S_HOST_TRANSFER_COUNT {
+    uint32_t reload;
+    uint32_t remaining;
+
+    operator uint32_t() const { return remaining; }
+    I2S_HOST_TRANSFER_COUNT &operator=(uint32_t count) { reload = count; return *this; }
+};
+
+/// SysTick current value, counts down at the system clock
+struct I2S_HOST_SYSTICK_CVR {
+    operator uint32_t() const;
+};
+
+// ---- hardware/pio ---- //
+
+typedef struct {
+    I2S_HOST_W1C fdebug;
+    uint32_t txf[NUM_PIO_STATE_MACHINES]; // only the addresses are used, as DMA targets
+    uint32_t rxf[NUM_PIO_STATE_MACHINES];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+struct pio_program {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+};
+
+typedef struct {
+    uint32_t clkdiv; // 16.8, an integer part of 0 is 65536
+    uint wrap_target, wrap;
+    uint sideset_bit_count, sideset_base;
+    bool sideset_optional;
+    uint out_base, out_count;
+    uint set_base, set_count;
+    uint in_base;
+    bool out_shift_right, autopull;
+    uint pull_threshold;
+    bool in_shift_right, autopush;
+    uint push_threshold;
+} pio_sm_config;
+
+struct I2S_HOST_FIFO {
+    uint32_t words[I2S_HOST_PIO_FIFO_DEPTH];
+    uint head, level;
+
+    bool empty() const { return level == 0; }
+    bool full() const { return level == I2S_HOST_PIO_FIFO_DEPTH; }
+    void clear() { head = level = 0; }
+    void push(uint32_t word) { words[(head + level++) % I2S_HOST_PIO_FIFO_DEPTH] = word; }
+    uint32_t pop() {
+        uint32_t word = words[head];
+        head = (head + 1) % I2S_HOST_PIO_FIFO_DEPTH;
+        --level;
+        return word;
+    }
+};
+
+struct I2S_HOST_SM {
+    bool claimed, enabled;
+    pio_sm_config config;
+    uint pc;
+    uint32_t x, y, osr, isr;
+    uint osr_count, isr_count; // bits shifted out of the OSR / into the ISR
+    uint delay;                // cycles left of the delay of the last instruction
+    bool push_pending;         // autopush stalled on a full RX FIFO
+    uint64_t next_tick;        // virtual time of the next PIO clock cycle, in 1/256 system clock cycles
+    I2S_HOST_FIFO tx_fifo, rx_fifo;
+    std::vector<uint32_t> tx_words; // every word the state machine took from its TX FIFO
+};
+
+// ---- hardware/dma ---- //
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2,
+};
+
+typedef struct {
+    uint dreq;
+    bool read_increment, write_increment;
+    enum dma_channel_transfer_size size;
+    uint chain_to;
+    bool irq_quiet;
+    bool ring_write;
+    uint ring_size_bits;
+    bool bswap;
+} dma_channel_config;
+
+typedef struct {
+    uintptr_t read_addr;
+    uintptr_t write_addr;
+    I2S_HOST_TRANSFER_COUNT transfer_count;
+    // only the addresses are used, as targets of a control channel. Adjacent and aligned for a write ring like on the RP2040
+    alignas(2 * sizeof(uintptr_t)) uintptr_t al3_transfer_count;
+    uintptr_t al3_read_addr_trig;
+    uintptr_t al2_write_addr_trig;
+} dma_channel_hw_t;
+
+typedef struct {
+    dma_channel_hw_t ch[NUM_DMA_CHANNELS];
+    uint32_t intr;
+    uint32_t inte0, inte1;
+    I2S_HOST_IRQ_STATUS ints0 = {&intr, &inte0};
+    I2S_HOST_IRQ_STATUS ints1 = {&intr, &inte1};
+} dma_hw_t;
+
+struct I2S_HOST_DMA_CHANNEL {
+    bool claimed, busy;
+    dma_channel_config config;
+};
+
+// ---- hardware/structs/systick, hardware/clocks, hardware/sync, hardware/irq ---- //
+
+typedef struct {
+    uint32_t csr;
+    uint32_t rvr;
+    I2S_HOST_SYSTICK_CVR cvr;
+} systick_hw_t;
+
+enum clock_index {
+    clk_gpout0 = 0, clk_gpout1, clk_gpout2, clk_gpout3, clk_ref, clk_sys, clk_peri, clk_usb, clk_adc, clk_rtc,
+};
+
+typedef volatile uint32_t spin_lock_t;
+typedef void (*irq_handler_t)(void);
+
+/// called after every state machine step, see i2s_host_add_step_hook()
+typedef void (*i2s_host_step_hook_t)(void *context);
+
+// ---- simulator state ---- //
+
+struct I2S_HOST_STATE {
+    uint64_t now;                    // virtual time in 1/256 system clock cycles
+    uint32_t sys_clock_hz = 125000000;
+    uint64_t clock_change_time;      // virtual time and timer value of the last system clock change
+    uint64_t clock_change_us;
+
+    pio_hw_t pio_regs[NUM_PIOS];
+    I2S_HOST_SM sm[NUM_PIOS][NUM_PIO_STATE_MACHINES];
+    uint16_t instructions[NUM_PIOS][I2S_HOST_PIO_INSTRUCTIONS];
+    uint32_t used_instructions[NUM_PIOS];
+
+    dma_hw_t dma_regs;
+    I2S_HOST_DMA_CHANNEL dma[NUM_DMA_CHANNELS];
+
+    std::vector<irq_handler_t> irq_handlers[32];
+    bool irq_enabled[32];
+    uint irq_depth;
+    uint interrupts_disabled;
+
+    bool gpio_level[I2S_HOST_GPIO_COUNT];
+    int gpio_source[I2S_HOST_GPIO_COUNT]; // pin read instead, see i2s_host_connect_pins()
+    bool fifo_changed;
+
+    spin_lock_t spin_locks[NUM_SPIN_LOCKS];
+    uint32_t claimed_spin_locks;
+
+    systick_hw_t systick_regs;
+
+    std::vector<std::pair<i2s_host_step_hook_t, void *>> step_hooks;
+
+    I2S_HOST_STATE() {
+        for(int &source : gpio_source)
+            source = -1;
+    }
+};
+
+inline I2S_HOST_STATE i2s_host;
+
+#define pio0 (&i2s_host.pio_regs[0])
+#define pio1 (&i2s_host.pio_regs[1])
+#define dma_hw (&i2s_host.dma_regs)
+#define systick_hw (&i2s_host.systick_regs)
+
+inline I2S_HOST_SYSTICK_CVR::operator uint32_t() const { return 0xFFFFFF - ((i2s_host.now >> 8) & 0xFFFFFF); }
+
+static inline uint pio_get_index(PIO pio) { return pio - i2s_host.pio_regs; }
+static inline PIO pio_get_instance(uint instance) { return &i2s_host.pio_regs[instance]; }
+static inline I2S_HOST_SM &i2s_host_sm(PIO pio, uint sm) { return i2s_host.sm[pio_get_index(pio)][sm]; }
+
+// ---- GPIO ---- //
+
+static inline bool i2s_host_gpio_get(uint pin) {
+    pin %= I2S_HOST_GPIO_COUNT;
+    return i2s_host.gpio_level[i2s_host.gpio_source[pin] >= 0 ? i2s_host.gpio_source[pin] : pin];
+}
+
+/// drive a pin from outside, e.g. the data input of an RX state machine
+static inline void i2s_host_gpio_put(uint pin, bool level) { i2s_host.gpio_level[pin % I2S_HOST_GPIO_COUNT] = level; }
+
+/// reads of pin to return the level of pin from, e.g. TX data into RX data for a loopback
+static inline void i2s_host_connect_pins(uint from, uint to) { i2s_host.gpio_source[to % I2S_HOST_GPIO_COUNT] = from; }
+
+static inline void i2s_host_write_pins(uint base, uint count, uint32_t value) {
+    for(uint i=0; i<count; ++i)
+        i2s_host.gpio_level[(base + i) % I2S_HOST_GPIO_COUNT] = (value >> i) & 1;
+}
+
+static inline uint32_t i2s_host_read_pins(uint base) {
+    uint32_t value = 0;
+    for(uint i=0; i<32; ++i)
+        value |= (uint32_t)i2s_host_gpio_get(base + i) << i;
+    return value;
+}
+
+// ---- DMA model ---- //
+
+static inline void i2s_host_dma_trigger(uint channel);
+
+static inline uint32_t i2s_host_dma_read(uintptr_t addr, dma_channel_transfer_size size) {
+    switch(size) {
+        case DMA_SIZE_8: return *(const uint8_t *)addr;
+        case DMA_SIZE_16: return *(const uint16_t *)addr;
+        default: return *(const uint32_t *)addr;
+    }
+}
+
+// BSWAP reverses the bytes of every transfer, byte transfers stay as they are
+static inline uint32_t i2s_host_dma_swap(const dma_channel_config &config, uint32_t value) {
+    if(!config.bswap)
+        return value;
+    switch(config.size) {
+        case DMA_SIZE_8: return value;
+        case DMA_SIZE_16: return (uint16_t)__builtin_bswap16((uint16_t)value);
+        default: return __builtin_bswap32(value);
+    }
+}
+
+static inline void i2s_host_dma_write(uintptr_t addr, dma_channel_transfer_size size, uint32_t value) {
+    switch(size) {
+        case DMA_SIZE_8: *(uint8_t *)addr = value; break;
+        case DMA_SIZE_16: *(uint16_t *)addr = value; break;
+        default: *(uint32_t *)addr = value; break;
+    }
+}
+
+// one transfer of a channel, returns false while the DREQ holds it back
+static inline bool i2s_host_dma_transfer(uint channel) {
+    I2S_HOST_DMA_CHANNEL &state = i2s_host.dma[channel];
+    dma_channel_hw_t &hw = i2s_host.dma_regs.ch[channel];
+    const dma_channel_config &config = state.config;
+    uint bytes = 1u << config.size;
+
+    if(config.dreq < DREQ_PIO0_TX0 + 8 * NUM_PIOS) {
+        I2S_HOST_SM &sm = i2s_host.sm[config.dreq / 8][config.dreq % 4];
+        if((config.dreq % 8) < DREQ_PIO0_RX0) {
+            if(sm.tx_fifo.full())
+                return false;
+            // narrow writes are replicated to all byte lanes of the FIFO
+            uint32_t value = i2s_host_dma_swap(config, i2s_host_dma_read(hw.read_addr, config.size));
+            if(config.size == DMA_SIZE_8)
+                value *= 0x01010101u;
+            else if(config.size == DMA_SIZE_16)
+                value *= 0x00010001u;
+            sm.tx_fifo.push(value);
+        } else {
+            if(sm.rx_fifo.empty())
+                return false;
+            i2s_host_dma_write(hw.write_addr, config.size, i2s_host_dma_swap(config, sm.rx_fifo.pop()));
+        }
+    } else {
+        bool register_write = false;
+        for(uint target=0; target<NUM_DMA_CHANNELS; ++target) {
+            dma_channel_hw_t &target_hw = i2s_host.dma_regs.ch[target];
+            if(hw.write_addr == (uintptr_t)&target_hw.al3_read_addr_trig) {
+                target_hw.read_addr = *(const uintptr_t *)hw.read_addr;
+                if(target_hw.read_addr)
+                    i2s_host_dma_trigger(target);
+                else if(i2s_host.dma[target].config.irq_quiet)
+                    i2s_host.dma_regs.intr |= 1u << target;
+                register_write = true;
+            } else if(hw.write_addr == (uintptr_t)&target_hw.al2_write_addr_trig) {
+                target_hw.write_addr = *(const uintptr_t *)hw.read_addr;
+                i2s_host_dma_trigger(target);
+                register_write = true;
+            } else if(hw.write_addr == (uintptr_t)&target_hw.al3_transfer_count) {
+                target_hw.transfer_count = *(const uintptr_t *)hw.read_addr;
+                register_write = true;
+            }
+        }
+        if(register_write)
+            bytes = sizeof(uintptr_t);
+        else
+            i2s_host_dma_write(hw.write_addr, config.size, i2s_host_dma_swap(config, i2s_host_dma_read(hw.read_addr, config.size)));
+    }
+
+    // a ring wraps the low ring_size_bits address bits
+    const uintptr_t ring_mask = config.ring_size_bits ? (uintptr_t(1) << config.ring_size_bits) - 1 : ~uintptr_t(0);
+    if(config.read_increment)
+        hw.read_addr = config.ring_write ? hw.read_addr + bytes : (hw.read_addr & ~ring_mask) | ((hw.read_addr + bytes) & ring_mask);
+    if(config.write_increment)
+        hw.write_addr = config.ring_write ? (hw.write_addr & ~ring_mask) | ((hw.write_addr + bytes) & ring_mask) : hw.write_addr + bytes;
+
+    if(--hw.transfer_count.remaining == 0) {
+        state.busy = false;
+        if(!config.irq_quiet)
+            i2s_host.dma_regs.intr |= 1u << channel;
+        if(config.chain_to != channel)
+            i2s_host_dma_trigger(config.chain_to);
+    }
+    return true;
+}
+
+/// let all channels move data until their DREQs stop them
+static inline void i2s_host_dma_service() {
+    bool progress = true;
+    while(progress) {
+        progress = false;
+        for(uint channel=0; channel<NUM_DMA_CHANNELS; ++channel) {
+            while(i2s_host.dma[channel].busy && i2s_host_dma_transfer(channel))
+                progress = true;
+        }
+    }
+}
+
+static inline void i2s_host_dma_trigger(uint channel) {
+    I2S_HOST_DMA_CHANNEL &state = i2s_host.dma[channel];
+    if(state.busy)
+        return;
+    dma_channel_hw_t &hw = i2s_host.dma_regs.ch[channel];
+    hw.transfer_count.remaining = hw.transfer_count.reload;
+    if(hw.transfer_count.remaining == 0) {
+        i2s_host.dma_regs.intr |= 1u << channel;
+        return;
+    }
+    state.busy = true;
+}
+
+// run the handlers of pending DMA IRQs, not from inside a handler
+static inline void i2s_host_dispatch_irqs() {
+    if(i2s_host.irq_depth || i2s_host.interrupts_disabled)
+        return;
+    ++i2s_host.irq_depth;
+
+    // a handler that does not acknowledge its channel would run forever on the RP2040
+    for(uint round=0; round<16; ++round) {
+        bool pending = false;
+        for(uint irq_index=0; irq_index<2; ++irq_index) {
+            const uint irq = DMA_IRQ_0 + irq_index;
+            const uint32_t enabled = irq_index ? i2s_host.dma_regs.inte1 : i2s_host.dma_regs.inte0;
+            if(!i2s_host.irq_enabled[irq] || !(i2s_host.dma_regs.intr & enabled))
+                continue;
+            pending = true;
+            for(irq_handler_t handler : i2s_host.irq_handlers[irq]) {
+                handler();
+                i2s_host_dma_service();
+            }
+        }
+        if(!pending)
+            break;
+    }
+    --i2s_host.irq_depth;
+}
+
+// ---- PIO model ---- //
+
+static inline uint i2s_host_threshold(uint threshold) { return threshold ? threshold : 32; }
+
+static inline void i2s_host_pull(I2S_HOST_SM &sm, bool from_exec = false) {
+    sm.osr = sm.tx_fifo.pop();
+    sm.osr_count = 0;
+    if(!from_exec)
+        sm.tx_words.push_back(sm.osr); // not setup words like the Y preload of TX_TDM
+    i2s_host.fifo_changed = true;
+}
+
+static inline bool i2s_host_push(PIO pio, uint sm_index) {
+    I2S_HOST_SM &sm = i2s_host_sm(pio, sm_index);
+    if(sm.rx_fifo.full()) {
+        pio->fdebug.value |= 1u << (PIO_FDEBUG_RXSTALL_LSB + sm_index);
+        return false;
+    }
+    sm.rx_fifo.push(sm.isr);
+    sm.isr = 0;
+    sm.isr_count = 0;
+    i2s_host.fifo_changed = true;
+    return true;
+}
+
+static inline uint32_t i2s_host_pio_source(I2S_HOST_SM &sm, uint source) {
+    switch(source) {
+        case pio_pins: return i2s_host_read_pins(sm.config.in_base);
+        case pio_x: return sm.x;
+        case pio_y: return sm.y;
+        case pio_isr: return sm.isr;
+        case pio_osr: return sm.osr;
+        default: return 0; // null, status
+    }
+}
+
+/**
+ * @brief execute one instruction
+ * @return false if the instruction stalls and has to be executed again on the next cycle
+ */
+static inline bool i2s_host_pio_execute(PIO pio, uint sm_index, uint16_t instruction, bool from_exec) {
+    I2S_HOST_SM &sm = i2s_host_sm(pio, sm_index);
+    const pio_sm_config &config = sm.config;
+
+    // side-set takes effect even if the instruction stalls
+    const uint delay_bits = 5 - config.sideset_bit_count;
+    uint delay = (instruction >> 8) & ((1u << delay_bits) - 1);
+    if(config.sideset_bit_count) {
+        uint sideset = (instruction >> (8 + delay_bits)) & ((1u << config.sideset_bit_count) - 1);
+        uint value_bits = config.sideset_bit_count;
+        bool apply = true;
+        if(config.sideset_optional) {
+            --value_bits;
+            apply = sideset >> value_bits;
+        }
+        if(apply)
+            i2s_host_write_pins(config.sideset_base, value_bits, sideset);
+    }
+
+    const uint operation = instruction >> 13;
+    const uint index = (instruction >> 5) & 7;
+    const uint count = (instruction & 31) ? (instruction & 31) : 32;
+    bool jump = false;
+    uint target = instruction & 31;
+
+    switch(operation) {
+        case 0: { // JMP
+            bool condition;
+            switch(index) {
+                case 0: condition = true; break;
+                case 1: condition = sm.x == 0; break;
+                case 2: condition = sm.x-- != 0; break;
+                case 3: condition = sm.y == 0; break;
+                case 4: condition = sm.y-- != 0; break;
+                case 5: condition = sm.x != sm.y; break;
+                case 6: condition = false; break; // jmp pin is not used by the library
+                default: condition = sm.osr_count < i2s_host_threshold(config.pull_threshold); break;
+            }
+            jump = condition;
+            break;
+        }
+        case 1: { // WAIT
+            const bool polarity = (instruction >> 7) & 1;
+            const uint source = (instruction >> 5) & 3;
+            const uint pin = instruction & 31;
+            if(source == 0 && i2s_host_gpio_get(pin) != polarity)
+                return false;
+            if(source == 1 && i2s_host_gpio_get(config.in_base + pin) != polarity)
+                return false;
+            break;
+        }
+        case 2: { // IN
+            if(!sm.push_pending) {
+                uint32_t data = i2s_host_pio_source(sm, index);
+                uint32_t mask = count == 32 ? 0xFFFFFFFFu : (1u << count) - 1;
+                if(config.in_shift_right)
+                    sm.isr = count == 32 ? data : (sm.isr >> count) | ((data & mask) << (32 - count));
+                else
+                    sm.isr = count == 32 ? data : (sm.isr << count) | (data & mask);
+                sm.isr_count = sm.isr_count + count > 32 ? 32 : sm.isr_count + count;
+                sm.push_pending = config.autopush && sm.isr_count >= i2s_host_threshold(config.push_threshold);
+            }
+            if(sm.push_pending) {
+                if(!i2s_host_push(pio, sm_index))
+                    return false;
+                sm.push_pending = false;
+            }
+            break;
+        }
+        case 3: { // OUT
+            const uint threshold = i2s_host_threshold(config.pull_threshold);
+            if(config.autopull && sm.osr_count >= threshold) {
+                if(sm.tx_fifo.empty()) {
+                    pio->fdebug.value |= 1u << (PIO_FDEBUG_TXSTALL_LSB + sm_index);
+                    return false;
+                }
+                i2s_host_pull(sm);
+            }
+
+            uint32_t data;
+            if(count == 32) {
+                data = sm.osr;
+                sm.osr = 0;
+            } else if(config.out_shift_right) {
+                data = sm.osr & ((1u << count) - 1);
+                sm.osr >>= count;
+            } else {
+                data = sm.osr >> (32 - count);
+                sm.osr <<= count;
+            }
+            sm.osr_count = sm.osr_count + count > 32 ? 32 : sm.osr_count + count;
+
+            switch(index) {
+                case pio_pins: i2s_host_write_pins(config.out_base, config.out_count, data); break;
+                case pio_x: sm.x = data; break;
+                case pio_y: sm.y = data; break;
+                case pio_pc: jump = true; target = data; break;
+                case pio_isr: sm.isr = data; sm.isr_count = count; break;
+                default: break; // null, pindirs, exec
+            }
+
+            // the OSR is refilled in the background as soon as it is empty
+            if(config.autopull && sm.osr_count >= threshold && !sm.tx_fifo.empty())
+                i2s_host_pull(sm);
+            break;
+        }
+        case 4: { // PUSH, PULL
+            const bool if_flag = (instruction >> 6) & 1;
+            const bool block = (instruction >> 5) & 1;
+            if(instruction & 0x80) {
+                if(if_flag && sm.osr_count < i2s_host_threshold(config.pull_threshold))
+                    break;
+                if(sm.tx_fifo.empty()) {
+                    if(block) {
+                        pio->fdebug.value |= 1u << (PIO_FDEBUG_TXSTALL_LSB + sm_index);
+                        return false;
+                    }
+                    sm.osr = sm.x;
+                    sm.osr_count = 0;
+                } else {
+                    i2s_host_pull(sm, from_exec);
+                }
+            } else {
+                if(if_flag && sm.isr_count < i2s_host_threshold(config.push_threshold))
+                    break;
+                if(!i2s_host_push(pio, sm_index) && block)
+                    return false;
+            }
+            break;
+        }
+        case 5: { // MOV
+            uint32_t data = i2s_host_pio_source(sm, instruction & 7);
+            const uint op = (instruction >> 3) & 3;
+            if(op == 1) {
+                data = ~data;
+            } else if(op == 2) {
+                uint32_t reversed = 0;
+                for(uint i=0; i<32; ++i)
+                    reversed |= ((data >> i) & 1) << (31 - i);
+                data = reversed;
+            }
+            switch(index) {
+                case pio_pins: i2s_host_write_pins(config.out_base, config.out_count, data); break;
+                case pio_x: sm.x = data; break;
+                case pio_y: sm.y = data; break;
+                case pio_pc: jump = true; target = data & 31; break;
+                case pio_isr: sm.isr = data; sm.isr_count = 0; break;
+                case pio_osr: sm.osr = data; sm.osr_count = 0; break;
+                default: break; // exec
+            }
+            break;
+        }
+        case 6: // IRQ, no PIO IRQs are used by the library
+            break;
+        default: { // SET
+            const uint32_t data = instruction & 31;
+            switch(index) {
+                case pio_pins: i2s_host_write_pins(config.set_base, config.set_count, data); break;
+                case pio_x: sm.x = data; break;
+                case pio_y: sm.y = data; break;
+                default: break; // pindirs
+            }
+            break;
+        }
+    }
+
+    if(jump)
+        sm.pc = target;
+    else if(!from_exec)
+        sm.pc = sm.pc == config.wrap ? config.wrap_target : (sm.pc + 1) % I2S_HOST_PIO_INSTRUCTIONS;
+    sm.delay = from_exec ? 0 : delay;
+    return true;
+}
+
+static inline void i2s_host_pio_step(uint pio_index, uint sm_index) {
+    I2S_HOST_SM &sm = i2s_host.sm[pio_index][sm_index];
+    if(sm.delay) {
+        --sm.delay;
+        return;
+    }
+    i2s_host_pio_execute(&i2s_host.pio_regs[pio_index], sm_index, i2s_host.instructions[pio_index][sm.pc], false);
+}
+
+// ---- virtual clock ---- //
+
+static inline uint64_t i2s_host_clkdiv(const I2S_HOST_SM &sm) {
+    uint64_t divider = sm.config.clkdiv;
+    return divider >> 8 ? divider : divider + (65536u << 8);
+}
+
+/// advance the virtual clock, runs the state machines, the DMA and the DMA IRQ handlers
+static inline void i2s_host_run_cycles(uint64_t cycles) {
+    const uint64_t end = i2s_host.now + (cycles << 8);
+
+    i2s_host_dma_service();
+    i2s_host_dispatch_irqs();
+
+    while(true) {
+        I2S_HOST_SM *next = NULL;
+        uint next_pio = 0, next_sm = 0;
+        for(uint p=0; p<NUM_PIOS; ++p) {
+            for(uint s=0; s<NUM_PIO_STATE_MACHINES; ++s) {
+                I2S_HOST_SM &sm = i2s_host.sm[p][s];
+                if(sm.enabled && sm.next_tick <= end && (!next || sm.next_tick < next->next_tick)) {
+                    next = &sm;
+                    next_pio = p;
+                    next_sm = s;
+                }
+            }
+        }
+        if(!next)
+            break;
+
+        i2s_host.now = next->next_tick;
+        next->next_tick += i2s_host_clkdiv(*next);
+        i2s_host_pio_step(next_pio, next_sm);
+        for(const auto &[hook, context] : i2s_host.step_hooks)
+            hook(context);
+
+        if(i2s_host.fifo_changed) {
+            i2s_host.fifo_changed = false;
+            i2s_host_dma_service();
+            i2s_host_dispatch_irqs();
+        }
+    }
+    i2s_host.now = end;
+}
+
+static inline uint64_t time_us_64() {
+    return i2s_host.clock_change_us + ((i2s_host.now - i2s_host.clock_change_time) >> 8) * 1000000 / i2s_host.sys_clock_hz;
+}
+
+static inline uint32_t time_us_32() { return time_us_64(); }
+
+static inline void i2s_host_run_us(uint64_t us) { i2s_host_run_cycles(us * i2s_host.sys_clock_hz / 1000000); }
+static inline void sleep_us(uint64_t us) { i2s_host_run_us(us); }
+static inline void sleep_ms(uint32_t ms) { i2s_host_run_us(ms * 1000ull); }
+
+/// busy waits of the library advance the virtual clock by 1 us per call
+static inline void tight_loop_contents() { i2s_host_run_us(1); }
+
+/**
+ * @brief run hook(context) after every state machine step, at the virtual time of the step (i2s_host.now)
+ * The pins show the levels after the step. A hook that drives a pin, e.g. the data output of an ADC model,
+ * is seen by the next step, like an input that changes right after a clock edge. Hooks run in the order they were added.
+ */
+static inline void i2s_host_add_step_hook(i2s_host_step_hook_t hook, void *context) {
+    i2s_host.step_hooks.emplace_back(hook, context);
+}
+
+static inline void i2s_host_remove_step_hook(i2s_host_step_hook_t hook, void *context) {
+    std::erase(i2s_host.step_hooks, std::make_pair(hook, context));
+}
+
+/// words the state machine took from its TX FIFO since the last call or pio_sm_init(), in the order they were played
+static inline std::vector<uint32_t> i2s_host_take_tx_words(PIO pio, uint sm) {
+    return std::exchange(i2s_host_sm(pio, sm).tx_words, {});
+}
+
+// ---- hardware/clocks ---- //
+
+static inline uint32_t clock_get_hz(enum clock_index clk_index) {
+    return clk_index == clk_sys ? i2s_host.sys_clock_hz : 125000000;
+}
+
+static inline void set_sys_clock_pll(uint32_t vco_freq, uint post_div1, uint post_div2) {
+    i2s_host.clock_change_us = time_us_64();
+    i2s_host.clock_change_time = i2s_host.now;
+    i2s_host.sys_clock_hz = vco_freq / (post_div1 * post_div2);
+}
+
+// ---- hardware/sync ---- //
+
+static inline uint32_t save_and_disable_interrupts() { return i2s_host.interrupts_disabled++; }
+static inline void restore_interrupts(uint32_t status) { i2s_host.interrupts_disabled = status; }
+
+static inline int spin_lock_claim_unused(bool required) {
+    for(uint i=0; i<NUM_SPIN_LOCKS; ++i) {
+        if(!(i2s_host.claimed_spin_locks & (1u << i))) {
+            i2s_host.claimed_spin_locks |= 1u << i;
+            return i;
+        }
+    }
+    if(required)
+        i2s_host_panic("no spin lock available");
+    return -1;
+}
+
+static inline spin_lock_t *spin_lock_instance(uint lock_num) { return &i2s_host.spin_locks[lock_num]; }
+static inline void spin_lock_unsafe_blocking(spin_lock_t *lock) { *lock = 1; }
+static inline void spin_unlock_unsafe(spin_lock_t *lock) { *lock = 0; }
+
+static inline uint32_t spin_lock_blocking(spin_lock_t *lock) {
+    uint32_t status = save_and_disable_interrupts();
+    spin_lock_unsafe_blocking(lock);
+    return status;
+}
+
+static inline void spin_unlock(spin_lock_t *lock, uint32_t status) {
+    spin_unlock_unsafe(lock);
+    restore_interrupts(status);
+}
+
+// ---- hardware/irq ---- //
+
+static inline void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t /*order_priority*/) {
+    i2s_host.irq_handlers[num].push_back(handler);
+}
+
+static inline void irq_set_enabled(uint num, bool enabled) { i2s_host.irq_enabled[num] = enabled; }
+
+// ---- hardware/pio ---- //
+
+static inline pio_sm_config pio_get_default_sm_config() {
+    pio_sm_config config = {};
+    config.clkdiv = 1u << 8;
+    config.wrap = I2S_HOST_PIO_INSTRUCTIONS - 1;
+    config.in_shift_right = true;
+    config.out_shift_right = true;
+    config.set_count = 5;
+    return config;
+}
+
+static inline void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap) { c->wrap_target = wrap_target; c->wrap = wrap; }
+static inline void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool /*pindirs*/) { c->sideset_bit_count = bit_count; c->sideset_optional = optional; }
+static inline void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base) { c->sideset_base = sideset_base; }
+static inline void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count) { c->out_base = out_base; c->out_count = out_count; }
+static inline void sm_config_set_set_pins(pio_sm_config *c, uint set_base, uint set_count) { c->set_base = set_base; c->set_count = set_count; }
+static inline void sm_config_set_in_pins(pio_sm_config *c, uint in_base) { c->in_base = in_base; }
+static inline void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac) { c->clkdiv = (uint32_t)div_int << 8 | div_frac; }
+
+static inline void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold) {
+    c->out_shift_right = shift_right;
+    c->autopull = autopull;
+    c->pull_threshold = pull_threshold & 31;
+}
+
+static inline void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold) {
+    c->in_shift_right = shift_right;
+    c->autopush = autopush;
+    c->push_threshold = push_threshold & 31;
+}
+
+static inline void pio_sm_claim(PIO pio, uint sm) {
+    if(i2s_host_sm(pio, sm).claimed)
+        i2s_host_panic("PIO state machine already claimed");
+    i2s_host_sm(pio, sm).claimed = true;
+}
+
+static inline int pio_claim_unused_sm(PIO pio, bool required) {
+    for(uint sm=0; sm<NUM_PIO_STATE_MACHINES; ++sm) {
+        if(!i2s_host_sm(pio, sm).claimed) {
+            i2s_host_sm(pio, sm).claimed = true;
+            return sm;
+        }
+    }
+    if(required)
+        i2s_host_panic("no PIO state machine available");
+    return -1;
+}
+
+static inline void pio_sm_unclaim(PIO pio, uint sm) { i2s_host_sm(pio, sm).claimed = false; }
+
+static inline uint pio_add_program(PIO pio, const struct pio_program *program) {
+    const uint index = pio_get_index(pio);
+    const uint32_t mask = (1u << program->length) - 1;
+    for(int offset=I2S_HOST_PIO_INSTRUCTIONS - program->length; offset>=0; --offset) {
+        if(program->origin >= 0 && offset != program->origin)
+            continue;
+        if(i2s_host.used_instructions[index] & (mask << offset))
+            continue;
+
+        // jumps are relative to the program start
+        for(uint i=0; i<program->length; ++i) {
+            uint16_t instruction = program->instructions[i];
+            if((instruction >> 13) == 0)
+                instruction += offset;
+            i2s_host.instructions[index][offset + i] = instruction;
+        }
+        i2s_host.used_instructions[index] |= mask << offset;
+        return offset;
+    }
+    i2s_host_panic("no program space");
+    return 0;
+}
+
+static inline void pio_remove_program(PIO pio, const struct pio_program *program, uint loaded_offset) {
+    i2s_host.used_instructions[pio_get_index(pio)] &= ~(((1u << program->length) - 1) << loaded_offset);
+}
+
+static inline void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    I2S_HOST_SM &state = i2s_host_sm(pio, sm);
+    if(enabled && !state.enabled)
+        state.next_tick = i2s_host.now + i2s_host_clkdiv(state);
+    state.enabled = enabled;
+    i2s_host_dma_service();
+}
+
+static inline void pio_set_sm_mask_enabled(PIO pio, uint32_t mask, bool enabled) {
+    for(uint sm=0; sm<NUM_PIO_STATE_MACHINES; ++sm)
+        if(mask & (1u << sm))
+            pio_sm_set_enabled(pio, sm, enabled);
+}
+
+/// enabling restarts the clock dividers, so the state machines run in lockstep
+static inline void pio_enable_sm_mask_in_sync(PIO pio, uint32_t mask) {
+    for(uint sm=0; sm<NUM_PIO_STATE_MACHINES; ++sm) {
+        if(mask & (1u << sm)) {
+            I2S_HOST_SM &state = i2s_host_sm(pio, sm);
+            state.enabled = true;
+            state.next_tick = i2s_host.now + i2s_host_clkdiv(state);
+        }
+    }
+    i2s_host_dma_service();
+}
+
+static inline void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config) {
+    I2S_HOST_SM &state = i2s_host_sm(pio, sm);
+    state.enabled = false;
+    state.config = *config;
+    state.pc = initial_pc;
+    state.x = state.y = state.osr = state.isr = 0;
+    state.osr_count = 32; // empty, the first OUT pulls
+    state.isr_count = 0;
+    state.delay = 0;
+    state.push_pending = false;
+    state.tx_fifo.clear();
+    state.rx_fifo.clear();
+    state.tx_words.clear();
+    pio->fdebug.value &= ~(0x01010101u << sm);
+}
+
+static inline void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac) {
+    i2s_host_sm(pio, sm).config.clkdiv = (uint32_t)div_int << 8 | div_frac;
+}
+
+static inline void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+    if(!i2s_host_sm(pio, sm).tx_fifo.full())
+        i2s_host_sm(pio, sm).tx_fifo.push(data);
+}
+
+static inline uint pio_sm_get_tx_fifo_level(PIO pio, uint sm) { return i2s_host_sm(pio, sm).tx_fifo.level; }
+static inline uint pio_sm_get_rx_fifo_level(PIO pio, uint sm) { return i2s_host_sm(pio, sm).rx_fifo.level; }
+
+static inline void pio_sm_exec(PIO pio, uint sm, uint instruction) {
+    i2s_host_pio_execute(pio, sm, instruction, true);
+}
+
+static inline void pio_gpio_init(PIO /*pio*/, uint /*pin*/) {}
+static inline void pio_sm_set_pins(PIO /*pio*/, uint /*sm*/, uint32_t /*pin_values*/) {}
+static inline void pio_sm_set_pindirs_with_mask(PIO /*pio*/, uint /*sm*/, uint32_t /*pin_dirs*/, uint32_t /*pin_mask*/) {}
+static inline void pio_sm_set_consecutive_pindirs(PIO /*pio*/, uint /*sm*/, uint /*pin_base*/, uint /*pin_count*/, bool /*is_out*/) {}
+
+static inline uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    return pio_get_index(pio) * 8 + (is_tx ? DREQ_PIO0_TX0 : DREQ_PIO0_RX0) + sm;
+}
+
+// ---- hardware/dma ---- //
+
+static inline dma_channel_hw_t *dma_channel_hw_addr(uint channel) { return &i2s_host.dma_regs.ch[channel]; }
+
+static inline int dma_claim_unused_channel(bool required) {
+    for(uint channel=0; channel<NUM_DMA_CHANNELS; ++channel) {
+        if(!i2s_host.dma[channel].claimed) {
+            i2s_host.dma[channel].claimed = true;
+            return channel;
+        }
+    }
+    if(required)
+        i2s_host_panic("no DMA channel available");
+    return -1;
+}
+
+static inline void dma_channel_claim(uint channel) {
+    if(i2s_host.dma[channel].claimed)
+        i2s_host_panic("DMA channel already claimed");
+    i2s_host.dma[channel].claimed = true;
+}
+
+static inline void dma_channel_unclaim(uint channel) { i2s_host.dma[channel].claimed = false; }
+
+static inline dma_channel_config dma_channel_get_default_config(uint channel) {
+    return {DREQ_FORCE, true, false, DMA_SIZE_32, channel, false, false, 0, false};
+}
+
+static inline dma_channel_config dma_get_channel_config(uint channel) { return i2s_host.dma[channel].config; }
+
+static inline void channel_config_set_read_increment(dma_channel_config *c, bool incr) { c->read_increment = incr; }
+static inline void channel_config_set_write_increment(dma_channel_config *c, bool incr) { c->write_increment = incr; }
+static inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) { c->dreq = dreq; }
+static inline void channel_config_set_chain_to(dma_channel_config *c, uint chain_to) { c->chain_to = chain_to; }
+static inline void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) { c->size = size; }
+static inline void channel_config_set_irq_quiet(dma_channel_config *c, bool irq_quiet) { c->irq_quiet = irq_quiet; }
+static inline void channel_config_set_bswap(dma_channel_config *c, bool bswap) { c->bswap = bswap; }
+static inline void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits) {
+    c->ring_write = write;
+    c->ring_size_bits = size_bits;
+}
+
+static inline void dma_channel_start(uint channel) {
+    i2s_host_dma_trigger(channel);
+    i2s_host_dma_service();
+}
+
+static inline void dma_channel_set_config(uint channel, const dma_channel_config *config, bool trigger) {
+    i2s_host.dma[channel].config = *config;
+    if(trigger)
+        dma_channel_start(channel);
+}
+
+static inline void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                                         const volatile void *read_addr, uint transfer_count, bool trigger) {
+    dma_channel_hw_t &hw = i2s_host.dma_regs.ch[channel];
+    hw.write_addr = (uintptr_t)write_addr;
+    hw.read_addr = (uintptr_t)read_addr;
+    hw.transfer_count = transfer_count;
+    dma_channel_set_config(channel, config, trigger);
+}
+
+static inline void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger) {
+    i2s_host.dma_regs.ch[channel].read_addr = (uintptr_t)read_addr;
+    if(trigger)
+        dma_channel_start(channel);
+}
+
+static inline void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count) {
+    i2s_host.dma_regs.ch[channel].read_addr = (uintptr_t)read_addr;
+    i2s_host.dma_regs.ch[channel].transfer_count = transfer_count;
+    dma_channel_start(channel);
+}
+
+static inline void dma_channel_transfer_to_buffer_now(uint channel, volatile void *write_addr, uint32_t transfer_count) {
+    i2s_host.dma_regs.ch[channel].write_addr = (uintptr_t)write_addr;
+    i2s_host.dma_regs.ch[channel].transfer_count = transfer_count;
+    dma_channel_start(channel);
+}
+
+static inline void dma_channel_abort(uint channel) {
+    i2s_host.dma[channel].busy = false;
+    i2s_host.dma_regs.ch[channel].transfer_count.remaining = 0;
+}
+
+static inline void dma_irqn_set_channel_mask_enabled(uint irq_index, uint32_t channel_mask, bool enabled) {
+    uint32_t &inte = irq_index ? i2s_host.dma_regs.inte1 : i2s_host.dma_regs.inte0;
+    if(enabled)
+        inte |= channel_mask;
+    else
+        inte &= ~channel_mask;
+}
+
+static inline void dma_irqn_set_channel_enabled(uint irq_index, uint channel, bool enabled) {
+    dma_irqn_set_channel_mask_enabled(irq_index, 1u << channel, enabled);
+}
+
+static inline void dma_irqn_acknowledge_channel(uint /*irq_index*/, uint channel) { i2s_host.dma_regs.intr &= ~(1u << channel); }
+
+static inline bool dma_irqn_get_channel_status(uint irq_index, uint channel) {
+    return i2s_host.dma_regs.intr & (irq_index ? i2s_host.dma_regs.inte1 : i2s_host.dma_regs.inte0) & (1u << channel);
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <new>
+#include <utility>
+
+// RP2040 SRAM: banks 0-3 have 64 KB each and are striped word by word at 0x20000000, word i lives in bank i%4.
+// Without striping they show up one after the other at 0x21000000.
+// SRAM4 and SRAM5 (4 KB each) follow at 0x20040000, they are the SCRATCH_X and SCRATCH_Y regions
+// of the linker script with the stacks of core 1 and core 0.
+#define I2S_SRAM_BANK_SIZE 0x10000
+#define I2S_SRAM_NONSTRIPED_BASE 0x21000000
+
+/**
+ * @brief bump allocator over memory the application provides, for I2S buffers without heap allocation
+ * PATTERN_BUFFER, RX_BUFFER_QUEUE, TX_RING_BUFFER and the I2S controllers take an optional arena and place
+ * their buffers (and the streaming objects) in it instead of using new. Memory is handed out in order and only
+ * given back all at once with reset(), after every user of the arena is destroyed.
+ * If an arena runs full, a warning is printed and the heap is used instead.
+ *
+ * The place of the arena decides which SRAM bank the DMA and the CPU share. The heap and the static data are spread across
+ * the striped banks 0-3, so an I2S DMA reading a heap buffer waits behind the CPU in every bank and the other way round.
+ * The stacks are not in there, core 0 runs on SCRATCH_Y (SRAM5) and core 1 on SCRATCH_X (SRAM4).
+ * An arena in SRAM4 (I2S_STATIC_ARENA with __scratch_x()) or in a bank of its own (i2s_sram_bank_arena()) keeps them apart.
+ */
+class I2S_BUFFER_ARENA {
+private:
+    uint8_t *const base;
+    const size_t size;
+    size_t used = 0;
+public:
+    /**
+     * @param storage memory of the arena, has to outlive all its users
+     * @param _size in bytes
+     */
+    I2S_BUFFER_ARENA(void *storage, size_t _size) : base((uint8_t *)storage), size(_size) {}
+
+    /// aligned memory or NULL if the arena is full
+    void *allocate(size_t bytes, size_t alignment = sizeof(int32_t)) {
+        uintptr_t address = (uintptr_t)base + used;
+        size_t start = used + ((alignment - address % alignment) % alignment);
+        if(start > size || bytes > size - start) {
+            return NULL;
+        }
+
+        used = start + bytes;
+        return base + start;
+    }
+
+    bool owns(const void *p) const { return (const uint8_t *)p >= base && (const uint8_t *)p < base + size; }
+
+    /// give back all memory, only when no buffer of the arena is in use anymore
+    void reset() { used = 0; }
+
+    size_t get_used() const { return used; }
+    size_t get_size() const { return size; }
+};
+
+/**
+ * @brief arena with its storage, sized at compile time
+ * As a global it can be placed into a bank with the SDK section macros, e.g. next to the core 1 stack in SRAM4:
+ *
+ *   static I2S_STATIC_ARENA<I2S_STATIC_CONTROLLER<I2S_CONTROLLER_MODE::RX, 32>::storage_words(128)> i2s_arena __scratch_x("i2s");
+ *
+ * SRAM4/5 have about 2 KB left besides the default stacks. Pick the one of the core that does not generate or consume the samples.
+ */
+template<size_t WORDS>
+class I2S_STATIC_ARENA : public I2S_BUFFER_ARENA {
+private:
+    int32_t storage[WORDS];
+public:
+    I2S_STATIC_ARENA() : I2S_BUFFER_ARENA(storage, sizeof(storage)) {}
+};
+
+/**
+ * @brief arena in one of the main SRAM banks 0-3 through its non-striped alias
+ * The linker only knows the striped alias, so the memory has to be kept free there: shortening the RAM region
+ * of the linker script by 4*N bytes leaves the top N bytes of every bank unused, e.g. 64 KB less RAM frees the top 16 KB of each bank.
+ * @param bank 0..3
+ * @param offset, size in bytes within the bank
+ */
+static inline I2S_BUFFER_ARENA i2s_sram_bank_arena(uint32_t bank, uint32_t offset, uint32_t size) {
+    return I2S_BUFFER_ARENA((void *)(uintptr_t)(I2S_SRAM_NONSTRIPED_BASE + bank * I2S_SRAM_BANK_SIZE + offset), size);
+}
+
+/// arena words for an object, with room for its alignment
+template<class T>
+static constexpr size_t i2s_object_words() {
+    return (sizeof(T) + alignof(T) - 1) / sizeof(int32_t) + 1;
+}
+
+/// words from the arena or, without one or when it is full, from the heap
+static inline int32_t *i2s_allocate_words(I2S_BUFFER_ARENA *arena, size_t words) {
+    if(arena) {
+        void *buffer = arena->allocate(words * sizeof(int32_t));
+        if(buffer) {
+            return (int32_t *)buffer;
+        }
+        printf("i2s: buffer arena full, %u words from the heap\n", (unsigned)words);
+    }
+    return new int32_t[words];
+}
+
+/// release words of i2s_allocate_words(), the arena only gets them back with I2S_BUFFER_ARENA::reset()
+static inline void i2s_free_words(I2S_BUFFER_ARENA *arena, int32_t *buffer) {
+    if(!arena || !arena->owns(buffer)) {
+        delete [] buffer;
+    }
+}
+
+/// construct an object in the arena or, without one or when it is full, on the heap
+template<class T, class... ARGS>
+static inline T *i2s_create(I2S_BUFFER_ARENA *arena, ARGS&&... args) {
+    if(arena) {
+        void *memory = arena->allocate(sizeof(T), alignof(T));
+        if(memory) {
+            return new(memory) T(std::forward<ARGS>(args)...);
+        }
+        printf("i2s: buffer arena full, %u bytes from the heap\n", (unsigned)sizeof(T));
+    }
+    return new T(std::forward<ARGS>(args)...);
+}
+
+/// destroy an object of i2s_create()
+template<class T>
+static inline void i2s_destroy(I2S_BUFFER_ARENA *arena, T *object) {
+    if(arena && arena->owns(object)) {
+        object->~T();
+    } else {
+        delete object;
+    }
+}
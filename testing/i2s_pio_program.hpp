@@ -0,0 +1,217 @@
+#pragma once
+
+#include <stdint.h>
+
+#define I2S_PIO_MAX_PROGRAM_LENGTH 16
+
+enum I2S_CONTROLLER_MODE {
+    TX  = 0, // for DAC only
+    RX  = 1, // for ADC only
+    TRX = 2, // for ADC & DAC
+    TX_MONO = 3, // for DAC only, sends every word on both channels to halve the buffer size. Runs half as fast as TX
+    TX_TDM = 4, // for multichannel DAC, one BCLK frame sync followed by tdm_slots slots. LRCK is the frame sync
+    TRX_FULL_RATE = 5, // for ADC & DAC at the TX sample rate, a second state machine follows BCLK/LRCK for RX
+};
+
+/**
+ * @brief generated I2S PIO program and the facts about it the controller needs
+ * Side-set bit 0 is BCLK, bit 1 is LRCK (and bit 2 the RX LRCK copy in TRX mode).
+ * LRCK is low for the left channel (channel 0) and changes one BCLK before the MSB, like Philips I2S.
+ * The program wraps from its last instruction to instruction wrap_target.
+ */
+struct I2S_PIO_PROGRAM {
+    uint16_t code[I2S_PIO_MAX_PROGRAM_LENGTH];
+    uint8_t length;
+    uint8_t wrap_target;
+    uint8_t entry;            // instruction the state machine starts with
+    uint8_t sideset_pins;
+    uint32_t cycles_per_frame; // PIO clock cycles per frame of all channels, the sample rate is PIO clock / cycles_per_frame
+    bool load_y;              // Y has to be preloaded with y_value before the start
+    uint32_t y_value;
+    bool load_x;              // X has to be preloaded with x_value (0..31) before the start
+    uint32_t x_value;
+};
+
+/// source and destination operands of the PIO instructions, same values as the SDK's pio_src_dest
+enum I2S_PIO_OPERAND : uint32_t {
+    I2S_PIO_PINS = 0,
+    I2S_PIO_X = 1,
+    I2S_PIO_Y = 2,
+    I2S_PIO_NULL = 3,
+    I2S_PIO_ISR = 6,
+    I2S_PIO_OSR = 7,
+};
+
+// PIO instruction encoders, the subset of the SDK's pio_instructions.h the programs use.
+// constexpr, so whole programs can be generated at compile time, see I2S_STATIC_CONFIG
+static constexpr uint32_t i2s_pio_encode_delay(uint32_t cycles) { return cycles << 8; }
+static constexpr uint32_t i2s_pio_encode_sideset(uint32_t sideset_bit_count, uint32_t value) { return value << (13 - sideset_bit_count); }
+static constexpr uint32_t i2s_pio_encode_jmp(uint32_t addr) { return 0x0000 | addr; }
+static constexpr uint32_t i2s_pio_encode_jmp_x_dec(uint32_t addr) { return 0x0040 | addr; }
+static constexpr uint32_t i2s_pio_encode_jmp_not_osre(uint32_t addr) { return 0x00e0 | addr; }
+static constexpr uint32_t i2s_pio_encode_wait_gpio(bool polarity, uint32_t gpio) { return 0x2000 | (polarity ? 0x80 : 0) | gpio; }
+static constexpr uint32_t i2s_pio_encode_in(I2S_PIO_OPERAND src, uint32_t count) { return 0x4000 | src << 5 | (count & 0x1F); }
+static constexpr uint32_t i2s_pio_encode_out(I2S_PIO_OPERAND dest, uint32_t count) { return 0x6000 | dest << 5 | (count & 0x1F); }
+static constexpr uint32_t i2s_pio_encode_pull(bool if_empty, bool block) { return 0x8080 | (if_empty ? 0x40 : 0) | (block ? 0x20 : 0); }
+static constexpr uint32_t i2s_pio_encode_mov(I2S_PIO_OPERAND dest, I2S_PIO_OPERAND src) { return 0xa000 | dest << 5 | src; }
+static constexpr uint32_t i2s_pio_encode_set(I2S_PIO_OPERAND dest, uint32_t value) { return 0xe000 | dest << 5 | (value & 0x1F); }
+
+/**
+ * @brief generate the PIO program for a mode
+ * Pure constexpr function of its arguments, so the programs can be built at compile time,
+ * inspected or run in an emulator on a host machine.
+ * @param bit_depth bits per sample (2..32)
+ * @param data_lanes data pins in TX mode
+ * @param channel_count TDM slots in TX_TDM mode
+ */
+static constexpr I2S_PIO_PROGRAM i2s_generate_pio_program(I2S_CONTROLLER_MODE mode, uint32_t bit_depth, uint32_t data_lanes = 1, uint32_t channel_count = 2) {
+    I2S_PIO_PROGRAM program = {};
+    uint32_t bit_depth_value = (bit_depth-2) & 0x1F;
+    program.sideset_pins = 2;
+
+    // NOTE: Take care of I2S_PIO_MAX_PROGRAM_LENGTH when you adjust this!
+    if(mode == I2S_CONTROLLER_MODE::TX || mode == I2S_CONTROLLER_MODE::TRX_FULL_RATE) {
+        // TX PIO ASM, also the clock master of TRX_FULL_RATE (see i2s_generate_rx_follower_program())
+        // every bit clock shifts one bit per data lane
+        program.code[0] = i2s_pio_encode_out(I2S_PIO_PINS, data_lanes)   | i2s_pio_encode_sideset(2, 0); //  0: out    pins, LANES     side 0
+        program.code[1] = i2s_pio_encode_jmp_x_dec(0)                    | i2s_pio_encode_sideset(2, 1); //  1: jmp    x--, 0          side 1
+        program.code[2] = i2s_pio_encode_out(I2S_PIO_PINS, data_lanes)   | i2s_pio_encode_sideset(2, 2); //  2: out    pins, LANES     side 2
+        program.code[3] = i2s_pio_encode_set(I2S_PIO_X, bit_depth_value) | i2s_pio_encode_sideset(2, 3); //  3: set    x, BIT_DEPTH-2  side 3
+        program.code[4] = i2s_pio_encode_out(I2S_PIO_PINS, data_lanes)   | i2s_pio_encode_sideset(2, 2); //  4: out    pins, LANES     side 2
+        program.code[5] = i2s_pio_encode_jmp_x_dec(4)                    | i2s_pio_encode_sideset(2, 3); //  5: jmp    x--, 4          side 3
+        program.code[6] = i2s_pio_encode_out(I2S_PIO_PINS, data_lanes)   | i2s_pio_encode_sideset(2, 0); //  6: out    pins, LANES     side 0
+        program.code[7] = i2s_pio_encode_set(I2S_PIO_X, bit_depth_value) | i2s_pio_encode_sideset(2, 1); //  7: set    x, BIT_DEPTH-2  side 1
+
+        program.length = 8;
+        program.entry = 7;
+        program.cycles_per_frame = 2 * 2*bit_depth; // 2 cycles per bit
+    } else if(mode == I2S_CONTROLLER_MODE::RX) {
+        // RX PIO ASM
+        // every in samples the bit of the previous BCLK period (the ADC changes it on the falling edge),
+        // so the first word is one bit short: it starts at 1 with X preloaded to BIT_DEPTH-2 and every autopush gets the
+        // bits of one word, from the one after the LRCK change to the LSB with the next change
+        program.code[0] = i2s_pio_encode_in(I2S_PIO_PINS, 1)             | i2s_pio_encode_sideset(2, 0); //  0: in     pins, 1         side 0
+        program.code[1] = i2s_pio_encode_jmp_x_dec(0)                    | i2s_pio_encode_sideset(2, 1); //  1: jmp    x--, 0          side 1
+        program.code[2] = i2s_pio_encode_in(I2S_PIO_PINS, 1)             | i2s_pio_encode_sideset(2, 2); //  2: in     pins, 1         side 2
+        program.code[3] = i2s_pio_encode_set(I2S_PIO_X, bit_depth_value) | i2s_pio_encode_sideset(2, 3); //  3: set    x, BIT_DEPTH-2  side 3
+        program.code[4] = i2s_pio_encode_in(I2S_PIO_PINS, 1)             | i2s_pio_encode_sideset(2, 2); //  4: in     pins, 1         side 2
+        program.code[5] = i2s_pio_encode_jmp_x_dec(4)                    | i2s_pio_encode_sideset(2, 3); //  5: jmp    x--, 4          side 3
+        program.code[6] = i2s_pio_encode_in(I2S_PIO_PINS, 1)             | i2s_pio_encode_sideset(2, 0); //  6: in     pins, 1         side 0
+        program.code[7] = i2s_pio_encode_set(I2S_PIO_X, bit_depth_value) | i2s_pio_encode_sideset(2, 1); //  7: set    x, BIT_DEPTH-2  side 1
+
+        program.length = 8;
+        program.entry = 1;
+        program.cycles_per_frame = 2 * 2*bit_depth; // 2 cycles per bit
+        program.load_x = true;
+        program.x_value = bit_depth_value;
+    } else if(mode == I2S_CONTROLLER_MODE::TRX) {
+        // TRX PIO ASM
+        // 2 cycles per BCLK phase, out with the falling edge and in with the rising edge, so the ADC has half a bit
+        // to change its data. The first instruction only runs once: it is the high phase of the last bit before the start
+        // runs half as fast as TX/RX
+        program.code[ 0] = i2s_pio_encode_set(I2S_PIO_X, bit_depth_value) | i2s_pio_encode_sideset(3, 1) | i2s_pio_encode_delay(1); //  0: set    x, BIT_DEPTH-2  side 1 delay 1
+
+        program.code[ 1] = i2s_pio_encode_out(I2S_PIO_PINS, 1)            | i2s_pio_encode_sideset(3, 0) | i2s_pio_encode_delay(1); //  1: out    pins, 1         side 0 delay 1   <- wrap target
+        program.code[ 2] = i2s_pio_encode_in(I2S_PIO_PINS, 1)             | i2s_pio_encode_sideset(3, 1);                           //  2: in     pins, 1         side 1
+        program.code[ 3] = i2s_pio_encode_jmp_x_dec(1)                    | i2s_pio_encode_sideset(3, 1);                           //  3: jmp    x--, 1          side 1
+
+        program.code[ 4] = i2s_pio_encode_out(I2S_PIO_PINS, 1)            | i2s_pio_encode_sideset(3, 6) | i2s_pio_encode_delay(1); //  4: out    pins, 1         side 6 delay 1
+        program.code[ 5] = i2s_pio_encode_in(I2S_PIO_PINS, 1)             | i2s_pio_encode_sideset(3, 7);                           //  5: in     pins, 1         side 7
+        program.code[ 6] = i2s_pio_encode_set(I2S_PIO_X, bit_depth_value) | i2s_pio_encode_sideset(3, 7);                           //  6: set    x, BIT_DEPTH-2  side 7
+
+        program.code[ 7] = i2s_pio_encode_out(I2S_PIO_PINS, 1)            | i2s_pio_encode_sideset(3, 6) | i2s_pio_encode_delay(1); //  7: out    pins, 1         side 6 delay 1
+        program.code[ 8] = i2s_pio_encode_in(I2S_PIO_PINS, 1)             | i2s_pio_encode_sideset(3, 7);                           //  8: in     pins, 1         side 7
+        program.code[ 9] = i2s_pio_encode_jmp_x_dec(7)                    | i2s_pio_encode_sideset(3, 7);                           //  9: jmp    x--, 7          side 7
+
+        program.code[10] = i2s_pio_encode_out(I2S_PIO_PINS, 1)            | i2s_pio_encode_sideset(3, 0) | i2s_pio_encode_delay(1); // 10: out    pins, 1         side 0 delay 1
+        program.code[11] = i2s_pio_encode_in(I2S_PIO_PINS, 1)             | i2s_pio_encode_sideset(3, 1);                           // 11: in     pins, 1         side 1
+        program.code[12] = i2s_pio_encode_set(I2S_PIO_X, bit_depth_value) | i2s_pio_encode_sideset(3, 1);                           // 12: set    x, BIT_DEPTH-2  side 1   -> wrap
+
+        program.length = 13;
+        program.wrap_target = 1;
+        program.entry = 0;
+        program.sideset_pins = 3;
+        program.cycles_per_frame = 4 * 2*bit_depth; // 4 cycles per bit
+    } else if(mode == I2S_CONTROLLER_MODE::TX_MONO) {
+        // TX MONO PIO ASM
+        // Every word is pulled once and sent twice, the copy is kept in the otherwise unused ISR.
+        // Bits are counted with jmp !osre (pull threshold is BIT_DEPTH-1), restoring the copy needs the extra cycles
+        // runs half as fast as TX
+        program.code[0] = i2s_pio_encode_out(I2S_PIO_PINS, 1)          | i2s_pio_encode_sideset(2, 0) | i2s_pio_encode_delay(1); //  0: out    pins, 1         side 0 delay 1
+        program.code[1] = i2s_pio_encode_jmp_not_osre(0)               | i2s_pio_encode_sideset(2, 1) | i2s_pio_encode_delay(1); //  1: jmp    !osre, 0        side 1 delay 1
+        program.code[2] = i2s_pio_encode_out(I2S_PIO_PINS, 1)          | i2s_pio_encode_sideset(2, 2) | i2s_pio_encode_delay(1); //  2: out    pins, 1         side 2 delay 1
+        program.code[3] = i2s_pio_encode_mov(I2S_PIO_OSR, I2S_PIO_ISR) | i2s_pio_encode_sideset(2, 3) | i2s_pio_encode_delay(1); //  3: mov osr, isr side 3 delay 1
+        program.code[4] = i2s_pio_encode_out(I2S_PIO_PINS, 1)          | i2s_pio_encode_sideset(2, 2) | i2s_pio_encode_delay(1); //  4: out    pins, 1         side 2 delay 1
+        program.code[5] = i2s_pio_encode_jmp_not_osre(4)               | i2s_pio_encode_sideset(2, 3) | i2s_pio_encode_delay(1); //  5: jmp    !osre, 4        side 3 delay 1
+        program.code[6] = i2s_pio_encode_out(I2S_PIO_PINS, 1)          | i2s_pio_encode_sideset(2, 0) | i2s_pio_encode_delay(1); //  6: out    pins, 1         side 0 delay 1
+        program.code[7] = i2s_pio_encode_pull(false, true)             | i2s_pio_encode_sideset(2, 1);                           //  7: pull   block           side 1
+        program.code[8] = i2s_pio_encode_mov(I2S_PIO_ISR, I2S_PIO_OSR) | i2s_pio_encode_sideset(2, 1);                           //  8: mov    isr, osr        side 1
+
+        program.length = 9;
+        program.entry = 7; // start with the pull
+        program.cycles_per_frame = 4 * 2*bit_depth; // 4 cycles per bit, pull and mov replace the delay of the last bit
+    } else if(mode == I2S_CONTROLLER_MODE::TX_TDM) {
+        // TX TDM PIO ASM
+        // X counts all bits of the frame, Y holds BIT_DEPTH*slots-2 (see I2S_PIO_PROGRAM::y_value)
+        // the frame sync (LRCK pin) is high for the last bit, like LRCK changes one bit early in I2S
+        program.code[0] = i2s_pio_encode_out(I2S_PIO_PINS, 1)      | i2s_pio_encode_sideset(2, 0); //  0: out    pins, 1         side 0
+        program.code[1] = i2s_pio_encode_jmp_x_dec(0)              | i2s_pio_encode_sideset(2, 1); //  1: jmp    x--, 0          side 1
+        program.code[2] = i2s_pio_encode_out(I2S_PIO_PINS, 1)      | i2s_pio_encode_sideset(2, 2); //  2: out    pins, 1         side 2
+        program.code[3] = i2s_pio_encode_mov(I2S_PIO_X, I2S_PIO_Y) | i2s_pio_encode_sideset(2, 3); //  3: mov x, y         side 3
+
+        program.length = 4;
+        program.entry = 3;
+        program.cycles_per_frame = 2 * bit_depth*channel_count; // 2 cycles per bit
+        program.load_y = true;
+        program.y_value = bit_depth*channel_count - 2;
+    }
+
+    return program;
+}
+
+/**
+ * @brief generate the RX program of TRX_FULL_RATE mode
+ * Runs on its own state machine at the full system clock and follows the clocks of the TX program,
+ * so full duplex keeps the 2 cycles per bit of TX instead of the 4 of the single state machine TRX program.
+ * It starts together with TX and syncs once to the LRCK low of the TX entry, skips the bit clock of the last bit before the start
+ * and then samples the data pin on every BCLK rising edge, like the ADC expects. So its first word is the left word of the first
+ * TX frame and the RX words stay in step with the TX words, which duplex processing relies on.
+ * Input synchronizers and the wait add about 3 system clock cycles between the edge and the sample,
+ * so every BCLK phase needs at least 4 system clock cycles (PIO divider >= 4).
+ * @param pin_bclk, pin_lrck GPIO numbers of the clocks driven by the TX state machine
+ */
+static constexpr I2S_PIO_PROGRAM i2s_generate_rx_follower_program(uint32_t pin_bclk, uint32_t pin_lrck) {
+    I2S_PIO_PROGRAM program = {};
+
+    // RX FOLLOWER PIO ASM
+    program.code[0] = i2s_pio_encode_wait_gpio(false, pin_lrck); //  0: wait   0 gpio LRCK     low from the TX entry on
+    program.code[1] = i2s_pio_encode_wait_gpio(true, pin_bclk);  //  1: wait   1 gpio BCLK     skip the bit before the start
+    program.code[2] = i2s_pio_encode_wait_gpio(false, pin_bclk); //  2: wait   0 gpio BCLK     <- wrap target
+    program.code[3] = i2s_pio_encode_wait_gpio(true, pin_bclk);  //  3: wait   1 gpio BCLK
+    program.code[4] = i2s_pio_encode_in(I2S_PIO_PINS, 1);        //  4: in     pins, 1         -> wrap
+
+    program.length = 5;
+    program.wrap_target = 2;
+    program.entry = 0;
+    program.sideset_pins = 0;
+    return program;
+}
+
+/**
+ * @brief generate the MCLK program, a square wave on one set pin
+ * The state machine runs at an integer divider, see i2s_mclk_split().
+ * @param period PIO clock cycles per MCLK period (2..I2S_MCLK_MAX_PERIOD), odd periods are high one cycle shorter
+ */
+static constexpr I2S_PIO_PROGRAM i2s_generate_mclk_program(uint32_t period) {
+    I2S_PIO_PROGRAM program = {};
+    uint32_t high = period / 2, low = period - high;
+
+    // MCLK PIO ASM
+    program.code[0] = i2s_pio_encode_set(I2S_PIO_PINS, 1) | i2s_pio_encode_delay(high-1); //  0: set    pins, 1         delay HIGH-1
+    program.code[1] = i2s_pio_encode_set(I2S_PIO_PINS, 0) | i2s_pio_encode_delay(low-1);  //  1: set    pins, 0         delay LOW-1
+
+    program.length = 2;
+    program.entry = 0;
+    program.cycles_per_frame = period; // per MCLK period
+    return program;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// compile with -DI2S_ENABLE_STATS=1 to collect I2S_STATS, otherwise none of it is built into the IRQ handler
+#ifndef I2S_ENABLE_STATS
+#define I2S_ENABLE_STATS 0
+#endif
+
+/// snapshot of the IRQ and FIFO statistics of one I2S_CONTROLLER
+struct I2S_STATS {
+    uint32_t irq_count;
+
+    // handler duration in system clock cycles
+    uint32_t isr_cycles_min, isr_cycles_max;
+    uint64_t isr_cycles_sum;
+
+    // time between two IRQs of the same DMA channel in us
+    uint32_t interval_us_min, interval_us_max;
+
+    // TX: least time left of the playing block when the handler was done, the queued block has to be in place before it runs out
+    uint32_t margin_us_min;
+
+    uint32_t tx_stall_count;  // PIO fdebug TXSTALL seen, the TX FIFO ran empty (an audible gap)
+    uint32_t rx_stall_count;  // PIO fdebug RXSTALL seen, the RX FIFO was full and samples were lost
+    uint32_t rx_overrun_count; // RX buffers overwritten because the application did not release them, see RX_BUFFER_QUEUE
+
+    uint32_t isr_cycles_avg() const { return irq_count ? isr_cycles_sum / irq_count : 0; }
+};
+
+/**
+ * @brief collects I2S_STATS in the DMA IRQ
+ * The IRQ is the only writer. snapshot() and reset() can be called from both cores,
+ * the snapshot is consistent through a sequence counter (the IRQ never waits for the reader).
+ */
+class I2S_STATS_COLLECTOR {
+private:
+    I2S_STATS stats;
+    std::atomic<uint32_t> sequence;      // odd while the IRQ writes
+    std::atomic<bool> reset_requested;
+
+    uint32_t last_irq_us;
+    bool has_last_irq;
+
+    void begin_write() {
+        if(reset_requested.exchange(false, std::memory_order_acquire))
+            clear();
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_write() {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    void clear() {
+        stats = {};
+        stats.isr_cycles_min = 0xFFFFFFFF;
+        stats.interval_us_min = 0xFFFFFFFF;
+        stats.margin_us_min = 0xFFFFFFFF;
+        has_last_irq = false;
+    }
+public:
+    I2S_STATS_COLLECTOR() : sequence(0), reset_requested(false) {
+        clear();
+    }
+
+    // ---- writer side (DMA IRQ) ---- //
+
+    /**
+     * @brief account one IRQ of the channel
+     * @param isr_cycles system clock cycles from the IRQ entry until the channel was handled
+     * @param now_us time of the IRQ
+     */
+    void record_irq(uint32_t isr_cycles, uint32_t now_us) {
+        begin_write();
+        ++stats.irq_count;
+        stats.isr_cycles_sum += isr_cycles;
+        if(isr_cycles < stats.isr_cycles_min)
+            stats.isr_cycles_min = isr_cycles;
+        if(isr_cycles > stats.isr_cycles_max)
+            stats.isr_cycles_max = isr_cycles;
+
+        if(has_last_irq) {
+            uint32_t interval = now_us - last_irq_us;
+            if(interval < stats.interval_us_min)
+                stats.interval_us_min = interval;
+            if(interval > stats.interval_us_max)
+                stats.interval_us_max = interval;
+        }
+        last_irq_us = now_us;
+        has_last_irq = true;
+        end_write();
+    }
+
+    /// add FIFO stalls seen in the PIO fdebug register since the last call
+    void record_stalls(bool tx_stall, bool rx_stall) {
+        if(!tx_stall && !rx_stall)
+            return;
+        begin_write();
+        stats.tx_stall_count += tx_stall;
+        stats.rx_stall_count += rx_stall;
+        end_write();
+    }
+
+    /// time left of the playing TX block after the handler
+    void record_margin(uint32_t margin_us) {
+        if(margin_us >= stats.margin_us_min && !reset_requested.load(std::memory_order_relaxed))
+            return;
+        begin_write();
+        if(margin_us < stats.margin_us_min)
+            stats.margin_us_min = margin_us;
+        end_write();
+    }
+
+    // ---- reader side (any core) ---- //
+
+    /// consistent copy of the statistics, retries while the IRQ is writing. rx_overrun_count is filled in by the controller
+    I2S_STATS snapshot() const {
+        I2S_STATS copy;
+        uint32_t before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            copy = stats;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while((before & 1) || before != after);
+        return copy;
+    }
+
+    /// start over with the next IRQ
+    void reset() { reset_requested.store(true, std::memory_order_release); }
+};
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include <hardware/gpio.h>
 #include <pico/stdlib.h>
@@ -28,10 +29,22 @@ int main(void) {
     I2S_CONTROLLER i2s_tx(PATTERN_BUFFER_SIZE, PIN_I2S_DOUT, PIN_I2S_CLOCK_BASE, I2S_CONTROLLER_MODE::TRX, 32);
     i2s_tx.set_pattern(PATTERN_BUFFER::PATTERN::SQUARE, 0, 0x1000, 2);
 
+    // exact 48 kHz would need a 61.44 MHz system clock in TRX mode, 200 ppm allow 110.6 MHz (-186 ppm).
+    // The system clock changes, so the UART needs its baud rate again before the result is printed
+    const I2S_CLOCK_SETTINGS clock = i2s_tx.set_sample_rate(48000, true, 200);
+    uart_set_baudrate(uart0, 115200);
+    printf("i2s: %.3f Hz (%.3f ppm) at %" PRIu32 " Hz system clock, divider %" PRIu32 "\n", clock.sample_rate, clock.error_ppm, clock.sys_clock_hz, clock.pio_divider);
+
     i2s_tx.start_i2s();
 
     while (1) {
         gpio_put(LED_PIN, (time_us_32() % 1000000) < 50000);
+
+        // hand captured buffers back to the DMA
+        uint32_t rx_len;
+        if(i2s_tx.rx_queue.peek(rx_len) != NULL) {
+            i2s_tx.rx_queue.release();
+        }
         // pio_sm_put_blocking(I2S_PIO, I2S_PIO_SM, (u++)%128 + 1000000);
 
         // i2s_tx.set_pattern(PATTERN_BUFFER::PATTERN::CONST, time_us_32(), 0, 1);
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "waveform.hpp"
+#include "sample_format.hpp"
+
+// FIR length per output sample and number of tabulated fractional positions
+#define RESAMPLER_TAPS 8
+#define RESAMPLER_PHASES 64
+#define RESAMPLER_PHASE_BITS 6
+
+/**
+ * @brief fixed point polyphase resampler for arbitrary, slowly changing ratios
+ * For sources that drift too far for the PIO divider trim of DRIFT_CONTROLLER, or when the I2S clock has to stay fixed (e.g. for MCLK).
+ * A Blackman windowed sinc is tabulated at RESAMPLER_PHASES positions between two input samples,
+ * coefficients of positions in between are interpolated linearly.
+ * Works on interleaved left-justified int32_t frames before they are written in the sample format (see I2S_FRAME_WRITER).
+ * Not thread safe, use it from the producer only.
+ */
+class POLYPHASE_RESAMPLER {
+private:
+    int32_t coefficients[RESAMPLER_PHASES + 1][RESAMPLER_TAPS]; // Q30, every phase sums up to 1
+    int32_t history[I2S_MAX_CHANNELS][2 * RESAMPLER_TAPS];      // last RESAMPLER_TAPS input frames, stored twice to avoid wrapping
+    uint32_t history_index;
+    uint32_t channels;
+
+    uint64_t step;     // input frames per output frame, Q32.32
+    uint32_t fraction; // position of the next output frame between two input frames, Q32
+    uint32_t pending;  // input frames to take in before the next output frame
+
+    void push_frame(const int32_t *frame) {
+        history_index = (history_index + 1) % RESAMPLER_TAPS;
+        for(uint32_t c=0; c<channels; ++c) {
+            history[c][history_index] = frame[c];
+            history[c][history_index + RESAMPLER_TAPS] = frame[c];
+        }
+    }
+public:
+    /**
+     * @param _channels samples per frame
+     * @param cutoff filter cutoff relative to the input rate (< 0.5), lower it below 0.5 / step when the rate goes down
+     */
+    POLYPHASE_RESAMPLER(uint32_t _channels = 2, double cutoff = 0.45) : channels(_channels) {
+        const double pi = 3.14159265358979;
+        const int32_t center = RESAMPLER_TAPS/2; // at a fraction of 0 the output is the frame of this age
+
+        for(uint32_t p=0; p<=RESAMPLER_PHASES; ++p) {
+            double taps[RESAMPLER_TAPS], sum = 0;
+            for(int32_t k=0; k<RESAMPLER_TAPS; ++k) {
+                double t = (double)(k - center) + (double)p / RESAMPLER_PHASES; // distance of the frame of age k from the output in input samples
+                double x = 2 * pi * cutoff * t;
+                double sinc = t == 0 ? 1. : sine_q31((uint32_t)(int64_t)(cutoff * t * 4294967296.0)) / 2147483647. / x;
+                double window_phase = t / RESAMPLER_TAPS + 0.5; // 0..1 over the filter length
+                double window = 0.42 - 0.5 * sine_q31((uint32_t)(int64_t)(window_phase * 4294967296.0) + 0x40000000) / 2147483647.
+                                     + 0.08 * sine_q31((uint32_t)(int64_t)(2 * window_phase * 4294967296.0) + 0x40000000) / 2147483647.;
+                taps[k] = sinc * window;
+                sum += taps[k];
+            }
+            for(uint32_t k=0; k<RESAMPLER_TAPS; ++k)
+                coefficients[p][k] = (int32_t)(taps[k] / sum * 1073741824.0);
+        }
+
+        set_step(1ull << 32);
+        reset();
+    }
+
+    /// clear the history, the output lags RESAMPLER_TAPS/2 + 1 input frames behind the input
+    void reset() {
+        for(uint32_t c=0; c<I2S_MAX_CHANNELS; ++c)
+            for(uint32_t i=0; i<2*RESAMPLER_TAPS; ++i)
+                history[c][i] = 0;
+        history_index = 0;
+        fraction = 0;
+        pending = 0;
+    }
+
+    /// input frames per output frame in Q32.32, e.g. input_rate / output_rate or DRIFT_CONTROLLER::get_resampler_step()
+    void set_step(uint64_t _step) { step = _step; }
+
+    /**
+     * @brief resample as many frames as input and output space allow
+     * @param input interleaved input frames
+     * @param input_frames number of input frames
+     * @param output interleaved output frames
+     * @param output_frames space for output frames
+     * @param consumed set to the number of input frames used, the rest has to be passed again
+     * @return number of output frames written
+     */
+    uint32_t process(const int32_t *input, uint32_t input_frames, int32_t *output, uint32_t output_frames, uint32_t &consumed) {
+        uint32_t written = 0;
+        consumed = 0;
+
+        while(written < output_frames) {
+            for(; pending && consumed < input_frames; --pending, ++consumed)
+                push_frame(input + consumed * channels);
+            if(pending)
+                break;
+
+            // interpolate the coefficients once for all channels
+            const uint32_t phase = fraction >> (32 - RESAMPLER_PHASE_BITS);
+            const int32_t weight = (fraction >> (16 - RESAMPLER_PHASE_BITS)) & 0xFFFF; // Q16
+            int32_t taps[RESAMPLER_TAPS];
+            for(uint32_t k=0; k<RESAMPLER_TAPS; ++k)
+                taps[k] = coefficients[phase][k] + (((int64_t)(coefficients[phase + 1][k] - coefficients[phase][k]) * weight) >> 16);
+
+            // taps[k] belongs to the frame of age k, 0 is the newest
+            for(uint32_t c=0; c<channels; ++c) {
+                const int32_t *frames = &history[c][history_index + RESAMPLER_TAPS];
+                int64_t sum = 0;
+                for(uint32_t k=0; k<RESAMPLER_TAPS; ++k)
+                    sum += (int64_t)taps[k] * frames[-(int32_t)k];
+                sum >>= 30;
+                output[written * channels + c] = sum > INT32_MAX ? INT32_MAX : sum < INT32_MIN ? INT32_MIN : (int32_t)sum;
+            }
+            ++written;
+
+            uint64_t position = fraction + step;
+            fraction = (uint32_t)position;
+            pending = position >> 32;
+        }
+        return written;
+    }
+};
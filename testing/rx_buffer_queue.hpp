@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "i2s_memory.hpp"
+
+/**
+ * @brief set of capture buffers that are filled by DMA and handed to the application
+ * Lock-free single producer (DMA IRQ) / single consumer (main loop or core 1) queue.
+ * Filled buffers are handed out by pointer and have to be released after use, nothing gets copied.
+ */
+class RX_BUFFER_QUEUE {
+private:
+    int32_t *buffers;
+    const uint32_t buffer_count, buffer_size;
+    I2S_BUFFER_ARENA *const arena;
+
+    // Both indices run through 0 .. 2*buffer_count-1, the buffer is index % buffer_count. Twice the count tells a full queue
+    // from an empty one, free running counters would jump buffers at the 2^32 wrap unless the count is a power of two.
+    std::atomic<uint32_t> write_index; // buffers handed to the consumer, only written by the producer
+    std::atomic<uint32_t> read_index;  // buffers released by the consumer, only written by the consumer
+    std::atomic<uint32_t> overrun_count;
+
+    uint32_t next_index(uint32_t index) const { return index + 1 == 2*buffer_count ? 0 : index + 1; }
+
+    /// filled buffers between the two indices
+    uint32_t distance(uint32_t read, uint32_t write) const { return write >= read ? write - read : write + 2*buffer_count - read; }
+
+    int32_t *get_buffer(uint32_t index) const { return buffers + (index < buffer_count ? index : index - buffer_count) * buffer_size; }
+public:
+    /**
+     * @param _buffer_count number of buffers, one of them is always being filled (0 or >= 2)
+     * @param _buffer_size buffer size in 32 bit words
+     * @param _arena place the buffers there instead of the heap, see I2S_BUFFER_ARENA
+     */
+    RX_BUFFER_QUEUE(uint32_t _buffer_count, uint32_t _buffer_size, I2S_BUFFER_ARENA *_arena = NULL)
+        : buffer_count(_buffer_count), buffer_size(_buffer_size), arena(_arena) {
+        buffers = buffer_count ? i2s_allocate_words(arena, buffer_count*buffer_size) : NULL;
+        reset();
+    }
+
+    ~RX_BUFFER_QUEUE() {
+        i2s_free_words(arena, buffers);
+    }
+
+    /// drop all data and counters, must not be called while DMA is running
+    void reset() {
+        write_index.store(0, std::memory_order_relaxed);
+        read_index.store(0, std::memory_order_relaxed);
+        overrun_count.store(0, std::memory_order_relaxed);
+    }
+
+    // ---- producer side (DMA IRQ) ---- //
+
+    /// buffer the DMA should write to next
+    int32_t *get_fill_buffer() const { return get_buffer(write_index.load(std::memory_order_relaxed)); }
+
+    /**
+     * @brief publish the buffer the DMA just filled
+     * If the consumer has not released enough buffers, the data is dropped and the same buffer is filled again.
+     * @return next buffer the DMA should write to
+     */
+    int32_t *buffer_filled() {
+        uint32_t write = write_index.load(std::memory_order_relaxed);
+
+        // one buffer is always reserved for the DMA
+        if(distance(read_index.load(std::memory_order_acquire), write) + 1 < buffer_count) {
+            write = next_index(write);
+            write_index.store(write, std::memory_order_release);
+        } else {
+            overrun_count.store(overrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        return get_buffer(write);
+    }
+
+    // ---- consumer side (application) ---- //
+
+    /// number of filled buffers waiting for the consumer
+    uint32_t available() const { return distance(read_index.load(std::memory_order_relaxed), write_index.load(std::memory_order_acquire)); }
+
+    /**
+     * @brief get the oldest filled buffer without removing it from the queue
+     * @param buffer_len set to the buffer length in 32 bit words
+     * @return pointer to the data or NULL if no buffer is available
+     */
+    const int32_t *peek(uint32_t &buffer_len) const {
+        uint32_t read = read_index.load(std::memory_order_relaxed);
+        if(write_index.load(std::memory_order_acquire) == read) {
+            buffer_len = 0;
+            return NULL;
+        }
+        buffer_len = buffer_size;
+        return get_buffer(read);
+    }
+
+    /// hand the buffer returned by peek() back to the DMA
+    void release() {
+        read_index.store(next_index(read_index.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+    /// number of filled buffers that got dropped because the consumer was too slow
+    uint32_t get_overrun_count() const { return overrun_count.load(std::memory_order_relaxed); }
+
+    uint32_t get_buffer_size() const { return buffer_size; }
+    uint32_t get_buffer_count() const { return buffer_count; }
+};
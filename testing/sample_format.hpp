@@ -0,0 +1,213 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Memory layouts of I2S frames (one sample per channel: left/right, left/right of every data lane or every TDM slot)
+ * The format follows from the bit depth, so the PIO autopull/autopush threshold matches the data:
+ *
+ *  WORD_32   one 32 bit word per sample, left-justified (bit depth 17..23 and 25..32)
+ *  PACKED_16 two samples per word, left (or even slot) sample in the top BIT_DEPTH bits, right sample directly below (bit depth <= 16)
+ *  PACKED_24 3 bytes per sample, most significant byte first (bit depth 24). The DMA moves whole words with a byte swap,
+ *            so the PIO sees the bytes as one continuous bit stream and counts 24 bits per slot across its 32 bit pulls
+ *  INTERLEAVED several data lanes (2 or 4) shifted out in parallel, the words hold the bit stream of all lanes:
+ *            for every bit from the MSB on, one bit per lane with the highest lane in the most significant position.
+ *            Channel 2*lane is the left sample, channel 2*lane+1 the right sample of a lane.
+ *
+ * Samples are always passed as left-justified int32_t values, only the top BIT_DEPTH bits are sent.
+ */
+enum I2S_SAMPLE_FORMAT {
+    WORD_32   = 0,
+    PACKED_16 = 1,
+    PACKED_24 = 2,
+    INTERLEAVED = 3,
+};
+
+// lanes of the INTERLEAVED format
+#define I2S_MAX_DATA_LANES 4
+
+// channels per frame, TDM slots or left/right of every data lane
+#define I2S_MAX_CHANNELS 16
+
+static constexpr I2S_SAMPLE_FORMAT i2s_sample_format(uint32_t bit_depth, uint32_t lanes = 1) {
+    if(lanes > 1)
+        return I2S_SAMPLE_FORMAT::INTERLEAVED;
+    if(bit_depth <= 16)
+        return I2S_SAMPLE_FORMAT::PACKED_16;
+    if(bit_depth == 24)
+        return I2S_SAMPLE_FORMAT::PACKED_24;
+    return I2S_SAMPLE_FORMAT::WORD_32;
+}
+
+/// bits per frame in memory, channels is even
+static constexpr uint32_t i2s_frame_bits(I2S_SAMPLE_FORMAT format, uint32_t bit_depth, uint32_t channels = 2) {
+    switch(format) {
+        case I2S_SAMPLE_FORMAT::PACKED_16: return 16*channels;
+        case I2S_SAMPLE_FORMAT::PACKED_24: return 24*channels;
+        case I2S_SAMPLE_FORMAT::INTERLEAVED: return bit_depth*channels;
+        default: return 32*channels;
+    }
+}
+
+/// smallest number of frames that fills whole 32 bit words, e.g. 2 for PACKED_24
+static constexpr uint32_t i2s_unit_frames(uint32_t frame_bits) {
+    uint32_t lowest_bit = frame_bits & -frame_bits;
+    return lowest_bit >= 32 ? 1 : 32 / lowest_bit;
+}
+
+/// 32 bit words of i2s_unit_frames() frames, e.g. 3 for PACKED_24 or 5 for 20 bit on 2 lanes. At most 31
+static constexpr uint32_t i2s_unit_words(uint32_t frame_bits) {
+    return i2s_unit_frames(frame_bits) * frame_bits / 32;
+}
+
+/// PIO autopull/autopush threshold in bits
+static constexpr uint32_t i2s_shift_threshold(I2S_SAMPLE_FORMAT format, uint32_t bit_depth) {
+    switch(format) {
+        case I2S_SAMPLE_FORMAT::PACKED_16: return bit_depth*2;
+        case I2S_SAMPLE_FORMAT::PACKED_24:
+        case I2S_SAMPLE_FORMAT::INTERLEAVED: return 32;
+        default: return bit_depth;
+    }
+}
+
+/// PACKED_24 buffers are a byte stream, the DMA reverses the bytes of every word so the MSB of the stream comes first
+static constexpr bool i2s_dma_byte_swap(I2S_SAMPLE_FORMAT format) {
+    return format == I2S_SAMPLE_FORMAT::PACKED_24;
+}
+
+/// combine two left-justified samples to a PACKED_16 TX word
+static inline uint32_t i2s_pack_16(uint32_t bit_depth, int32_t left, int32_t right) {
+    uint32_t sample_mask = ~(0xFFFFFFFFu >> bit_depth);
+    return ((uint32_t)left & sample_mask) | (((uint32_t)right & sample_mask) >> bit_depth);
+}
+
+/// move bit i of x to bit 2*i
+static inline uint32_t i2s_spread_2(uint32_t x) {
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    return (x | (x << 1)) & 0x55555555;
+}
+
+/// move bit i of x to bit 4*i
+static inline uint32_t i2s_spread_4(uint32_t x) {
+    x = (x | (x << 12)) & 0x000F000F;
+    x = (x | (x << 6)) & 0x03030303;
+    return (x | (x << 3)) & 0x11111111;
+}
+
+/**
+ * @brief writes TX frames in the memory layout of a sample format
+ * Buffers stay int32_t arrays, PACKED_24 writes them byte wise in stream order.
+ * INTERLEAVED frames do not have to end on a word boundary, only whole multiples of i2s_unit_frames() are completely written.
+ */
+class I2S_FRAME_WRITER {
+private:
+    uint8_t *position;
+    const I2S_SAMPLE_FORMAT format;
+    const uint32_t bit_depth;
+    const uint32_t channels;
+    const uint32_t lanes; // INTERLEAVED only
+
+    // INTERLEAVED bit stream, pending bits are aligned to the top
+    uint64_t pending;
+    uint32_t pending_bits;
+
+    /// append the top count bits of value to the bit stream
+    void put_bits(uint32_t value, uint32_t count) {
+        pending |= ((uint64_t)(value & ~(0xFFFFFFFFull >> count)) << 32) >> pending_bits;
+        pending_bits += count;
+        if(pending_bits >= 32) {
+            *(uint32_t *)position = pending >> 32;
+            position += 4;
+            pending <<= 32;
+            pending_bits -= 32;
+        }
+    }
+
+    /// one sample slot of all lanes, 32/lanes sample bits are interleaved per word
+    void write_interleaved_slot(const int32_t *samples) {
+        const uint32_t chunk_bits = 32 / lanes;
+
+        for(uint32_t bit=0; bit<bit_depth; bit+=chunk_bits) {
+            uint32_t word = 0;
+            for(uint32_t lane=0; lane<lanes; ++lane) {
+                uint32_t chunk = ((uint32_t)samples[2*lane] << bit) >> (32 - chunk_bits);
+                word |= (lanes == 4 ? i2s_spread_4(chunk) : i2s_spread_2(chunk)) << lane;
+            }
+
+            uint32_t sample_bits = bit_depth - bit < chunk_bits ? bit_depth - bit : chunk_bits;
+            put_bits(word, sample_bits * lanes);
+        }
+    }
+public:
+    /// @param _channels samples per frame (even), for INTERLEAVED 2*lanes with 2 or 4 lanes
+    I2S_FRAME_WRITER(int32_t *buffer, I2S_SAMPLE_FORMAT _format, uint32_t _bit_depth, uint32_t _channels = 2)
+        : position((uint8_t *)buffer), format(_format), bit_depth(_bit_depth), channels(_channels), lanes(_channels/2), pending(0), pending_bits(0) {}
+
+    /**
+     * @brief write one frame with all channels
+     * @param samples one sample per channel: TDM slots in order, or left and right of lane 0 first
+     */
+    void write_frame(const int32_t *samples) {
+        if(format == I2S_SAMPLE_FORMAT::INTERLEAVED) {
+            write_interleaved_slot(samples);     // all left samples
+            write_interleaved_slot(samples + 1); // all right samples
+        } else {
+            for(uint32_t c=0; c<channels; c+=2)
+                write(samples[c], samples[c+1]);
+        }
+    }
+
+    /// write two consecutive channels, not for INTERLEAVED
+    void write(int32_t left, int32_t right) {
+        switch(format) {
+            case I2S_SAMPLE_FORMAT::PACKED_16:
+                *(uint32_t *)position = i2s_pack_16(bit_depth, left, right);
+                position += 4;
+                break;
+            case I2S_SAMPLE_FORMAT::PACKED_24:
+                position[0] = left >> 24;
+                position[1] = left >> 16;
+                position[2] = left >> 8;
+                position[3] = right >> 24;
+                position[4] = right >> 16;
+                position[5] = right >> 8;
+                position += 6;
+                break;
+            default:
+                ((int32_t *)position)[0] = left;
+                ((int32_t *)position)[1] = right;
+                position += 8;
+        }
+    }
+};
+
+/**
+ * @brief convert captured RX data back to left-justified samples
+ * The PIO shifts RX data in from the right, so PACKED_16 words hold the left sample above the right one, right-justified.
+ * WORD_32 samples are right-justified as well.
+ * @param buffer data from RX_BUFFER_QUEUE::peek()
+ * @param frames number of frames to convert
+ * @param left, right destinations for frames samples each
+ */
+static inline void i2s_unpack_rx(const int32_t *buffer, uint32_t frames, I2S_SAMPLE_FORMAT format, uint32_t bit_depth, int32_t *left, int32_t *right) {
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    const uint32_t *words = (const uint32_t *)buffer;
+
+    for(uint32_t i=0; i<frames; ++i) {
+        switch(format) {
+            case I2S_SAMPLE_FORMAT::PACKED_16:
+                left[i] = (words[i] >> bit_depth) << (32 - bit_depth);
+                right[i] = words[i] << (32 - bit_depth);
+                break;
+            case I2S_SAMPLE_FORMAT::PACKED_24:
+                left[i] = (bytes[6*i] << 24) | (bytes[6*i+1] << 16) | (bytes[6*i+2] << 8);
+                right[i] = (bytes[6*i+3] << 24) | (bytes[6*i+4] << 16) | (bytes[6*i+5] << 8);
+                break;
+            default:
+                left[i] = words[2*i] << (32 - bit_depth);
+                right[i] = words[2*i+1] << (32 - bit_depth);
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Framed binary streaming of I2S samples over a byte stream: USB CDC on the device (see usb_stream.cpp),
+ * a tty or socket on the host (see host/i2s_stream_tool.cpp).
+ * Every frame is a 16 byte I2S_STREAM_HEADER followed by length bytes of payload. Headers and payloads are whole words,
+ * so sample blocks go straight from and into the I2S buffers, and a payload stays word aligned in a receive buffer.
+ * All fields are little endian, like on the RP2040 and on x86/ARM hosts.
+ */
+
+#define I2S_STREAM_MAGIC 0x42533249 // "I2SB"
+#define I2S_STREAM_MAX_PAYLOAD 0x10000
+
+enum class I2S_STREAM_TYPE : uint8_t {
+    RX_DATA = 1,         // device -> host: one captured block in the sample format
+    TX_DATA = 2,         // host -> device: samples for the TX stream in the sample format
+    STATUS = 3,          // device -> host: I2S_STREAM_STATUS, about once per second
+    SET_SAMPLE_RATE = 4, // host -> device: uint32_t sample rate in Hz
+};
+#define I2S_STREAM_TYPE_COUNT 5
+
+struct I2S_STREAM_HEADER {
+    uint32_t magic;
+    I2S_STREAM_TYPE type;
+    uint8_t sample_format; // I2S_SAMPLE_FORMAT of the payload
+    uint8_t bit_depth;
+    uint8_t channel_count;
+    uint32_t sequence;     // frames of this type sent before, a gap means lost frames
+    uint32_t length;       // payload bytes, a multiple of 4
+};
+static_assert(sizeof(I2S_STREAM_HEADER) == 16, "i2s: the stream header has to be packed");
+
+struct I2S_STREAM_STATUS {
+    uint32_t sample_rate;
+    uint32_t rx_overrun_count;  // captured blocks dropped because the host did not read fast enough
+    uint32_t tx_underrun_count; // TX blocks played as idle values because no data arrived
+    uint32_t tx_fill_level;     // words waiting in the TX ring
+};
+
+/// sequence numbers of outgoing frames, one counter per frame type
+class I2S_STREAM_SENDER {
+private:
+    uint32_t sequence[I2S_STREAM_TYPE_COUNT] = {};
+public:
+    /// header of the next frame of a type
+    I2S_STREAM_HEADER header(I2S_STREAM_TYPE type, uint32_t length, uint8_t sample_format = 0, uint8_t bit_depth = 0, uint8_t channel_count = 0) {
+        return {I2S_STREAM_MAGIC, type, sample_format, bit_depth, channel_count, sequence[(uint8_t)type]++, length};
+    }
+};
+
+/**
+ * @brief incremental frame parser, the caller moves the bytes
+ * While a header is incomplete the bytes go into header_space(). After that, the caller reads the payload wherever
+ * it wants it (e.g. into TX_RING_BUFFER::get_write_region()) and reports it with payload_consumed().
+ * A header with a wrong magic, type or length drops one byte and searches the stream again, see get_resync_count().
+ */
+class I2S_STREAM_RECEIVER {
+private:
+    I2S_STREAM_HEADER header;
+    uint32_t header_fill = 0;
+    uint32_t payload_left = 0;
+    bool header_valid = false;
+
+    uint32_t expected_sequence[I2S_STREAM_TYPE_COUNT] = {};
+    uint32_t lost_frame_count = 0;
+    uint32_t resync_count = 0;
+
+    bool check_header() const {
+        return header.magic == I2S_STREAM_MAGIC && (uint8_t)header.type > 0 && (uint8_t)header.type < I2S_STREAM_TYPE_COUNT
+            && header.length <= I2S_STREAM_MAX_PAYLOAD && header.length % 4 == 0;
+    }
+public:
+    /// true while payload bytes of the current frame are expected
+    bool in_payload() const { return header_valid && payload_left > 0; }
+
+    /// where the next header bytes go and how many are missing, NULL while in the payload
+    uint8_t *header_space(uint32_t &len) {
+        if(in_payload()) {
+            len = 0;
+            return NULL;
+        }
+        len = sizeof(header) - header_fill;
+        return (uint8_t *)&header + header_fill;
+    }
+
+    /**
+     * @brief account bytes written to header_space()
+     * @return true when a valid header is complete, get_header() and payload_left() describe the frame then
+     */
+    bool header_filled(uint32_t len) {
+        header_valid = false;
+        header_fill += len;
+        if(header_fill < sizeof(header)) {
+            return false;
+        }
+
+        if(!check_header()) {
+            memmove(&header, (uint8_t *)&header + 1, sizeof(header) - 1);
+            header_fill = sizeof(header) - 1;
+            ++resync_count;
+            return false;
+        }
+
+        // sequence numbers count up per type, a jump means frames got lost on the way
+        uint32_t &expected = expected_sequence[(uint8_t)header.type];
+        lost_frame_count += header.sequence - expected;
+        expected = header.sequence + 1;
+
+        header_fill = 0;
+        header_valid = true;
+        payload_left = header.length;
+        return true;
+    }
+
+    const I2S_STREAM_HEADER &get_header() const { return header; }
+
+    /// payload bytes of the current frame that were not consumed yet
+    uint32_t get_payload_left() const { return payload_left; }
+
+    /// account payload bytes the caller read, up to get_payload_left()
+    void payload_consumed(uint32_t len) { payload_left -= len; }
+
+    /// frames missing between the sequence numbers of the received ones
+    uint32_t get_lost_frame_count() const { return lost_frame_count; }
+
+    /// bytes dropped while searching for a valid header
+    uint32_t get_resync_count() const { return resync_count; }
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+#include "i2s_memory.hpp"
+
+// space for the block that is played instead of real data on an underrun, the block is the largest multiple of the unit that fits
+#define TX_RING_IDLE_BLOCK_LEN 32
+
+/**
+ * @brief ring buffer that feeds the TX DMA in streaming mode
+ * Lock-free single producer (application, either core) / single consumer (DMA IRQ).
+ * The consumer hands contiguous regions of the ring directly to the DMA, so samples are only copied once (or never, see get_write_region()).
+ * A region is only freed after the DMA is done with it.
+ */
+class TX_RING_BUFFER {
+private:
+    int32_t *buffer;
+    const uint32_t size, mask;
+    const uint32_t unit_words; // words of the smallest run of whole frames, blocks and underruns keep to it
+    const uint32_t block_size;
+    const uint32_t idle_len;
+    I2S_BUFFER_ARENA *const arena;
+
+    // all indices count up forever, the position in the buffer is index & mask
+    std::atomic<uint32_t> write_index;   // written by the producer
+    std::atomic<uint32_t> reserve_index; // handed to the DMA, only used by the consumer
+    std::atomic<uint32_t> read_index;    // released by the DMA, written by the consumer
+    std::atomic<uint32_t> underrun_count;
+
+    // ring words of the blocks in the DMA chain: [0] is playing, [1] is queued
+    uint32_t in_flight[2];
+    uint32_t in_flight_count;
+    uint32_t unit_phase; // words of the current unit already handed to the DMA, only not 0 after a unit split by the wrap around
+
+    int32_t idle_block[TX_RING_IDLE_BLOCK_LEN];
+public:
+    /**
+     * @param size_log2 ring size is 2**size_log2 32 bit words
+     * @param _block_size maximum number of words handed to the DMA at once, rounded down to whole units
+     * @param _unit_words words of the smallest run of whole frames (1..TX_RING_IDLE_BLOCK_LEN), e.g. 2 for WORD_32 stereo,
+     *                    3 for PACKED_24 or 5 for 20 bit on 2 lanes, see i2s_unit_words(). The ring never plays a partial unit
+     * @param idle_value value that is sent on underrun
+     * @param _arena place the ring there instead of the heap, see I2S_BUFFER_ARENA
+     */
+    TX_RING_BUFFER(uint32_t size_log2, uint32_t _block_size, uint32_t _unit_words = 2, int32_t idle_value = 0, I2S_BUFFER_ARENA *_arena = NULL)
+        : size(1u << size_log2), mask(size - 1), unit_words(_unit_words),
+          block_size(_block_size > _unit_words ? _block_size - _block_size % _unit_words : _unit_words),
+          idle_len(TX_RING_IDLE_BLOCK_LEN - TX_RING_IDLE_BLOCK_LEN % _unit_words), arena(_arena) {
+        buffer = i2s_allocate_words(arena, size);
+        set_idle_value(idle_value);
+        reset();
+    }
+
+    ~TX_RING_BUFFER() {
+        i2s_free_words(arena, buffer);
+    }
+
+    /// drop all data and counters, must not be called while DMA is running
+    void reset() {
+        write_index.store(0, std::memory_order_relaxed);
+        reserve_index.store(0, std::memory_order_relaxed);
+        read_index.store(0, std::memory_order_relaxed);
+        underrun_count.store(0, std::memory_order_relaxed);
+        in_flight[0] = in_flight[1] = 0;
+        in_flight_count = 0;
+        unit_phase = 0;
+    }
+
+    /// value sent while no data is available, only change while DMA is not running
+    void set_idle_value(int32_t idle_value) {
+        for(uint32_t i=0; i<idle_len; ++i)
+            idle_block[i] = idle_value;
+    }
+
+    uint32_t get_size() const { return size; }
+    uint32_t get_block_size() const { return block_size; }
+    uint32_t get_unit_words() const { return unit_words; }
+
+    /// words of the block played on an underrun
+    uint32_t get_idle_block_len() const { return idle_len; }
+
+    /// words written but not yet played
+    uint32_t fill_level() const { return write_index.load(std::memory_order_acquire) - read_index.load(std::memory_order_acquire); }
+
+    /// number of blocks that were replaced by idle values
+    uint32_t get_underrun_count() const { return underrun_count.load(std::memory_order_relaxed); }
+
+    // ---- producer side (application) ---- //
+
+    uint32_t free_space() const { return size - (write_index.load(std::memory_order_relaxed) - read_index.load(std::memory_order_acquire)); }
+
+    /**
+     * @brief get the largest contiguous free region to generate samples into directly
+     * @param len set to the region length in words
+     * @return start of the region, pass the number of words written to commit_write()
+     */
+    int32_t *get_write_region(uint32_t &len) {
+        uint32_t write = write_index.load(std::memory_order_relaxed);
+        uint32_t to_end = size - (write & mask);
+        uint32_t free = free_space();
+
+        len = free < to_end ? free : to_end;
+        return buffer + (write & mask);
+    }
+
+    /// make words written to the region from get_write_region() visible to the DMA
+    void commit_write(uint32_t len) {
+        write_index.store(write_index.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    /**
+     * @brief copy samples into the ring
+     * @return number of words written, might be less than len if the ring is full
+     */
+    uint32_t write(const int32_t *data, uint32_t len) {
+        uint32_t written = 0, region_len;
+
+        // at most two regions because of the wrap around
+        for(uint32_t region=0; region<2 && written<len; ++region) {
+            int32_t *region_start = get_write_region(region_len);
+            if(region_len > len - written)
+                region_len = len - written;
+
+            memcpy(region_start, data + written, region_len * sizeof(int32_t));
+            commit_write(region_len);
+            written += region_len;
+        }
+        return written;
+    }
+
+    // ---- consumer side (DMA IRQ) ---- //
+
+    /**
+     * @brief get the next block for the DMA
+     * Hands out a contiguous region that ends with a whole unit, or the idle block if no whole unit is available.
+     * So the idle block always starts at a frame boundary and frames stay aligned after an underrun.
+     * A unit split by the wrap around is handed out in two blocks, but only once all of it is written.
+     * At most two blocks can be in the DMA chain, call finish_block() before starting a third one.
+     * @param len set to the block length in words
+     */
+    const int32_t *start_block(uint32_t &len) {
+        uint32_t reserve = reserve_index.load(std::memory_order_relaxed);
+        uint32_t available = write_index.load(std::memory_order_acquire) - reserve;
+        uint32_t to_end = size - (reserve & mask);
+
+        // up to the end of the last whole unit
+        len = available - (unit_phase + available) % unit_words;
+        if(len > block_size)
+            len = block_size - (unit_phase + block_size) % unit_words;
+        if(len > to_end)
+            len = to_end; // the rest of the unit is already written at the start of the ring
+
+        in_flight[in_flight_count++] = len;
+        if(len == 0) {
+            underrun_count.store(underrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            len = idle_len;
+            return idle_block;
+        }
+
+        unit_phase = (unit_phase + len) % unit_words;
+        reserve_index.store(reserve + len, std::memory_order_relaxed);
+        return buffer + (reserve & mask);
+    }
+
+    /// the DMA finished the oldest block, release its words to the producer
+    void finish_block() {
+        read_index.store(read_index.load(std::memory_order_relaxed) + in_flight[0], std::memory_order_release);
+        in_flight[0] = in_flight[1];
+        in_flight[1] = 0;
+        --in_flight_count;
+    }
+};
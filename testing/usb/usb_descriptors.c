@@ -0,0 +1,103 @@
+#include <string.h>
+
+#include <pico/unique_id.h>
+#include <tusb.h>
+
+// USB descriptors of usb_stream_i2s: a single CDC ACM interface, so Linux shows it as /dev/ttyACM* without a driver.
+// Same IDs as the pico-sdk USB stdio, which it replaces.
+
+#define USB_VID 0x2E8A // Raspberry Pi
+#define USB_PID 0x000A // Raspberry Pi Pico SDK CDC
+
+enum {
+    ITF_NUM_CDC = 0,
+    ITF_NUM_CDC_DATA,
+    ITF_NUM_TOTAL
+};
+
+#define EPNUM_CDC_NOTIF 0x81
+#define EPNUM_CDC_OUT 0x02
+#define EPNUM_CDC_IN 0x82
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN)
+
+enum {
+    STRID_LANGID = 0,
+    STRID_MANUFACTURER,
+    STRID_PRODUCT,
+    STRID_SERIAL,
+    STRID_CDC
+};
+
+static const tusb_desc_device_t desc_device = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = 0x0200,
+    // IAD for the CDC interface pair
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = USB_VID,
+    .idProduct = USB_PID,
+    .bcdDevice = 0x0100,
+    .iManufacturer = STRID_MANUFACTURER,
+    .iProduct = STRID_PRODUCT,
+    .iSerialNumber = STRID_SERIAL,
+    .bNumConfigurations = 1
+};
+
+static const uint8_t desc_configuration[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0, 100),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, STRID_CDC, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
+};
+
+static const char *const string_descriptors[] = {
+    [STRID_MANUFACTURER] = "Raspberry Pi",
+    [STRID_PRODUCT] = "I2S stream",
+    [STRID_SERIAL] = NULL, // board id
+    [STRID_CDC] = "I2S stream CDC",
+};
+
+uint8_t const *tud_descriptor_device_cb(void) {
+    return (uint8_t const *)&desc_device;
+}
+
+uint8_t const *tud_descriptor_configuration_cb(uint8_t index) {
+    (void)index;
+    return desc_configuration;
+}
+
+uint16_t const *tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+    (void)langid;
+    static uint16_t desc_str[33]; // header word and up to 32 UTF-16 characters
+    char serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+    uint32_t len;
+
+    if(index == STRID_LANGID) {
+        desc_str[1] = 0x0409; // English
+        len = 1;
+    } else {
+        if(index >= sizeof(string_descriptors) / sizeof(string_descriptors[0])) {
+            return NULL;
+        }
+
+        const char *str = string_descriptors[index];
+        if(index == STRID_SERIAL) {
+            pico_get_unique_board_id_string(serial, sizeof(serial));
+            str = serial;
+        }
+
+        len = strlen(str);
+        if(len > 32) {
+            len = 32;
+        }
+        for(uint32_t i=0; i<len; ++i) {
+            desc_str[1 + i] = str[i];
+        }
+    }
+
+    // length in bytes including the header word, then the descriptor type
+    desc_str[0] = (TUSB_DESC_STRING << 8) | (2 * len + 2);
+    return desc_str;
+}
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <pico/stdlib.h>
+#include <hardware/uart.h>
+#include <tusb.h>
+
+#include "i2s.hpp"
+#include "stream_protocol.hpp"
+
+// Streaming firmware: captured blocks go to the host and TX samples come from the host over USB CDC,
+// framed as in stream_protocol.hpp. printf stays on the UART. Host side: host/i2s_stream_tool.cpp
+//
+// Nothing is copied by this code: RX frames are written to the CDC FIFO straight from the rx_queue buffers,
+// TX payloads are read from the CDC FIFO straight into the TX ring (TX_RING_BUFFER::get_write_region()).
+// When the ring is full the payload stays in the CDC FIFO, so USB flow control holds the host back.
+// 32 bit stereo at 96 kHz is 6.14 Mbit/s each way. Full speed USB shares its 12 Mbit/s between both directions and bulk
+// gets about 9.7 Mbit/s of it, so capture or play alone keeps up at 96 kHz, both at once need 48 kHz (rate command).
+
+#define PIN_I2S_DOUT 20
+#define PIN_I2S_CLOCK_BASE 17
+
+const uint STREAM_BIT_DEPTH = 32;
+const uint32_t STREAM_SAMPLE_RATE = 96000;
+const uint STREAM_BLOCK_FRAMES = 256;    // RX frame payload and TX DMA block, 2 kB at 32 bit
+const uint STREAM_RX_BUFFER_COUNT = 8;   // covers 21 ms without USB polls
+const uint STREAM_RING_SIZE_LOG2 = 13;   // 43 ms of TX samples at 32 bit
+const uint32_t STATUS_INTERVAL_US = 1000000;
+
+// frame that is written to the CDC FIFO: the header, then the payload in place
+static I2S_STREAM_HEADER out_header;
+static const uint8_t *out_payload;
+static uint32_t out_header_left = 0, out_payload_left = 0;
+
+static void begin_frame(const I2S_STREAM_HEADER &header, const void *payload) {
+    out_header = header;
+    out_header_left = sizeof(out_header);
+    out_payload = (const uint8_t *)payload;
+    out_payload_left = header.length;
+}
+
+// the system clock changes with the rate, clk_peri follows it, so the UART needs its baud rate again before printing
+static void set_sample_rate(I2S_CONTROLLER &i2s, uint32_t sample_rate) {
+    const I2S_CLOCK_SETTINGS clock = i2s.set_sample_rate(sample_rate);
+    uart_set_baudrate(uart0, 115200);
+    if(clock.valid) {
+        printf("i2s: %.3f Hz (%.3f ppm) at %" PRIu32 " Hz system clock, divider %" PRIu32 "\n", clock.sample_rate, clock.error_ppm, clock.sys_clock_hz, clock.pio_divider);
+    }
+}
+
+/// @return true when the whole frame is in the CDC FIFO
+static bool continue_frame() {
+    while(out_header_left) {
+        uint32_t written = tud_cdc_write((const uint8_t *)&out_header + sizeof(out_header) - out_header_left, out_header_left);
+        if(written == 0) {
+            return false;
+        }
+        out_header_left -= written;
+    }
+    while(out_payload_left) {
+        uint32_t written = tud_cdc_write(out_payload, out_payload_left);
+        if(written == 0) {
+            return false;
+        }
+        out_payload += written;
+        out_payload_left -= written;
+    }
+    return true;
+}
+
+int main(void) {
+    stdio_uart_init_full(uart0, 115200, 0, 1);
+
+    I2S_CONTROLLER i2s(STREAM_BLOCK_FRAMES, PIN_I2S_DOUT, PIN_I2S_CLOCK_BASE, I2S_CONTROLLER_MODE::TRX, STREAM_BIT_DEPTH,
+                       pio0, -1, -1, STREAM_RX_BUFFER_COUNT);
+    // the block size is in words
+    i2s.enable_tx_streaming(STREAM_RING_SIZE_LOG2, STREAM_BLOCK_FRAMES * i2s_frame_bits(i2s.get_sample_format(), STREAM_BIT_DEPTH) / 32);
+
+    // the USB clock has its own PLL
+    set_sample_rate(i2s, STREAM_SAMPLE_RATE);
+
+    tusb_init();
+    i2s.start_i2s();
+
+    const uint8_t sample_format = (uint8_t)i2s.get_sample_format();
+    const uint8_t channel_count = i2s.get_channel_count();
+
+    I2S_STREAM_SENDER sender;
+    I2S_STREAM_RECEIVER receiver;
+    I2S_STREAM_STATUS status;
+    bool sending_rx = false, sending = false;
+    uint32_t last_status_us = time_us_32();
+
+    uint32_t control_payload[4];  // payload of frames that are not samples
+    uint32_t partial_bytes = 0;   // bytes of a TX word read into the ring but not committed yet
+
+    while (1) {
+        tud_task();
+
+        if(!tud_cdc_connected()) {
+            // the RX queue drops blocks by itself while nobody reads
+            continue;
+        }
+
+        // ---- device -> host ---- //
+
+        if(sending && continue_frame()) {
+            sending = false;
+            if(sending_rx) {
+                i2s.rx_queue.release();
+                sending_rx = false;
+            }
+        }
+
+        if(!sending && time_us_32() - last_status_us >= STATUS_INTERVAL_US) {
+            last_status_us = time_us_32();
+            status.sample_rate = (uint32_t)i2s.get_sample_rate();
+            status.rx_overrun_count = i2s.rx_queue.get_overrun_count();
+            status.tx_underrun_count = i2s.tx_stream->get_underrun_count();
+            status.tx_fill_level = i2s.tx_stream->fill_level();
+            begin_frame(sender.header(I2S_STREAM_TYPE::STATUS, sizeof(status)), &status);
+            sending = true;
+        }
+
+        uint32_t rx_len;
+        const int32_t *rx_buffer;
+        if(!sending && (rx_buffer = i2s.rx_queue.peek(rx_len)) != NULL) {
+            begin_frame(sender.header(I2S_STREAM_TYPE::RX_DATA, rx_len * sizeof(int32_t), sample_format, STREAM_BIT_DEPTH, channel_count), rx_buffer);
+            sending = sending_rx = true;
+        }
+
+        tud_cdc_write_flush();
+
+        // ---- host -> device ---- //
+
+        while(tud_cdc_available()) {
+            uint32_t len;
+            uint8_t *header_space = receiver.header_space(len);
+            if(header_space) {
+                receiver.header_filled(tud_cdc_read(header_space, len));
+                continue;
+            }
+
+            const I2S_STREAM_HEADER &header = receiver.get_header();
+            const uint32_t payload_left = receiver.get_payload_left();
+
+            if(header.type == I2S_STREAM_TYPE::TX_DATA && header.sample_format == sample_format && header.bit_depth == STREAM_BIT_DEPTH) {
+                // whole words are committed, a partial one waits in the ring for the rest of its bytes
+                uint32_t region_len;
+                uint8_t *region = (uint8_t *)i2s.tx_stream->get_write_region(region_len);
+                if(region_len == 0) {
+                    break;
+                }
+
+                len = region_len * sizeof(int32_t) - partial_bytes;
+                len = tud_cdc_read(region + partial_bytes, len < payload_left ? len : payload_left);
+                receiver.payload_consumed(len);
+
+                partial_bytes += len;
+                i2s.tx_stream->commit_write(partial_bytes / sizeof(int32_t));
+                partial_bytes %= sizeof(int32_t);
+                continue;
+            }
+
+            // control frames are small, anything else is dropped
+            const uint32_t offset = header.length - payload_left;
+            if(offset < sizeof(control_payload)) {
+                len = sizeof(control_payload) - offset;
+                len = tud_cdc_read((uint8_t *)control_payload + offset, len < payload_left ? len : payload_left);
+            } else {
+                uint8_t discard[64];
+                len = tud_cdc_read(discard, payload_left < sizeof(discard) ? payload_left : sizeof(discard));
+            }
+            receiver.payload_consumed(len);
+
+            if(!receiver.in_payload() && header.type == I2S_STREAM_TYPE::SET_SAMPLE_RATE && header.length == sizeof(uint32_t)) {
+                set_sample_rate(i2s, control_payload[0]);
+            }
+        }
+    }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Integer waveform kernels for the signal generators
+ * The RP2040 has no FPU, so everything here runs on Q31 fixed point numbers and lookup tables.
+ */
+
+// quarter wave sine table resolution (4 kB of flash)
+// interpolated to second order, the max error is about 1e-9 of full scale (2 LSB of Q31), see sine_q31()
+#define WAVEFORM_SINE_TABLE_BITS 10
+#define WAVEFORM_SINE_TABLE_SIZE (1u << WAVEFORM_SINE_TABLE_BITS)
+
+// phase bits below the table index inside one quadrant
+#define WAVEFORM_SINE_FRAC_BITS (30 - WAVEFORM_SINE_TABLE_BITS)
+
+/// quarter wave sine table in Q31, computed at compile time so it ends up in flash
+struct WAVEFORM_SINE_TABLE {
+    int32_t values[WAVEFORM_SINE_TABLE_SIZE + 1];
+
+    constexpr WAVEFORM_SINE_TABLE() : values() {
+        const double quarter_pi = 1.5707963267948966;
+
+        for(uint32_t i=0; i<=WAVEFORM_SINE_TABLE_SIZE; ++i) {
+            // taylor series, converges to double precision within the first quadrant
+            double x = quarter_pi * i / WAVEFORM_SINE_TABLE_SIZE;
+            double term = x, sum = x;
+            for(int n=1; n<12; ++n) {
+                term *= -x * x / ((2*n) * (2*n + 1));
+                sum += term;
+            }
+
+            double scaled = sum * 2147483647.0 + 0.5;
+            values[i] = scaled > 2147483647.0 ? 2147483647 : (int32_t)scaled;
+        }
+    }
+};
+
+inline constexpr WAVEFORM_SINE_TABLE waveform_sine_table;
+
+// table step in radians * 2**32, (pi/2) / WAVEFORM_SINE_TABLE_SIZE
+#define WAVEFORM_SINE_STEP_Q32 ((uint32_t)(1.5707963267948966 / WAVEFORM_SINE_TABLE_SIZE * 4294967296.0 + 0.5))
+
+/**
+ * @brief sine from the quarter wave table, interpolated with sin(x+d) = sin(x) + cos(x)*d - sin(x)*d*d/2
+ * The cosine is the mirrored table entry. Linear interpolation alone would be off by up to 3e-7 (2.5 LSB of a 24 bit sample),
+ * the second order term brings it down to about 1e-9.
+ * @param phase one period equals 2**32
+ * @return sine value in Q31
+ */
+static inline int32_t sine_q31(uint32_t phase) {
+    uint32_t quadrant = phase >> 30;
+    uint32_t position = phase & 0x3FFFFFFF;
+
+    // the second half of each half wave is the mirrored first half
+    if(quadrant & 1)
+        position = 0x40000000 - position;
+
+    uint32_t index = position >> WAVEFORM_SINE_FRAC_BITS;
+    uint32_t frac = position & ((1u << WAVEFORM_SINE_FRAC_BITS) - 1);
+    int32_t sine = waveform_sine_table.values[index];
+    int32_t cosine = waveform_sine_table.values[WAVEFORM_SINE_TABLE_SIZE - index];
+
+    // d is below one table step, so d*2**32 fits into 23 bits and d*d/2*2**32 into 13 bits
+    uint32_t d_q32 = ((uint64_t)frac * WAVEFORM_SINE_STEP_Q32) >> WAVEFORM_SINE_FRAC_BITS;
+    uint32_t half_d2_q32 = ((uint64_t)d_q32 * d_q32) >> 33;
+    int64_t value = sine + (((int64_t)cosine * d_q32) >> 32) - (((int64_t)sine * half_d2_q32) >> 32);
+    if(value > 2147483647)
+        value = 2147483647;
+
+    return (quadrant & 2) ? -value : value;
+}
+
+/// multiply a Q31 value with an integer amplitude
+static inline int32_t scale_q31(int32_t amplitude, int32_t value_q31) {
+    return ((int64_t)amplitude * value_q31) >> 31;
+}
+
+/**
+ * @brief exact integer ramp numerator * i / denominator for i = start, start+1, ... without a division per step
+ * Bresenham style, the result is truncated towards zero. Can step in both directions.
+ */
+class WAVEFORM_RAMP {
+private:
+    int64_t value;
+    uint32_t remainder;
+    int64_t step;
+    uint32_t step_remainder;
+    uint32_t denominator;
+    bool negative;
+public:
+    WAVEFORM_RAMP() : WAVEFORM_RAMP(0, 1) {}
+
+    /// @param start first i, numerator * start must fit into 64 bits
+    WAVEFORM_RAMP(int64_t numerator, uint32_t _denominator, uint32_t start = 0) : denominator(_denominator), negative(numerator < 0) {
+        uint64_t magnitude = negative ? -numerator : numerator;
+        step = magnitude / denominator;
+        step_remainder = magnitude % denominator;
+        value = magnitude * start / denominator;
+        remainder = magnitude * start % denominator;
+    }
+
+    int32_t get() const { return negative ? -value : value; }
+
+    /// advance by one step
+    void next() {
+        value += step;
+        remainder += step_remainder;
+        if(remainder >= denominator) {
+            remainder -= denominator;
+            ++value;
+        }
+    }
+
+    /// go back by one step
+    void prev() {
+        value -= step;
+        if(remainder < step_remainder) {
+            remainder += denominator - step_remainder;
+            --value;
+        } else {
+            remainder -= step_remainder;
+        }
+    }
+};
+
+/**
+ * @brief exact phase for sample i of a period with length samples: i * 2**32 / length
+ * Works like WAVEFORM_RAMP, but wraps around with the 32 bit phase.
+ */
+class WAVEFORM_PHASE {
+private:
+    uint32_t phase, remainder;
+    uint32_t step, step_remainder;
+    uint32_t length;
+public:
+    WAVEFORM_PHASE() : WAVEFORM_PHASE(1) {}
+
+    WAVEFORM_PHASE(uint32_t _length, uint32_t start_phase = 0) : phase(start_phase), remainder(0), length(_length) {
+        step = (1ull << 32) / length;
+        step_remainder = (1ull << 32) % length;
+    }
+
+    uint32_t get() const { return phase; }
+
+    void next() {
+        phase += step;
+        remainder += step_remainder;
+        if(remainder >= length) {
+            remainder -= length;
+            ++phase;
+        }
+    }
+};